@@ -0,0 +1,143 @@
+"""Shared memory transport between a local controller and sr.
+
+The segment layout is defined in router/sr_shm.h; keep the two in sync.
+The controller side creates /dev/shm/<name>, publishes the interface
+table and then moves frames through two single producer / single
+consumer rings (ring 0 towards the router, ring 1 back).  A frame names
+its interface by index into the table instead of by string.
+
+Ring indices are free running 32 bit counters.  A slot is written before
+head is advanced past it; on x86 (TSO) the plain stores below are seen by
+the router in program order, which is all the protocol needs.
+"""
+
+import mmap
+import os
+import struct
+
+SHM_MAGIC = 0x53525348
+SHM_VERSION = 1
+SHM_MAX_IF = 16
+SHM_RING_OFF = 4096
+SHM_DEFAULT_NSLOTS = 1024
+SHM_DEFAULT_SLOT_SIZE = 2048
+
+TO_ROUTER = 0
+TO_CTRL = 1
+
+HDR_FORMAT = '=IIIIIIII'
+HDR_SIZE = struct.calcsize(HDR_FORMAT)
+IF_FORMAT = '=32s6sHIII'          # name, mac, pad, ip, mask, speed
+IF_SIZE = struct.calcsize(IF_FORMAT)
+IDX_SIZE = 128                    # head, 60 pad, tail, 60 pad
+TAIL_OFF = 64
+SLOT_FORMAT = '=HHI'              # ifindex, flags, len
+SLOT_SIZE = struct.calcsize(SLOT_FORMAT)
+
+# header field offsets
+OFF_NIF = 16
+OFF_READY = 20
+OFF_ATTACHED = 24
+
+class SRShmException(Exception):
+    def __init__(self, msg):
+        self.msg = msg
+
+    def __str__(self):
+        return self.msg
+
+class SRShmEndpoint:
+    """Controller end of the segment."""
+
+    def __init__(self, name='sr-shm', nslots=SHM_DEFAULT_NSLOTS,
+                 slot_size=SHM_DEFAULT_SLOT_SIZE):
+        if nslots & (nslots - 1):
+            raise SRShmException('nslots must be a power of two')
+        self.path = '/dev/shm/' + name
+        self.nslots = nslots
+        self.slot_size = slot_size
+        self.ring_size = IDX_SIZE + nslots * slot_size
+        self.size = SHM_RING_OFF + 2 * self.ring_size
+        self.names = []
+        self.index = {}
+
+        fd = os.open(self.path, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0600)
+        try:
+            os.ftruncate(fd, self.size)
+            self.mem = mmap.mmap(fd, self.size, mmap.MAP_SHARED,
+                                 mmap.PROT_READ | mmap.PROT_WRITE)
+        finally:
+            os.close(fd)
+        struct.pack_into(HDR_FORMAT, self.mem, 0, SHM_MAGIC, SHM_VERSION,
+                         nslots, slot_size, 0, 0, 0, 0)
+
+    def set_interfaces(self, interfaces):
+        """interfaces: list of (name, mac, ip, mask) with mac as 6 raw bytes
+        and ip/mask as 4 raw bytes in network order (as in VNSInterface).
+        Marks the segment ready."""
+        if len(interfaces) > SHM_MAX_IF:
+            raise SRShmException('at most %d interfaces' % SHM_MAX_IF)
+        self.names = []
+        self.index = {}
+        for i, (name, mac, ip, mask) in enumerate(interfaces):
+            ip = struct.unpack('=I', ip)[0]
+            mask = struct.unpack('=I', mask)[0]
+            struct.pack_into(IF_FORMAT, self.mem, HDR_SIZE + i * IF_SIZE,
+                             name, mac, 0, ip, mask, 0)
+            self.names.append(name)
+            self.index[name] = i
+        struct.pack_into('=I', self.mem, OFF_NIF, len(interfaces))
+        struct.pack_into('=I', self.mem, OFF_READY, 1)
+
+    def router_attached(self):
+        """pid of the attached router, 0 if none."""
+        return struct.unpack_from('=I', self.mem, OFF_ATTACHED)[0]
+
+    def _ring(self, r):
+        return SHM_RING_OFF + r * self.ring_size
+
+    def _slot(self, r, n):
+        return self._ring(r) + IDX_SIZE + (n & (self.nslots - 1)) * self.slot_size
+
+    def send(self, intf_name, frame):
+        """Queue a frame for the router.  Returns False (frame dropped) if
+        the ring is full or the interface is unknown."""
+        idx = self.index.get(intf_name)
+        if idx is None or len(frame) > self.slot_size - SLOT_SIZE:
+            return False
+        ring = self._ring(TO_ROUTER)
+        head, = struct.unpack_from('=I', self.mem, ring)
+        tail, = struct.unpack_from('=I', self.mem, ring + TAIL_OFF)
+        if (head - tail) & 0xffffffff == self.nslots:
+            return False
+        off = self._slot(TO_ROUTER, head)
+        struct.pack_into(SLOT_FORMAT, self.mem, off, idx, 0, len(frame))
+        self.mem[off + SLOT_SIZE:off + SLOT_SIZE + len(frame)] = frame
+        struct.pack_into('=I', self.mem, ring, (head + 1) & 0xffffffff)
+        return True
+
+    def recv(self, max_frames=256):
+        """Return up to max_frames (intf_name, frame) tuples from the router."""
+        ring = self._ring(TO_CTRL)
+        head, = struct.unpack_from('=I', self.mem, ring)
+        tail, = struct.unpack_from('=I', self.mem, ring + TAIL_OFF)
+        start = tail
+        frames = []
+        while tail != head and len(frames) < max_frames:
+            off = self._slot(TO_CTRL, tail)
+            idx, flags, length = struct.unpack_from(SLOT_FORMAT, self.mem, off)
+            if idx < len(self.names):
+                frames.append((self.names[idx],
+                               self.mem[off + SLOT_SIZE:off + SLOT_SIZE + length]))
+            tail = (tail + 1) & 0xffffffff
+        if tail != start:
+            struct.pack_into('=I', self.mem, ring + TAIL_OFF, tail)
+        return frames
+
+    def close(self):
+        struct.pack_into('=I', self.mem, OFF_READY, 0)
+        self.mem.close()
+        try:
+            os.unlink(self.path)
+        except OSError:
+            pass
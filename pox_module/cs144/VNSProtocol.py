@@ -10,6 +10,13 @@ VNS_DEFAULT_PORT = 3250
 VNS_MESSAGES = []
 IDSIZE = 32
 
+# Protocol v2 (see router/vnscommand.h): the client asks for it in
+# VNSOpen.version, the server answers with interface ids in VNSHardwareInfo
+# and both sides may then use VNSPacketV2.
+VNS_VERSION_2 = 2
+VNS_V2_MAXMSG = 32768    # max VNSPacketV2 message, length and type included
+VNS_V2_MAXBATCH = 64     # max frames in one VNSPacketV2
+
 __clean_re = re.compile(r'\x00*')
 def strip_null_chars(s):
     """Remove null characters from a string."""
@@ -20,12 +27,13 @@ class VNSOpen(LTMessage):
     def get_type():
         return 1
 
-    def __init__(self, topo_id, virtualHostID, UID, pw):
+    def __init__(self, topo_id, virtualHostID, UID, pw, version=0):
         LTMessage.__init__(self)
         self.topo_id = int(topo_id)
         self.vhost = str(virtualHostID)
         self.user = str(UID)
         self.pw = str(pw)
+        self.version = int(version) # 0 (v1) from old clients
 
     def length(self):
         return VNSOpen.SIZE
@@ -34,18 +42,18 @@ class VNSOpen(LTMessage):
     SIZE = struct.calcsize(FORMAT)
 
     def pack(self):
-        return struct.pack(VNSOpen.FORMAT, self.topo_id, 0, self.vhost, self.user, self.pw)
+        return struct.pack(VNSOpen.FORMAT, self.topo_id, self.version, self.vhost, self.user, self.pw)
 
     @staticmethod
     def unpack(body):
-        t = struct.unpack(VNSOpen.FORMAT, body) # t[1] is pad => ignored
+        t = struct.unpack(VNSOpen.FORMAT, body)
         vhost = strip_null_chars(t[2])
         user = strip_null_chars(t[3])
         pw = strip_null_chars(t[4])
-        return VNSOpen(t[0], vhost, user, pw)
+        return VNSOpen(t[0], vhost, user, pw, t[1])
 
     def __str__(self):
-        return 'OPEN: topo_id=%u host=%s user=%s' % (self.topo_id, self.vhost, self.user)
+        return 'OPEN: topo_id=%u host=%s user=%s version=%u' % (self.topo_id, self.vhost, self.user, self.version)
 VNS_MESSAGES.append(VNSOpen)
 
 class VNSClose(LTMessage):
@@ -116,6 +124,68 @@ class VNSPacket(LTMessage):
         return 'PACKET: %uB on %s' % (len(self.ethernet_frame), self.intf_name)
 VNS_MESSAGES.append(VNSPacket)
 
+class VNSPacketV2(LTMessage):
+    @staticmethod
+    def get_type():
+        return 1024
+
+    @staticmethod
+    def batches(frames):
+        """Split a list of (intf_id, ethernet_frame) tuples into the minimum
+        number of VNSPacketV2 messages they fit in."""
+        msgs = []
+        batch = []
+        size = VNSPacketV2.HEADER_SIZE
+        for intf_id, frame in frames:
+            need = VNSPacketV2.REC_SIZE + len(frame)
+            if batch and (size + need > VNS_V2_MAXMSG - 8 or len(batch) == VNS_V2_MAXBATCH):
+                msgs.append(VNSPacketV2(batch))
+                batch = []
+                size = VNSPacketV2.HEADER_SIZE
+            batch.append((intf_id, frame))
+            size += need
+        if batch:
+            msgs.append(VNSPacketV2(batch))
+        return msgs
+
+    def __init__(self, frames):
+        """frames is a list of (intf_id, ethernet_frame) tuples."""
+        LTMessage.__init__(self)
+        self.frames = [(int(intf_id), str(frame)) for intf_id, frame in frames]
+
+    def length(self):
+        return VNSPacketV2.HEADER_SIZE + sum(VNSPacketV2.REC_SIZE + len(f) for _, f in self.frames)
+
+    HEADER_FORMAT = '> I'   # frame count
+    HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+    REC_FORMAT = '> HH'     # intf_id, frame length; frame follows unpadded
+    REC_SIZE = struct.calcsize(REC_FORMAT)
+
+    def pack(self):
+        recs = [struct.pack(VNSPacketV2.REC_FORMAT, intf_id, len(frame)) + frame
+                for intf_id, frame in self.frames]
+        return struct.pack(VNSPacketV2.HEADER_FORMAT, len(self.frames)) + ''.join(recs)
+
+    @staticmethod
+    def unpack(body):
+        count = struct.unpack(VNSPacketV2.HEADER_FORMAT, body[:VNSPacketV2.HEADER_SIZE])[0]
+        off = VNSPacketV2.HEADER_SIZE
+        frames = []
+        for i in range(count):
+            if off + VNSPacketV2.REC_SIZE > len(body):
+                raise VNSProtocolException('truncated VNSPacketV2')
+            intf_id, n = struct.unpack(VNSPacketV2.REC_FORMAT, body[off:off+VNSPacketV2.REC_SIZE])
+            off += VNSPacketV2.REC_SIZE
+            if off + n > len(body):
+                raise VNSProtocolException('truncated VNSPacketV2')
+            frames.append((intf_id, body[off:off+n]))
+            off += n
+        return VNSPacketV2(frames)
+
+    def __str__(self):
+        return 'PACKETV2: %u frames, %uB' % (len(self.frames), sum(len(f) for _, f in self.frames))
+VNS_MESSAGES.append(VNSPacketV2)
+
 class VNSProtocolException(Exception):
     def __init__(self, msg):
         self.msg = msg
@@ -124,11 +194,12 @@ class VNSProtocolException(Exception):
         return self.msg
 
 class VNSInterface:
-    def __init__(self, name, mac, ip, mask):
+    def __init__(self, name, mac, ip, mask, intf_id=None):
         self.name = str(name)
         self.mac = str(mac)
         self.ip = str(ip)
         self.mask = str(mask)
+        self.intf_id = intf_id # v2 only
 
         if len(mac) != 6:
             raise VNSProtocolException('MAC address must be 6B')
@@ -145,18 +216,24 @@ class VNSInterface:
     HWETHER = 32     # string
     HWETHIP = 64     # uint32
     HWMASK = 128     # uint32
+    HWIFID = 256     # uint32, v2 only
 
     FORMAT = '> I32s II28s I32s I4s28s II28s I4s28s'
     SIZE = struct.calcsize(FORMAT)
+    IFID_FORMAT = '> II28s'
 
-    def pack(self):
-        return struct.pack(VNSInterface.FORMAT,
+    def pack(self, with_id=False):
+        body = struct.pack(VNSInterface.FORMAT,
                            VNSInterface.HWINTERFACE, self.name,
                            VNSInterface.HWSPEED, 0, '',
                            VNSInterface.HWETHER, self.mac,
                            VNSInterface.HWETHIP, self.ip, '',
                            VNSInterface.HWSUBNET, 0, '',
                            VNSInterface.HWMASK, self.mask, '')
+        if with_id and self.intf_id is not None:
+            # the id belongs to the last HWINTERFACE before it
+            body += struct.pack(VNSInterface.IFID_FORMAT, VNSInterface.HWIFID, self.intf_id, '')
+        return body
 
     def __str__(self):
         fmt = '%s: mac=%s ip=%s mask=%s'
@@ -203,15 +280,18 @@ class VNSHardwareInfo(LTMessage):
     def get_type():
         return 16
 
-    def __init__(self, interfaces):
+    def __init__(self, interfaces, with_ids=False):
+        """with_ids adds the v2 interface ids; only send that to clients
+        which asked for VNS_VERSION_2."""
         LTMessage.__init__(self)
         self.interfaces = interfaces
+        self.with_ids = with_ids
 
     def length(self):
-        return len(self.interfaces) * VNSInterface.SIZE
+        return len(self.pack())
 
     def pack(self):
-        return ''.join([intf.pack() for intf in self.interfaces])
+        return ''.join([intf.pack(self.with_ids) for intf in self.interfaces])
 
     def __str__(self):
         return 'Hardware Info: %s' % ' || '.join([str(intf) for intf in self.interfaces])
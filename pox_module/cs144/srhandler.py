@@ -22,7 +22,9 @@ from threading import Thread
 from twisted.internet import reactor
 from VNSProtocol import VNS_DEFAULT_PORT, create_vns_server
 from VNSProtocol import VNSOpen, VNSClose, VNSPacket, VNSOpenTemplate, VNSBanner
+from VNSProtocol import VNSPacketV2, VNS_VERSION_2
 from VNSProtocol import VNSRtable, VNSAuthRequest, VNSAuthReply, VNSAuthStatus, VNSInterface, VNSHardwareInfo
+from SRShm import SRShmEndpoint
 
 log = core.getLogger()
 
@@ -42,24 +44,62 @@ def pack_ip(ipaddr):
 
 class SRServerListener(EventMixin):
   ''' TCP Server to handle connection to SR '''
-  def __init__ (self, address=('127.0.0.1', 8888)):
+  def __init__ (self, address=('127.0.0.1', 8888), shm=None):
     port = address[1]
     self.listenTo(core.cs144_ofhandler)
     self.srclients = []
+    self.v2clients = set()
     self.listen_port = port
     self.intfname_to_port = {}
     self.port_to_intfname = {}
+    self.intfname_to_id = {}
+    self.id_to_intfname = {}
+    # packet-ins for v2 clients, sent as one VNSPacketV2 per reactor turn
+    self.v2_lock = threading.Lock()
+    self.v2_pending = []
+    self.v2_flush_scheduled = False
     self.server = create_vns_server(port,
                                     self._handle_recv_msg,
                                     self._handle_new_client,
                                     self._handle_client_disconnected)
     log.info('created server')
+    # optional shared memory transport for a router on this machine
+    self.shm = None
+    self.shm_thread = None
+    self.shm_stop = threading.Event()
+    if shm:
+      self.shm = SRShmEndpoint(shm)
+      self.shm_thread = Thread(target=self._shm_poll, args=(self.shm,))
+      self.shm_thread.daemon = True
+      self.shm_thread.start()
+      log.info('shared memory transport at %s' % self.shm.path)
     return
 
   def broadcast(self, message):
     log.debug('Broadcasting message: %s', message)
     for client in self.srclients:
-      client.send(message)
+      if client not in self.v2clients:
+        client.send(message)
+
+  def _queue_v2(self, intfname, pkt):
+    if not self.v2clients:
+      return
+    with self.v2_lock:
+      self.v2_pending.append((self.intfname_to_id[intfname], pkt))
+      if self.v2_flush_scheduled:
+        return
+      self.v2_flush_scheduled = True
+    reactor.callFromThread(self._flush_v2)
+
+  def _flush_v2(self):
+    # runs in the reactor thread: whatever queued up since the last flush
+    # goes out together
+    with self.v2_lock:
+      frames, self.v2_pending = self.v2_pending, []
+      self.v2_flush_scheduled = False
+    for msg in VNSPacketV2.batches(frames):
+      for client in self.v2clients:
+        client.send(msg)
 
   def _handle_SRPacketIn(self, event):
     #log.debug("SRServerListener catch SRPacketIn event, port=%d, pkt=%r" % (event.port, event.pkt))
@@ -70,21 +110,58 @@ class SRServerListener(EventMixin):
         return
     print "srpacketin, packet=%s" % ethernet(event.pkt)
     self.broadcast(VNSPacket(intfname, event.pkt))
+    self._queue_v2(intfname, event.pkt)
+    shm = self.shm
+    if shm and shm.router_attached():
+      shm.send(intfname, event.pkt)
 
   def _handle_RouterInfo(self, event):
     log.debug("SRServerListener catch RouterInfo even, info=%s, rtable=%s", event.info, event.rtable)
     interfaces = []
-    for intf in event.info.keys():
+    for intf_id, intf in enumerate(event.info.keys()):
       ip, mac, rate, port = event.info[intf]
       ip = pack_ip(ip)
       mac = pack_mac(mac)
       mask = pack_ip('255.255.255.255')
-      interfaces.append(VNSInterface(intf, mac, ip, mask))
+      interfaces.append(VNSInterface(intf, mac, ip, mask, intf_id))
       # Mapping between of-port and intf-name
       self.intfname_to_port[intf] = port
       self.port_to_intfname[port] = intf
+      # v2 clients name interfaces by id
+      self.intfname_to_id[intf] = intf_id
+      self.id_to_intfname[intf_id] = intf
     # store the list of interfaces...
     self.interfaces = interfaces
+    if self.shm:
+      self.shm.set_interfaces([(i.name, i.mac, i.ip, i.mask) for i in interfaces])
+
+  def _shm_poll(self, shm):
+    # the rings have no doorbell: poll, backing off to 1ms sleeps when idle
+    idle = 0
+    while not self.shm_stop.is_set():
+      frames = shm.recv()
+      if not frames:
+        idle = min(idle + 1, 20)
+        self.shm_stop.wait(0.00005 * idle)
+        continue
+      idle = 0
+      for intfname, pkt in frames:
+        try:
+          out_port = self.intfname_to_port[intfname]
+        except KeyError:
+          log.debug('shm packet-out through unknown interface %s' % intfname)
+          continue
+        core.cs144_srhandler.raiseEvent(SRPacketOut(pkt, out_port))
+
+  def close_shm(self):
+    # the poll thread must be out of shm.recv() before the mapping goes
+    shm, self.shm = self.shm, None
+    self.shm_stop.set()
+    if self.shm_thread is not None:
+      self.shm_thread.join()
+      self.shm_thread = None
+    if shm:
+      shm.close()
 
   def _handle_recv_msg(self, conn, vns_msg):
     # demux sr-client messages and take approriate actions
@@ -103,6 +180,8 @@ class SRServerListener(EventMixin):
       self._handle_close_msg(conn)
     elif vns_msg.get_type() == VNSPacket.get_type():
       self._handle_packet_msg(conn, vns_msg)
+    elif vns_msg.get_type() == VNSPacketV2.get_type():
+      self._handle_packet_v2_msg(conn, vns_msg)
     elif vns_msg.get_type() == VNSOpenTemplate.get_type():
       # TODO: see if this is needed...
       self._handle_open_template_msg(conn, vns_msg)
@@ -124,16 +203,22 @@ class SRServerListener(EventMixin):
 
   def _handle_client_disconnected(self, conn):
     log.info("disconnected")
+    self.v2clients.discard(conn)
     conn.transport.loseConnection()
     return
 
   def _handle_open_msg(self, conn, vns_msg):
     # client wants to connect to some topology.
     log.debug("open-msg: %s, %s" % (vns_msg.topo_id, vns_msg.vhost))
+    v2 = vns_msg.version >= VNS_VERSION_2
     try:
-      conn.send(VNSHardwareInfo(self.interfaces))
+      conn.send(VNSHardwareInfo(self.interfaces, with_ids=v2))
     except:
       log.debug('interfaces not populated yet')  
+      return
+    if v2:
+      log.debug('client speaks VNS v2')
+      self.v2clients.add(conn)
     return
 
   def _handle_close_msg(self, conn):
@@ -155,6 +240,15 @@ class SRServerListener(EventMixin):
     log.debug('SRServerHandler raise packet out event')
     core.cs144_srhandler.raiseEvent(SRPacketOut(pkt, out_port))
 
+  def _handle_packet_v2_msg(self, conn, vns_msg):
+    for intf_id, pkt in vns_msg.frames:
+      try:
+        out_port = self.intfname_to_port[self.id_to_intfname[intf_id]]
+      except KeyError:
+        log.debug('packet-out through unknown interface id %s' % intf_id)
+        continue
+      core.cs144_srhandler.raiseEvent(SRPacketOut(pkt, out_port))
+
 class SRPacketOut(Event):
   '''Event to raise upon receicing a packet back from SR'''
 
@@ -166,11 +260,11 @@ class SRPacketOut(Event):
 class cs144_srhandler(EventMixin):
   _eventMixin_events = set([SRPacketOut])
 
-  def __init__(self):
+  def __init__(self, shm=None):
     EventMixin.__init__(self)
     self.listenTo(core)
     #self.listenTo(core.cs144_ofhandler)
-    self.server = SRServerListener()
+    self.server = SRServerListener(shm=shm)
     log.debug("SRServerListener listening on %s" % self.server.listen_port)
     # self.server_thread = threading.Thread(target=asyncore.loop)
     # use twisted as VNS also used Twisted.
@@ -181,11 +275,15 @@ class cs144_srhandler(EventMixin):
 
   def _handle_GoingDownEvent (self, event):
     log.debug("Shutting down SRServer")
+    self.server.close_shm()
     del self.server
 
 
-def launch (transparent=False):
+def launch (transparent=False, shm=None):
   """
   Starts the SR handler application.
+
+  --shm=<name> also offers the shared memory transport at /dev/shm/<name>
+  (sr -b shm -m <name>) for a router running on the same machine.
   """
-  core.registerNew(cs144_srhandler)
+  core.registerNew(cs144_srhandler, shm)
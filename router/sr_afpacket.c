@@ -0,0 +1,518 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.c
+ *
+ * Description:
+ *
+ * AF_PACKET backend using TPACKET_V3 memory mapped rings.  The router
+ * attaches to real or veth interfaces:
+ *
+ *   ./sr -b packet -i veth0,veth1=192.168.2.1 -r rtable
+ *
+ * Interface MAC and (unless given after '=') IP address are read from
+ * the kernel instead of VNSHWINFO.  Give the router addresses the kernel
+ * does not own, or the host stack will answer ARP for them as well.
+ *
+ * Receive: one block-based RX ring per interface.  A retired block can
+ * hold hundreds of frames; they are handed to the router in place (no
+ * copy) and the block goes back to the kernel in rx_release once every
+ * frame in it has been processed.
+ *
+ * Transmit: frames are copied into slots of a TX ring and the kernel is
+ * kicked with one send() per burst.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+
+#ifdef _LINUX_
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_backend.h"
+#include "sr_mem.h"
+
+#define SR_PKT_BLOCK_SIZE  (1 << 18)   /* 256KB RX blocks */
+#define SR_PKT_BLOCK_NR    16
+#define SR_PKT_FRAME_SIZE  2048        /* RX frame hint / TX slot size */
+#define SR_PKT_BLOCK_TOV   2           /* ms before a partial block retires */
+#define SR_PKT_TX_BLOCK_NR 4
+
+#ifdef _LINUX_
+
+struct sr_afp_dev
+{
+    struct sr_ifspec spec;
+    int      fd;
+    int      ifindex;
+    unsigned char mac[ETHER_ADDR_LEN];
+    uint8_t* map;
+    size_t   map_len;
+
+    /* -- rx ring cursor -- */
+    unsigned rx_block;          /* block being drained */
+    unsigned rx_left;           /* frames left in it, 0 if not started */
+    struct tpacket3_hdr* rx_next;
+
+    /* -- tx ring cursor -- */
+    uint8_t* tx_ring;
+    unsigned tx_frame_nr;
+    unsigned tx_next;
+    unsigned tx_pending;        /* frames queued since the last kick */
+};
+
+struct sr_afp
+{
+    struct sr_afp_dev dev[SR_MAX_IFSPEC];
+    int ndev;
+    int next_rx;
+
+    pthread_mutex_t tx_lock;   /* the ARP thread and workers send too */
+
+    /* -- blocks fully handed out during the current burst -- */
+    struct tpacket_block_desc* done[SR_MAX_IFSPEC * SR_PKT_BLOCK_NR];
+    int ndone;
+
+    unsigned long rx_frames;
+    unsigned long rx_blocks;
+    unsigned long tx_frames;
+    unsigned long tx_drops;
+    unsigned long wakeups;
+};
+
+static struct tpacket_block_desc* sr_afp_block(struct sr_afp_dev* d, unsigned i)
+{
+    return (struct tpacket_block_desc*)(d->map + (size_t)i * SR_PKT_BLOCK_SIZE);
+}
+
+static void sr_afp_release_blocks(struct sr_afp* pk)
+{
+    int i;
+
+    for (i = 0; i < pk->ndone; i++)
+    {
+        __atomic_store_n(&pk->done[i]->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                         __ATOMIC_RELEASE);
+    }
+    pk->ndone = 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_afp_attach(..)
+ * Scope: Local
+ *
+ * Open a TPACKET_V3 socket with RX and TX rings on one device.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_afp_attach(struct sr_afp_dev* d)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    int v = TPACKET_V3, one = 1;
+    size_t rx_len, tx_len;
+
+    if ((d->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0)
+    {
+        perror("socket(AF_PACKET):sr_afpacket.c::sr_afp_attach");
+        return -1;
+    }
+
+    if (sr_ifspec_resolve(&d->spec, &d->ifindex, d->mac) < 0)
+    { return -1; }
+
+    if (setsockopt(d->fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) < 0)
+    {
+        perror("setsockopt(PACKET_VERSION):sr_afpacket.c::sr_afp_attach");
+        return -1;
+    }
+    /* -- best effort, also filtered on sll_pkttype below -- */
+    setsockopt(d->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_PKT_BLOCK_SIZE;
+    req.tp_block_nr   = SR_PKT_BLOCK_NR;
+    req.tp_frame_size = SR_PKT_FRAME_SIZE;
+    req.tp_frame_nr   = (SR_PKT_BLOCK_SIZE / SR_PKT_FRAME_SIZE) * SR_PKT_BLOCK_NR;
+    req.tp_retire_blk_tov = SR_PKT_BLOCK_TOV;
+    if (setsockopt(d->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("setsockopt(PACKET_RX_RING):sr_afpacket.c::sr_afp_attach");
+        return -1;
+    }
+    rx_len = (size_t)req.tp_block_size * req.tp_block_nr;
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_PKT_BLOCK_SIZE;
+    req.tp_block_nr   = SR_PKT_TX_BLOCK_NR;
+    req.tp_frame_size = SR_PKT_FRAME_SIZE;
+    req.tp_frame_nr   = (SR_PKT_BLOCK_SIZE / SR_PKT_FRAME_SIZE) * SR_PKT_TX_BLOCK_NR;
+    if (setsockopt(d->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("setsockopt(PACKET_TX_RING):sr_afpacket.c::sr_afp_attach");
+        return -1;
+    }
+    tx_len = (size_t)req.tp_block_size * req.tp_block_nr;
+    d->tx_frame_nr = req.tp_frame_nr;
+
+    d->map_len = rx_len + tx_len;
+    d->map = (uint8_t*)mmap(0, d->map_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_LOCKED, d->fd, 0);
+    if (d->map == MAP_FAILED)
+    {
+        /* -- MAP_LOCKED can fail under RLIMIT_MEMLOCK, retry without -- */
+        d->map = (uint8_t*)mmap(0, d->map_len, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, d->fd, 0);
+    }
+    if (d->map == MAP_FAILED)
+    {
+        perror("mmap:sr_afpacket.c::sr_afp_attach");
+        d->map = 0;
+        return -1;
+    }
+    d->tx_ring = d->map + rx_len;
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family   = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex  = d->ifindex;
+    if (bind(d->fd, (struct sockaddr*)&sll, sizeof(sll)) < 0)
+    {
+        perror("bind:sr_afpacket.c::sr_afp_attach");
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_afp_attach -- */
+
+static void sr_afp_detach(struct sr_afp_dev* d)
+{
+    if (d->map)
+    { munmap(d->map, d->map_len); }
+    if (d->fd >= 0)
+    { close(d->fd); }
+    d->map = 0;
+    d->fd = -1;
+}
+
+static int sr_afp_open(struct sr_instance* sr, const struct sr_backend_config* cfg)
+{
+    struct sr_ifspec specs[SR_MAX_IFSPEC];
+    struct sr_afp* pk;
+    int i;
+
+    pk = (struct sr_afp*)sr_mem_calloc(SR_MEM_BACKEND, 1, sizeof(struct sr_afp));
+    assert(pk);
+
+    pk->ndev = sr_parse_ifspec(cfg->ifspec, specs, SR_MAX_IFSPEC);
+    if (pk->ndev <= 0)
+    {
+        fprintf(stderr, "packet backend needs -i dev[=ip][,dev[=ip]...]\n");
+        sr_mem_free(pk);
+        return -1;
+    }
+
+    for (i = 0; i < pk->ndev; i++)
+    {
+        pk->dev[i].spec = specs[i];
+        pk->dev[i].fd = -1;
+    }
+    for (i = 0; i < pk->ndev; i++)
+    {
+        if (sr_afp_attach(&pk->dev[i]) < 0)
+        {
+            for (i = 0; i < pk->ndev; i++)
+            { sr_afp_detach(&pk->dev[i]); }
+            sr_mem_free(pk);
+            return -1;
+        }
+    }
+
+    pthread_mutex_init(&pk->tx_lock, 0);
+    sr->backend_data = pk;
+    return 0;
+}
+
+static int sr_afp_discover(struct sr_instance* sr)
+{
+    struct sr_afp* pk = (struct sr_afp*)sr->backend_data;
+    int i;
+
+    assert(sr->nif == 0);
+    for (i = 0; i < pk->ndev; i++)
+    {
+        /* -- device i becomes router interface i -- */
+        sr_add_interface(sr, pk->dev[i].spec.dev);
+        sr_set_ether_addr(sr, pk->dev[i].mac);
+        sr_set_ether_ip(sr, pk->dev[i].spec.ip);
+    }
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_afp_rx_dev(..)
+ * Scope: Local
+ *
+ * Hand out up to max frames from the device's RX ring, moving on to the
+ * next retired block when the current one is used up.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_afp_rx_dev(struct sr_afp* pk, struct sr_afp_dev* d,
+                         struct sr_frame* frames, int max)
+{
+    int n = 0;
+
+    while (n < max)
+    {
+        struct tpacket_block_desc* bd = sr_afp_block(d, d->rx_block);
+        struct tpacket3_hdr* h;
+        struct sockaddr_ll* sll;
+
+        if (d->rx_left == 0)
+        {
+            if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+                  & TP_STATUS_USER))
+            { break; }
+            d->rx_left = bd->hdr.bh1.num_pkts;
+            d->rx_next = (struct tpacket3_hdr*)((uint8_t*)bd +
+                                bd->hdr.bh1.offset_to_first_pkt);
+            pk->rx_blocks++;
+            if (d->rx_left == 0)
+            {
+                pk->done[pk->ndone++] = bd;
+                d->rx_block = (d->rx_block + 1) % SR_PKT_BLOCK_NR;
+                continue;
+            }
+        }
+
+        h = d->rx_next;
+        sll = (struct sockaddr_ll*)((uint8_t*)h +
+                        TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+        if (sll->sll_pkttype != PACKET_OUTGOING &&
+                h->tp_snaplen >= sizeof(struct sr_ethernet_hdr))
+        {
+            frames[n].buf   = (uint8_t*)h + h->tp_mac;
+            frames[n].len   = h->tp_snaplen;
+            frames[n].ifindex = d - pk->dev;
+            frames[n].headroom = 0;
+            frames[n].priv  = 0;
+            n++;
+        }
+
+        d->rx_next = (struct tpacket3_hdr*)((uint8_t*)h + h->tp_next_offset);
+        if (--d->rx_left == 0)
+        {
+            /* -- frames still point into it; give it back in rx_release -- */
+            pk->done[pk->ndone++] = bd;
+            d->rx_block = (d->rx_block + 1) % SR_PKT_BLOCK_NR;
+        }
+    }
+
+    return n;
+} /* -- sr_afp_rx_dev -- */
+
+static int sr_afp_rx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int max)
+{
+    struct sr_afp* pk = (struct sr_afp*)sr->backend_data;
+    struct pollfd pfd[SR_MAX_IFSPEC];
+    int i, n = 0;
+
+    for (i = 0; i < pk->ndev && n < max; i++)
+    {
+        struct sr_afp_dev* d = &pk->dev[(pk->next_rx + i) % pk->ndev];
+        n += sr_afp_rx_dev(pk, d, frames + n, max - n);
+    }
+    pk->next_rx = (pk->next_rx + 1) % pk->ndev;
+
+    if (n > 0)
+    {
+        pk->rx_frames += n;
+        return n;
+    }
+    if (pk->ndone > 0)
+    {
+        /* -- only empty/outgoing frames, nothing references the blocks -- */
+        sr_afp_release_blocks(pk);
+        return 0;
+    }
+
+    for (i = 0; i < pk->ndev; i++)
+    {
+        pfd[i].fd = pk->dev[i].fd;
+        pfd[i].events = POLLIN | POLLERR;
+        pfd[i].revents = 0;
+    }
+
+    pk->wakeups++;
+    if (poll(pfd, pk->ndev, -1) < 0)
+    {
+        if (errno == EINTR)
+        { return sr_stop_requested ? -1 : 0; }
+        perror("poll(..):sr_afpacket.c::sr_afp_rx_burst");
+        return -1;
+    }
+    return 0;
+}
+
+static void sr_afp_rx_release(struct sr_instance* sr, struct sr_frame* frames,
+                              int n)
+{
+    sr_afp_release_blocks((struct sr_afp*)sr->backend_data);
+}
+
+/* -- a look at the block status words, no syscall -- */
+static int sr_afp_rx_ready(struct sr_instance* sr)
+{
+    struct sr_afp* pk = (struct sr_afp*)sr->backend_data;
+    int i;
+
+    for (i = 0; i < pk->ndev; i++)
+    {
+        struct sr_afp_dev* d = &pk->dev[i];
+
+        if (d->rx_left > 0 ||
+                (__atomic_load_n(&sr_afp_block(d, d->rx_block)->hdr.bh1.block_status,
+                                 __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+        { return 1; }
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_afp_tx_burst(..)
+ * Scope: Local
+ *
+ * Copy frames into free TX ring slots and kick each device once.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_afp_tx_burst(struct sr_instance* sr, const struct sr_frame* frames,
+                           int n)
+{
+    struct sr_afp* pk = (struct sr_afp*)sr->backend_data;
+    unsigned int max_len = SR_PKT_FRAME_SIZE - TPACKET3_HDRLEN;
+    int i, j;
+
+    pthread_mutex_lock(&pk->tx_lock);
+    for (i = 0; i < n; i++)
+    {
+        struct sr_afp_dev* d = 0;
+        struct tpacket3_hdr* h;
+
+        if (frames[i].ifindex < 0 || frames[i].ifindex >= pk->ndev)
+        {
+            n = i;
+            break;
+        }
+        d = &pk->dev[frames[i].ifindex];
+
+        h = (struct tpacket3_hdr*)(d->tx_ring +
+                        (size_t)d->tx_next * SR_PKT_FRAME_SIZE);
+        if (frames[i].len > max_len ||
+                __atomic_load_n(&h->tp_status, __ATOMIC_ACQUIRE) !=
+                TP_STATUS_AVAILABLE)
+        {
+            /* -- ring full (or jumbo frame): drop like a full NIC queue -- */
+            pk->tx_drops++;
+            continue;
+        }
+
+        memcpy((uint8_t*)h + TPACKET3_HDRLEN - sizeof(struct sockaddr_ll),
+               frames[i].buf, frames[i].len);
+        h->tp_len = frames[i].len;
+        h->tp_snaplen = frames[i].len;
+        h->tp_next_offset = 0;
+        __atomic_store_n(&h->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+        d->tx_next = (d->tx_next + 1) % d->tx_frame_nr;
+        d->tx_pending++;
+        pk->tx_frames++;
+    }
+
+    for (j = 0; j < pk->ndev; j++)
+    {
+        if (pk->dev[j].tx_pending)
+        {
+            if (send(pk->dev[j].fd, 0, 0, MSG_DONTWAIT) < 0 &&
+                    errno != EAGAIN && errno != ENOBUFS)
+            { perror("send(..):sr_afpacket.c::sr_afp_tx_burst"); }
+            pk->dev[j].tx_pending = 0;
+        }
+    }
+    pthread_mutex_unlock(&pk->tx_lock);
+
+    return n;
+}
+
+static void sr_afp_close(struct sr_instance* sr)
+{
+    struct sr_afp* pk = (struct sr_afp*)sr->backend_data;
+    int i;
+
+    if (!pk)
+    { return; }
+
+    fprintf(stderr, "AF_PACKET: %lu frames rx in %lu blocks (%lu wakeups), "
+            "%lu frames tx, %lu tx drops\n", pk->rx_frames, pk->rx_blocks,
+            pk->wakeups, pk->tx_frames, pk->tx_drops);
+
+    for (i = 0; i < pk->ndev; i++)
+    { sr_afp_detach(&pk->dev[i]); }
+    pthread_mutex_destroy(&pk->tx_lock);
+    sr_mem_free(pk);
+    sr->backend_data = 0;
+}
+
+#else /* -- !_LINUX_ -- */
+
+static int sr_afp_open(struct sr_instance* sr, const struct sr_backend_config* cfg)
+{
+    fprintf(stderr, "packet backend is only available on Linux\n");
+    return -1;
+}
+static int sr_afp_discover(struct sr_instance* sr) { return -1; }
+static int sr_afp_rx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int max) { return -1; }
+static void sr_afp_rx_release(struct sr_instance* sr, struct sr_frame* frames,
+                              int n) { }
+static int sr_afp_tx_burst(struct sr_instance* sr, const struct sr_frame* frames,
+                           int n) { return -1; }
+static void sr_afp_close(struct sr_instance* sr) { }
+static int sr_afp_rx_ready(struct sr_instance* sr) { return 0; }
+
+#endif /* _LINUX_ */
+
+const struct sr_backend sr_afpacket_backend =
+{
+    "packet",
+    sr_afp_open,
+    sr_afp_discover,
+    sr_afp_rx_burst,
+    sr_afp_rx_release,
+    sr_afp_tx_burst,
+    sr_afp_close,
+    0,
+    0,
+    0,
+    sr_afp_rx_ready
+};
@@ -13,6 +13,12 @@
 #include "sr_protocol.h"
 #include "sr_utils.h"
 #include "sr_rt.h"
+#include "sr_backend.h"
+#include "sr_pool.h"
+#include "sr_pkt.h"
+#include "sr_trace.h"
+#include "sr_stats.h"
+#include "sr_probe.h"
 
 void handle_arpreq(struct sr_instance * sr, struct sr_arpreq * req)
 {
@@ -22,58 +28,25 @@ void handle_arpreq(struct sr_instance * sr, struct sr_arpreq * req)
         {
             /* Send ICMP host unreachable */
             struct sr_packet * pkts = req->packets;
+            unsigned int queued = 0;
 
             while(pkts)
             {
-                
-                
-                /* Loop through all packets and send ICMP host unreachable */
-                uint8_t * packet = pkts->buf;
-                
-                struct sr_if * outgoing_if = sr_get_interface(sr, pkts->iface);
-                
-                /* Initialize current ether, ip header */
-                struct sr_ethernet_hdr * ether_hdr = (sr_ethernet_hdr_t *)(packet);
-                struct sr_ip_hdr * ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
-                /*Create reply headers */
-                struct sr_ethernet_hdr * ether_reply = (sr_ethernet_hdr_t *)malloc(sizeof(sr_ethernet_hdr_t));
-                /*sr_fill_ether_hdr_reply(ether_hdr, ether_reply);*/
-
-                sr_fill_ether_reply_arp(ether_hdr, ether_reply, outgoing_if);
-                ether_reply->ether_type = htons(ethertype_ip);
-
-                struct sr_ip_hdr * ip_reply = (sr_ip_hdr_t *)malloc(sizeof(sr_ip_hdr_t));
-                sr_fill_ip_hdr_icmpt11(ip_hdr, ip_reply, ip_protocol_icmp, outgoing_if->ip, pkts->len - sizeof(sr_ethernet_hdr_t));
-
-                struct sr_icmp_t3_hdr * icmp_t3_reply = (sr_icmp_t3_hdr_t *)malloc(sizeof(sr_icmp_t3_hdr_t));
-                sr_fill_icmp_t3_reply(icmp_t3_reply,3, 1, packet, pkts->len);
-                uint8_t * reply_packet = (uint8_t *) malloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
-
-                memcpy(reply_packet, ether_reply, sizeof(sr_ethernet_hdr_t));
-                memcpy(reply_packet + sizeof(sr_ethernet_hdr_t), ip_reply, sizeof(sr_ip_hdr_t));
-                memcpy(reply_packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t), icmp_t3_reply, sizeof(sr_icmp_t3_hdr_t));
-                struct sr_rt * outgoing_rt = find_rt_by_ip(sr, ip_reply->ip_dst);
-
-                printf("outgoing_rt->interface: %s \n", outgoing_rt->interface);
-                print_addr_ip_int(ip_reply->ip_dst);
-                printf("Outgoing interface: %s \n", pkts->iface);
-
-                sr_send_packet(sr, reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t), pkts->iface);
-
-                printf("Sent out below: \n");
-                print_hdrs(reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +sizeof(sr_icmp_t3_hdr_t));
-                free(ether_reply);
-                free(ip_reply);
-                free(icmp_t3_reply);
-                free(reply_packet);
-
-
+                /* Loop through all packets and send ICMP host unreachable
+                   back out the interface each one arrived on */
+                struct sr_ip_hdr * ip_hdr = (sr_ip_hdr_t *)(SR_PKT_DATA(pkts->pkt) + sizeof(sr_ethernet_hdr_t));
+                struct sr_if * in_if = sr_get_interface_idx(sr, pkts->pkt->ifindex);
 
+                /* Echo replies we queued ourselves have no one to tell;
+                   any source, 0.0.0.0 included, may be asked about */
+                if (in_if && !sr_find_local_addr(sr, ip_hdr->ip_src))
+                { sr_send_icmp_error(sr, pkts->pkt, 3, 1, in_if->ip); }
 
+                SR_STATS_DROP(ARP_TIMEOUT, pkts->pkt->len);
                 pkts = pkts->next;
+                queued++;
             }
-
-
+            SR_TRACE(ARP_GIVE_UP, req->ip, queued, 0, 0);
 
             sr_arpreq_destroy(&(sr->cache), req);
 
@@ -82,68 +55,28 @@ void handle_arpreq(struct sr_instance * sr, struct sr_arpreq * req)
             /* Send ARP req */
             
 
-            /* Find the outgoing interface name given ip (gateway) */
-
-            struct sr_rt* rt_walker = 0;
-            char * if_name = (char *) malloc(sr_IFACE_NAMELEN * sizeof(char));
-            rt_walker = sr->routing_table;
-            print_addr_ip_int(req->ip);
-           
-            if (rt_walker == 0)
-            {
-                printf("rt_walker is zero!\n");
-                return;
-                                                                                    
-            }
-            printf("Before rt_walker \n");
-            sr_print_routing_table(sr);
-
-            while(rt_walker)
-            {
-                printf("In rt walker\n");
-                if (rt_walker->gw.s_addr == req->ip)
-                {
-                    memcpy(if_name, rt_walker->interface, sr_IFACE_NAMELEN);
-                    printf("Found IF name\n");
-                    break;
-                
-                }
-                rt_walker = rt_walker->next;
-            }
+            /* The outgoing interface was recorded when the first packet
+               was queued on this request */
+            struct sr_if * target_if = sr_get_interface_idx(sr, req->ifindex);
 
-            printf("After rt_walker \n");
-            sr_print_routing_table(sr);
-            
-            printf("if_name: %s \n", if_name);
-            
-            struct sr_if * target_if = sr_get_interface(sr, if_name);
-           
             assert(target_if);
 
-            struct sr_ethernet_hdr * ether_reply = (sr_ethernet_hdr_t *)malloc(sizeof(sr_ethernet_hdr_t));
+            struct sr_pkt * reply = sr_pkt_alloc(sr, SR_PKT_HEADROOM);
 
-            sr_fill_ether_req_arp(ether_reply, target_if);
-            
-            struct sr_arp_hdr * arp_req = (sr_arp_hdr_t *) malloc(sizeof(sr_arp_hdr_t));
-            sr_fill_arp_req(arp_req, target_if, ether_reply, req->ip);
+            if (reply)
+            {
+                struct sr_arp_hdr * arp_req = (sr_arp_hdr_t *)sr_pkt_put(reply, sizeof(sr_arp_hdr_t));
+                struct sr_ethernet_hdr * ether_reply = (sr_ethernet_hdr_t *)sr_pkt_push(reply, sizeof(sr_ethernet_hdr_t));
 
-            uint8_t * reply_packet = (uint8_t *)malloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));
-            memcpy(reply_packet, ether_reply, sizeof(sr_ethernet_hdr_t));
-            memcpy(reply_packet + sizeof(sr_ethernet_hdr_t), arp_req, sizeof(sr_arp_hdr_t));
+                sr_fill_ether_req_arp(ether_reply, target_if);
+                sr_fill_arp_req(arp_req, target_if, ether_reply, req->ip);
 
-            printf("send arp req target_if->name %s \n", target_if->name);
+                SR_TRACE(ARP_SEND, req->ip, target_if->index, req->times_sent + 1, 0);
+                SR_PROBE3(arp__request, req->ip, target_if->index, req->times_sent + 1);
+                sr_send_packet(sr, reply, target_if->index);
+                sr_pkt_unref(reply);
+            }
 
-            sr_send_packet(sr, reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t), target_if->name);
-            
-            
-            printf("Sent out below ARP req: \n");
-            print_hdrs(reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));
-            free(ether_reply);
-            free(arp_req);
-            free(reply_packet);
-            free(if_name);
-            /*free(rt_walker);*/
-            
             req->sent = time(NULL);
             req->times_sent++;
 
@@ -163,52 +96,66 @@ void sr_arpcache_sweepreqs(struct sr_instance *sr) {
     /* For each request, in sr->cache, call handle_arpreq */
     struct sr_arpcache * cache = &(sr->cache);
     struct sr_arpreq * req = cache->requests;
+    struct sr_arpreq * next;
     while(req)
     {
+        /* handle_arpreq may destroy req */
+        next = req->next;
         handle_arpreq(sr, req);
-        req = req->next;
+        req = next;
     }
 }
 
 /* You should not need to touch the rest of this code. */
 
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
-    pthread_mutex_lock(&(cache->lock));
+   If it is, copies the entry into *copy and returns 1. */
+int sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip,
+                       struct sr_arpentry *copy) {
+    /* Lock free for readers: writers hold the lock and make seq odd while
+       they change entries, so retry if it was odd or moved under us. This
+       keeps forwarding off the lock the ARP thread and slow path hold while
+       they send. */
+    unsigned int seq;
+    int found;
     
-    struct sr_arpentry *entry = NULL, *copy = NULL;
-    
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
-            entry = &(cache->entries[i]);
+    do {
+        while ((seq = __atomic_load_n(&(cache->seq), __ATOMIC_ACQUIRE)) & 1)
+            ;
+        
+        found = 0;
+        int i;
+        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+            if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
+                /* Must return a copy b/c another thread could jump in and
+                   modify table after we return. */
+                memcpy(copy, &(cache->entries[i]), sizeof(struct sr_arpentry));
+                found = 1;
+            }
         }
-    }
-    
-    /* Must return a copy b/c another thread could jump in and modify
-       table after we return. */
-    if (entry) {
-        copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
-        memcpy(copy, entry, sizeof(struct sr_arpentry));
-    }
         
-    pthread_mutex_unlock(&(cache->lock));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&(cache->seq), __ATOMIC_RELAXED) != seq);
     
-    return copy;
+    if (found)
+        SR_PROBE1(arp__hit, ip);
+    else
+        SR_PROBE1(arp__miss, ip);
+    return found;
 }
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. You should free the passed *packet.
+   that corresponds to this ARP request. The queue keeps its own reference to
+   pkt (see sr_backend_hold), the caller's is untouched.
    
    A pointer to the ARP request is returned; it should not be freed. The caller
    can remove the ARP request from the queue by calling sr_arpreq_destroy. */
 struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
-                                       uint8_t *packet,           /* borrowed */
-                                       unsigned int packet_len,
-                                       char *iface)
+                                       struct sr_pkt *pkt,        /* borrowed */
+                                       int ifindex,
+                                       int forward)
 {
     pthread_mutex_lock(&(cache->lock));
     
@@ -221,21 +168,34 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     
     /* If the IP wasn't found, add it */
     if (!req) {
-        req = (struct sr_arpreq *) calloc(1, sizeof(struct sr_arpreq));
+        req = (struct sr_arpreq *) sr_pool_get(cache->sr->arpreq_pool);
+        if (!req) {
+            if (pkt && pkt->len)
+                SR_STATS_DROP(NO_BUFFER, pkt->len);
+            pthread_mutex_unlock(&(cache->lock));
+            return NULL;
+        }
+        memset(req, 0, sizeof(struct sr_arpreq));
         req->ip = ip;
+        req->ifindex = ifindex;
         req->next = cache->requests;
         cache->requests = req;
     }
     
-    /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
-        struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
+    /* Add the packet to the list of packets for this request; if the
+       pools are exhausted it is dropped, as a full queue would */
+    if (pkt && pkt->len && ifindex >= 0) {
+        struct sr_packet *new_pkt = (struct sr_packet *)sr_pool_get(cache->sr->arpq_pool);
         
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
-        memcpy(new_pkt->buf, packet, packet_len);
-        new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-        strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
+        if (!new_pkt ||
+                !(new_pkt->pkt = sr_backend_hold(cache->sr, pkt, &new_pkt->pin))) {
+            SR_STATS_DROP(QUEUE_FULL, pkt->len);
+            sr_pool_put(new_pkt);
+            pthread_mutex_unlock(&(cache->lock));
+            return req;
+        }
+        new_pkt->ifindex = ifindex;
+        new_pkt->forward = forward;
         new_pkt->next = req->packets;
         req->packets = new_pkt;
     }
@@ -246,8 +206,9 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
 }
 
 /* This method performs two functions:
-   1) Looks up this IP in the request queue. If it is found, returns a pointer
-      to the sr_arpreq with this IP. Otherwise, returns NULL.
+   1) Looks up this IP in the request queue. If it is found, takes it off the
+      queue and returns a pointer to the sr_arpreq with this IP. Otherwise,
+      returns NULL.
    2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
@@ -279,11 +240,14 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
     }
     
     if (i != SR_ARPCACHE_SZ) {
+        __atomic_add_fetch(&(cache->seq), 1, __ATOMIC_SEQ_CST);
         memcpy(cache->entries[i].mac, mac, 6);
         cache->entries[i].ip = ip;
         cache->entries[i].added = time(NULL);
         cache->entries[i].valid = 1;
+        __atomic_add_fetch(&(cache->seq), 1, __ATOMIC_SEQ_CST);
     }
+    SR_PROBE3(arp__insert, ip, mac, req != NULL);
     
     pthread_mutex_unlock(&(cache->lock));
     
@@ -317,14 +281,11 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
         
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
-            free(pkt);
+            sr_pkt_unref(pkt->pkt);
+            sr_pool_put(pkt);
         }
         
-        free(entry);
+        sr_pool_put(entry);
     }
     
     pthread_mutex_unlock(&(cache->lock));
@@ -352,6 +313,7 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
     
     /* Invalidate all entries */
     memset(cache->entries, 0, sizeof(cache->entries));
+    cache->seq = 0;
     cache->requests = NULL;
     
     /* Acquire mutex lock */
@@ -373,6 +335,9 @@ void *sr_arpcache_timeout(void *sr_ptr) {
     struct sr_instance *sr = sr_ptr;
     struct sr_arpcache *cache = &(sr->cache);
     
+    sr_trace_thread("arp");
+    sr_stats_thread("arp");
+
     while (1) {
         sleep(1.0);
         
@@ -383,7 +348,10 @@ void *sr_arpcache_timeout(void *sr_ptr) {
         int i;    
         for (i = 0; i < SR_ARPCACHE_SZ; i++) {
             if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
+                __atomic_add_fetch(&(cache->seq), 1, __ATOMIC_SEQ_CST);
                 cache->entries[i].valid = 0;
+                __atomic_add_fetch(&(cache->seq), 1, __ATOMIC_SEQ_CST);
+                SR_PROBE1(arp__expire, cache->entries[i].ip);
             }
         }
         
@@ -70,15 +70,18 @@
 #include <time.h>
 #include <pthread.h>
 #include "sr_if.h"
+#include "sr_pkt.h"
 
 #define SR_ARPCACHE_SZ    100  
 #define SR_ARPCACHE_TO    15.0
 
 struct sr_packet {
-    uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
-    unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
+    struct sr_pkt *pkt;         /* Held raw Ethernet frame, presumably with the dest MAC empty */
+    int ifindex;                /* The outgoing interface (sr->if_table) */
+    int forward;                /* In transit and queued as it arrived: lower
+                                   the TTL and set the source MAC on release */
     struct sr_packet *next;
+    struct sr_pkt pin;          /* Describes pkt if the backend pinned it */
 };
 
 struct sr_arpentry {
@@ -96,12 +99,16 @@ struct sr_arpreq {
     uint32_t times_sent;        /* Number of times this request was sent. You 
                                    should update this. */
     struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
+    int ifindex;                /* Interface the request goes out on */
     struct sr_arpreq *next;
 };
 
 struct sr_arpcache {
     struct sr_arpentry entries[SR_ARPCACHE_SZ];
+    unsigned int seq;           /* odd while entries are being changed, lets
+                                   sr_arpcache_lookup read without the lock */
     struct sr_arpreq *requests;
+    struct sr_instance *sr;     /* owner, queued frames are held through its backend */
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
 };
@@ -110,26 +117,31 @@ void handle_arpreq(struct sr_instance * sr, struct sr_arpreq * req);
 
 
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order. 
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
+/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
+   If it is, copies the entry into *copy and returns 1, otherwise returns 0. */
+int sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip,
+                       struct sr_arpentry *copy);
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. The packet argument should not be
-   freed by the caller.
+   that corresponds to this ARP request. The packet is borrowed; the queue
+   keeps its own reference (or copy, see sr_backend_hold).  A datagram
+   being forwarded is queued untouched with 'forward' set, so that if ARP
+   gives up the host unreachable quotes it, and goes back, as it arrived.
 
    A pointer to the ARP request is returned; it should be freed. The caller
    can remove the ARP request from the queue by calling sr_arpreq_destroy. */
 struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
-                         uint8_t *packet,               /* borrowed */
-                         unsigned int packet_len,
-                         char *iface);
+                         struct sr_pkt *pkt,            /* borrowed */
+                         int ifindex,
+                         int forward);
 
 /* This method performs two functions:
-   1) Looks up this IP in the request queue. If it is found, returns a pointer
-      to the sr_arpreq with this IP. Otherwise, returns NULL.
+   1) Looks up this IP in the request queue. If it is found, takes it off the
+      queue and returns a pointer to the sr_arpreq with this IP, which the
+      caller now owns (send its packets, then sr_arpreq_destroy). Otherwise,
+      returns NULL.
    2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
@@ -0,0 +1,798 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_backend.c
+ *
+ * Description:
+ *
+ * Backend independent packet input/output: the receive loop step, packet
+ * logging, the sanity checks on frames going out and sr_send_packet(..)
+ * itself.  Backends only move raw frames.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <net/if.h>
+#endif /* _LINUX_ */
+
+#include "sr_dumper.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_backend.h"
+#include "sr_pool.h"
+#include "sr_pkt.h"
+#include "sr_worker.h"
+#include "sr_graph.h"
+#include "sr_capture.h"
+#include "sr_stats.h"
+#include "sr_probe.h"
+
+static const struct sr_backend* sr_backends[] =
+{
+    &sr_vns_backend,
+    &sr_tap_backend,
+    &sr_afpacket_backend,
+    &sr_xdp_backend,
+    &sr_shm_backend,
+    0
+};
+
+/* -- set while this thread hands a burst to the router, so sends made
+      from the forwarding graph are flushed once at the end of the burst -- */
+static __thread int sr_in_burst;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SR_CPU_RELAX() __builtin_ia32_pause()
+#else
+#define SR_CPU_RELAX() do { } while (0)
+#endif
+
+static double sr_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void sr_log_packet(struct sr_instance* , uint8_t* , int , int , int );
+static int  sr_arp_req_not_for_us(struct sr_instance* sr,
+                                  uint8_t * packet /* lent */,
+                                  unsigned int len,
+                                  int ifindex);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_find(..)
+ * Scope: Global
+ *
+ * Look up a backend by name, 0 if there is no such backend.
+ *
+ *---------------------------------------------------------------------------*/
+
+const struct sr_backend* sr_backend_find(const char* name)
+{
+    int i;
+
+    assert(name);
+
+    for (i = 0; sr_backends[i]; i++)
+    {
+        if (strcmp(sr_backends[i]->name, name) == 0)
+        { return sr_backends[i]; }
+    }
+    return 0;
+} /* -- sr_backend_find -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_spin(..)
+ * Scope: Local
+ *
+ * Busy poll the backend for up to busy_poll.spin_us before the loop
+ * blocks in rx_burst.  Returns the receive mode for the stats: 0 if
+ * frames turned up while spinning, 1 if rx_burst will block.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_backend_spin(struct sr_instance* sr)
+{
+    struct sr_busy_poll* bp = &sr->busy_poll;
+    double t0, now;
+
+    if (bp->spin_us == 0 || !sr->backend->rx_ready)
+    { return 1; }
+
+    bp->spins++;
+    t0 = sr_now_us();
+    while (!sr->backend->rx_ready(sr))
+    {
+        now = sr_now_us();
+        if (now - t0 >= bp->spin_us || sr_stop_requested)
+        {
+            /* -- idle: spin less next time, down to not at all -- */
+            bp->spin_time_us += now - t0;
+            bp->spin_us /= 2;
+            return 1;
+        }
+        SR_CPU_RELAX();
+    }
+
+    bp->spin_time_us += sr_now_us() - t0;
+    bp->spin_hits++;
+    bp->spin_us = bp->budget_us;
+    return 0;
+} /* -- sr_backend_spin -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_poll(..)
+ * Scope: Global
+ *
+ * One iteration of the main loop: pull a burst of frames from the backend
+ * and hand each one to the router, or to the workers if there are any.
+ * With -B the backend is busy polled first (sr_backend_spin(..)).
+ *
+ * RETURN VALUES:
+ *
+ *  1 to keep going, anything else when the backend is done
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_backend_poll(struct sr_instance* sr)
+{
+    struct sr_frame frames[SR_RX_BURST];
+    struct sr_io_stats* st = &sr->io_stats;
+    struct sr_busy_poll* bp = &sr->busy_poll;
+    double t0, lat;
+    int n, mode;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->backend);
+
+    if (sr_stop_requested)
+    { return 0; }
+
+    if (bp->started_us == 0)
+    { bp->started_us = sr_now_us(); }
+
+    mode = sr_backend_spin(sr);
+    t0 = sr_now_us();
+    n = sr->backend->rx_burst(sr, frames, SR_RX_BURST);
+    if (n < 0)
+    { return n; }
+
+    if (mode == 1 && bp->budget_us)
+    {
+        double waited = sr_now_us() - t0;
+
+        /* -- traffic came back within the budget: worth spinning again -- */
+        bp->block_time_us += waited;
+        if (n > 0 && waited < bp->budget_us)
+        { bp->spin_us = bp->budget_us; }
+    }
+
+    if (n == 0)
+    { return 1; }
+
+    if (st->rx_frames == 0)
+    { gettimeofday(&st->first_rx, 0); }
+    st->rx_frames += n;
+    st->bursts++;
+
+    t0 = sr_now_us();
+    if (sr->workers)
+    {
+        /* -- latency is rx -> handed to a worker here -- */
+        sr_workers_dispatch(sr, frames, n);
+
+        lat = sr_now_us() - t0;
+        st->lat_sum_us += lat * n;
+        if (lat > st->lat_max_us)
+        { st->lat_max_us = lat; }
+    }
+    else
+    {
+        /* -- latency is rx -> whole burst through the graph -- */
+        sr_backend_burst_begin();
+        sr_backend_input_burst(sr, frames, n);
+
+        lat = sr_now_us() - t0;
+        st->lat_sum_us += lat * n;
+        if (lat > st->lat_max_us)
+        { st->lat_max_us = lat; }
+    }
+    gettimeofday(&st->last_rx, 0);
+
+    bp->mode_bursts[mode]++;
+    bp->mode_frames[mode] += n;
+    bp->mode_lat_sum_us[mode] += lat * n;
+    if (lat > bp->mode_lat_max_us[mode])
+    { bp->mode_lat_max_us[mode] = lat; }
+
+    sr_backend_burst_end(sr);
+
+    if (sr->backend->rx_release)
+    { sr->backend->rx_release(sr, frames, n); }
+
+    return 1;
+} /* -- sr_backend_poll -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_print_busy_poll(..)
+ * Scope: Local
+ *
+ * Per receive mode numbers and the CPU the receive thread burnt, printed
+ * with or without -B so the two runs can be compared.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_backend_print_busy_poll(struct sr_instance* sr)
+{
+    static const char* mode_name[2] = { "spin", "block" };
+    struct sr_busy_poll* bp = &sr->busy_poll;
+#ifdef RUSAGE_THREAD
+    struct rusage ru;
+#endif /* RUSAGE_THREAD */
+    int i;
+
+    if (bp->budget_us)
+    {
+        fprintf(stderr, "  busy poll %u us: %lu spins, %lu found frames, "
+                "%.3f s spinning, %.3f s blocked, spin now %u us\n",
+                bp->budget_us, bp->spins, bp->spin_hits, bp->spin_time_us / 1e6,
+                bp->block_time_us / 1e6, bp->spin_us);
+        for (i = 0; i < 2; i++)
+        {
+            if (bp->mode_frames[i] == 0)
+            { continue; }
+            fprintf(stderr, "  %-5s: %lu frames in %lu bursts, rx->handled "
+                    "latency avg %.2f us max %.2f us\n", mode_name[i],
+                    bp->mode_frames[i], bp->mode_bursts[i],
+                    bp->mode_lat_sum_us[i] / bp->mode_frames[i],
+                    bp->mode_lat_max_us[i]);
+        }
+    }
+
+#ifdef RUSAGE_THREAD
+    if (bp->started_us > 0 && getrusage(RUSAGE_THREAD, &ru) == 0)
+    {
+        double user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+        double sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        double wall = (sr_now_us() - bp->started_us) / 1e6;
+
+        fprintf(stderr, "  rx thread cpu %.3f s user %.3f s sys, %.0f%% of "
+                "%.3f s\n", user, sys,
+                wall > 0 ? 100.0 * (user + sys) / wall : 0.0, wall);
+    }
+#endif /* RUSAGE_THREAD */
+} /* -- sr_backend_print_busy_poll -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_close(..)
+ * Scope: Global
+ *
+ * Print the I/O summary for the run and detach the backend.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_backend_close(struct sr_instance* sr)
+{
+    struct sr_io_stats* st = &sr->io_stats;
+    double secs;
+
+    assert(sr->backend);
+
+    secs = (st->last_rx.tv_sec - st->first_rx.tv_sec) +
+           (st->last_rx.tv_usec - st->first_rx.tv_usec) / 1e6;
+
+    fprintf(stderr, "%s backend: %lu frames rx in %lu bursts, %lu frames tx\n",
+            sr->backend->name, st->rx_frames, st->bursts, st->tx_frames);
+    if (st->rx_frames > 1 && secs > 0)
+    {
+        fprintf(stderr, "  %.0f pps rx, rx->handled latency avg %.2f us "
+                "max %.2f us\n", (st->rx_frames - 1) / secs,
+                st->lat_sum_us / st->rx_frames, st->lat_max_us);
+    }
+    sr_backend_print_busy_poll(sr);
+
+    sr->backend->close(sr);
+} /* -- sr_backend_close -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_input(..), sr_backend_input_burst(..)
+ * Scope: Global
+ *
+ * Deliver received frames to the router.  The frames are lent to the
+ * router through descriptors on the stack; a burst goes through the
+ * forwarding graph as one vector.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_backend_accept(struct sr_instance* sr, struct sr_pkt* pkt)
+{
+    /* -- check if it is an ARP to another router if so drop   -- */
+    if ( sr_arp_req_not_for_us(sr, SR_PKT_DATA(pkt), pkt->len, pkt->ifindex) )
+    {
+        SR_STATS_DROP(ARP_NOT_FOR_US, pkt->len);
+        return 0;
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, SR_PKT_DATA(pkt), pkt->len, pkt->ifindex, SR_CAP_RX);
+    return 1;
+} /* -- sr_backend_accept -- */
+
+static int sr_backend_wrap(struct sr_pkt* pkt, struct sr_frame* frame,
+                           uint64_t now)
+{
+    SR_STATS_IF(frame->ifindex, RX, frame->len);
+    SR_PROBE3(packet__receive, frame->ifindex, frame->len, frame->buf);
+
+    /* -- the router may have to copy it into a packet buffer; counted
+          (sr_stat "oversize") and traced, not printed: a flood of them
+          would be a flood on stderr -- */
+    if ( frame->len > SR_PKT_DATA_MAX )
+    {
+        SR_STATS_DROP(OVERSIZE, frame->len);
+        return 0;
+    }
+
+    sr_pkt_wrap(pkt, frame->buf, frame->len, frame->headroom, frame->ifindex);
+    pkt->ts_ns = now;
+    return 1;
+} /* -- sr_backend_wrap -- */
+
+void sr_backend_input(struct sr_instance* sr, struct sr_frame* frame)
+{
+    struct sr_pkt pkt;
+
+    if ( !sr_backend_wrap(&pkt, frame, sr_pkt_clock()) ||
+            !sr_backend_accept(sr, &pkt) )
+    { return; }
+
+    /* -- pass to router, student's code should take over here -- */
+    sr_alloc_check_begin();
+    sr_handlepacket(sr, &pkt);
+    sr_alloc_check_end();
+} /* -- sr_backend_input -- */
+
+void sr_backend_input_burst(struct sr_instance* sr, struct sr_frame* frames,
+                            int n)
+{
+    struct sr_pkt pkts[SR_RX_BURST];
+    struct sr_pkt* vec[SR_RX_BURST];
+    uint64_t now = sr_pkt_clock();
+    int i, m = 0;
+
+    assert(n <= SR_RX_BURST);
+
+    for (i = 0; i < n; i++)
+    {
+        if ( sr_backend_wrap(&pkts[m], &frames[i], now) &&
+                sr_backend_accept(sr, &pkts[m]) )
+        {
+            vec[m] = &pkts[m];
+            m++;
+        }
+    }
+
+    sr_alloc_check_begin();
+    sr_graph_run(sr, vec, m);
+    sr_alloc_check_end();
+} /* -- sr_backend_input_burst -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_deliver(..)
+ * Scope: Global
+ *
+ * Worker side of sr_backend_input_burst(..): run a burst of packets the
+ * worker owns through the graph, drop them and flush whatever the router
+ * sent.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_backend_deliver(struct sr_instance* sr, struct sr_pkt** pkts, int n)
+{
+    struct sr_pkt* vec[SR_RX_BURST];
+    int i, m = 0;
+
+    assert(n <= SR_RX_BURST);
+
+    for (i = 0; i < n; i++)
+    {
+        if (sr_backend_accept(sr, pkts[i]))
+        { vec[m++] = pkts[i]; }
+    }
+
+    sr_backend_burst_begin();
+    sr_alloc_check_begin();
+    sr_graph_run(sr, vec, m);
+    sr_alloc_check_end();
+    sr_backend_burst_end(sr);
+
+    for (i = 0; i < n; i++)
+    { sr_pkt_unref(pkts[i]); }
+} /* -- sr_backend_deliver -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_burst_begin(..), sr_backend_burst_end(..)
+ * Scope: Global
+ *
+ * Bracket a batch of sr_send_packet(..) calls on this thread: backends
+ * that queue frames are flushed once at the end instead of per send.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_backend_burst_begin(void)
+{
+    sr_in_burst = 1;
+} /* -- sr_backend_burst_begin -- */
+
+void sr_backend_burst_end(struct sr_instance* sr)
+{
+    sr_in_burst = 0;
+
+    if (sr->backend->tx_flush && sr->backend->tx_flush(sr) < 0)
+    { fprintf(stderr, "Error flushing packets\n"); }
+} /* -- sr_backend_burst_end -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_ether_addrs_match_interface(..)
+ * Scope: Local
+ *
+ * Make sure ethernet addresses are sane so we don't muck uo the system.
+ *
+ *----------------------------------------------------------------------------*/
+
+static int
+sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
+                                uint8_t* buf, /* borrowed */
+                                int ifindex )
+{
+    struct sr_ethernet_hdr* ether_hdr = 0;
+    struct sr_if* iface = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(buf);
+
+    ether_hdr = (struct sr_ethernet_hdr*)buf;
+    iface = sr_get_interface_idx(sr, ifindex);
+
+    if ( iface == 0 ){
+        fprintf( stderr, "** Error, interface %d, does not exist\n", ifindex);
+        return 0;
+    }
+
+    if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
+        fprintf( stderr, "** Error, source address does not match interface\n");
+        return 0;
+    }
+
+    /* TODO */
+    /* Check destination, hardware address.  If it is private (i.e. destined
+     * to a virtual interface) ensure it is going to the correct topology
+     * Note: This check should really be done server side ...
+     */
+
+    return 1;
+
+} /* -- sr_ether_addrs_match_interface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet(..)
+ * Scope: Global
+ *
+ * Send a packet (ethernet header included!) out of the interface with
+ * index 'ifindex' through the active backend.  The packet's headroom is
+ * passed down so the backend can add its own framing in place.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet(struct sr_instance* sr /* borrowed */,
+                         struct sr_pkt* pkt /* borrowed */ ,
+                         int ifindex)
+{
+    struct sr_frame frame;
+    uint8_t* buf = SR_PKT_DATA(pkt);
+    unsigned int len = pkt->len;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(pkt);
+
+    /* don't waste my time ... */
+    if ( len < sizeof(struct sr_ethernet_hdr) ){
+        fprintf(stderr , "** Error: packet is wayy to short \n");
+        SR_STATS_TX_ERROR(ifindex);
+        return -1;
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, buf, len, ifindex, SR_CAP_TX);
+
+    if ( ! sr_ether_addrs_match_interface( sr, buf, ifindex) ){
+        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
+        SR_STATS_TX_ERROR(ifindex);
+        return -1;
+    }
+
+    frame.buf   = buf;
+    frame.len   = len;
+    frame.ifindex = ifindex;
+    frame.headroom = pkt->off;
+    frame.priv  = 0;
+
+    if ( sr->backend->tx_burst(sr, &frame, 1) != 1 ){
+        fprintf(stderr, "Error writing packet\n");
+        SR_STATS_TX_ERROR(ifindex);
+        return -1;
+    }
+    __atomic_add_fetch(&sr->io_stats.tx_frames, 1, __ATOMIC_RELAXED);
+    SR_STATS_IF(ifindex, TX, len);
+    SR_PROBE3(packet__transmit, ifindex, len, buf);
+    if ( pkt->lat_path && pkt->ts_ns )
+    { sr_stats_latency(pkt->lat_path, sr_pkt_clock() - pkt->ts_ns); }
+    if ( pkt->route >= 0 )
+    { SR_STATS_ROUTE(pkt->route, len); }
+
+    if ( !sr_in_burst && sr->backend->tx_flush && sr->backend->tx_flush(sr) < 0 ){
+        fprintf(stderr, "Error writing packet\n");
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_hold(..)
+ * Scope: Global
+ *
+ * Keep a packet around past the current rx burst (packets waiting on ARP)
+ * and return a reference to drop with sr_pkt_unref(..):
+ *
+ *  - packets already in router memory just gain a reference
+ *  - backends that own their buffers can pin a received frame in place;
+ *    'pin' (caller's storage) then describes it.  Pass 0 to always copy.
+ *  - anything else is copied into a pool packet
+ *
+ * Returns 0 if the pool is exhausted.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_backend_unpin(struct sr_pkt* pkt)
+{
+    struct sr_instance* sr = (struct sr_instance*)pkt->ctx;
+
+    sr->backend->unhold(sr, pkt->head);
+} /* -- sr_backend_unpin -- */
+
+struct sr_pkt* sr_backend_hold(struct sr_instance* sr, struct sr_pkt* pkt,
+                               struct sr_pkt* pin)
+{
+    struct sr_pkt* copy;
+
+    if (pkt->release)
+    { return sr_pkt_ref(pkt); }
+
+    if (pin && sr->backend->hold && sr->backend->unhold &&
+            sr->backend->hold(sr, SR_PKT_DATA(pkt), pkt->len) != 0)
+    {
+        *pin = *pkt;
+        pin->refcnt = 1;
+        pin->release = sr_backend_unpin;
+        pin->ctx = sr;
+        return pin;
+    }
+
+    if ((copy = sr_pkt_alloc(sr, SR_PKT_HEADROOM)) == 0)
+    { return 0; }
+    memcpy(sr_pkt_put(copy, pkt->len), SR_PKT_DATA(pkt), pkt->len);
+    copy->ifindex = pkt->ifindex;
+    copy->ts_ns = pkt->ts_ns;
+    copy->route = pkt->route;
+    return copy;
+} /* -- sr_backend_hold -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_packet()
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len,
+                   int ifindex, int dir)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    if(!sr->capture)
+    {return; }
+
+    /* -- a copy into the capture ring, the file is written elsewhere -- */
+    sr_capture_packet(sr->capture, buf, len, ifindex, dir);
+} /* -- sr_log_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_req_not_for_us()
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+int  sr_arp_req_not_for_us(struct sr_instance* sr,
+                           uint8_t * packet /* lent */,
+                           unsigned int len,
+                           int ifindex)
+{
+    struct sr_if* owner = 0;
+    struct sr_ethernet_hdr* e_hdr = 0;
+    struct sr_arp_hdr*       a_hdr = 0;
+
+    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
+    { return 0; }
+
+    e_hdr = (struct sr_ethernet_hdr*)packet;
+    a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+
+    if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
+            (a_hdr->ar_op      == htons(arp_op_request)) )
+    {
+        /* -- only answer for addresses owned by the receiving interface -- */
+        owner = sr_find_local_addr(sr, a_hdr->ar_tip);
+        if (!owner || owner->index != ifindex)
+        { return 1; }
+    }
+
+    return 0;
+} /* -- sr_arp_req_not_for_us -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_parse_ifspec(..)
+ * Scope: Global
+ *
+ * Parse "dev[=a.b.c.d],dev[=a.b.c.d],..." into out.
+ *
+ * RETURN VALUES:
+ *
+ *  number of entries parsed, -1 on a malformed spec
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_parse_ifspec(const char* spec, struct sr_ifspec* out, int max)
+{
+    char buf[128];
+    const char* p = spec;
+    int n = 0;
+
+    if (!spec)
+    { return 0; }
+
+    while (*p)
+    {
+        const char* end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        char* eq;
+        struct in_addr addr;
+
+        if (n == max || len == 0 || len >= sizeof(buf))
+        { return -1; }
+
+        memcpy(buf, p, len);
+        buf[len] = 0;
+        memset(&out[n], 0, sizeof(out[n]));
+
+        if ((eq = strchr(buf, '=')) != 0)
+        {
+            *eq = 0;
+            if (inet_aton(eq + 1, &addr) == 0)
+            {
+                fprintf(stderr, "Bad address %s for %s\n", eq + 1, buf);
+                return -1;
+            }
+            out[n].ip = addr.s_addr;
+        }
+        strncpy(out[n].dev, buf, sr_IFACE_NAMELEN - 1);
+        n++;
+
+        p += len;
+        if (*p == ',')
+        { p++; }
+    }
+
+    return n;
+} /* -- sr_parse_ifspec -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_local_mac(..)
+ * Scope: Global
+ *
+ * Derive a locally administered MAC (02:53:ip) for interfaces the router
+ * owns itself (i.e. that the kernel or controller does not assign).
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_local_mac(uint32_t ip, unsigned char* mac)
+{
+    mac[0] = 0x02;
+    mac[1] = 0x53;
+    memcpy(mac + 2, &ip, 4);
+} /* -- sr_local_mac -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_ifspec_resolve(..)
+ * Scope: Global
+ *
+ * For backends attaching to kernel devices: look up the ifindex and MAC of
+ * spec->dev, fill in spec->ip from the kernel if it was not given on the
+ * command line and make sure the link is up.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_ifspec_resolve(struct sr_ifspec* spec, int* ifindex, unsigned char* mac)
+{
+#ifdef _LINUX_
+    struct ifreq ifr;
+    int fd;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    {
+        perror("socket(..):sr_backend.c::sr_ifspec_resolve");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, spec->dev, IFNAMSIZ - 1);
+
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        fprintf(stderr, "No such interface %s\n", spec->dev);
+        goto fail;
+    }
+    *ifindex = ifr.ifr_ifindex;
+
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0)
+    {
+        perror("ioctl(SIOCGIFHWADDR):sr_backend.c::sr_ifspec_resolve");
+        goto fail;
+    }
+    memcpy(mac, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+
+    if (spec->ip == 0)
+    {
+        if (ioctl(fd, SIOCGIFADDR, &ifr) < 0)
+        {
+            fprintf(stderr, "Interface %s has no IPv4 address, use %s=a.b.c.d\n",
+                    spec->dev, spec->dev);
+            goto fail;
+        }
+        spec->ip = ((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr.s_addr;
+    }
+
+    if (ioctl(fd, SIOCGIFFLAGS, &ifr) == 0 && !(ifr.ifr_flags & IFF_UP))
+    {
+        ifr.ifr_flags |= IFF_UP;
+        ioctl(fd, SIOCSIFFLAGS, &ifr);
+    }
+
+    close(fd);
+    return 0;
+
+fail:
+    close(fd);
+    return -1;
+#else
+    fprintf(stderr, "Attaching to kernel interfaces needs Linux\n");
+    return -1;
+#endif /* _LINUX_ */
+} /* -- sr_ifspec_resolve -- */
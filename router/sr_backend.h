@@ -0,0 +1,142 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_backend.h
+ *
+ * Description:
+ *
+ * Packet I/O backend interface.  A backend attaches the router to some
+ * packet source/sink (the VNS server, local tap devices, AF_PACKET or
+ * AF_XDP sockets, a local controller over shared memory, ...), populates
+ * the interface list and moves frames in bursts.  sr_handlepacket(..) and
+ * sr_send_packet(..) are backend agnostic; everything below them goes
+ * through the ops table hanging off the sr_instance.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_BACKEND_H
+#define SR_BACKEND_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+
+#define SR_RX_BURST   256  /* max frames handed up per rx_burst call */
+#define SR_MAX_IFSPEC 16   /* max devices on the -i command line option */
+
+struct sr_instance;
+struct sr_pkt;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_frame
+ *
+ * One ethernet frame moving between a backend and the router.  buf is
+ * owned by the backend; on receive it stays valid until rx_release is
+ * called for the burst.  ifindex is the router's interface index (see
+ * sr_if.h); backends map it to their own devices.  headroom is how many
+ * bytes in front of buf may be overwritten, so headers can be prepended
+ * in place (see sr_pkt.h).
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_frame
+{
+    uint8_t*     buf;
+    unsigned int len;
+    int          ifindex;
+    unsigned int headroom;
+    void*        priv;   /* backend private (e.g. buffer to recycle) */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_backend_config
+ *
+ * Command line settings a backend may need to attach.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_backend_config
+{
+    const char*    server;  /* vns: controller host */
+    unsigned short port;    /* vns: controller port */
+    const char*    ifspec;  /* local backends: dev[=ip],dev[=ip],... */
+    const char*    shm_name;/* shm: segment under /dev/shm */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_backend
+ *
+ * Backend operations.  All return negative values on error.
+ *
+ *  open       attach to the packet source (connect, open devices)
+ *  discover   populate sr->if_list
+ *  rx_burst   block until at least one event, fill up to max frames and
+ *             return how many (0 if only control traffic was handled)
+ *  rx_release give back the frames from the last rx_burst
+ *  tx_burst   transmit n frames, return how many were sent
+ *  close      detach and free backend state
+ *  hold       optional: keep a received frame past rx_release (ARP queue),
+ *             return buf or 0 if the backend cannot (it is copied then)
+ *  unhold     optional: drop a hold, return 0 or -1 if buf is not the
+ *             backend's
+ *  tx_flush   optional: push out frames tx_burst queued instead of sending
+ *             (called after each rx burst and after sends outside one)
+ *  rx_ready   optional: without blocking, return nonzero if rx_burst has
+ *             something to hand out; needed for busy polling (-B)
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_backend
+{
+    const char* name;
+    int  (*open)(struct sr_instance* sr, const struct sr_backend_config* cfg);
+    int  (*discover)(struct sr_instance* sr);
+    int  (*rx_burst)(struct sr_instance* sr, struct sr_frame* frames, int max);
+    void (*rx_release)(struct sr_instance* sr, struct sr_frame* frames, int n);
+    int  (*tx_burst)(struct sr_instance* sr, const struct sr_frame* frames, int n);
+    void (*close)(struct sr_instance* sr);
+    uint8_t* (*hold)(struct sr_instance* sr, uint8_t* buf, unsigned int len);
+    int  (*unhold)(struct sr_instance* sr, uint8_t* buf);
+    int  (*tx_flush)(struct sr_instance* sr);
+    int  (*rx_ready)(struct sr_instance* sr);
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ifspec
+ *
+ * One parsed entry of the -i option.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ifspec
+{
+    char     dev[sr_IFACE_NAMELEN];
+    uint32_t ip;       /* network byte order, 0 if not given */
+};
+
+extern const struct sr_backend sr_vns_backend;
+extern const struct sr_backend sr_tap_backend;
+extern const struct sr_backend sr_afpacket_backend;
+extern const struct sr_backend sr_xdp_backend;
+extern const struct sr_backend sr_shm_backend;
+
+const struct sr_backend* sr_backend_find(const char* name);
+int  sr_backend_poll(struct sr_instance* sr);
+void sr_backend_close(struct sr_instance* sr);
+void sr_backend_input(struct sr_instance* sr, struct sr_frame* frame);
+void sr_backend_input_burst(struct sr_instance* sr, struct sr_frame* frames,
+                            int n);
+void sr_backend_deliver(struct sr_instance* sr, struct sr_pkt** pkts, int n);
+void sr_backend_burst_begin(void);
+void sr_backend_burst_end(struct sr_instance* sr);
+struct sr_pkt* sr_backend_hold(struct sr_instance* sr, struct sr_pkt* pkt,
+                               struct sr_pkt* pin);
+int  sr_parse_ifspec(const char* spec, struct sr_ifspec* out, int max);
+void sr_local_mac(uint32_t ip, unsigned char* mac);
+int  sr_ifspec_resolve(struct sr_ifspec* spec, int* ifindex, unsigned char* mac);
+
+#endif /* -- SR_BACKEND_H -- */
@@ -0,0 +1,556 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.c
+ *
+ * Description:
+ *
+ * Packet capture ring and writer thread, see sr_capture.h.
+ *
+ * The ring is a bounded queue with a sequence number per slot: a producer
+ * claims slot 'pos' by moving head from pos to pos + 1 with a CAS once
+ * the slot's sequence says it is free (seq == pos), fills it and
+ * publishes it with seq = pos + 1.  The writer consumes in order and
+ * hands the slot back with seq = pos + SR_CAP_SLOTS.  A producer that
+ * finds the slot still holding last lap's capture drops instead.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_dumper.h"
+#include "sr_capture.h"
+#include "sr_filter.h"
+#include "sr_lz4.h"
+#include "sr_mem.h"
+
+struct sr_cap_slot
+{
+    unsigned int seq;
+    unsigned int caplen;
+    unsigned int len;          /* on the wire */
+    short        ifindex;
+    unsigned char dir;
+    uint64_t     ts_ns;        /* CLOCK_REALTIME */
+    uint8_t      data[PACKET_DUMP_SIZE];
+} __attribute__((aligned(64)));
+
+struct sr_cap_index
+{
+    uint64_t offset;           /* of the block's size word in the file */
+    uint64_t first_ns;         /* 0 for the header block */
+    uint64_t last_ns;
+};
+
+struct sr_capture
+{
+    unsigned int head __attribute__((aligned(64)));  /* producers */
+    unsigned int tail __attribute__((aligned(64)));  /* writer */
+    int stop;
+
+    struct sr_cap_slot* slots;
+    struct sr_filter* filter;  /* read only once the writer runs */
+    pthread_t thread;
+
+    /* -- writer side -- */
+    struct sr_capture_config cfg;
+    char fname[256];
+    int rotate;
+    FILE* fp;                  /* 0 if the last open failed */
+    unsigned int seq;          /* number of the current rotated file */
+    unsigned long file_bytes;  /* written to fp so far */
+    uint64_t file_start_ns;
+
+    uint8_t* blk;              /* pcapng records for the next write */
+    unsigned int blk_len;
+    unsigned int blk_recs;
+    uint64_t blk_first_ns;
+    uint64_t blk_last_ns;
+
+    uint8_t* zbuf;             /* -z: block size word + compressed block */
+    uint16_t* ztable;
+    struct sr_cap_index* index;
+    unsigned int nindex;
+    unsigned int index_size;
+
+    int nif;                   /* interfaces as of sr_capture_open(..) */
+    char if_name[SR_MAX_IF][sr_IFACE_NAMELEN];
+    unsigned char if_mac[SR_MAX_IF][ETHER_ADDR_LEN];
+
+    unsigned long captured;
+    unsigned long dropped;
+    unsigned long written;
+    unsigned long flushes;
+    unsigned long files;
+    unsigned long lost;        /* no file to write to, or unknown interface */
+
+    uint64_t z_in;             /* compressor */
+    uint64_t z_out;
+    uint64_t z_ns;
+    unsigned long z_blocks;
+    unsigned long z_stored;    /* blocks that didn't shrink */
+};
+
+static uint64_t sr_capture_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t sr_capture_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sr_capture_write(struct sr_capture* cap, const void* buf, size_t n)
+{
+    if (fwrite(buf, n, 1, cap->fp) == 1)
+    { cap->file_bytes += n; }
+} /* -- sr_capture_write -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_flush_block(..)
+ * Scope: Local
+ *
+ * Write out the staged records, compressed into one LZ4 block with -z
+ * (stored as is if that doesn't make it smaller).
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_capture_flush_block(struct sr_capture* cap)
+{
+    uint64_t t0;
+    int n;
+
+    if (cap->blk_len == 0)
+    { return; }
+
+    if (!cap->cfg.compress)
+    {
+        sr_capture_write(cap, cap->blk, cap->blk_len);
+        cap->blk_len = cap->blk_recs = 0;
+        return;
+    }
+
+    if (cap->nindex == cap->index_size)
+    {
+        cap->index_size = cap->index_size ? cap->index_size * 2 : 256;
+        cap->index = (struct sr_cap_index*)sr_mem_realloc(SR_MEM_CAPTURE,
+                     cap->index, cap->index_size * sizeof(struct sr_cap_index));
+        assert(cap->index);
+    }
+    cap->index[cap->nindex].offset = cap->file_bytes;
+    cap->index[cap->nindex].first_ns = cap->blk_first_ns;
+    cap->index[cap->nindex].last_ns = cap->blk_last_ns;
+    cap->nindex++;
+
+    t0 = sr_capture_cpu_ns();
+    n = sr_lz4_compress(cap->blk, cap->blk_len, cap->zbuf + 4,
+                        cap->blk_len - 1, cap->ztable);
+    cap->z_ns += sr_capture_cpu_ns() - t0;
+    if (n > 0)
+    { sr_lz4_put32(cap->zbuf, n); }
+    else
+    {
+        sr_lz4_put32(cap->zbuf, cap->blk_len | SR_LZ4_UNCOMPRESSED);
+        memcpy(cap->zbuf + 4, cap->blk, cap->blk_len);
+        n = cap->blk_len;
+        cap->z_stored++;
+    }
+    sr_capture_write(cap, cap->zbuf, n + 4);
+
+    cap->z_in += cap->blk_len;
+    cap->z_out += n + 4;
+    cap->z_blocks++;
+    cap->blk_len = cap->blk_recs = 0;
+} /* -- sr_capture_flush_block -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_end_file(..)
+ * Scope: Local
+ *
+ * With -z, end the LZ4 frame and append the block index as a skippable
+ * frame, see sr_capture.h.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_capture_end_file(struct sr_capture* cap)
+{
+    uint8_t w[8];
+    unsigned int i;
+
+    if (!cap->fp)
+    { return; }
+
+    sr_capture_flush_block(cap);
+
+    if (cap->cfg.compress)
+    {
+        sr_lz4_put32(w, 0);                         /* end mark */
+        sr_capture_write(cap, w, 4);
+
+        sr_lz4_put32(w, SR_CAP_INDEX_MAGIC);
+        sr_lz4_put32(w + 4, cap->nindex * 24 + 8);
+        sr_capture_write(cap, w, 8);
+        for (i = 0; i < cap->nindex; i++)
+        {
+            uint8_t e[24];
+
+            sr_lz4_put32(e,      cap->index[i].offset);
+            sr_lz4_put32(e + 4,  cap->index[i].offset >> 32);
+            sr_lz4_put32(e + 8,  cap->index[i].first_ns);
+            sr_lz4_put32(e + 12, cap->index[i].first_ns >> 32);
+            sr_lz4_put32(e + 16, cap->index[i].last_ns);
+            sr_lz4_put32(e + 20, cap->index[i].last_ns >> 32);
+            sr_capture_write(cap, e, sizeof(e));
+        }
+        sr_lz4_put32(w, cap->nindex);
+        sr_lz4_put32(w + 4, SR_CAP_INDEX_TAG);
+        sr_capture_write(cap, w, 8);
+        cap->nindex = 0;
+    }
+
+    if (cap->fp == stdout)
+    { fflush(cap->fp); }
+    else
+    { fclose(cap->fp); }
+    cap->fp = 0;
+} /* -- sr_capture_end_file -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_next_file(..)
+ * Scope: Local
+ *
+ * Close the current file and start the next one with a section header
+ * and one IDB per interface, in a block of their own.  When rotating,
+ * the file max_files back is removed.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_capture_next_file(struct sr_capture* cap)
+{
+    char path[300];
+    int i;
+
+    sr_capture_end_file(cap);
+
+    if (!cap->rotate)
+    {
+        snprintf(path, sizeof(path), "%s", cap->fname);
+        cap->fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    }
+    else
+    {
+        if (cap->files > 0)
+        { cap->seq++; }
+        if (cap->cfg.max_files && cap->seq >= cap->cfg.max_files)
+        {
+            snprintf(path, sizeof(path), "%s.%u", cap->fname,
+                     cap->seq - cap->cfg.max_files);
+            unlink(path);
+        }
+        snprintf(path, sizeof(path), "%s.%u", cap->fname, cap->seq);
+        cap->fp = fopen(path, "w");
+    }
+
+    cap->file_start_ns = sr_capture_clock();
+    cap->file_bytes = 0;
+    cap->blk_len = cap->blk_recs = 0;
+    if (!cap->fp)
+    {
+        /* -- captures are lost until the next rotation point -- */
+        perror("fopen:sr_capture.c::sr_capture_next_file");
+        return -1;
+    }
+    cap->files++;
+
+    if (cap->cfg.compress)
+    {
+        uint8_t hdr[SR_LZ4_FRAME_HDR];
+
+        sr_capture_write(cap, hdr, sr_lz4_frame_header(hdr));
+    }
+
+    cap->blk_first_ns = cap->blk_last_ns = 0;
+    cap->blk_len = sr_pcapng_put_shb(cap->blk);
+    for (i = 0; i < cap->nif; i++)
+    {
+        cap->blk_len += sr_pcapng_put_idb(cap->blk + cap->blk_len,
+                                          cap->if_name[i], cap->if_mac[i],
+                                          PACKET_DUMP_SIZE);
+    }
+    sr_capture_flush_block(cap);
+
+    return 0;
+} /* -- sr_capture_next_file -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_drain(..)
+ * Scope: Local
+ *
+ * Stage every published slot, returns how many.  Records never straddle
+ * a block.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned long sr_capture_drain(struct sr_capture* cap)
+{
+    unsigned long n = 0;
+
+    while (1)
+    {
+        struct sr_cap_slot* s = &cap->slots[cap->tail & (SR_CAP_SLOTS - 1)];
+
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != cap->tail + 1)
+        { break; }
+
+        if (cap->rotate &&
+                ((cap->cfg.rotate_bytes && cap->file_bytes >= cap->cfg.rotate_bytes) ||
+                 (cap->cfg.rotate_secs && s->ts_ns >= cap->file_start_ns +
+                  cap->cfg.rotate_secs * 1000000000ull)))
+        { sr_capture_next_file(cap); }
+
+        if (cap->fp && s->ifindex >= 0 && s->ifindex < cap->nif)
+        {
+            if (cap->blk_len + PCAPNG_EPB_MAX(s->caplen) > SR_CAP_BLOCK)
+            { sr_capture_flush_block(cap); }
+            if (cap->blk_recs++ == 0)
+            { cap->blk_first_ns = s->ts_ns; }
+            cap->blk_last_ns = s->ts_ns;
+            cap->blk_len +=
+                sr_pcapng_put_epb(cap->blk + cap->blk_len, s->ifindex, s->ts_ns,
+                                  s->caplen, s->len, s->dir == SR_CAP_RX ?
+                                  PCAPNG_EPB_INBOUND : PCAPNG_EPB_OUTBOUND,
+                                  s->data);
+        }
+        else
+        {
+            cap->lost++;
+            if (!cap->fp)
+            { cap->file_bytes += s->caplen; }
+        }
+
+        __atomic_store_n(&s->seq, cap->tail + SR_CAP_SLOTS, __ATOMIC_RELEASE);
+        cap->tail++;
+        n++;
+    }
+
+    return n;
+} /* -- sr_capture_drain -- */
+
+static void* sr_capture_main(void* arg)
+{
+    struct sr_capture* cap = (struct sr_capture*)arg;
+    struct timespec idle;
+    int dirty = 0;
+
+    idle.tv_sec = 0;
+    idle.tv_nsec = SR_CAP_IDLE_US * 1000;
+
+    while (1)
+    {
+        unsigned long n = sr_capture_drain(cap);
+
+        if (n > 0)
+        {
+            cap->written += n;
+            dirty = 1;
+            continue;
+        }
+
+        /* -- caught up: write out what is staged, compressed blocks only
+              once they are full or SR_CAP_FLUSH_MS old -- */
+        if (dirty && cap->fp &&
+                (!cap->cfg.compress || cap->blk_recs == 0 ||
+                 sr_capture_clock() - cap->blk_first_ns >=
+                 SR_CAP_FLUSH_MS * 1000000ull))
+        {
+            sr_capture_flush_block(cap);
+            fflush(cap->fp);
+            cap->flushes++;
+            dirty = 0;
+        }
+
+        if (__atomic_load_n(&cap->stop, __ATOMIC_ACQUIRE))
+        {
+            /* -- one more pass for captures racing with the stop -- */
+            if ((n = sr_capture_drain(cap)) == 0)
+            { break; }
+            cap->written += n;
+            dirty = 1;
+            continue;
+        }
+        nanosleep(&idle, 0);
+    }
+
+    return 0;
+} /* -- sr_capture_main -- */
+
+static void sr_capture_free(struct sr_capture* cap)
+{
+    sr_capture_end_file(cap);
+    sr_mem_free(cap->slots);
+    sr_mem_free(cap->blk);
+    sr_mem_free(cap->zbuf);
+    sr_mem_free(cap->ztable);
+    sr_mem_free(cap->index);
+    sr_filter_free(cap->filter);
+    sr_mem_free(cap);
+} /* -- sr_capture_free -- */
+
+struct sr_capture* sr_capture_open(struct sr_instance* sr,
+                                   const struct sr_capture_config* cfg)
+{
+    struct sr_capture* cap;
+    unsigned int i;
+
+    cap = (struct sr_capture*)sr_mem_calloc(SR_MEM_CAPTURE, 1,
+                                            sizeof(struct sr_capture));
+    assert(cap);
+
+    cap->cfg = *cfg;
+    snprintf(cap->fname, sizeof(cap->fname), "%s", cfg->fname);
+    cap->cfg.fname = cap->fname;
+    cap->filter = cfg->filter;
+    cap->rotate = (cfg->rotate_bytes || cfg->rotate_secs) &&
+                  strcmp(cfg->fname, "-") != 0;
+
+    for (i = 0; i < SR_MAX_IF && i < (unsigned int)sr->nif; i++)
+    {
+        struct sr_if* iface = sr_get_interface_idx(sr, i);
+
+        if (iface)
+        {
+            strncpy(cap->if_name[i], iface->name, sr_IFACE_NAMELEN - 1);
+            memcpy(cap->if_mac[i], iface->addr, ETHER_ADDR_LEN);
+        }
+        cap->nif = i + 1;
+    }
+
+    cap->blk = (uint8_t*)sr_mem_malloc(SR_MEM_CAPTURE, SR_CAP_BLOCK);
+    assert(cap->blk);
+    if (cfg->compress)
+    {
+        cap->zbuf = (uint8_t*)sr_mem_malloc(SR_MEM_CAPTURE, 4 + SR_CAP_BLOCK);
+        cap->ztable = (uint16_t*)sr_mem_malloc(SR_MEM_CAPTURE,
+                      SR_LZ4_HASH_SIZE * sizeof(uint16_t));
+        assert(cap->zbuf && cap->ztable);
+    }
+
+    if (sr_capture_next_file(cap) != 0)
+    {
+        sr_capture_free(cap);
+        return 0;
+    }
+
+    if ((cap->slots = (struct sr_cap_slot*)sr_mem_memalign(SR_MEM_CAPTURE, 64,
+                       SR_CAP_SLOTS * sizeof(struct sr_cap_slot))) == 0)
+    {
+        fprintf(stderr, "sr_capture_open: can't allocate the capture ring\n");
+        sr_capture_free(cap);
+        return 0;
+    }
+    for (i = 0; i < SR_CAP_SLOTS; i++)
+    { cap->slots[i].seq = i; }
+
+    if ((errno = pthread_create(&cap->thread, 0, sr_capture_main, cap)) != 0)
+    {
+        perror("pthread_create:sr_capture.c::sr_capture_open");
+        sr_capture_free(cap);
+        return 0;
+    }
+
+    return cap;
+} /* -- sr_capture_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_packet(..)
+ * Scope: Global
+ *
+ * Called from any packet thread.  The filter runs on the caller's
+ * buffer, a slot is only claimed for frames it keeps.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf,
+                       unsigned int len, int ifindex, int dir)
+{
+    struct sr_cap_slot* s;
+    unsigned int snap = PACKET_DUMP_SIZE;
+    unsigned int pos;
+
+    if (cap->filter &&
+            (snap = sr_filter_match(cap->filter, buf, len, ifindex, dir)) == 0)
+    { return; }
+
+    pos = __atomic_load_n(&cap->head, __ATOMIC_RELAXED);
+    while (1)
+    {
+        int diff;
+
+        s = &cap->slots[pos & (SR_CAP_SLOTS - 1)];
+        diff = (int)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&cap->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            { break; }
+        }
+        else if (diff < 0)
+        {
+            /* -- writer a full lap behind -- */
+            __atomic_add_fetch(&cap->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        { pos = __atomic_load_n(&cap->head, __ATOMIC_RELAXED); }
+    }
+
+    s->ts_ns   = sr_capture_clock();
+    s->len     = len;
+    s->caplen  = min(len, min(snap, PACKET_DUMP_SIZE));
+    s->ifindex = ifindex;
+    s->dir     = dir;
+    memcpy(s->data, buf, s->caplen);
+
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&cap->captured, 1, __ATOMIC_RELAXED);
+} /* -- sr_capture_packet -- */
+
+void sr_capture_close(struct sr_capture* cap)
+{
+    if (!cap)
+    { return; }
+
+    __atomic_store_n(&cap->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(cap->thread, 0);
+    sr_capture_end_file(cap);
+
+    fprintf(stderr, "capture: %lu frames captured, %lu written in %lu flushes "
+            "to %lu file(s), %lu dropped (ring full), %lu lost\n", cap->captured,
+            cap->written - cap->lost, cap->flushes, cap->files, cap->dropped,
+            cap->lost);
+    if (cap->cfg.compress && cap->z_in > 0)
+    {
+        fprintf(stderr, "capture: lz4 %lu blocks (%lu stored), %.1f MB -> %.1f MB "
+                "(%.2fx), %.0f MB/s\n", cap->z_blocks, cap->z_stored,
+                cap->z_in / 1e6, cap->z_out / 1e6,
+                (double)cap->z_in / cap->z_out,
+                cap->z_ns ? cap->z_in * 1e3 / cap->z_ns : 0.0);
+    }
+
+    sr_capture_free(cap);
+} /* -- sr_capture_close -- */
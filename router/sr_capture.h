@@ -0,0 +1,91 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.h
+ *
+ * Description:
+ *
+ * Packet capture for -l logfile.  Packet threads copy each frame (up to
+ * PACKET_DUMP_SIZE bytes) into a slot of a lock-free multi-producer ring
+ * and go on; a writer thread drains the ring into the dump file in blocks
+ * of up to SR_CAP_BLOCK bytes, so the file sees a few big writes instead
+ * of two fwrite(..)s and an fflush(..) per frame.  If the writer falls behind
+ * the ring fills up and captures are dropped and counted -- forwarding
+ * never waits on the disk.
+ *
+ * Files are pcapng: one Interface Description Block per router interface
+ * (the IDB number is the interface index), nanosecond timestamps and the
+ * direction in each packet's epb_flags.  With a size (-C) or age (-G)
+ * limit the capture rotates through logfile.0, logfile.1, ... keeping at
+ * most max_files of them (-W) so it can be left on.
+ *
+ * With -z every block is LZ4 compressed (see sr_lz4.h) on the writer
+ * thread and the file is one LZ4 frame, readable with `lz4 -d`:
+ *
+ *   frame header, block 0 (section header and IDBs), record blocks ...,
+ *   end mark, index
+ *
+ * No record straddles a block and blocks are independent, so a reader
+ * can decompress block 0 and just the blocks of a time range and get a
+ * valid pcapng file.  The index is a skippable frame
+ *
+ *   SR_CAP_INDEX_MAGIC, size, n x { offset, first ns, last ns },
+ *   n, SR_CAP_INDEX_TAG
+ *
+ * all little endian (u32, u32, n x 3 u64, u32, u32), where offset is
+ * that of the block's size word and block 0 has 0 timestamps; a reader
+ * finds it from the last 8 bytes.  sr_capx extracts ranges this way.
+ *
+ * A filter (-F, -n, see sr_filter.h) is checked before a slot is taken,
+ * so frames it rejects cost a few compares and no copy.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPTURE_H
+#define SR_CAPTURE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_CAP_SLOTS     4096     /* ring size, power of 2 */
+#define SR_CAP_BLOCK     65536    /* staged per write, <= SR_LZ4_BLOCK_MAX */
+#define SR_CAP_FLUSH_MS  1000     /* -z: longest a partial block waits */
+#define SR_CAP_IDLE_US   1000     /* writer sleep when the ring is empty */
+
+#define SR_CAP_INDEX_MAGIC  0x184D2A5E  /* LZ4 skippable frame */
+#define SR_CAP_INDEX_TAG    0x58435253  /* "SRCX" */
+
+#define SR_CAP_RX  0
+#define SR_CAP_TX  1
+
+struct sr_instance;
+struct sr_capture;
+struct sr_filter;
+
+struct sr_capture_config
+{
+    const char*   fname;         /* "-" for stdout, never rotated */
+    unsigned long rotate_bytes;  /* 0: no size limit */
+    unsigned int  rotate_secs;   /* 0: no age limit */
+    unsigned int  max_files;     /* rotated files kept, 0: all */
+    int           compress;      /* LZ4 frame with a block index */
+    struct sr_filter* filter;    /* 0: everything, owned by the capture */
+};
+
+/* Open the first file and start the writer thread, or return 0.  The
+   router's interfaces must be known by now, they go into every file. */
+struct sr_capture* sr_capture_open(struct sr_instance* sr,
+                                   const struct sr_capture_config* cfg);
+
+/* Queue a copy of the frame if the filter takes it; never blocks.
+   ifindex is the router's interface, dir SR_CAP_RX or SR_CAP_TX. */
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf,
+                       unsigned int len, int ifindex, int dir);
+
+/* Drain the ring, stop the writer, close the file and print counters. */
+void sr_capture_close(struct sr_capture* cap);
+
+#endif /* -- SR_CAPTURE_H -- */
@@ -0,0 +1,259 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capx.c
+ *
+ * Description:
+ *
+ * Pull a time range out of a compressed capture (sr -z) without
+ * decompressing all of it:
+ *
+ *   sr_capx [-l] file [from [to]]
+ *
+ * from and to are seconds since the epoch (fractions allowed) and default
+ * to the whole file.  The matching records go to stdout as pcapng; only
+ * block 0 and the blocks whose time span overlaps the range are read,
+ * found through the index at the end of the file (see sr_capture.h).
+ * -l lists the index instead.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sr_lz4.h"
+#include "sr_dumper.h"
+#include "sr_capture.h"
+
+struct sr_capx_entry
+{
+    uint64_t offset;
+    uint64_t first_ns;
+    uint64_t last_ns;
+};
+
+static uint64_t sr_capx_get64(const uint8_t* p)
+{
+    return sr_lz4_get32(p) | (uint64_t)sr_lz4_get32(p + 4) << 32;
+} /* -- sr_capx_get64 -- */
+
+/* -- "SEC[.FRAC]" to ns, without going through a double -- */
+static int sr_capx_time(const char* s, uint64_t* ns)
+{
+    char* end;
+    uint64_t sec = strtoull(s, &end, 10);
+    uint64_t frac = 0, scale = 1000000000ull;
+
+    if (end == s)
+    { return -1; }
+    if (*end == '.')
+    {
+        for (end++; *end >= '0' && *end <= '9'; end++)
+        {
+            if (scale > 1)
+            {
+                scale /= 10;
+                frac += (*end - '0') * scale;
+            }
+        }
+    }
+    if (*end != 0)
+    { return -1; }
+    *ns = sec * 1000000000ull + frac;
+    return 0;
+} /* -- sr_capx_time -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capx_read_index(..)
+ * Scope: Local
+ *
+ * Returns the entry count and a malloc'd array in *idx, -1 if the file
+ * has no index (not -z, or the writer didn't get to close it).
+ *
+ *---------------------------------------------------------------------*/
+
+static long sr_capx_read_index(FILE* fp, struct sr_capx_entry** idx)
+{
+    uint8_t w[8];
+    uint8_t* raw;
+    long size, n, i;
+
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 16 ||
+            fseek(fp, size - 8, SEEK_SET) != 0 || fread(w, 8, 1, fp) != 1 ||
+            sr_lz4_get32(w + 4) != SR_CAP_INDEX_TAG)
+    { return -1; }
+
+    n = sr_lz4_get32(w);
+    if (n <= 0 || n > (size - 16) / 24 ||
+            fseek(fp, size - 16 - n * 24, SEEK_SET) != 0 ||
+            fread(w, 8, 1, fp) != 1 ||
+            sr_lz4_get32(w) != SR_CAP_INDEX_MAGIC ||
+            sr_lz4_get32(w + 4) != (uint32_t)(n * 24 + 8))
+    { return -1; }
+
+    raw = (uint8_t*)malloc(n * 24);
+    *idx = (struct sr_capx_entry*)malloc(n * sizeof(struct sr_capx_entry));
+    if (!raw || !*idx || fread(raw, 24, n, fp) != (size_t)n)
+    {
+        free(raw);
+        free(*idx);
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        (*idx)[i].offset   = sr_capx_get64(raw + i * 24);
+        (*idx)[i].first_ns = sr_capx_get64(raw + i * 24 + 8);
+        (*idx)[i].last_ns  = sr_capx_get64(raw + i * 24 + 16);
+    }
+    free(raw);
+    return n;
+} /* -- sr_capx_read_index -- */
+
+/* -- decompressed size of the block at offset, -1 on error -- */
+static int sr_capx_read_block(FILE* fp, uint64_t offset, uint8_t* zbuf,
+                              uint8_t* out)
+{
+    uint8_t w[4];
+    uint32_t bsize, n;
+
+    if (fseek(fp, offset, SEEK_SET) != 0 || fread(w, 4, 1, fp) != 1)
+    { return -1; }
+    bsize = sr_lz4_get32(w);
+    n = bsize & ~SR_LZ4_UNCOMPRESSED;
+    if (n == 0 || n > SR_LZ4_BLOCK_MAX)
+    { return -1; }
+    if (bsize & SR_LZ4_UNCOMPRESSED)
+    { return fread(out, n, 1, fp) == 1 ? (int)n : -1; }
+    if (fread(zbuf, n, 1, fp) != 1)
+    { return -1; }
+    return sr_lz4_decompress(zbuf, n, out, SR_LZ4_BLOCK_MAX);
+} /* -- sr_capx_read_block -- */
+
+static void usage(char* argv0)
+{
+    fprintf(stderr, "usage: %s [-l] file [from [to]]\n", argv0);
+    fprintf(stderr, "   from, to: seconds since the epoch\n");
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    FILE* fp;
+    struct sr_capx_entry* idx;
+    uint8_t hdr[SR_LZ4_FRAME_HDR];
+    uint8_t* zbuf;
+    uint8_t* blk;
+    uint64_t from = 0, to = ~0ull;
+    unsigned long blocks = 0, records = 0;
+    long n, i;
+    int c, list = 0;
+
+    while ((c = getopt(argc, argv, "hl")) != EOF)
+    {
+        switch (c)
+        {
+            case 'l':
+                list = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc || argc - optind > 3 ||
+            (argc - optind > 1 && sr_capx_time(argv[optind + 1], &from) != 0) ||
+            (argc - optind > 2 && sr_capx_time(argv[optind + 2], &to) != 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ((fp = fopen(argv[optind], "rb")) == 0)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (fread(hdr, sizeof(hdr), 1, fp) != 1 ||
+            sr_lz4_get32(hdr) != SR_LZ4_MAGIC || hdr[4] != 0x60)
+    {
+        fprintf(stderr, "%s: not a compressed capture\n", argv[optind]);
+        return 1;
+    }
+    if ((n = sr_capx_read_index(fp, &idx)) < 0)
+    {
+        fprintf(stderr, "%s: no block index, use lz4 -d\n", argv[optind]);
+        return 1;
+    }
+
+    if (list)
+    {
+        for (i = 0; i < n; i++)
+        {
+            printf("%6ld %12llu %llu.%09llu %llu.%09llu\n", i,
+                   (unsigned long long)idx[i].offset,
+                   (unsigned long long)(idx[i].first_ns / 1000000000ull),
+                   (unsigned long long)(idx[i].first_ns % 1000000000ull),
+                   (unsigned long long)(idx[i].last_ns / 1000000000ull),
+                   (unsigned long long)(idx[i].last_ns % 1000000000ull));
+        }
+        return 0;
+    }
+
+    zbuf = (uint8_t*)malloc(SR_LZ4_BLOCK_MAX);
+    blk = (uint8_t*)malloc(SR_LZ4_BLOCK_MAX);
+    if (!zbuf || !blk)
+    { return 1; }
+
+    for (i = 0; i < n; i++)
+    {
+        int len, off;
+
+        /* -- block 0 is the section header, always wanted -- */
+        if (i > 0 && (idx[i].last_ns < from || idx[i].first_ns > to))
+        { continue; }
+        if ((len = sr_capx_read_block(fp, idx[i].offset, zbuf, blk)) < 0)
+        {
+            fprintf(stderr, "%s: bad block at %llu\n", argv[optind],
+                    (unsigned long long)idx[i].offset);
+            return 1;
+        }
+        blocks++;
+
+        for (off = 0; off + 12 <= len; )
+        {
+            uint32_t type, total;
+            uint64_t ts;
+
+            memcpy(&type, blk + off, 4);
+            memcpy(&total, blk + off + 4, 4);
+            if (total < 12 || total > (uint32_t)(len - off))
+            {
+                fprintf(stderr, "%s: bad record in block at %llu\n",
+                        argv[optind], (unsigned long long)idx[i].offset);
+                return 1;
+            }
+            if (type == PCAPNG_BT_EPB && total >= 20)
+            {
+                uint32_t hi, lo;
+
+                memcpy(&hi, blk + off + 12, 4);
+                memcpy(&lo, blk + off + 16, 4);
+                ts = (uint64_t)hi << 32 | lo;
+                if (ts < from || ts > to)
+                {
+                    off += total;
+                    continue;
+                }
+                records++;
+            }
+            fwrite(blk + off, total, 1, stdout);
+            off += total;
+        }
+    }
+
+    fprintf(stderr, "%lu records from %lu of %ld blocks\n", records, blocks, n);
+    fclose(fp);
+    free(idx);
+    free(zbuf);
+    free(blk);
+    return 0;
+} /* -- main -- */
@@ -0,0 +1,293 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_check.c
+ *
+ * Description:
+ *
+ * 'make check': the allocation check (see sr_pool.h) without a server.
+ *
+ *   eth1 192.168.2.1 --- A 192.168.2.2      eth2 172.64.3.1 --- B 172.64.3.10
+ *
+ * Builds a router with the two interfaces above, a host route to each
+ * neighbour and a backend that only counts what it is asked to send.
+ * One warm-up pass of the mix (a UDP datagram B -> A, ARP replies from A
+ * and B, a ping from B to eth2, an ARP request from A for eth1 and a
+ * datagram from B with TTL 1) goes through sr_handlepacket(..) and then
+ * through sr_backend_input_burst(..); it fills the ARP cache, the pools
+ * and the per-thread caches.  The same mix is then replayed with the
+ * check armed and must neither touch the heap nor lose a packet: each
+ * pass sends the datagram on, answers the ping and the ARP request and
+ * sends B a time exceeded.  Exits nonzero if either fails.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_protocol.h"
+#include "sr_arpcache.h"
+#include "sr_backend.h"
+#include "sr_utils.h"
+#include "sr_pool.h"
+#include "sr_pkt.h"
+#include "sr_mem.h"
+
+#define SR_CHECK_ROUNDS   64   /* replays of the mix */
+#define SR_CHECK_PAYLOAD  32   /* bytes after the UDP / ICMP header */
+#define SR_CHECK_FRAME    (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + \
+                           8 + SR_CHECK_PAYLOAD)
+
+enum sr_check_kind
+{
+    SR_CHECK_FORWARD,
+    SR_CHECK_ARP_A,
+    SR_CHECK_ARP_B,
+    SR_CHECK_ECHO,
+    SR_CHECK_ARP_REQ,
+    SR_CHECK_TTL1,
+    SR_CHECK_MIX
+};
+
+struct sr_check_frame
+{
+    uint8_t      buf[SR_PKT_HEADROOM + SR_CHECK_FRAME];
+    unsigned int len;
+    int          ifindex;
+};
+
+/* -- sr_main.c's, the router code reads it -- */
+volatile sig_atomic_t sr_stop_requested = 0;
+
+static const uint8_t sr_check_eth1[ETHER_ADDR_LEN] = { 0, 0, 0, 0, 1, 1 };
+static const uint8_t sr_check_eth2[ETHER_ADDR_LEN] = { 0, 0, 0, 0, 2, 2 };
+static const uint8_t sr_check_mac_a[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 0xa };
+static const uint8_t sr_check_mac_b[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 0xb };
+
+static unsigned long sr_check_sent;
+
+/*---------------------------------------------------------------------
+ * Stub backend
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_check_tx_burst(struct sr_instance* sr,
+                             const struct sr_frame* frames, int n)
+{
+    __atomic_add_fetch(&sr_check_sent, n, __ATOMIC_RELAXED);
+    return n;
+} /* -- sr_check_tx_burst -- */
+
+static const struct sr_backend sr_check_backend =
+{
+    "check",
+    0,                    /* open */
+    0,                    /* discover */
+    0,                    /* rx_burst */
+    0,                    /* rx_release */
+    sr_check_tx_burst,
+    0,                    /* close */
+    0,                    /* hold */
+    0,                    /* unhold */
+    0,                    /* tx_flush */
+    0                     /* rx_ready */
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_check_build(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_check_build(struct sr_check_frame* f, enum sr_check_kind kind)
+{
+    uint8_t* p = f->buf + SR_PKT_HEADROOM;
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)p;
+    sr_arp_hdr_t* arp = (sr_arp_hdr_t*)(p + sizeof(*eth));
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(p + sizeof(*eth));
+    uint8_t* l4 = p + sizeof(*eth) + sizeof(*ip);
+
+    memset(f, 0, sizeof(*f));
+
+    if (kind == SR_CHECK_ARP_A || kind == SR_CHECK_ARP_B ||
+        kind == SR_CHECK_ARP_REQ)
+    {
+        int a = kind != SR_CHECK_ARP_B;
+        int req = kind == SR_CHECK_ARP_REQ;
+
+        f->ifindex = a ? 0 : 1;
+        f->len = sizeof(*eth) + sizeof(*arp);
+        if (req)
+        { memset(eth->ether_dhost, 0xff, ETHER_ADDR_LEN); }
+        else
+        {
+            memcpy(eth->ether_dhost, a ? sr_check_eth1 : sr_check_eth2,
+                   ETHER_ADDR_LEN);
+            memcpy(arp->ar_tha, eth->ether_dhost, ETHER_ADDR_LEN);
+        }
+        memcpy(eth->ether_shost, a ? sr_check_mac_a : sr_check_mac_b,
+               ETHER_ADDR_LEN);
+        eth->ether_type = htons(ethertype_arp);
+        arp->ar_hrd = htons(arp_hrd_ethernet);
+        arp->ar_pro = htons(ethertype_ip);
+        arp->ar_hln = ETHER_ADDR_LEN;
+        arp->ar_pln = 4;
+        arp->ar_op = htons(req ? arp_op_request : arp_op_reply);
+        memcpy(arp->ar_sha, eth->ether_shost, ETHER_ADDR_LEN);
+        arp->ar_sip = inet_addr(a ? "192.168.2.2" : "172.64.3.10");
+        arp->ar_tip = inet_addr(a ? "192.168.2.1" : "172.64.3.1");
+        return;
+    }
+
+    /* -- the IP ones all come from B on eth2 -- */
+    f->ifindex = 1;
+    f->len = SR_CHECK_FRAME;
+    memcpy(eth->ether_dhost, sr_check_eth2, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, sr_check_mac_b, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+    ip->ip_v = 4;
+    ip->ip_hl = sizeof(*ip) / 4;
+    ip->ip_len = htons(f->len - sizeof(*eth));
+    ip->ip_ttl = kind == SR_CHECK_TTL1 ? 1 : 64;
+    ip->ip_src = inet_addr("172.64.3.10");
+
+    if (kind == SR_CHECK_FORWARD || kind == SR_CHECK_TTL1)
+    {
+        ip->ip_p = ip_protocol_udp;
+        ip->ip_dst = inet_addr("192.168.2.2");
+        l4[1] = 9;          /* source port 9 */
+        l4[3] = 9;          /* destination port 9 */
+        l4[5] = 8 + SR_CHECK_PAYLOAD;
+    }
+    else
+    {
+        sr_icmp_hdr_t* icmp = (sr_icmp_hdr_t*)l4;
+
+        ip->ip_p = ip_protocol_icmp;
+        ip->ip_dst = inet_addr("172.64.3.1");
+        icmp->icmp_type = 8;
+        icmp->icmp_sum = cksum(icmp, 8 + SR_CHECK_PAYLOAD);
+    }
+    ip->ip_sum = cksum(ip, sizeof(*ip));
+} /* -- sr_check_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_check_pass(..)
+ * Scope: Local
+ *
+ * The mix once through sr_handlepacket(..) and once as a burst.  The
+ * router rewrites frames in place, so each goes out from a fresh copy.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_check_pass(struct sr_instance* sr,
+                          const struct sr_check_frame* mix)
+{
+    static struct sr_check_frame work[SR_CHECK_MIX];
+    struct sr_frame frames[SR_CHECK_MIX];
+    struct sr_pkt pkt;
+    int i;
+
+    for (i = 0; i < SR_CHECK_MIX; i++)
+    {
+        work[i] = mix[i];
+        sr_pkt_wrap(&pkt, work[i].buf + SR_PKT_HEADROOM, work[i].len,
+                    SR_PKT_HEADROOM, work[i].ifindex);
+        sr_handlepacket(sr, &pkt);
+    }
+
+    for (i = 0; i < SR_CHECK_MIX; i++)
+    {
+        work[i] = mix[i];
+        frames[i].buf = work[i].buf + SR_PKT_HEADROOM;
+        frames[i].len = work[i].len;
+        frames[i].ifindex = work[i].ifindex;
+        frames[i].headroom = SR_PKT_HEADROOM;
+        frames[i].priv = 0;
+    }
+    sr_backend_input_burst(sr, frames, SR_CHECK_MIX);
+} /* -- sr_check_pass -- */
+
+static void sr_check_add_if(struct sr_instance* sr, const char* name,
+                            const uint8_t* mac, const char* ip)
+{
+    sr_add_interface(sr, name);
+    sr_set_ether_addr(sr, mac);
+    sr_set_ether_ip(sr, inet_addr(ip));
+} /* -- sr_check_add_if -- */
+
+static void sr_check_add_rt(struct sr_instance* sr, const char* dest,
+                            const char* ifname)
+{
+    struct in_addr d, m;
+
+    d.s_addr = inet_addr(dest);
+    m.s_addr = 0xffffffff;
+    sr_add_rt_entry(sr, d, d, m, (char*)ifname);
+} /* -- sr_check_add_rt -- */
+
+int main(int argc, char** argv)
+{
+    static struct sr_instance sr;
+    struct sr_check_frame mix[SR_CHECK_MIX];
+    unsigned long sent, expect = SR_CHECK_ROUNDS * 2 * 4;
+    int i, rc = 0;
+
+    sr.sockfd = -1;
+    sr_rebuild_local_addrs(&sr);
+    sr.backend = &sr_check_backend;
+    sr.pkt_pool = sr_pool_create("pkt", SR_PKT_BUF_SIZE, 64, 0,
+                                 SR_MEM_PACKET);
+    sr.arpq_pool = sr_pool_create("arpq", sizeof(struct sr_packet), 64, 0,
+                                  SR_MEM_ARP);
+    sr.arpreq_pool = sr_pool_create("arpreq", sizeof(struct sr_arpreq), 16, 0,
+                                    SR_MEM_ARP);
+    if (!sr.pkt_pool || !sr.arpq_pool || !sr.arpreq_pool)
+    {
+        fprintf(stderr, "check: out of memory (packet pools)\n");
+        return 1;
+    }
+
+    sr_check_add_if(&sr, "eth1", sr_check_eth1, "192.168.2.1");
+    sr_check_add_if(&sr, "eth2", sr_check_eth2, "172.64.3.1");
+    sr_check_add_rt(&sr, "192.168.2.2", "eth1");
+    sr_check_add_rt(&sr, "172.64.3.10", "eth2");
+    if (sr_verify_routing_table(&sr) != 0)
+    {
+        fprintf(stderr, "check: routing table not consistent with interfaces\n");
+        return 1;
+    }
+    sr_init(&sr);
+
+    for (i = 0; i < SR_CHECK_MIX; i++)
+    { sr_check_build(&mix[i], (enum sr_check_kind)i); }
+
+    /* -- warm up: resolve A and B, grow the pools, fill the caches -- */
+    sr_check_pass(&sr, mix);
+
+    sent = __atomic_load_n(&sr_check_sent, __ATOMIC_RELAXED);
+    for (i = 0; i < SR_CHECK_ROUNDS; i++)
+    {
+        /* -- sr_backend_input_burst(..) disarms it on its way out -- */
+        sr_alloc_check_begin();
+        sr_check_pass(&sr, mix);
+    }
+    sr_alloc_check_end();
+    sent = __atomic_load_n(&sr_check_sent, __ATOMIC_RELAXED) - sent;
+
+    if (sent != expect)
+    {
+        fprintf(stderr, "check: %lu frames sent, expected %lu\n", sent, expect);
+        rc = 1;
+    }
+    if (sr_alloc_check_report(stderr) != 0)
+    { rc = 1; }
+
+    fprintf(stderr, "check: %d passes of %d frames, %s\n", SR_CHECK_ROUNDS,
+            SR_CHECK_MIX * 2, rc ? "FAILED" : "ok");
+    return rc;
+} /* -- main -- */
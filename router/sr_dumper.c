@@ -2,6 +2,7 @@
 #include <sys/types.h>
 
 #include <stdio.h>
+#include <string.h>
 #include "sr_dumper.h"
 
 static void
@@ -69,3 +70,95 @@ sr_dump_close(FILE *fp)
   fclose(fp);
 }
 
+
+/*
+ * pcapng.  Options are padded to 4 bytes; every block ends with its
+ * total length repeated.
+ */
+static size_t
+pcapng_opt(unsigned char *p, uint16_t code, const void *val, uint16_t len)
+{
+        size_t padded = (len + 3) & ~3u;
+
+        memcpy(p, &code, 2);
+        memcpy(p + 2, &len, 2);
+        memset(p + 4, 0, padded);
+        if (len)
+                memcpy(p + 4, val, len);
+        return 4 + padded;
+}
+
+static size_t
+pcapng_block(unsigned char *blk, uint32_t type, size_t len)
+{
+        uint32_t total = len + 4;
+
+        memcpy(blk, &type, 4);
+        memcpy(blk + 4, &total, 4);
+        memcpy(blk + len, &total, 4);
+        return total;
+}
+
+size_t
+sr_pcapng_put_shb(unsigned char *blk)
+{
+        uint32_t bom = PCAPNG_BOM;
+        uint16_t major = 1, minor = 0;
+        int64_t section_len = -1;     /* unknown */
+        size_t len = 8;
+
+        memcpy(blk + len, &bom, 4);          len += 4;
+        memcpy(blk + len, &major, 2);        len += 2;
+        memcpy(blk + len, &minor, 2);        len += 2;
+        memcpy(blk + len, &section_len, 8);  len += 8;
+        len += pcapng_opt(blk + len, PCAPNG_OPT_END, 0, 0);
+
+        return pcapng_block(blk, PCAPNG_BT_SHB, len);
+}
+
+size_t
+sr_pcapng_put_idb(unsigned char *blk, const char *name,
+                  const unsigned char *mac, int snaplen)
+{
+        uint16_t linktype = LINKTYPE_ETHERNET, reserved = 0;
+        uint32_t snap = snaplen;
+        unsigned char tsresol = 9;    /* 10^-9 s */
+        size_t len = 8, nlen = strlen(name);
+
+        if (nlen > 32)
+                nlen = 32;
+
+        memcpy(blk + len, &linktype, 2);     len += 2;
+        memcpy(blk + len, &reserved, 2);     len += 2;
+        memcpy(blk + len, &snap, 4);         len += 4;
+        len += pcapng_opt(blk + len, PCAPNG_OPT_IF_NAME, name, nlen);
+        if (mac)
+                len += pcapng_opt(blk + len, PCAPNG_OPT_IF_MAC, mac, PCAP_ETHA_LEN);
+        len += pcapng_opt(blk + len, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+        len += pcapng_opt(blk + len, PCAPNG_OPT_END, 0, 0);
+
+        return pcapng_block(blk, PCAPNG_BT_IDB, len);
+}
+
+size_t
+sr_pcapng_put_epb(unsigned char *blk, uint32_t ifid, uint64_t ts_ns,
+                  uint32_t caplen, uint32_t len, uint32_t flags,
+                  const unsigned char *data)
+{
+        uint32_t ts_hi = ts_ns >> 32, ts_lo = ts_ns;
+        uint32_t pad = (4 - (caplen & 3)) & 3;
+        size_t off = 8;
+
+        memcpy(blk + off, &ifid, 4);    off += 4;
+        memcpy(blk + off, &ts_hi, 4);   off += 4;
+        memcpy(blk + off, &ts_lo, 4);   off += 4;
+        memcpy(blk + off, &caplen, 4);  off += 4;
+        memcpy(blk + off, &len, 4);     off += 4;
+        memcpy(blk + off, data, caplen);
+        memset(blk + off + caplen, 0, pad);
+        off += caplen + pad;
+        off += pcapng_opt(blk + off, PCAPNG_OPT_EPB_FLAGS, &flags, 4);
+        off += pcapng_opt(blk + off, PCAPNG_OPT_END, 0, 0);
+
+        return pcapng_block(blk, PCAPNG_BT_EPB, off);
+}
@@ -63,6 +63,40 @@ struct pcap_sf_pkthdr {
     uint32_t len;            /* length this packet (off wire) */
 };
 
+/*
+ * pcapng (https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-02.html)
+ * blocks, in host byte order.  Each function builds one block at blk and
+ * returns its size in bytes; blk needs PCAPNG_SHB_MAX, PCAPNG_IDB_MAX or
+ * PCAPNG_EPB_MAX(caplen) bytes.
+ */
+#define PCAPNG_BT_SHB    0x0A0D0D0A   /* section header */
+#define PCAPNG_BT_IDB    0x00000001   /* interface description */
+#define PCAPNG_BT_EPB    0x00000006   /* enhanced packet */
+#define PCAPNG_BOM       0x1A2B3C4D   /* byte-order magic */
+
+#define PCAPNG_OPT_END        0
+#define PCAPNG_OPT_IF_NAME    2
+#define PCAPNG_OPT_IF_MAC     6
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS  2
+
+#define PCAPNG_EPB_INBOUND    1       /* epb_flags direction bits */
+#define PCAPNG_EPB_OUTBOUND   2
+
+#define PCAPNG_SHB_MAX        32
+#define PCAPNG_IDB_MAX        80
+#define PCAPNG_EPB_MAX(caplen) (28 + (caplen) + 3 + 16)
+
+size_t sr_pcapng_put_shb(unsigned char *blk);
+
+/* Interface with nanosecond timestamps; mac may be 0. */
+size_t sr_pcapng_put_idb(unsigned char *blk, const char *name,
+                         const unsigned char *mac, int snaplen);
+
+size_t sr_pcapng_put_epb(unsigned char *blk, uint32_t ifid, uint64_t ts_ns,
+                         uint32_t caplen, uint32_t len, uint32_t flags,
+                         const unsigned char *data);
+
 /**
  * Open a dump file and initialize the file.
  */
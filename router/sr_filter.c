@@ -0,0 +1,815 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter.c
+ *
+ * Description:
+ *
+ * Capture filter, see sr_filter.h.
+ *
+ * Expressions are compiled one term at a time.  While a term is being
+ * generated its conditional jumps name SR_L_TRUE / SR_L_FALSE instead of
+ * an offset; at the end of the term those become "go on with the next
+ * term" and "reject" (the other way round for "not"), reject being the
+ * final ret #0.  Programs stay short enough that every offset fits the
+ * 8-bit jt / jf fields and the placeholders can't clash with one.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#define __USE_MISC 1 /* force linux to show inet_aton */
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_capture.h"
+#include "sr_filter.h"
+#include "sr_mem.h"
+
+#define SR_FILTER_MAX_INSNS  250   /* compiled programs, < SR_L_REJECT */
+#define SR_FILTER_MAX_TOKENS 64
+
+#define SR_L_REJECT  0xfd   /* placeholders in jt / jf, see above */
+#define SR_L_FALSE   0xfe
+#define SR_L_TRUE    0xff
+
+#define SR_SNAP_ALL  0xffff
+
+struct sr_filter
+{
+    uint32_t ifmask;            /* bit per interface index */
+    unsigned int dirmask;       /* bit per SR_CAP_RX / SR_CAP_TX */
+    unsigned int sample;        /* keep 1 in sample, <= 1 all */
+    unsigned int nprog;         /* 0: no program, accept */
+    struct sr_bpf_insn* prog;
+};
+
+struct sr_filter_gen
+{
+    struct sr_bpf_insn prog[SR_FILTER_MAX_INSNS];
+    unsigned int n;
+    unsigned int term;          /* first instruction of the current term */
+};
+
+/* -- frames sampled out since this thread last kept one -- */
+static __thread unsigned int sr_filter_skip;
+
+#define SR_BPF_LOAD32(p) \
+    ((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 | \
+     (uint32_t)(p)[2] << 8 | (uint32_t)(p)[3])
+#define SR_BPF_LOAD16(p) ((uint32_t)(p)[0] << 8 | (uint32_t)(p)[1])
+
+/*---------------------------------------------------------------------
+ * Method: sr_bpf_run(..)
+ * Scope: Global
+ *
+ * Classic BPF over one frame.  Loads past the end of the frame and
+ * division by zero reject it, as in the kernel.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_bpf_run(const struct sr_bpf_insn* prog, const uint8_t* buf,
+                        unsigned int len)
+{
+    const struct sr_bpf_insn* pc = prog;
+    uint32_t A = 0, X = 0, k;
+    uint32_t mem[SR_BPF_MEMWORDS];
+
+    memset(mem, 0, sizeof(mem));
+
+    for (;; pc++)
+    {
+        switch (pc->code)
+        {
+            case SR_BPF_RET|SR_BPF_K:
+                return pc->k;
+            case SR_BPF_RET|SR_BPF_A:
+                return A;
+
+            case SR_BPF_LD|SR_BPF_W|SR_BPF_ABS:
+                k = pc->k;
+                if (k > len || len - k < 4)
+                { return 0; }
+                A = SR_BPF_LOAD32(buf + k);
+                break;
+            case SR_BPF_LD|SR_BPF_H|SR_BPF_ABS:
+                k = pc->k;
+                if (k > len || len - k < 2)
+                { return 0; }
+                A = SR_BPF_LOAD16(buf + k);
+                break;
+            case SR_BPF_LD|SR_BPF_B|SR_BPF_ABS:
+                k = pc->k;
+                if (k >= len)
+                { return 0; }
+                A = buf[k];
+                break;
+            case SR_BPF_LD|SR_BPF_W|SR_BPF_IND:
+                k = X + pc->k;
+                if (pc->k > len || X > len - pc->k || len - k < 4)
+                { return 0; }
+                A = SR_BPF_LOAD32(buf + k);
+                break;
+            case SR_BPF_LD|SR_BPF_H|SR_BPF_IND:
+                k = X + pc->k;
+                if (pc->k > len || X > len - pc->k || len - k < 2)
+                { return 0; }
+                A = SR_BPF_LOAD16(buf + k);
+                break;
+            case SR_BPF_LD|SR_BPF_B|SR_BPF_IND:
+                k = X + pc->k;
+                if (pc->k >= len || X >= len - pc->k)
+                { return 0; }
+                A = buf[k];
+                break;
+            case SR_BPF_LD|SR_BPF_W|SR_BPF_LEN:
+                A = len;
+                break;
+            case SR_BPF_LDX|SR_BPF_W|SR_BPF_LEN:
+                X = len;
+                break;
+            case SR_BPF_LDX|SR_BPF_B|SR_BPF_MSH:
+                k = pc->k;
+                if (k >= len)
+                { return 0; }
+                X = (buf[k] & 0xf) << 2;
+                break;
+            case SR_BPF_LD|SR_BPF_IMM:
+                A = pc->k;
+                break;
+            case SR_BPF_LDX|SR_BPF_IMM:
+                X = pc->k;
+                break;
+            case SR_BPF_LD|SR_BPF_MEM:
+                A = mem[pc->k];
+                break;
+            case SR_BPF_LDX|SR_BPF_MEM:
+                X = mem[pc->k];
+                break;
+            case SR_BPF_ST:
+                mem[pc->k] = A;
+                break;
+            case SR_BPF_STX:
+                mem[pc->k] = X;
+                break;
+
+            case SR_BPF_JMP|SR_BPF_JA:
+                pc += pc->k;
+                break;
+            case SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K:
+                pc += (A == pc->k) ? pc->jt : pc->jf;
+                break;
+            case SR_BPF_JMP|SR_BPF_JGT|SR_BPF_K:
+                pc += (A > pc->k) ? pc->jt : pc->jf;
+                break;
+            case SR_BPF_JMP|SR_BPF_JGE|SR_BPF_K:
+                pc += (A >= pc->k) ? pc->jt : pc->jf;
+                break;
+            case SR_BPF_JMP|SR_BPF_JSET|SR_BPF_K:
+                pc += (A & pc->k) ? pc->jt : pc->jf;
+                break;
+            case SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_X:
+                pc += (A == X) ? pc->jt : pc->jf;
+                break;
+            case SR_BPF_JMP|SR_BPF_JGT|SR_BPF_X:
+                pc += (A > X) ? pc->jt : pc->jf;
+                break;
+            case SR_BPF_JMP|SR_BPF_JGE|SR_BPF_X:
+                pc += (A >= X) ? pc->jt : pc->jf;
+                break;
+            case SR_BPF_JMP|SR_BPF_JSET|SR_BPF_X:
+                pc += (A & X) ? pc->jt : pc->jf;
+                break;
+
+            case SR_BPF_ALU|SR_BPF_ADD|SR_BPF_X: A += X; break;
+            case SR_BPF_ALU|SR_BPF_SUB|SR_BPF_X: A -= X; break;
+            case SR_BPF_ALU|SR_BPF_MUL|SR_BPF_X: A *= X; break;
+            case SR_BPF_ALU|SR_BPF_DIV|SR_BPF_X:
+                if (X == 0)
+                { return 0; }
+                A /= X;
+                break;
+            case SR_BPF_ALU|SR_BPF_MOD|SR_BPF_X:
+                if (X == 0)
+                { return 0; }
+                A %= X;
+                break;
+            case SR_BPF_ALU|SR_BPF_AND|SR_BPF_X: A &= X; break;
+            case SR_BPF_ALU|SR_BPF_OR|SR_BPF_X:  A |= X; break;
+            case SR_BPF_ALU|SR_BPF_XOR|SR_BPF_X: A ^= X; break;
+            case SR_BPF_ALU|SR_BPF_LSH|SR_BPF_X: A = X < 32 ? A << X : 0; break;
+            case SR_BPF_ALU|SR_BPF_RSH|SR_BPF_X: A = X < 32 ? A >> X : 0; break;
+            case SR_BPF_ALU|SR_BPF_ADD|SR_BPF_K: A += pc->k; break;
+            case SR_BPF_ALU|SR_BPF_SUB|SR_BPF_K: A -= pc->k; break;
+            case SR_BPF_ALU|SR_BPF_MUL|SR_BPF_K: A *= pc->k; break;
+            case SR_BPF_ALU|SR_BPF_DIV|SR_BPF_K: A /= pc->k; break;
+            case SR_BPF_ALU|SR_BPF_MOD|SR_BPF_K: A %= pc->k; break;
+            case SR_BPF_ALU|SR_BPF_AND|SR_BPF_K: A &= pc->k; break;
+            case SR_BPF_ALU|SR_BPF_OR|SR_BPF_K:  A |= pc->k; break;
+            case SR_BPF_ALU|SR_BPF_XOR|SR_BPF_K: A ^= pc->k; break;
+            case SR_BPF_ALU|SR_BPF_LSH|SR_BPF_K: A <<= pc->k; break;
+            case SR_BPF_ALU|SR_BPF_RSH|SR_BPF_K: A >>= pc->k; break;
+            case SR_BPF_ALU|SR_BPF_NEG:          A = -A; break;
+
+            case SR_BPF_MISC|SR_BPF_TAX:
+                X = A;
+                break;
+            case SR_BPF_MISC|SR_BPF_TXA:
+                A = X;
+                break;
+
+            default:
+                /* -- sr_bpf_validate(..) lets nothing else through -- */
+                assert(0);
+                return 0;
+        }
+    }
+} /* -- sr_bpf_run -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bpf_validate(..)
+ * Scope: Global
+ *
+ * Known opcodes only, jumps forward and inside the program, scratch
+ * memory in range, no constant division by zero or over-wide shift and
+ * a ret at the end, so sr_bpf_run(..) always terminates.  Returns 0 if
+ * the program is ok.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_bpf_validate(const struct sr_bpf_insn* prog, unsigned int n)
+{
+    unsigned int i;
+
+    if (n == 0 || n > SR_BPF_MAXINSNS)
+    { return -1; }
+
+    for (i = 0; i < n; i++)
+    {
+        const struct sr_bpf_insn* p = &prog[i];
+        unsigned int left = n - i - 1;
+
+        /* -- the macros below only look at the low byte -- */
+        if (p->code & ~0xff)
+        { return -1; }
+
+        switch (SR_BPF_CLASS(p->code))
+        {
+            case SR_BPF_LD:
+            case SR_BPF_LDX:
+                switch (SR_BPF_MODE(p->code))
+                {
+                    case SR_BPF_MEM:
+                        if (p->k >= SR_BPF_MEMWORDS)
+                        { return -1; }
+                        break;
+                    case SR_BPF_IMM:
+                    case SR_BPF_LEN:
+                        break;
+                    case SR_BPF_ABS:
+                    case SR_BPF_IND:
+                        if (SR_BPF_CLASS(p->code) != SR_BPF_LD)
+                        { return -1; }
+                        break;
+                    case SR_BPF_MSH:
+                        if (p->code != (SR_BPF_LDX|SR_BPF_B|SR_BPF_MSH))
+                        { return -1; }
+                        break;
+                    default:
+                        return -1;
+                }
+                if (SR_BPF_MODE(p->code) != SR_BPF_MSH &&
+                        SR_BPF_MODE(p->code) != SR_BPF_ABS &&
+                        SR_BPF_MODE(p->code) != SR_BPF_IND &&
+                        SR_BPF_SIZE(p->code) != SR_BPF_W)
+                { return -1; }
+                if (SR_BPF_SIZE(p->code) == 0x18)
+                { return -1; }
+                break;
+            case SR_BPF_ST:
+            case SR_BPF_STX:
+                if (p->code != SR_BPF_CLASS(p->code) || p->k >= SR_BPF_MEMWORDS)
+                { return -1; }
+                break;
+            case SR_BPF_ALU:
+                if (SR_BPF_OP(p->code) > SR_BPF_XOR)
+                { return -1; }
+                if (SR_BPF_OP(p->code) == SR_BPF_NEG)
+                {
+                    if (SR_BPF_SRC(p->code) != SR_BPF_K)
+                    { return -1; }
+                }
+                else if ((SR_BPF_OP(p->code) == SR_BPF_DIV ||
+                          SR_BPF_OP(p->code) == SR_BPF_MOD) &&
+                         SR_BPF_SRC(p->code) == SR_BPF_K && p->k == 0)
+                { return -1; }
+                else if ((SR_BPF_OP(p->code) == SR_BPF_LSH ||
+                          SR_BPF_OP(p->code) == SR_BPF_RSH) &&
+                         SR_BPF_SRC(p->code) == SR_BPF_K && p->k >= 32)
+                { return -1; }
+                break;
+            case SR_BPF_JMP:
+                if (SR_BPF_OP(p->code) == SR_BPF_JA)
+                {
+                    if (p->code != (SR_BPF_JMP|SR_BPF_JA) || p->k >= left)
+                    { return -1; }
+                }
+                else if (SR_BPF_OP(p->code) > SR_BPF_JSET ||
+                         p->jt >= left || p->jf >= left)
+                { return -1; }
+                break;
+            case SR_BPF_RET:
+                if (p->code != (SR_BPF_RET|SR_BPF_K) &&
+                        p->code != (SR_BPF_RET|SR_BPF_A))
+                { return -1; }
+                break;
+            case SR_BPF_MISC:
+                if (p->code != (SR_BPF_MISC|SR_BPF_TAX) &&
+                        p->code != (SR_BPF_MISC|SR_BPF_TXA))
+                { return -1; }
+                break;
+        }
+    }
+
+    return SR_BPF_CLASS(prog[n - 1].code) == SR_BPF_RET ? 0 : -1;
+} /* -- sr_bpf_validate -- */
+
+/*---------------------------------------------------------------------
+ * Expression compiler
+ *---------------------------------------------------------------------*/
+
+static void sr_gen(struct sr_filter_gen* g, uint16_t code, uint8_t jt,
+                   uint8_t jf, uint32_t k)
+{
+    struct sr_bpf_insn* p;
+
+    /* -- over-long expressions are refused by the caller -- */
+    if (g->n == SR_FILTER_MAX_INSNS)
+    { return; }
+
+    p = &g->prog[g->n++];
+    p->code = code;
+    p->jt = jt;
+    p->jf = jf;
+    p->k = k;
+} /* -- sr_gen -- */
+
+/* -- fall through if the frame is IPv4, else the term is false -- */
+static void sr_gen_ipv4(struct sr_filter_gen* g)
+{
+    sr_gen(g, SR_BPF_LD|SR_BPF_H|SR_BPF_ABS, 0, 0, 12);
+    sr_gen(g, SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K, 0, SR_L_FALSE, ethertype_ip);
+} /* -- sr_gen_ipv4 -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_gen_end_term(..)
+ * Scope: Local
+ *
+ * Point the current term's true / false placeholders at the next term
+ * and at reject.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_gen_end_term(struct sr_filter_gen* g, int negate)
+{
+    unsigned int i;
+
+    for (i = g->term; i < g->n; i++)
+    {
+        struct sr_bpf_insn* p = &g->prog[i];
+        uint8_t next = g->n - i - 1;
+
+        if (SR_BPF_CLASS(p->code) != SR_BPF_JMP)
+        { continue; }
+        if (p->jt == SR_L_TRUE)
+        { p->jt = negate ? SR_L_REJECT : next; }
+        else if (p->jt == SR_L_FALSE)
+        { p->jt = negate ? next : SR_L_REJECT; }
+        if (p->jf == SR_L_TRUE)
+        { p->jf = negate ? SR_L_REJECT : next; }
+        else if (p->jf == SR_L_FALSE)
+        { p->jf = negate ? next : SR_L_REJECT; }
+    }
+    g->term = g->n;
+} /* -- sr_gen_end_term -- */
+
+static int sr_filter_number(const char* s, uint32_t* v)
+{
+    char* end;
+    unsigned long n;
+
+    if (!s)
+    { return -1; }
+    n = strtoul(s, &end, 0);
+    if (*s == 0 || *end != 0 || n > 0xffffffffUL)
+    { return -1; }
+    *v = n;
+    return 0;
+} /* -- sr_filter_number -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_term(..)
+ * Scope: Local
+ *
+ * Parse one term starting at tok[*i], leave *i after it.  Returns 0 or
+ * -1 with a message.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_filter_term(struct sr_instance* sr, struct sr_filter* f,
+                          struct sr_filter_gen* g, char** tok, int ntok,
+                          int* i)
+{
+    int negate = 0;
+    int src = 1, dst = 1;
+    const char* t;
+    const char* arg;
+    uint32_t v;
+
+    while (*i < ntok && (strcmp(tok[*i], "not") == 0 ||
+                         strcmp(tok[*i], "!") == 0))
+    {
+        negate = !negate;
+        (*i)++;
+    }
+    if (*i < ntok && strcmp(tok[*i], "src") == 0)
+    { dst = 0; (*i)++; }
+    else if (*i < ntok && strcmp(tok[*i], "dst") == 0)
+    { src = 0; (*i)++; }
+    if (*i >= ntok)
+    {
+        fprintf(stderr, "filter: expression ends early\n");
+        return -1;
+    }
+
+    t = tok[(*i)++];
+    arg = *i < ntok ? tok[*i] : 0;
+
+    if (!(src && dst) && strcmp(t, "host") != 0 && strcmp(t, "net") != 0 &&
+            strcmp(t, "port") != 0)
+    {
+        fprintf(stderr, "filter: src / dst before '%s'\n", t);
+        return -1;
+    }
+
+    /* -- metadata, checked before the program runs -- */
+    if (strcmp(t, "in") == 0 || strcmp(t, "out") == 0)
+    {
+        unsigned int m = 1u << (strcmp(t, "in") == 0 ? SR_CAP_RX : SR_CAP_TX);
+
+        f->dirmask &= negate ? ~m : m;
+        return 0;
+    }
+    if (strcmp(t, "iface") == 0)
+    {
+        struct sr_if* iface = arg ? sr_get_interface(sr, arg) : 0;
+
+        if (!iface)
+        {
+            fprintf(stderr, "filter: no interface '%s'\n", arg ? arg : "");
+            return -1;
+        }
+        (*i)++;
+        f->ifmask &= negate ? ~(1u << iface->index) : 1u << iface->index;
+        return 0;
+    }
+
+    /* -- packet terms -- */
+    if (strcmp(t, "ip") == 0 || strcmp(t, "arp") == 0)
+    {
+        sr_gen(g, SR_BPF_LD|SR_BPF_H|SR_BPF_ABS, 0, 0, 12);
+        sr_gen(g, SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K, SR_L_TRUE, SR_L_FALSE,
+               strcmp(t, "ip") == 0 ? ethertype_ip : ethertype_arp);
+    }
+    else if (strcmp(t, "ether") == 0)
+    {
+        if (!arg || strcmp(arg, "proto") != 0 ||
+                sr_filter_number(*i + 1 < ntok ? tok[*i + 1] : 0, &v) != 0 ||
+                v > 0xffff)
+        {
+            fprintf(stderr, "filter: expected 'ether proto N'\n");
+            return -1;
+        }
+        *i += 2;
+        sr_gen(g, SR_BPF_LD|SR_BPF_H|SR_BPF_ABS, 0, 0, 12);
+        sr_gen(g, SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K, SR_L_TRUE, SR_L_FALSE, v);
+    }
+    else if (strcmp(t, "icmp") == 0 || strcmp(t, "tcp") == 0 ||
+             strcmp(t, "udp") == 0 || strcmp(t, "proto") == 0)
+    {
+        if (strcmp(t, "icmp") == 0)
+        { v = ip_protocol_icmp; }
+        else if (strcmp(t, "tcp") == 0)
+        { v = 6; }
+        else if (strcmp(t, "udp") == 0)
+        { v = 17; }
+        else if (sr_filter_number(arg, &v) != 0 || v > 0xff)
+        {
+            fprintf(stderr, "filter: expected 'proto N'\n");
+            return -1;
+        }
+        else
+        { (*i)++; }
+        sr_gen_ipv4(g);
+        sr_gen(g, SR_BPF_LD|SR_BPF_B|SR_BPF_ABS, 0, 0, 23);
+        sr_gen(g, SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K, SR_L_TRUE, SR_L_FALSE, v);
+    }
+    else if (strcmp(t, "host") == 0 || strcmp(t, "net") == 0)
+    {
+        char addr[32];
+        char* slash;
+        struct in_addr a;
+        uint32_t mask = 0xffffffff;
+
+        if (!arg || strlen(arg) >= sizeof(addr))
+        {
+            fprintf(stderr, "filter: expected an address after '%s'\n", t);
+            return -1;
+        }
+        strcpy(addr, arg);
+        (*i)++;
+        if ((slash = strchr(addr, '/')) != 0)
+        {
+            if (strcmp(t, "net") != 0 || sr_filter_number(slash + 1, &v) != 0 ||
+                    v > 32)
+            {
+                fprintf(stderr, "filter: bad prefix '%s'\n", arg);
+                return -1;
+            }
+            *slash = 0;
+            mask = v == 0 ? 0 : 0xffffffff << (32 - v);
+        }
+        if (inet_aton(addr, &a) == 0)
+        {
+            fprintf(stderr, "filter: bad address '%s'\n", arg);
+            return -1;
+        }
+        v = ntohl(a.s_addr) & mask;
+
+        sr_gen_ipv4(g);
+        if (src)
+        {
+            sr_gen(g, SR_BPF_LD|SR_BPF_W|SR_BPF_ABS, 0, 0, 26);
+            if (mask != 0xffffffff)
+            { sr_gen(g, SR_BPF_ALU|SR_BPF_AND|SR_BPF_K, 0, 0, mask); }
+            sr_gen(g, SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K, SR_L_TRUE,
+                   dst ? 0 : SR_L_FALSE, v);
+        }
+        if (dst)
+        {
+            sr_gen(g, SR_BPF_LD|SR_BPF_W|SR_BPF_ABS, 0, 0, 30);
+            if (mask != 0xffffffff)
+            { sr_gen(g, SR_BPF_ALU|SR_BPF_AND|SR_BPF_K, 0, 0, mask); }
+            sr_gen(g, SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K, SR_L_TRUE, SR_L_FALSE, v);
+        }
+    }
+    else if (strcmp(t, "port") == 0)
+    {
+        if (sr_filter_number(arg, &v) != 0 || v > 0xffff)
+        {
+            fprintf(stderr, "filter: expected 'port N'\n");
+            return -1;
+        }
+        (*i)++;
+
+        /* -- TCP or UDP, first fragment only, ports after the options -- */
+        sr_gen_ipv4(g);
+        sr_gen(g, SR_BPF_LD|SR_BPF_B|SR_BPF_ABS, 0, 0, 23);
+        sr_gen(g, SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K, 1, 0, 6);
+        sr_gen(g, SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K, 0, SR_L_FALSE, 17);
+        sr_gen(g, SR_BPF_LD|SR_BPF_H|SR_BPF_ABS, 0, 0, 20);
+        sr_gen(g, SR_BPF_JMP|SR_BPF_JSET|SR_BPF_K, SR_L_FALSE, 0, 0x1fff);
+        sr_gen(g, SR_BPF_LDX|SR_BPF_B|SR_BPF_MSH, 0, 0, 14);
+        if (src)
+        {
+            sr_gen(g, SR_BPF_LD|SR_BPF_H|SR_BPF_IND, 0, 0, 14);
+            sr_gen(g, SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K, SR_L_TRUE,
+                   dst ? 0 : SR_L_FALSE, v);
+        }
+        if (dst)
+        {
+            sr_gen(g, SR_BPF_LD|SR_BPF_H|SR_BPF_IND, 0, 0, 16);
+            sr_gen(g, SR_BPF_JMP|SR_BPF_JEQ|SR_BPF_K, SR_L_TRUE, SR_L_FALSE, v);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "filter: unknown term '%s'\n", t);
+        return -1;
+    }
+
+    sr_gen_end_term(g, negate);
+    return 0;
+} /* -- sr_filter_term -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_load(..)
+ * Scope: Local
+ *
+ * Read a program in `tcpdump -ddd` form: the instruction count, then
+ * "code jt jf k" per instruction, all decimal.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_filter_load(struct sr_filter* f, const char* path)
+{
+    FILE* fp;
+    unsigned int n, i;
+
+    if ((fp = fopen(path, "r")) == 0)
+    {
+        perror("fopen:sr_filter.c::sr_filter_load");
+        return -1;
+    }
+    if (fscanf(fp, "%u", &n) != 1 || n == 0 || n > SR_BPF_MAXINSNS)
+    {
+        fprintf(stderr, "filter: %s: bad instruction count\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    f->prog = (struct sr_bpf_insn*)sr_mem_calloc(SR_MEM_CAPTURE, n,
+                                                 sizeof(struct sr_bpf_insn));
+    assert(f->prog);
+    for (i = 0; i < n; i++)
+    {
+        unsigned int code, jt, jf;
+        unsigned long k;
+
+        if (fscanf(fp, "%u %u %u %lu", &code, &jt, &jf, &k) != 4 ||
+                code > 0xffff || jt > 0xff || jf > 0xff || k > 0xffffffffUL)
+        {
+            fprintf(stderr, "filter: %s: bad instruction %u\n", path, i);
+            fclose(fp);
+            return -1;
+        }
+        f->prog[i].code = code;
+        f->prog[i].jt = jt;
+        f->prog[i].jf = jf;
+        f->prog[i].k = k;
+    }
+    fclose(fp);
+
+    f->nprog = n;
+    if (sr_bpf_validate(f->prog, n) != 0)
+    {
+        fprintf(stderr, "filter: %s: invalid program\n", path);
+        return -1;
+    }
+    return 0;
+} /* -- sr_filter_load -- */
+
+struct sr_filter* sr_filter_compile(struct sr_instance* sr, const char* expr)
+{
+    struct sr_filter* f;
+    struct sr_filter_gen* g;
+    char* copy;
+    char* tok[SR_FILTER_MAX_TOKENS];
+    char* p;
+    int ntok = 0, i = 0, err = 0;
+
+    assert(sr);
+    assert(expr);
+
+    f = (struct sr_filter*)sr_mem_calloc(SR_MEM_CAPTURE, 1, sizeof(struct sr_filter));
+    assert(f);
+    f->ifmask = 0xffffffff;
+    f->dirmask = 1u << SR_CAP_RX | 1u << SR_CAP_TX;
+
+    if (expr[0] == '@')
+    {
+        if (sr_filter_load(f, expr + 1) != 0)
+        {
+            sr_filter_free(f);
+            return 0;
+        }
+        return f;
+    }
+
+    copy = (char*)sr_mem_malloc(SR_MEM_CAPTURE, strlen(expr) + 1);
+    assert(copy);
+    strcpy(copy, expr);
+    for (p = strtok(copy, " \t\n"); p; p = strtok(0, " \t\n"))
+    {
+        if (ntok == SR_FILTER_MAX_TOKENS)
+        {
+            fprintf(stderr, "filter: expression too long\n");
+            sr_mem_free(copy);
+            sr_filter_free(f);
+            return 0;
+        }
+        tok[ntok++] = p;
+    }
+
+    g = (struct sr_filter_gen*)sr_mem_calloc(SR_MEM_CAPTURE, 1,
+                                             sizeof(struct sr_filter_gen));
+    assert(g);
+
+    while (i < ntok && !err)
+    {
+        if (sr_filter_term(sr, f, g, tok, ntok, &i) != 0)
+        { err = 1; }
+        else if (i < ntok && strcmp(tok[i], "and") != 0 && strcmp(tok[i], "&&") != 0)
+        {
+            fprintf(stderr, "filter: expected 'and' before '%s'\n", tok[i]);
+            err = 1;
+        }
+        else if (i < ntok && ++i == ntok)
+        {
+            fprintf(stderr, "filter: expression ends early\n");
+            err = 1;
+        }
+    }
+
+    if (!err && g->n > 0)
+    {
+        /* -- accept falls out of the last term, reject is the last ret -- */
+        unsigned int j;
+
+        sr_gen(g, SR_BPF_RET|SR_BPF_K, 0, 0, SR_SNAP_ALL);
+        sr_gen(g, SR_BPF_RET|SR_BPF_K, 0, 0, 0);
+        for (j = 0; j < g->n; j++)
+        {
+            if (SR_BPF_CLASS(g->prog[j].code) != SR_BPF_JMP)
+            { continue; }
+            if (g->prog[j].jt == SR_L_REJECT)
+            { g->prog[j].jt = g->n - j - 2; }
+            if (g->prog[j].jf == SR_L_REJECT)
+            { g->prog[j].jf = g->n - j - 2; }
+        }
+
+        if (g->n == SR_FILTER_MAX_INSNS || sr_bpf_validate(g->prog, g->n) != 0)
+        {
+            fprintf(stderr, "filter: expression too long\n");
+            err = 1;
+        }
+        else
+        {
+            f->nprog = g->n;
+            f->prog = (struct sr_bpf_insn*)sr_mem_malloc(SR_MEM_CAPTURE,
+                      g->n * sizeof(struct sr_bpf_insn));
+            assert(f->prog);
+            memcpy(f->prog, g->prog, g->n * sizeof(struct sr_bpf_insn));
+        }
+    }
+
+    sr_mem_free(g);
+    sr_mem_free(copy);
+    if (err)
+    {
+        sr_filter_free(f);
+        return 0;
+    }
+    return f;
+} /* -- sr_filter_compile -- */
+
+void sr_filter_set_sample(struct sr_filter* f, unsigned int n)
+{
+    f->sample = n;
+} /* -- sr_filter_set_sample -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_match(..)
+ * Scope: Global
+ *
+ * Cheapest test first.  Sampling counts per thread, so with several
+ * packet threads it keeps 1 in n of each thread's matching frames.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_filter_match(const struct sr_filter* f, const uint8_t* buf,
+                             unsigned int len, int ifindex, int dir)
+{
+    unsigned int snap = SR_SNAP_ALL;
+
+    if (!(f->dirmask & 1u << dir) ||
+            ifindex < 0 || ifindex >= SR_MAX_IF || !(f->ifmask & 1u << ifindex))
+    { return 0; }
+
+    if (f->nprog && (snap = sr_bpf_run(f->prog, buf, len)) == 0)
+    { return 0; }
+
+    if (f->sample > 1)
+    {
+        if (sr_filter_skip > 0)
+        {
+            sr_filter_skip--;
+            return 0;
+        }
+        sr_filter_skip = f->sample - 1;
+    }
+
+    return snap;
+} /* -- sr_filter_match -- */
+
+void sr_filter_free(struct sr_filter* f)
+{
+    if (!f)
+    { return; }
+    sr_mem_free(f->prog);
+    sr_mem_free(f);
+} /* -- sr_filter_free -- */
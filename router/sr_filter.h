@@ -0,0 +1,125 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter.h
+ *
+ * Description:
+ *
+ * Capture filter, checked by sr_capture_packet(..) before anything is
+ * copied so that a capture aimed at one flow leaves the rest of the
+ * traffic alone.  A filter is
+ *
+ *   - interface and direction sets, tested first since they only look at
+ *     the frame's metadata,
+ *   - an optional classic BPF program run over the frame by a small
+ *     interpreter; its return value is the snap length, 0 rejects,
+ *   - 1-in-N sampling of the frames that got through the rest.
+ *
+ * sr_filter_compile(..) takes a tcpdump-like expression, terms joined by
+ * "and", each optionally negated with "not":
+ *
+ *   in | out | iface NAME
+ *   arp | ip | icmp | tcp | udp | proto N | ether proto N
+ *   [src|dst] host A.B.C.D | [src|dst] net A.B.C.D/LEN | [src|dst] port N
+ *
+ * and turns the packet terms into BPF.  "@file" loads a program from
+ * `tcpdump -ddd` output instead, for anything the expressions can't say.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FILTER_H
+#define SR_FILTER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_BPF_MAXINSNS   4096  /* longest program accepted */
+#define SR_BPF_MEMWORDS   16
+
+/* -- classic BPF encoding, as in <net/bpf.h> -- */
+#define SR_BPF_CLASS(c)  ((c) & 0x07)
+#define SR_BPF_LD    0x00
+#define SR_BPF_LDX   0x01
+#define SR_BPF_ST    0x02
+#define SR_BPF_STX   0x03
+#define SR_BPF_ALU   0x04
+#define SR_BPF_JMP   0x05
+#define SR_BPF_RET   0x06
+#define SR_BPF_MISC  0x07
+
+#define SR_BPF_SIZE(c)   ((c) & 0x18)
+#define SR_BPF_W     0x00
+#define SR_BPF_H     0x08
+#define SR_BPF_B     0x10
+
+#define SR_BPF_MODE(c)   ((c) & 0xe0)
+#define SR_BPF_IMM   0x00
+#define SR_BPF_ABS   0x20
+#define SR_BPF_IND   0x40
+#define SR_BPF_MEM   0x60
+#define SR_BPF_LEN   0x80
+#define SR_BPF_MSH   0xa0
+
+#define SR_BPF_OP(c)     ((c) & 0xf0)
+#define SR_BPF_ADD   0x00
+#define SR_BPF_SUB   0x10
+#define SR_BPF_MUL   0x20
+#define SR_BPF_DIV   0x30
+#define SR_BPF_OR    0x40
+#define SR_BPF_AND   0x50
+#define SR_BPF_LSH   0x60
+#define SR_BPF_RSH   0x70
+#define SR_BPF_NEG   0x80
+#define SR_BPF_MOD   0x90
+#define SR_BPF_XOR   0xa0
+
+#define SR_BPF_JA    0x00
+#define SR_BPF_JEQ   0x10
+#define SR_BPF_JGT   0x20
+#define SR_BPF_JGE   0x30
+#define SR_BPF_JSET  0x40
+
+#define SR_BPF_SRC(c)    ((c) & 0x08)
+#define SR_BPF_K     0x00
+#define SR_BPF_X     0x08
+
+#define SR_BPF_RVAL(c)   ((c) & 0x18)
+#define SR_BPF_A     0x10
+
+#define SR_BPF_MISCOP(c) ((c) & 0xf8)
+#define SR_BPF_TAX   0x00
+#define SR_BPF_TXA   0x80
+
+struct sr_bpf_insn
+{
+    uint16_t code;
+    uint8_t  jt;
+    uint8_t  jf;
+    uint32_t k;
+};
+
+struct sr_instance;
+struct sr_filter;
+
+/* Build a filter from an expression (or "@file"), 0 with a message on
+   stderr if it doesn't parse.  Interface names are resolved now. */
+struct sr_filter* sr_filter_compile(struct sr_instance* sr, const char* expr);
+
+/* Sample 1 in n of the frames the filter accepts, n <= 1 keeps all. */
+void sr_filter_set_sample(struct sr_filter* f, unsigned int n);
+
+/* Snap length to capture, 0 to skip the frame.  Any thread. */
+unsigned int sr_filter_match(const struct sr_filter* f, const uint8_t* buf,
+                             unsigned int len, int ifindex, int dir);
+
+void sr_filter_free(struct sr_filter* f);
+
+/* The program must have passed sr_bpf_validate(..). */
+unsigned int sr_bpf_run(const struct sr_bpf_insn* prog, const uint8_t* buf,
+                        unsigned int len);
+int sr_bpf_validate(const struct sr_bpf_insn* prog, unsigned int n);
+
+#endif /* -- SR_FILTER_H -- */
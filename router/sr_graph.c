@@ -0,0 +1,451 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_graph.c
+ *
+ * Description:
+ *
+ * Forwarding graph, see sr_graph.h.
+ *
+ * The graph is fixed and acyclic and the node indices below are in
+ * topological order, so a run is one pass over the node table: each node
+ * drains its pending vector into the vectors of nodes further down.
+ * Every packet sits in exactly one vector at a time, so no vector can
+ * overflow as long as a run is fed at most SR_GRAPH_VEC packets.
+ *
+ * Node counters are per thread, like the sr_stats blocks: a thread
+ * claims a block on its first run and only it writes there, and
+ * sr_graph_print_stats(..) sums the blocks.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_protocol.h"
+#include "sr_arpcache.h"
+#include "sr_utils.h"
+#include "sr_pkt.h"
+#include "sr_slowpath.h"
+#include "sr_stats.h"
+#include "sr_graph.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SR_GRAPH_CLOCK()    __builtin_ia32_rdtsc()
+#define SR_GRAPH_CLOCK_UNIT "clocks"
+#else
+#define SR_GRAPH_CLOCK()    sr_pkt_clock()
+#define SR_GRAPH_CLOCK_UNIT "ns"
+#endif
+
+#define SR_GRAPH_PREFETCH   4   /* packets ahead in ethernet-input */
+#define SR_GRAPH_THREADS    32  /* counter blocks: rx and workers, with room */
+
+enum sr_graph_node_index
+{
+    SR_NODE_ETHERNET_INPUT,
+    SR_NODE_ARP_INPUT,
+    SR_NODE_IP4_INPUT,
+    SR_NODE_IP4_LOOKUP,
+    SR_NODE_IP4_REWRITE,
+    SR_NODE_ICMP_ERROR,
+    SR_NODE_SLOW_PATH,
+    SR_NODE_INTERFACE_OUTPUT,
+    SR_NODE_DROP,
+    SR_NODE_COUNT
+};
+
+struct sr_graph_rt
+{
+    struct sr_pkt* vec[SR_NODE_COUNT][SR_GRAPH_VEC];
+    int n[SR_NODE_COUNT];
+};
+
+#define SR_GRAPH_NEXT(rt, node, pkt) \
+    ((rt)->vec[(node)][(rt)->n[(node)]++] = (pkt))
+
+struct sr_graph_node
+{
+    const char* name;
+    void (*fn)(struct sr_instance* sr, struct sr_pkt** pkts, int n,
+               struct sr_graph_rt* rt);
+};
+
+struct sr_graph_count
+{
+    unsigned long vectors;
+    unsigned long pkts;
+    uint64_t clocks;
+};
+
+/* -- a thread's counters, a cache line apart from the next thread's -- */
+struct sr_graph_counts
+{
+    struct sr_graph_count node[SR_NODE_COUNT];
+} __attribute__((aligned(64)));
+
+/* -- per thread: workers run the graph concurrently -- */
+static __thread struct sr_graph_rt sr_graph_rt;
+
+static struct sr_graph_counts sr_graph_counts[SR_GRAPH_THREADS];
+static unsigned int sr_graph_nblocks;
+
+/* -- until a thread's first run; a thread that finds no block left
+      counts here, unreported -- */
+static __thread struct sr_graph_counts sr_graph_private;
+static __thread struct sr_graph_counts* sr_graph_mine;
+
+/*---------------------------------------------------------------------
+ * Nodes
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_node_ethernet_input(struct sr_instance* sr, struct sr_pkt** pkts,
+                                   int n, struct sr_graph_rt* rt)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_pkt* pkt = pkts[i];
+
+        if (i + SR_GRAPH_PREFETCH < n)
+        { __builtin_prefetch(SR_PKT_DATA(pkts[i + SR_GRAPH_PREFETCH])); }
+
+        if (pkt->len < sizeof(sr_ethernet_hdr_t))
+        {
+            SR_STATS_DROP(SHORT_FRAME, pkt->len);
+            SR_GRAPH_NEXT(rt, SR_NODE_DROP, pkt);
+            continue;
+        }
+
+        switch (ethertype(SR_PKT_DATA(pkt)))
+        {
+            case ethertype_arp:
+                SR_GRAPH_NEXT(rt, SR_NODE_ARP_INPUT, pkt);
+                break;
+            case ethertype_ip:
+                SR_GRAPH_NEXT(rt, SR_NODE_IP4_INPUT, pkt);
+                break;
+            default:
+                SR_STATS_DROP(BAD_ETHERTYPE, pkt->len);
+                SR_GRAPH_NEXT(rt, SR_NODE_DROP, pkt);
+                break;
+        }
+    }
+} /* -- sr_node_ethernet_input -- */
+
+static void sr_node_arp_input(struct sr_instance* sr, struct sr_pkt** pkts,
+                              int n, struct sr_graph_rt* rt)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (pkts[i]->len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+        {
+            SR_STATS_DROP(SHORT_ARP, pkts[i]->len);
+            SR_GRAPH_NEXT(rt, SR_NODE_DROP, pkts[i]);
+        }
+        else
+        { SR_GRAPH_NEXT(rt, SR_NODE_SLOW_PATH, pkts[i]); }
+    }
+} /* -- sr_node_arp_input -- */
+
+static void sr_node_ip4_input(struct sr_instance* sr, struct sr_pkt** pkts,
+                              int n, struct sr_graph_rt* rt)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_pkt* pkt = pkts[i];
+        sr_ip_hdr_t* ip_hdr =
+            (sr_ip_hdr_t*)(SR_PKT_DATA(pkt) + sizeof(sr_ethernet_hdr_t));
+        uint16_t old_ip_sum;
+
+        if (pkt->len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+                ip_hdr->ip_v != 4 || ip_hdr->ip_hl < 5)
+        {
+            SR_STATS_DROP(BAD_IP_HEADER, pkt->len);
+            SR_GRAPH_NEXT(rt, SR_NODE_DROP, pkt);
+            continue;
+        }
+
+        old_ip_sum = ip_hdr->ip_sum;
+        ip_hdr->ip_sum = 0;
+        if (cksum(ip_hdr, sizeof(sr_ip_hdr_t)) != old_ip_sum)
+        {
+            ip_hdr->ip_sum = old_ip_sum;
+            SR_STATS_DROP(BAD_CKSUM, pkt->len);
+            SR_GRAPH_NEXT(rt, SR_NODE_DROP, pkt);
+            continue;
+        }
+        ip_hdr->ip_sum = old_ip_sum;
+
+        if (sr_find_local_addr(sr, ip_hdr->ip_dst))
+        { SR_GRAPH_NEXT(rt, SR_NODE_SLOW_PATH, pkt); }
+        else if (ip_hdr->ip_ttl <= 1)
+        {
+            SR_STATS_DROP(TTL_EXPIRED, pkt->len);
+            pkt->icmp_type = 11;
+            pkt->icmp_code = 0;
+            SR_GRAPH_NEXT(rt, SR_NODE_ICMP_ERROR, pkt);
+        }
+        else
+        { SR_GRAPH_NEXT(rt, SR_NODE_IP4_LOOKUP, pkt); }
+    }
+} /* -- sr_node_ip4_input -- */
+
+static void sr_node_ip4_lookup(struct sr_instance* sr, struct sr_pkt** pkts,
+                               int n, struct sr_graph_rt* rt)
+{
+    struct sr_rt* lpm_match = 0;
+    uint32_t last_dst = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_pkt* pkt = pkts[i];
+        sr_ip_hdr_t* ip_hdr =
+            (sr_ip_hdr_t*)(SR_PKT_DATA(pkt) + sizeof(sr_ethernet_hdr_t));
+
+        /* -- bursts are mostly a few flows, skip the walk for repeats -- */
+        if (i == 0 || ip_hdr->ip_dst != last_dst)
+        {
+            last_dst = ip_hdr->ip_dst;
+            lpm_match = longest_prefix_match(sr, last_dst);
+        }
+
+        if (!lpm_match)
+        {
+            SR_STATS_DROP(NO_ROUTE, pkt->len);
+            pkt->icmp_type = 3;
+            pkt->icmp_code = 0;
+            SR_GRAPH_NEXT(rt, SR_NODE_ICMP_ERROR, pkt);
+            continue;
+        }
+
+        pkt->route = SR_STATS_ROUTE_ID(lpm_match);
+        pkt->next_hop = lpm_match->gw.s_addr ? lpm_match->gw.s_addr : last_dst;
+        pkt->tx_ifindex = lpm_match->ifindex;
+        SR_GRAPH_NEXT(rt, SR_NODE_IP4_REWRITE, pkt);
+    }
+} /* -- sr_node_ip4_lookup -- */
+
+static void sr_node_ip4_rewrite(struct sr_instance* sr, struct sr_pkt** pkts,
+                                int n, struct sr_graph_rt* rt)
+{
+    struct sr_arpentry entry;
+    uint32_t last_nh = 0;
+    int have_entry = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_pkt* pkt = pkts[i];
+        sr_ethernet_hdr_t* ether_hdr = (sr_ethernet_hdr_t*)SR_PKT_DATA(pkt);
+        sr_ip_hdr_t* ip_hdr =
+            (sr_ip_hdr_t*)(SR_PKT_DATA(pkt) + sizeof(sr_ethernet_hdr_t));
+        struct sr_if* target_if;
+
+        if (i == 0 || pkt->next_hop != last_nh)
+        {
+            last_nh = pkt->next_hop;
+            have_entry = sr_arpcache_lookup(&(sr->cache), last_nh, &entry);
+        }
+
+        /* -- left untouched, the slow path queues it for ARP -- */
+        if (!have_entry)
+        {
+            SR_GRAPH_NEXT(rt, SR_NODE_SLOW_PATH, pkt);
+            continue;
+        }
+
+        target_if = sr_get_interface_idx(sr, pkt->tx_ifindex);
+
+        ip_hdr->ip_ttl--;
+        ip_hdr->ip_sum = 0;
+        ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+        memcpy(ether_hdr->ether_shost, target_if->addr, ETHER_ADDR_LEN);
+        memcpy(ether_hdr->ether_dhost, entry.mac, ETHER_ADDR_LEN);
+
+        pkt->lat_path = SR_PATH_FORWARD;
+        SR_GRAPH_NEXT(rt, SR_NODE_INTERFACE_OUTPUT, pkt);
+    }
+} /* -- sr_node_ip4_rewrite -- */
+
+static void sr_node_icmp_error(struct sr_instance* sr, struct sr_pkt** pkts,
+                               int n, struct sr_graph_rt* rt)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_pkt* pkt = pkts[i];
+
+        if (sr->slowpath)
+        {
+            sr_slowpath_punt(sr, pkt);
+            continue;
+        }
+        sr_send_icmp_error(sr, pkt, pkt->icmp_type, pkt->icmp_code,
+                           sr_get_interface_idx(sr, pkt->ifindex)->ip);
+    }
+} /* -- sr_node_icmp_error -- */
+
+static void sr_node_slow_path(struct sr_instance* sr, struct sr_pkt** pkts,
+                              int n, struct sr_graph_rt* rt)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (sr->slowpath)
+        { sr_slowpath_punt(sr, pkts[i]); }
+        else
+        { sr_handle_exception(sr, pkts[i]); }
+    }
+} /* -- sr_node_slow_path -- */
+
+static void sr_node_interface_output(struct sr_instance* sr, struct sr_pkt** pkts,
+                                     int n, struct sr_graph_rt* rt)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    { sr_send_packet(sr, pkts[i], pkts[i]->tx_ifindex); }
+} /* -- sr_node_interface_output -- */
+
+static void sr_node_drop(struct sr_instance* sr, struct sr_pkt** pkts,
+                         int n, struct sr_graph_rt* rt)
+{
+    /* -- packets are lent, counting them is all there is to do -- */
+} /* -- sr_node_drop -- */
+
+static struct sr_graph_node sr_graph_nodes[SR_NODE_COUNT] =
+{
+    { "ethernet-input",   sr_node_ethernet_input },
+    { "arp-input",        sr_node_arp_input },
+    { "ip4-input",        sr_node_ip4_input },
+    { "ip4-lookup",       sr_node_ip4_lookup },
+    { "ip4-rewrite",      sr_node_ip4_rewrite },
+    { "icmp-error",       sr_node_icmp_error },
+    { "slow-path",        sr_node_slow_path },
+    { "interface-output", sr_node_interface_output },
+    { "drop",             sr_node_drop }
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_graph_claim(..)
+ * Scope: Local
+ *
+ * A thread's first run takes the next counter block.  Blocks are never
+ * given back.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_graph_counts* sr_graph_claim(void)
+{
+    unsigned int i;
+
+    if ((i = __atomic_fetch_add(&sr_graph_nblocks, 1, __ATOMIC_ACQ_REL)) >=
+            SR_GRAPH_THREADS)
+    {
+        fprintf(stderr, "graph: no counter block left for this thread\n");
+        return &sr_graph_private;
+    }
+
+    return &sr_graph_counts[i];
+} /* -- sr_graph_claim -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_graph_run(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_graph_run(struct sr_instance* sr, struct sr_pkt** pkts, int n)
+{
+    struct sr_graph_rt* rt = &sr_graph_rt;
+    struct sr_graph_counts* mine;
+    int base, chunk, i;
+
+    assert(sr);
+
+    if ((mine = sr_graph_mine) == 0)
+    { mine = sr_graph_mine = sr_graph_claim(); }
+
+    for (base = 0; base < n; base += chunk)
+    {
+        chunk = n - base < SR_GRAPH_VEC ? n - base : SR_GRAPH_VEC;
+
+        memcpy(rt->vec[SR_NODE_ETHERNET_INPUT], pkts + base,
+               chunk * sizeof(struct sr_pkt*));
+        rt->n[SR_NODE_ETHERNET_INPUT] = chunk;
+
+        for (i = 0; i < SR_NODE_COUNT; i++)
+        {
+            struct sr_graph_node* node = &sr_graph_nodes[i];
+            struct sr_graph_count* cnt = &mine->node[i];
+            int m = rt->n[i];
+            uint64_t t0;
+
+            if (m == 0)
+            { continue; }
+
+            /* -- a node only feeds nodes after it, so vec[i] is final -- */
+            t0 = SR_GRAPH_CLOCK();
+            node->fn(sr, rt->vec[i], m, rt);
+            rt->n[i] = 0;
+
+            cnt->clocks += SR_GRAPH_CLOCK() - t0;
+            cnt->vectors++;
+            cnt->pkts += m;
+        }
+    }
+} /* -- sr_graph_run -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_graph_print_stats(..)
+ * Scope: Global
+ *
+ * Sums the threads' blocks.  Counters are read without stopping their
+ * writers, so a report taken mid-run may be a vector out.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_graph_print_stats(FILE* fp)
+{
+    unsigned int nblocks, b;
+    int i;
+
+    nblocks = __atomic_load_n(&sr_graph_nblocks, __ATOMIC_ACQUIRE);
+    if (nblocks > SR_GRAPH_THREADS)
+    { nblocks = SR_GRAPH_THREADS; }
+
+    fprintf(fp, "%-18s %10s %12s %10s %12s\n", "node", "vectors", "packets",
+            "pkts/vec", SR_GRAPH_CLOCK_UNIT "/pkt");
+    for (i = 0; i < SR_NODE_COUNT; i++)
+    {
+        struct sr_graph_count sum;
+
+        memset(&sum, 0, sizeof(sum));
+        for (b = 0; b < nblocks; b++)
+        {
+            const struct sr_graph_count* cnt = &sr_graph_counts[b].node[i];
+
+            sum.vectors += cnt->vectors;
+            sum.pkts += cnt->pkts;
+            sum.clocks += cnt->clocks;
+        }
+
+        if (sum.vectors == 0)
+        { continue; }
+        fprintf(fp, "%-18s %10lu %12lu %10.1f %12.1f\n", sr_graph_nodes[i].name,
+                sum.vectors, sum.pkts, (double)sum.pkts / sum.vectors,
+                (double)sum.clocks / sum.pkts);
+    }
+} /* -- sr_graph_print_stats -- */
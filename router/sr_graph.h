@@ -0,0 +1,48 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_graph.h
+ *
+ * Description:
+ *
+ * Forwarding graph.  A received burst is pushed through a fixed set of
+ * nodes, each of which runs over its whole input vector before the next
+ * node starts:
+ *
+ *   ethernet-input    -> arp-input, ip4-input
+ *   arp-input         -> slow-path
+ *   ip4-input         -> ip4-lookup, icmp-error (TTL expired),
+ *                        slow-path (for one of our addresses)
+ *   ip4-lookup        -> ip4-rewrite, icmp-error (no route)
+ *   ip4-rewrite       -> interface-output, slow-path (next hop unresolved)
+ *
+ * Malformed frames go to drop.  A node's code and the tables it reads
+ * (routing table, ARP cache) stay hot for the whole vector, and ip4-lookup
+ * and ip4-rewrite reuse their last result for runs of packets to the
+ * same destination / next hop.
+ *
+ * slow-path hands packets to sr_handle_exception(..) (through the slow
+ * path thread if there is one) and icmp-error does the same when that
+ * thread is running, so ICMP and ARP stay on the slow path budget.
+ *
+ * Every node counts vectors, packets and clocks (TSC ticks on x86, ns
+ * elsewhere) per thread; sr_graph_print_stats(..) reports their sums.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_GRAPH_H
+#define SR_GRAPH_H
+
+#include <stdio.h>
+
+#define SR_GRAPH_VEC  256   /* max packets per node vector */
+
+struct sr_instance;
+struct sr_pkt;
+
+/* Run n lent packets through the graph.  Packets the graph keeps
+   (slow path, ARP queue) are held or copied, so the caller still owns
+   all of them when this returns. */
+void sr_graph_run(struct sr_instance* sr, struct sr_pkt** pkts, int n);
+
+void sr_graph_print_stats(FILE* fp);
+
+#endif /* -- SR_GRAPH_H -- */
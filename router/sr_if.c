@@ -24,13 +24,15 @@
 
 #include "sr_if.h"
 #include "sr_router.h"
+#include "sr_mem.h"
 
 /*--------------------------------------------------------------------- 
  * Method: sr_get_interface
  * Scope: Global
  *
  * Given an interface name return the interface record or 0 if it doesn't
- * exist.
+ * exist.  Only for configuration and the VNS boundary, packets carry the
+ * interface index (see sr_get_interface_idx).
  *
  *---------------------------------------------------------------------*/
 
@@ -54,30 +56,65 @@ struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
     return 0;
 } /* -- sr_get_interface -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_get_interface_idx
+ * Scope: Global
+ *
+ * Given an interface index return the interface record or 0 if it doesn't
+ * exist.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_get_interface_idx(struct sr_instance* sr, int ifindex)
+{
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if(ifindex < 0 || ifindex >= sr->nif)
+    { return 0; }
+
+    return sr->if_table[ifindex];
+} /* -- sr_get_interface_idx -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_add_interface(..)
  * Scope: Global
  *
- * Add and interface to the router's list
+ * Add and interface to the router's list and give it the next free index.
+ *
+ * RETURN VALUES:
+ *
+ *  the new interface's index
  *
  *---------------------------------------------------------------------*/
 
-void sr_add_interface(struct sr_instance* sr, const char* name)
+int sr_add_interface(struct sr_instance* sr, const char* name)
 {
     struct sr_if* if_walker = 0;
+    struct sr_if* new_if = 0;
 
     /* -- REQUIRES -- */
     assert(name);
     assert(sr);
 
+    if(sr->nif == SR_MAX_IF)
+    {
+        fprintf(stderr, "Too many interfaces (max %d) at %s\n", SR_MAX_IF, name);
+        exit(1);
+    }
+
+    new_if = (struct sr_if*)sr_mem_calloc(SR_MEM_IFACE, 1,
+                                          sizeof(struct sr_if));
+    assert(new_if);
+    strncpy(new_if->name,name,sr_IFACE_NAMELEN);
+    new_if->index = sr->nif;
+    sr->if_table[sr->nif++] = new_if;
+
     /* -- empty list special case -- */
     if(sr->if_list == 0)
     {
-        sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
-        assert(sr->if_list);
-        sr->if_list->next = 0;
-        strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
-        return;
+        sr->if_list = new_if;
+        return new_if->index;
     }
 
     /* -- find the end of the list -- */
@@ -85,11 +122,8 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     while(if_walker->next)
     {if_walker = if_walker->next; }
 
-    if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
-    assert(if_walker->next);
-    if_walker = if_walker->next;
-    strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
-    if_walker->next = 0;
+    if_walker->next = new_if;
+    return new_if->index;
 } /* -- sr_add_interface -- */ 
 
 /*--------------------------------------------------------------------- 
@@ -105,11 +139,9 @@ void sr_set_ether_addr(struct sr_instance* sr, const unsigned char* addr)
     struct sr_if* if_walker = 0;
 
     /* -- REQUIRES -- */
-    assert(sr->if_list);
-    
-    if_walker = sr->if_list;
-    while(if_walker->next)
-    {if_walker = if_walker->next; }
+    assert(sr->nif > 0);
+
+    if_walker = sr->if_table[sr->nif - 1];
 
     /* -- copy address -- */
     memcpy(if_walker->addr,addr,6);
@@ -129,17 +161,95 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
     struct sr_if* if_walker = 0;
 
     /* -- REQUIRES -- */
-    assert(sr->if_list);
-    
-    if_walker = sr->if_list;
-    while(if_walker->next)
-    {if_walker = if_walker->next; }
+    assert(sr->nif > 0);
+
+    if_walker = sr->if_table[sr->nif - 1];
 
     /* -- copy address -- */
     if_walker->ip = ip_nbo;
 
+    sr_rebuild_local_addrs(sr);
+
 } /* -- sr_set_ether_ip -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_local_hash(..)
+ * Scope: Local
+ *
+ * Fibonacci hash of an address into the local address table.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_local_hash(uint32_t ip_nbo)
+{
+    return (uint32_t)(ip_nbo * 2654435761u) >> (32 - SR_LOCAL_HASH_BITS);
+} /* -- sr_local_hash -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_rebuild_local_addrs(..)
+ * Scope: Global
+ *
+ * Rebuild sr->local_addrs from the interface table.  Interfaces without
+ * an address yet are left out; if two interfaces share an address the
+ * one added first wins, as it did with the old list walk.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rebuild_local_addrs(struct sr_instance* sr)
+{
+    unsigned int h;
+    int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    for(i = 0; i < SR_LOCAL_HASH_SZ; i++)
+    {
+        sr->local_addrs[i].ip = 0;
+        sr->local_addrs[i].ifindex = -1;
+    }
+
+    for(i = 0; i < sr->nif; i++)
+    {
+        if(sr->if_table[i]->ip == 0)
+        { continue; }
+
+        h = sr_local_hash(sr->if_table[i]->ip);
+        while(sr->local_addrs[h].ifindex >= 0 &&
+                sr->local_addrs[h].ip != sr->if_table[i]->ip)
+        { h = (h + 1) & (SR_LOCAL_HASH_SZ - 1); }
+
+        if(sr->local_addrs[h].ifindex < 0)
+        {
+            sr->local_addrs[h].ip = sr->if_table[i]->ip;
+            sr->local_addrs[h].ifindex = i;
+        }
+    }
+} /* -- sr_rebuild_local_addrs -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_find_local_addr(..)
+ * Scope: Global
+ *
+ * Return the interface owning ip_nbo, or 0 if the address is not one of
+ * the router's.  Usually a single probe.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_find_local_addr(struct sr_instance* sr, uint32_t ip_nbo)
+{
+    unsigned int h = sr_local_hash(ip_nbo);
+
+    while(sr->local_addrs[h].ifindex >= 0)
+    {
+        if(sr->local_addrs[h].ip == ip_nbo)
+        { return sr->if_table[sr->local_addrs[h].ifindex]; }
+        h = (h + 1) & (SR_LOCAL_HASH_SZ - 1);
+    }
+
+    return 0;
+} /* -- sr_find_local_addr -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_print_if_list(..)
  * Scope: Global
@@ -26,12 +26,18 @@
 
 #include "sr_protocol.h"
 
+#define SR_MAX_IF 32   /* interfaces per router */
+#define SR_LOCAL_HASH_BITS 7  /* local address table, keep well above SR_MAX_IF */
+#define SR_LOCAL_HASH_SZ (1 << SR_LOCAL_HASH_BITS)
+
 struct sr_instance;
 
 /* ----------------------------------------------------------------------------
  * struct sr_if
  *
- * Node in the interface list for each router
+ * Node in the interface list for each router.  Interfaces are also kept in
+ * sr->if_table, indexed by 'index'; the data path carries that index and
+ * only configuration and the VNS protocol deal in names.
  *
  * -------------------------------------------------------------------------- */
 
@@ -41,13 +47,32 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  int index;              /* slot in sr->if_table */
   struct sr_if* next;
 };
 
+/* ----------------------------------------------------------------------------
+ * struct sr_local_addr
+ *
+ * Slot in the router's local address table, an open addressed hash of
+ * every address the router owns (sr->local_addrs).  ifindex is -1 for an
+ * empty slot.  Rebuilt whenever an interface address changes.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_local_addr
+{
+  uint32_t ip;            /* network byte order */
+  int ifindex;
+};
+
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name);
-void sr_add_interface(struct sr_instance*, const char*);
+struct sr_if* sr_get_interface_idx(struct sr_instance* sr, int ifindex);
+int  sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
+void sr_rebuild_local_addrs(struct sr_instance*);
+struct sr_if* sr_find_local_addr(struct sr_instance*, uint32_t ip_nbo);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
 
@@ -0,0 +1,308 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_lz4.c
+ *
+ * Description:
+ *
+ * LZ4 block codec and frame header, see sr_lz4.h.
+ *
+ * A block is a run of sequences: a token (literal length in the high
+ * nibble, match length - 4 in the low one, 15 meaning "more in following
+ * bytes of 255 each"), the literals, a 2 byte little endian offset back
+ * into the block and the rest of the match length.  The last 5 bytes are
+ * always literals and no match starts in the last 12, which is what lets
+ * decoders copy in words; we keep to that so any decoder reads us.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "sr_lz4.h"
+
+#define SR_LZ4_MINMATCH   4
+#define SR_LZ4_LASTLITS   5
+#define SR_LZ4_MFLIMIT    12
+#define SR_LZ4_SKIP_TRIGGER 6    /* misses before the search step grows */
+
+static uint32_t sr_lz4_read32(const uint8_t* p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+} /* -- sr_lz4_read32 -- */
+
+static uint32_t sr_lz4_hash(uint32_t seq)
+{
+    return (seq * 2654435761u) >> (32 - SR_LZ4_HASH_LOG);
+} /* -- sr_lz4_hash -- */
+
+void sr_lz4_put32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+} /* -- sr_lz4_put32 -- */
+
+uint32_t sr_lz4_get32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+} /* -- sr_lz4_get32 -- */
+
+/* -- length beyond the token's 15, as a run of 255s and a remainder -- */
+static uint8_t* sr_lz4_put_len(uint8_t* op, unsigned int len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+} /* -- sr_lz4_put_len -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lz4_compress(..)
+ * Scope: Global
+ *
+ * Greedy: hash the next 4 bytes, take whatever the table remembers if
+ * it really matches, else move on, in bigger steps the longer nothing
+ * has matched so incompressible data goes through quickly.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_lz4_compress(const uint8_t* src, int n, uint8_t* dst, int cap,
+                    uint16_t* table)
+{
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + n;
+    const uint8_t* mflimit = end - SR_LZ4_MFLIMIT;
+    const uint8_t* matchlimit = end - SR_LZ4_LASTLITS;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + cap;
+    unsigned int lits;
+
+    if (n < 0 || n > SR_LZ4_BLOCK_MAX)
+    { return 0; }
+
+    memset(table, 0, SR_LZ4_HASH_SIZE * sizeof(uint16_t));
+
+    if (n > SR_LZ4_MFLIMIT)
+    {
+        unsigned int misses = 1 << SR_LZ4_SKIP_TRIGGER;
+
+        ip++;
+        while (ip < mflimit)
+        {
+            uint32_t seq = sr_lz4_read32(ip);
+            uint32_t h = sr_lz4_hash(seq);
+            const uint8_t* ref = src + table[h];
+            unsigned int mlen;
+            uint8_t* token;
+
+            table[h] = ip - src;
+            if (ref >= ip || sr_lz4_read32(ref) != seq)
+            {
+                ip += misses++ >> SR_LZ4_SKIP_TRIGGER;
+                continue;
+            }
+            misses = 1 << SR_LZ4_SKIP_TRIGGER;
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+            mlen = SR_LZ4_MINMATCH;
+            while (ip + mlen < matchlimit && ip[mlen] == ref[mlen])
+            { mlen++; }
+
+            lits = ip - anchor;
+            if (op + 1 + lits / 255 + 1 + lits + 2 + mlen / 255 + 1 > oend)
+            { return 0; }
+
+            token = op++;
+            *token = (lits >= 15 ? 15 : lits) << 4;
+            if (lits >= 15)
+            { op = sr_lz4_put_len(op, lits - 15); }
+            memcpy(op, anchor, lits);
+            op += lits;
+
+            *op++ = (ip - ref);
+            *op++ = (ip - ref) >> 8;
+
+            mlen -= SR_LZ4_MINMATCH;
+            *token |= mlen >= 15 ? 15 : mlen;
+            if (mlen >= 15)
+            { op = sr_lz4_put_len(op, mlen - 15); }
+
+            ip += mlen + SR_LZ4_MINMATCH;
+            anchor = ip;
+
+            /* -- remember a position inside the match as well -- */
+            if (ip < mflimit)
+            { table[sr_lz4_hash(sr_lz4_read32(ip - 2))] = ip - 2 - src; }
+        }
+    }
+
+    lits = end - anchor;
+    if (op + 1 + lits / 255 + 1 + lits > oend)
+    { return 0; }
+    *op++ = (lits >= 15 ? 15 : lits) << 4;
+    if (lits >= 15)
+    { op = sr_lz4_put_len(op, lits - 15); }
+    memcpy(op, anchor, lits);
+    op += lits;
+
+    return op - dst;
+} /* -- sr_lz4_compress -- */
+
+int sr_lz4_decompress(const uint8_t* src, int n, uint8_t* dst, int cap)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + n;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + cap;
+
+    while (ip < iend)
+    {
+        unsigned int token = *ip++;
+        unsigned int len = token >> 4;
+        unsigned int off;
+        const uint8_t* ref;
+
+        if (len == 15)
+        {
+            unsigned int b;
+
+            do
+            {
+                if (ip >= iend)
+                { return -1; }
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if (len > (unsigned int)(iend - ip) || len > (unsigned int)(oend - op))
+        { return -1; }
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+
+        if (ip == iend)
+        { break; }          /* last sequence has no match */
+
+        if (iend - ip < 2)
+        { return -1; }
+        off = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (off == 0 || off > (unsigned int)(op - dst))
+        { return -1; }
+        ref = op - off;
+
+        len = token & 15;
+        if (len == 15)
+        {
+            unsigned int b;
+
+            do
+            {
+                if (ip >= iend)
+                { return -1; }
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += SR_LZ4_MINMATCH;
+        if (len > (unsigned int)(oend - op))
+        { return -1; }
+
+        /* -- byte at a time: the match may overlap what it produces -- */
+        while (len--)
+        { *op++ = *ref++; }
+    }
+
+    return op - dst;
+} /* -- sr_lz4_decompress -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xxh32(..)
+ * Scope: Global
+ *
+ * xxHash32, the frame format's checksum.
+ *
+ *---------------------------------------------------------------------*/
+
+#define SR_XXH_P1 2654435761u
+#define SR_XXH_P2 2246822519u
+#define SR_XXH_P3 3266489917u
+#define SR_XXH_P4  668265263u
+#define SR_XXH_P5  374761393u
+#define SR_XXH_ROTL(x, r) (((x) << (r)) | ((x) >> (32 - (r))))
+
+static uint32_t sr_xxh32_round(uint32_t acc, uint32_t in)
+{
+    acc += in * SR_XXH_P2;
+    acc = SR_XXH_ROTL(acc, 13);
+    return acc * SR_XXH_P1;
+} /* -- sr_xxh32_round -- */
+
+uint32_t sr_xxh32(const void* buf, size_t len, uint32_t seed)
+{
+    const uint8_t* p = (const uint8_t*)buf;
+    const uint8_t* end = p + len;
+    uint32_t h;
+
+    if (len >= 16)
+    {
+        uint32_t v1 = seed + SR_XXH_P1 + SR_XXH_P2;
+        uint32_t v2 = seed + SR_XXH_P2;
+        uint32_t v3 = seed;
+        uint32_t v4 = seed - SR_XXH_P1;
+
+        while (end - p >= 16)
+        {
+            v1 = sr_xxh32_round(v1, sr_lz4_get32(p));
+            v2 = sr_xxh32_round(v2, sr_lz4_get32(p + 4));
+            v3 = sr_xxh32_round(v3, sr_lz4_get32(p + 8));
+            v4 = sr_xxh32_round(v4, sr_lz4_get32(p + 12));
+            p += 16;
+        }
+        h = SR_XXH_ROTL(v1, 1) + SR_XXH_ROTL(v2, 7) + SR_XXH_ROTL(v3, 12) +
+            SR_XXH_ROTL(v4, 18);
+    }
+    else
+    { h = seed + SR_XXH_P5; }
+
+    h += len;
+
+    while (end - p >= 4)
+    {
+        h += sr_lz4_get32(p) * SR_XXH_P3;
+        h = SR_XXH_ROTL(h, 17) * SR_XXH_P4;
+        p += 4;
+    }
+    while (p < end)
+    {
+        h += *p++ * SR_XXH_P5;
+        h = SR_XXH_ROTL(h, 11) * SR_XXH_P1;
+    }
+
+    h ^= h >> 15;
+    h *= SR_XXH_P2;
+    h ^= h >> 13;
+    h *= SR_XXH_P3;
+    h ^= h >> 16;
+    return h;
+} /* -- sr_xxh32 -- */
+
+size_t sr_lz4_frame_header(uint8_t* p)
+{
+    sr_lz4_put32(p, SR_LZ4_MAGIC);
+    p[4] = 0x60;            /* version 01, independent blocks */
+    p[5] = 0x40;            /* 64 KiB max block size */
+    p[6] = (sr_xxh32(p + 4, 2, 0) >> 8) & 0xff;
+    return SR_LZ4_FRAME_HDR;
+} /* -- sr_lz4_frame_header -- */
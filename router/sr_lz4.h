@@ -0,0 +1,58 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_lz4.h
+ *
+ * Description:
+ *
+ * Just enough LZ4 (https://github.com/lz4/lz4/tree/dev/doc) for the
+ * capture writer and sr_capx: the block format, a greedy single-pass
+ * compressor in the style of LZ4_compress_fast(), a checked decompressor
+ * and the frame header.  Frames are written with independent blocks of
+ * at most SR_LZ4_BLOCK_MAX bytes and no checksums, so every block can be
+ * decoded on its own and `lz4 -d` reads the files.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LZ4_H
+#define SR_LZ4_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+#define SR_LZ4_BLOCK_MAX     65536        /* frame BD: 64 KiB blocks */
+#define SR_LZ4_HASH_LOG      12
+#define SR_LZ4_HASH_SIZE     (1 << SR_LZ4_HASH_LOG)
+
+#define SR_LZ4_MAGIC         0x184D2204
+#define SR_LZ4_SKIP_MAGIC    0x184D2A50   /* .. 0x184D2A5F */
+#define SR_LZ4_FRAME_HDR     7            /* magic, FLG, BD, HC */
+#define SR_LZ4_UNCOMPRESSED  0x80000000u  /* in a block size: stored raw */
+
+/* Worst case compressed size of n bytes. */
+#define SR_LZ4_BOUND(n)      ((n) + (n) / 255 + 16)
+
+/* Compress one block of n <= SR_LZ4_BLOCK_MAX bytes into dst, using
+   table (SR_LZ4_HASH_SIZE entries) as scratch.  Returns the compressed
+   size, 0 if it doesn't fit in cap. */
+int sr_lz4_compress(const uint8_t* src, int n, uint8_t* dst, int cap,
+                    uint16_t* table);
+
+/* Returns the decompressed size, -1 if the block is corrupt or needs
+   more than cap bytes. */
+int sr_lz4_decompress(const uint8_t* src, int n, uint8_t* dst, int cap);
+
+/* Frame header for independent 64 KiB blocks, SR_LZ4_FRAME_HDR bytes. */
+size_t sr_lz4_frame_header(uint8_t* p);
+
+uint32_t sr_xxh32(const void* buf, size_t len, uint32_t seed);
+
+void     sr_lz4_put32(uint8_t* p, uint32_t v);
+uint32_t sr_lz4_get32(const uint8_t* p);
+
+#endif /* -- SR_LZ4_H -- */
@@ -23,6 +23,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <signal.h>
 #include <sys/types.h>
 
 #ifdef _LINUX_
@@ -32,9 +33,21 @@
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_backend.h"
+#include "sr_pool.h"
+#include "sr_worker.h"
+#include "sr_slowpath.h"
+#include "sr_graph.h"
+#include "sr_capture.h"
+#include "sr_filter.h"
+#include "sr_trace.h"
+#include "sr_stats.h"
+#include "sr_mem.h"
 
 extern char* optarg;
 
+volatile sig_atomic_t sr_stop_requested = 0;
+
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
 
@@ -44,12 +57,18 @@ extern char* optarg;
 #define DEFAULT_SERVER "localhost"
 #define DEFAULT_RTABLE "rtable"
 #define DEFAULT_TOPO 0
+#define DEFAULT_BACKEND "vns"
+#define DEFAULT_SHM "sr-shm"
+#define SR_PKT_POOL_CHUNK 256
+#define SR_PKT_POOL_MAX 8192      /* 80 MB of packet buffers */
+#define SR_ARPREQ_POOL_MAX 1024   /* outstanding ARP requests */
 
 static void usage(char* );
-static void sr_init_instance(struct sr_instance* );
+static void sr_init_instance(struct sr_instance* , unsigned long );
 static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static void sr_install_stop_handler(void);
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -65,11 +84,30 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    char *capfilter = 0;
+    unsigned int capsample = 0;
+    char *backend = DEFAULT_BACKEND;
+    char *ifspec = 0;
+    char *shm_name = DEFAULT_SHM;
+    int use_uring = 0;
+    int nworkers = 0;
+    int cpus[SR_MAX_WORKERS];
+    int ncpus = 0;
+    unsigned int slow_rate = SR_SLOW_RATE;
+    unsigned long pkt_max = SR_PKT_POOL_MAX;
+    unsigned int busy_poll_us = 0;
+    unsigned int trace_entries = 0;
+    char *trace_file = SR_TRACE_FILE;
+    char *stats_name = SR_STATS_NAME;
+    struct sr_capture_config capcfg;
+    struct sr_backend_config cfg;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    memset(&capcfg, 0, sizeof(capcfg));
+
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:Ub:i:m:w:c:S:B:C:G:W:F:n:ze:E:M:P:")) != EOF)
     {
         switch (c)
         {
@@ -101,11 +139,86 @@ int main(int argc, char **argv)
             case 'T':
                 template = optarg;
                 break;
+            case 'U':
+                use_uring = 1;
+                break;
+            case 'b':
+                backend = optarg;
+                break;
+            case 'i':
+                ifspec = optarg;
+                break;
+            case 'm':
+                shm_name = optarg;
+                break;
+            case 'w':
+                nworkers = atoi((char *) optarg);
+                break;
+            case 'c':
+                if((ncpus = sr_parse_cpulist(optarg, cpus, SR_MAX_WORKERS)) < 0)
+                {
+                    fprintf(stderr,"Bad cpu list %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'S':
+                slow_rate = atoi((char *) optarg);
+                break;
+            case 'B':
+                busy_poll_us = atoi((char *) optarg);
+                break;
+            case 'C':
+                capcfg.rotate_bytes = strtoul(optarg, 0, 10) * 1000000ul;
+                break;
+            case 'G':
+                capcfg.rotate_secs = atoi((char *) optarg);
+                break;
+            case 'W':
+                capcfg.max_files = atoi((char *) optarg);
+                break;
+            case 'F':
+                capfilter = optarg;
+                break;
+            case 'n':
+                capsample = atoi((char *) optarg);
+                break;
+            case 'z':
+                capcfg.compress = 1;
+                break;
+            case 'e':
+                trace_entries = atoi((char *) optarg);
+                break;
+            case 'E':
+                trace_file = optarg;
+                break;
+            case 'M':
+                stats_name = optarg;
+                break;
+            case 'P':
+                pkt_max = strtoul(optarg, 0, 10);
+                break;
         } /* switch */
     } /* -- while -- */
 
     /* -- zero out sr instance -- */
-    sr_init_instance(&sr);
+    sr_init_instance(&sr, pkt_max);
+
+    if((sr.backend = sr_backend_find(backend)) == 0)
+    {
+        fprintf(stderr,"Unknown backend %s\n", backend);
+        usage(argv[0]);
+        exit(1);
+    }
+    sr.use_uring = use_uring;
+
+    if(busy_poll_us && !sr.backend->rx_ready)
+    {
+        fprintf(stderr,"%s backend can't busy poll, ignoring -B\n",
+                sr.backend->name);
+        busy_poll_us = 0;
+    }
+    sr.busy_poll.budget_us = busy_poll_us;
+    sr.busy_poll.spin_us = busy_poll_us;
 
     /* -- set up routing table from file -- */
     if(template == NULL) {
@@ -123,26 +236,37 @@ int main(int argc, char **argv)
     else
     { strncpy(sr.user, user, 32); }
 
-    /* -- set up file pointer for logging of raw packets -- */
-    if(logfile != 0)
-    {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
-        {
-            fprintf(stderr,"Error opening up dump file %s\n",
-                    logfile);
-            exit(1);
-        }
-    }
-
     Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
     if(template)
         Debug("Requesting topology template %s\n", template);
     else
         Debug("Requesting topology %d\n", topo);
 
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    /* -- kill -USR1 prints heap use by subsystem -- */
+    if(sr_mem_init() != 0)
+    {
+        return 1;
+    }
+
+    /* -- before any thread starts, they each pick up a trace ring and
+          a counter block -- */
+    if(trace_entries > 0 && sr_trace_init(trace_entries, trace_file) != 0)
+    {
+        return 1;
+    }
+    if(sr_stats_init(stats_name) != 0)
+    {
+        return 1;
+    }
+    sr_trace_thread("rx");
+    sr_stats_thread("rx");
+
+    /* connect to server (or open devices) and negotiate session */
+    cfg.server = server;
+    cfg.port   = port;
+    cfg.ifspec = ifspec;
+    cfg.shm_name = shm_name;
+    if(sr.backend->open(&sr, &cfg) != 0)
     {
         return 1;
     }
@@ -156,15 +280,71 @@ int main(int argc, char **argv)
       sr_load_rt_wrap(&sr, rtable);
     }
 
+    /* learn the router's interfaces */
+    if(sr.backend->discover(&sr) != 0)
+    {
+        fprintf(stderr,"Error discovering interfaces (%s backend)\n",
+                sr.backend->name);
+        sr_destroy_instance(&sr);
+        return 1;
+    }
+    sr_stats_set_ifs(&sr);
+
+    /* -- set up packet capture, its files describe the interfaces -- */
+    if(logfile != 0)
+    {
+        capcfg.fname = logfile;
+        if(capfilter || capsample > 1)
+        {
+            capcfg.filter = sr_filter_compile(&sr, capfilter ? capfilter : "");
+            if(!capcfg.filter)
+            {
+                fprintf(stderr,"Bad capture filter\n");
+                sr_destroy_instance(&sr);
+                return 1;
+            }
+            sr_filter_set_sample(capcfg.filter, capsample);
+        }
+        sr.capture = sr_capture_open(&sr, &capcfg);
+        if(!sr.capture)
+        {
+            fprintf(stderr,"Error opening up dump file %s\n",
+                    logfile);
+            sr_destroy_instance(&sr);
+            return 1;
+        }
+    }
+    else if(capfilter || capsample)
+    { fprintf(stderr,"Capture filter ignored without -l\n"); }
+
+    if(sr_verify_routing_table(&sr) != 0)
+    {
+        fprintf(stderr,"Routing table not consistent with hardware\n");
+        sr_destroy_instance(&sr);
+        return 1;
+    }
+    sr_stats_set_routes(&sr);
+    printf(" <-- Ready to process packets --> \n");
+
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
+    if(sr_slowpath_start(&sr, slow_rate) != 0 ||
+       sr_workers_start(&sr, nworkers, cpus, ncpus) != 0)
+    {
+        sr_destroy_instance(&sr);
+        return 1;
+    }
+
+    sr_install_stop_handler();
+
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    while( sr_backend_poll(&sr) == 1);
 
     sr_destroy_instance(&sr);
 
-    return 0;
+    /* -- built with ALLOC_CHECK=1, heap use on the packet path fails the run -- */
+    return sr_alloc_check_report(stderr) ? 1 : 0;
 }/* -- main -- */
 
 /*-----------------------------------------------------------------------------
@@ -178,9 +358,20 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
-    printf("   defaults server=%s port=%d host=%s  \n",
-            DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
+    printf("           [-l log file] [-U (use io_uring)] \n");
+    printf("           [-b backend (vns|tap|packet|xdp|shm)] [-i dev[=ip],dev[=ip],...] \n");
+    printf("           [-m shm segment] [-w workers] [-c cpu,cpu,...] \n");
+    printf("           [-S slow path pps, 0 = inline] [-B busy poll usecs] \n");
+    printf("           [-C rotate log every MB] [-G rotate log every secs] \n");
+    printf("           [-W keep this many rotated logs] \n");
+    printf("           [-F capture filter, or @file of tcpdump -ddd output] \n");
+    printf("           [-n capture 1 in n filtered frames] [-z compress log (lz4)] \n");
+    printf("           [-e trace ring entries per thread] [-E trace file] \n");
+    printf("           [-M stats segment for sr_stat] \n");
+    printf("           [-P packet buffer limit, 0 = none] \n");
+    printf("   defaults server=%s port=%d host=%s shm=%s slow path=%d pps stats=%s \n",
+            DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST, DEFAULT_SHM, SR_SLOW_RATE,
+            SR_STATS_NAME );
 } /* -- usage -- */
 
 /*-----------------------------------------------------------------------------
@@ -208,6 +399,30 @@ void sr_set_user(struct sr_instance* sr)
 
 } /* -- sr_set_user -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_install_stop_handler(..)
+ * Scope: local
+ *
+ * SIGINT/SIGTERM interrupt the blocking read from the server (no
+ * SA_RESTART) so the main loop can exit and print statistics.
+ *---------------------------------------------------------------------------*/
+
+static void sr_stop_handler(int sig)
+{
+    sr_stop_requested = 1;
+}
+
+static void sr_install_stop_handler(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sr_stop_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+} /* -- sr_install_stop_handler -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_destroy_instance(..)
  * Scope: Local
@@ -220,11 +435,32 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    /* -- workers still transmit through the backend -- */
+    sr_workers_stop(sr);
+    sr_slowpath_stop(sr);
+
+    if(sr->backend)
     {
-        sr_dump_close(sr->logfile);
+        sr_backend_close(sr);
     }
 
+    if(sr->capture)
+    {
+        sr_capture_close(sr->capture);
+    }
+
+    sr_graph_print_stats(stderr);
+    sr_pool_print_stats(stderr);
+    sr_stats_report(stderr);
+    sr_mem_report(stderr);
+
+    if(sr_trace_on && sr_trace_dump() != 0)
+    {
+        perror("sr_trace_dump");
+    }
+
+    sr_stats_close();
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -237,7 +473,7 @@ static void sr_destroy_instance(struct sr_instance* sr)
  *
  *----------------------------------------------------------------------------*/
 
-static void sr_init_instance(struct sr_instance* sr)
+static void sr_init_instance(struct sr_instance* sr, unsigned long pkt_max)
 {
     /* REQUIRES */
     assert(sr);
@@ -247,60 +483,36 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
+    memset(sr->if_table, 0, sizeof(sr->if_table));
+    sr->nif = 0;
+    sr_rebuild_local_addrs(sr);
     sr->routing_table = 0;
-    sr->logfile = 0;
-} /* -- sr_init_instance -- */
-
-/*-----------------------------------------------------------------------------
- * Method: sr_verify_routing_table()
- * Scope: Global
- *
- * make sure the routing table is consistent with the interface list by
- * verifying that all interfaces used in the routing table actually exist
- * in the hardware.
- *
- * RETURN VALUES:
- *
- *  0 on success
- *  something other than zero on error
- *
- *---------------------------------------------------------------------------*/
-
-int sr_verify_routing_table(struct sr_instance* sr)
-{
-    struct sr_rt* rt_walker = 0;
-    struct sr_if* if_walker = 0;
-    int ret = 0;
-
-    /* -- REQUIRES --*/
-    assert(sr);
-
-    if( (sr->if_list == 0) || (sr->routing_table == 0))
+    sr->capture = 0;
+    sr->backend = 0;
+    sr->backend_data = 0;
+    sr->use_uring = 0;
+    sr->uring = 0;
+    sr->vns_v2 = 0;
+    sr->workers = 0;
+    sr->slowpath = 0;
+    /* -- capped, so a flood drops (counted as no buffer) rather than
+          growing the heap; queued ARP packets each hold a buffer -- */
+    sr->pkt_pool = sr_pool_create("pkt", SR_PKT_BUF_SIZE, SR_PKT_POOL_CHUNK,
+                                  pkt_max, SR_MEM_PACKET);
+    sr->arpq_pool = sr_pool_create("arpq", sizeof(struct sr_packet),
+                                   SR_PKT_POOL_CHUNK, pkt_max, SR_MEM_ARP);
+    sr->arpreq_pool = sr_pool_create("arpreq", sizeof(struct sr_arpreq),
+                                     SR_ARPCACHE_SZ, SR_ARPREQ_POOL_MAX,
+                                     SR_MEM_ARP);
+    if(!sr->pkt_pool || !sr->arpq_pool || !sr->arpreq_pool)
     {
-        return 999; /* doh! */
+        fprintf(stderr,"Error: out of memory (packet pools)\n");
+        exit(1);
     }
-
-    rt_walker = sr->routing_table;
-
-    while(rt_walker)
-    {
-        /* -- check to see if interface exists -- */
-        if_walker = sr->if_list;
-        while(if_walker)
-        {
-            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
-                    == 0)
-            { break; }
-            if_walker = if_walker->next;
-        }
-        if(if_walker == 0)
-        { ret++; } /* -- interface not found! -- */
-
-        rt_walker = rt_walker->next;
-    } /* -- while -- */
-
-    return ret;
-} /* -- sr_verify_routing_table -- */
+    memset(&sr->vns_stats, 0, sizeof(sr->vns_stats));
+    memset(&sr->io_stats, 0, sizeof(sr->io_stats));
+    memset(&sr->busy_poll, 0, sizeof(sr->busy_poll));
+} /* -- sr_init_instance -- */
 
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     if(sr_load_rt(sr, rtable) != 0) {
@@ -0,0 +1,319 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_mem.c
+ *
+ * Description:
+ *
+ * Heap accounting by subsystem, see sr_mem.h.
+ *
+ *   | sr_mem_hdr | caller's n bytes ... |
+ *   ^ malloc'd    ^ returned
+ *
+ * Aligned blocks have some slack in front of the header; its offset
+ * field leads back to what malloc returned.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "sr_mem.h"
+
+struct sr_mem_hdr
+{
+    uint32_t tag;
+    uint32_t offset;      /* from the malloc'd address to the caller's */
+    uint64_t size;        /* what the caller asked for */
+};
+
+static const char* sr_mem_names[] =
+{
+#define SR_MEM_NAME(id, name) name,
+    SR_MEM_TAGS(SR_MEM_NAME)
+#undef SR_MEM_NAME
+};
+
+/* -- until sr_mem_attach(..) -- */
+static struct sr_mem_counter sr_mem_private[SR_MEM_SLOTS];
+
+static struct sr_mem_counter* sr_mem_tab = sr_mem_private;
+
+static void sr_mem_add(struct sr_mem_counter* c, uint64_t n)
+{
+    uint64_t live = __atomic_add_fetch(&c->live, n, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&c->peak, &peak, live, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    { }
+} /* -- sr_mem_add -- */
+
+static void sr_mem_got(unsigned int tag, uint64_t n)
+{
+    sr_mem_add(&sr_mem_tab[tag], n);
+    sr_mem_add(&sr_mem_tab[SR_MEM_TOTAL], n);
+    __atomic_add_fetch(&sr_mem_tab[tag].allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sr_mem_tab[SR_MEM_TOTAL].allocs, 1, __ATOMIC_RELAXED);
+} /* -- sr_mem_got -- */
+
+static void sr_mem_gone(unsigned int tag, uint64_t n)
+{
+    __atomic_sub_fetch(&sr_mem_tab[tag].live, n, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&sr_mem_tab[SR_MEM_TOTAL].live, n, __ATOMIC_RELAXED);
+} /* -- sr_mem_gone -- */
+
+static void* sr_mem_failed(unsigned int tag)
+{
+    __atomic_add_fetch(&sr_mem_tab[tag].failures, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sr_mem_tab[SR_MEM_TOTAL].failures, 1, __ATOMIC_RELAXED);
+    return 0;
+} /* -- sr_mem_failed -- */
+
+void* sr_mem_memalign(unsigned int tag, size_t align, size_t n)
+{
+    struct sr_mem_hdr* h;
+    uint8_t* base;
+    uintptr_t p;
+
+    assert(tag < SR_MEM_COUNT);
+    assert(align >= sizeof(struct sr_mem_hdr) && (align & (align - 1)) == 0);
+
+    if (n > (size_t)-1 - sizeof(*h) - align ||
+            (base = (uint8_t*)malloc(sizeof(*h) + align - 1 + n)) == 0)
+    { return sr_mem_failed(tag); }
+
+    p = ((uintptr_t)base + sizeof(*h) + align - 1) & ~(uintptr_t)(align - 1);
+    h = (struct sr_mem_hdr*)p - 1;
+    h->tag = tag;
+    h->offset = (uint32_t)(p - (uintptr_t)base);
+    h->size = n;
+    sr_mem_got(tag, n);
+
+    return (void*)p;
+} /* -- sr_mem_memalign -- */
+
+void* sr_mem_malloc(unsigned int tag, size_t n)
+{
+    struct sr_mem_hdr* h;
+
+    assert(tag < SR_MEM_COUNT);
+
+    if (n > (size_t)-1 - sizeof(*h) ||
+            (h = (struct sr_mem_hdr*)malloc(sizeof(*h) + n)) == 0)
+    { return sr_mem_failed(tag); }
+
+    h->tag = tag;
+    h->offset = sizeof(*h);
+    h->size = n;
+    sr_mem_got(tag, n);
+
+    return h + 1;
+} /* -- sr_mem_malloc -- */
+
+void* sr_mem_calloc(unsigned int tag, size_t n, size_t size)
+{
+    void* p;
+
+    if (size && n > (size_t)-1 / size)
+    { return sr_mem_failed(tag); }
+    if ((p = sr_mem_malloc(tag, n * size)) != 0)
+    { memset(p, 0, n * size); }
+
+    return p;
+} /* -- sr_mem_calloc -- */
+
+void* sr_mem_realloc(unsigned int tag, void* p, size_t n)
+{
+    struct sr_mem_hdr* h;
+    uint64_t old;
+
+    if (!p)
+    { return sr_mem_malloc(tag, n); }
+
+    h = (struct sr_mem_hdr*)p - 1;
+    assert(h->offset == sizeof(*h));
+    tag = h->tag;
+    old = h->size;
+
+    if (n > (size_t)-1 - sizeof(*h) ||
+            (h = (struct sr_mem_hdr*)realloc(h, sizeof(*h) + n)) == 0)
+    { return sr_mem_failed(tag); }
+
+    h->size = n;
+    sr_mem_gone(tag, old);
+    sr_mem_got(tag, n);
+
+    return h + 1;
+} /* -- sr_mem_realloc -- */
+
+void sr_mem_free(void* p)
+{
+    struct sr_mem_hdr* h;
+
+    if (!p)
+    { return; }
+
+    h = (struct sr_mem_hdr*)p - 1;
+    assert(h->tag < SR_MEM_COUNT);
+    sr_mem_gone(h->tag, h->size);
+    free((uint8_t*)p - h->offset);
+} /* -- sr_mem_free -- */
+
+void sr_mem_attach(struct sr_mem_counter* tab)
+{
+    assert(tab);
+
+    memcpy(tab, sr_mem_tab, SR_MEM_SLOTS * sizeof(*tab));
+    sr_mem_tab = tab;
+} /* -- sr_mem_attach -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_mem_put(..)
+ * Scope: Local
+ *
+ * Append s to buf at len, padded to width (negative to left justify),
+ * keeping room for the terminating nul.  Returns the new length.  No
+ * stdio, so the signal handler can format with it.
+ *
+ *---------------------------------------------------------------------*/
+
+static size_t sr_mem_put(char* buf, size_t size, size_t len, const char* s,
+                         int width)
+{
+    size_t n = strlen(s);
+    size_t pad = 0;
+
+    if (width > 0 && n < (size_t)width)
+    { pad = width - n; }
+    while (pad-- > 0 && len + 1 < size)
+    { buf[len++] = ' '; }
+    while (*s && len + 1 < size)
+    { buf[len++] = *s++; }
+    if (width < 0)
+    {
+        for (pad = n; pad < (size_t)-width && len + 1 < size; pad++)
+        { buf[len++] = ' '; }
+    }
+    buf[len] = '\0';
+
+    return len;
+} /* -- sr_mem_put -- */
+
+/* -- v in decimal, with one place after the point if tenths is set -- */
+static size_t sr_mem_put_u64(char* buf, size_t size, size_t len, uint64_t v,
+                             int tenths, int width)
+{
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+
+    *--p = '\0';
+    if (tenths)
+    {
+        *--p = '0' + v % 10;
+        *--p = '.';
+        v /= 10;
+    }
+    do
+    { *--p = '0' + v % 10; }
+    while ((v /= 10) != 0);
+
+    return sr_mem_put(buf, size, len, p, width);
+} /* -- sr_mem_put_u64 -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_mem_format(..)
+ * Scope: Local
+ *
+ * The table as text into buf, for sr_mem_print(..) and the signal
+ * handler alike, so it is built by hand rather than with snprintf(3).
+ * Returns its length, cut short if buf is.
+ *
+ *---------------------------------------------------------------------*/
+
+static size_t sr_mem_format(char* buf, size_t size,
+                            const struct sr_mem_counter* tab)
+{
+    unsigned int i;
+    size_t len;
+
+    len = sr_mem_put(buf, size, 0, "memory", -10);
+    len = sr_mem_put(buf, size, len, " ", 0);
+    len = sr_mem_put(buf, size, len, "live KB", 12);
+    len = sr_mem_put(buf, size, len, " ", 0);
+    len = sr_mem_put(buf, size, len, "peak KB", 12);
+    len = sr_mem_put(buf, size, len, " ", 0);
+    len = sr_mem_put(buf, size, len, "allocs", 10);
+    len = sr_mem_put(buf, size, len, " ", 0);
+    len = sr_mem_put(buf, size, len, "failed", 8);
+    len = sr_mem_put(buf, size, len, "\n", 0);
+
+    for (i = 0; i < SR_MEM_SLOTS; i++)
+    {
+        const struct sr_mem_counter* c = &tab[i];
+
+        if (i < SR_MEM_COUNT && c->allocs == 0 && c->failures == 0)
+        { continue; }
+
+        /* -- KB to one place, rounded -- */
+        len = sr_mem_put(buf, size, len,
+                         i < SR_MEM_COUNT ? sr_mem_names[i] : "total", -10);
+        len = sr_mem_put(buf, size, len, " ", 0);
+        len = sr_mem_put_u64(buf, size, len, (c->live * 10 + 512) / 1024, 1, 12);
+        len = sr_mem_put(buf, size, len, " ", 0);
+        len = sr_mem_put_u64(buf, size, len, (c->peak * 10 + 512) / 1024, 1, 12);
+        len = sr_mem_put(buf, size, len, " ", 0);
+        len = sr_mem_put_u64(buf, size, len, c->allocs, 0, 10);
+        len = sr_mem_put(buf, size, len, " ", 0);
+        len = sr_mem_put_u64(buf, size, len, c->failures, 0, 8);
+        len = sr_mem_put(buf, size, len, "\n", 0);
+    }
+
+    return len;
+} /* -- sr_mem_format -- */
+
+void sr_mem_print(FILE* fp, const struct sr_mem_counter* tab)
+{
+    char buf[1024];
+
+    sr_mem_format(buf, sizeof(buf), tab);
+    fputs(buf, fp);
+} /* -- sr_mem_print -- */
+
+void sr_mem_report(FILE* fp)
+{
+    sr_mem_print(fp, sr_mem_tab);
+} /* -- sr_mem_report -- */
+
+/* -- only write(2) and sr_mem_format(..), both async-signal-safe -- */
+static void sr_mem_usr1(int sig)
+{
+    int saved = errno;
+    char buf[1024];
+    size_t len = sr_mem_format(buf, sizeof(buf), sr_mem_tab);
+
+    if (write(STDERR_FILENO, buf, len) < 0)
+    { }
+    errno = saved;
+} /* -- sr_mem_usr1 -- */
+
+int sr_mem_init(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = sr_mem_usr1;
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &sa, 0) != 0)
+    {
+        perror("sigaction:sr_mem.c::sr_mem_init");
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_mem_init -- */
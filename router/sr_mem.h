@@ -0,0 +1,88 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_mem.h
+ *
+ * Description:
+ *
+ * Heap use by subsystem.  The router's own malloc family calls go through
+ * sr_mem_*(..) with a tag naming the subsystem that owns the memory, and
+ * every tag keeps its live bytes, the highest live it has seen, and how
+ * many allocations it made and failed.  Each block starts with a 16 byte
+ * header holding its tag and size, so sr_mem_free(..) needs neither.
+ *
+ * Pools (sr_pool.h) count their slabs under the tag they were created
+ * with; objects handed out of a pool are not heap calls and show up in
+ * the pool stats instead.  Sizes are what the caller asked for, without
+ * malloc's own overhead.  mmap(2)ed rings and frame areas are not heap
+ * and not counted.
+ *
+ * Until sr_stats_init(..) the counters are private; after it they live
+ * in the stats segment, where sr_stat shows them.  kill -USR1 prints
+ * them to stderr, formatted by hand and written with write(2), so that
+ * printing from the handler is async-signal-safe and takes no stdio
+ * lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_MEM_H
+#define SR_MEM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_MEM_TAGS(X) \
+    X(PACKET,  "packet")   /* packet buffer pool */ \
+    X(ARP,     "arp")      /* pending requests and their queues */ \
+    X(ROUTE,   "route") \
+    X(IFACE,   "iface") \
+    X(VNS,     "vns")      /* session and message buffers */ \
+    X(BACKEND, "backend")  /* tap, packet, xdp, shm and io_uring state */ \
+    X(CAPTURE, "capture")  /* staging ring, blocks, index, filter */ \
+    X(THREAD,  "thread")   /* workers and the slow path */ \
+    X(TRACE,   "trace")
+
+#define SR_MEM_ENUM(id, name) SR_MEM_##id,
+enum sr_mem_tag { SR_MEM_TAGS(SR_MEM_ENUM) SR_MEM_COUNT };
+#undef SR_MEM_ENUM
+
+#define SR_MEM_TOTAL SR_MEM_COUNT          /* all tags together */
+#define SR_MEM_SLOTS (SR_MEM_COUNT + 1)    /* counters per table */
+
+struct sr_mem_counter
+{
+    uint64_t live;                    /* bytes */
+    uint64_t peak;                    /* highest live */
+    uint64_t allocs;
+    uint64_t failures;
+};
+
+/* As malloc(3), calloc(3), realloc(3) and free(3).  realloc keeps the
+   block's tag (tag is for p == 0) and can't move aligned blocks. */
+void* sr_mem_malloc(unsigned int tag, size_t n);
+void* sr_mem_calloc(unsigned int tag, size_t n, size_t size);
+void* sr_mem_realloc(unsigned int tag, void* p, size_t n);
+void  sr_mem_free(void* p);
+
+/* n bytes aligned to align, a power of 2; free with sr_mem_free(..). */
+void* sr_mem_memalign(unsigned int tag, size_t align, size_t n);
+
+/* Print the counters on SIGUSR1.  Returns 0 or -1. */
+int   sr_mem_init(void);
+
+/* Move the counters to tab (SR_MEM_SLOTS of them), before threads start. */
+void  sr_mem_attach(struct sr_mem_counter* tab);
+
+/* One line per tag that was ever used, and the total. */
+void  sr_mem_print(FILE* fp, const struct sr_mem_counter* tab);
+
+/* Print this router's counters. */
+void  sr_mem_report(FILE* fp);
+
+#endif /* -- SR_MEM_H -- */
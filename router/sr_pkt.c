@@ -0,0 +1,137 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pkt.c
+ *
+ * Description:
+ *
+ * Packet descriptors, see sr_pkt.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sr_router.h"
+#include "sr_pool.h"
+#include "sr_pkt.h"
+
+static void sr_pkt_pool_release(struct sr_pkt* pkt)
+{
+    sr_pool_put(pkt);
+}
+
+void sr_pkt_wrap(struct sr_pkt* pkt, uint8_t* buf, unsigned int len,
+                 unsigned int headroom, int ifindex)
+{
+    pkt->head    = buf - headroom;
+    pkt->off     = headroom;
+    pkt->len     = len;
+    pkt->end     = headroom + len;
+    pkt->ifindex = ifindex;
+    pkt->refcnt  = 1;
+    pkt->ts_ns   = 0;
+    pkt->lat_path = 0;
+    pkt->route   = -1;
+    pkt->release = 0;
+    pkt->ctx     = 0;
+} /* -- sr_pkt_wrap -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_alloc(..)
+ * Scope: Global
+ *
+ * The descriptor sits in the first SR_PKT_DESC_SIZE bytes of the pool
+ * buffer, so a packet costs one pool object and is freed with it.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_pkt* sr_pkt_alloc(struct sr_instance* sr, unsigned int headroom)
+{
+    struct sr_pkt* pkt;
+
+    assert(sizeof(struct sr_pkt) <= SR_PKT_DESC_SIZE);
+    assert(headroom <= SR_PKT_BUF_SIZE - SR_PKT_DESC_SIZE);
+
+    if ((pkt = (struct sr_pkt*)sr_pool_get(sr->pkt_pool)) == 0)
+    { return 0; }
+
+    pkt->head    = (uint8_t*)pkt + SR_PKT_DESC_SIZE;
+    pkt->off     = headroom;
+    pkt->len     = 0;
+    pkt->end     = SR_PKT_BUF_SIZE - SR_PKT_DESC_SIZE;
+    pkt->ifindex = -1;
+    pkt->refcnt  = 1;
+    pkt->ts_ns   = 0;
+    pkt->lat_path = 0;
+    pkt->route   = -1;
+    pkt->release = sr_pkt_pool_release;
+    pkt->ctx     = 0;
+
+    return pkt;
+} /* -- sr_pkt_alloc -- */
+
+uint8_t* sr_pkt_push(struct sr_pkt* pkt, unsigned int n)
+{
+    if (n > pkt->off)
+    { return 0; }
+
+    pkt->off -= n;
+    pkt->len += n;
+    return SR_PKT_DATA(pkt);
+} /* -- sr_pkt_push -- */
+
+uint8_t* sr_pkt_pull(struct sr_pkt* pkt, unsigned int n)
+{
+    if (n > pkt->len)
+    { return 0; }
+
+    pkt->off += n;
+    pkt->len -= n;
+    return SR_PKT_DATA(pkt);
+} /* -- sr_pkt_pull -- */
+
+uint8_t* sr_pkt_put(struct sr_pkt* pkt, unsigned int n)
+{
+    uint8_t* tail = SR_PKT_DATA(pkt) + pkt->len;
+
+    if (n > SR_PKT_TAILROOM(pkt))
+    { return 0; }
+
+    pkt->len += n;
+    return tail;
+} /* -- sr_pkt_put -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pkt_ref(..), sr_pkt_unref(..)
+ * Scope: Global
+ *
+ * References may be dropped from another thread (the ARP thread drains
+ * and expires queued packets), hence the atomics.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_pkt* sr_pkt_ref(struct sr_pkt* pkt)
+{
+    __atomic_add_fetch(&pkt->refcnt, 1, __ATOMIC_RELAXED);
+    return pkt;
+} /* -- sr_pkt_ref -- */
+
+void sr_pkt_unref(struct sr_pkt* pkt)
+{
+    if (!pkt)
+    { return; }
+
+    if (__atomic_sub_fetch(&pkt->refcnt, 1, __ATOMIC_ACQ_REL) == 0 &&
+            pkt->release)
+    { pkt->release(pkt); }
+} /* -- sr_pkt_unref -- */
+
+uint64_t sr_pkt_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+} /* -- sr_pkt_clock -- */
@@ -0,0 +1,97 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pkt.h
+ *
+ * Description:
+ *
+ * Packet descriptor.  Every frame the router handles, received or built
+ * locally, is described by a struct sr_pkt that points into a buffer with
+ * some room reserved in front of the data:
+ *
+ *   head                  head + off            head + off + len   head + end
+ *   |<----- headroom ----->|<-------- data -------->|<-- tailroom -->|
+ *
+ * Headers are prepended with sr_pkt_push() and stripped with
+ * sr_pkt_pull(), so replies and encapsulation (ethernet, IP, VNS framing)
+ * are written in place instead of being assembled from separate pieces.
+ *
+ * Received frames are usually borrowed: the descriptor lives on the stack
+ * and the buffer belongs to the backend until the burst is released.
+ * Packets from sr_pkt_alloc() own a pool buffer (descriptor, headroom and
+ * data in one object) and are freed when the last reference is dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PKT_H
+#define SR_PKT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_pool.h"
+
+#define SR_PKT_HEADROOM  128   /* reserved in front of locally built packets */
+#define SR_PKT_DESC_SIZE 64    /* descriptor slot at the start of a pool buffer */
+#define SR_PKT_DATA_MAX  (SR_PKT_BUF_SIZE - SR_PKT_DESC_SIZE - SR_PKT_HEADROOM)
+
+struct sr_instance;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pkt
+ *
+ * release is called when refcnt drops to 0; it is 0 for borrowed frames,
+ * which are never queued by reference (see sr_backend_hold()).  The
+ * graph fields are scratch space for sr_graph.c, only valid between the
+ * nodes that set and read them.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pkt
+{
+    uint8_t*     head;     /* start of the buffer */
+    unsigned int off;      /* data starts at head + off, i.e. the headroom */
+    unsigned int len;      /* bytes of data */
+    unsigned int end;      /* size of the buffer */
+    int          ifindex;  /* interface it arrived on, -1 if built locally */
+    int          refcnt;
+    uint32_t     next_hop; /* graph: set by ip4-lookup */
+    uint64_t     ts_ns;    /* receive time, CLOCK_MONOTONIC */
+    void       (*release)(struct sr_pkt* pkt);
+    void*        ctx;      /* for release */
+    int16_t      tx_ifindex;          /* graph: set by ip4-lookup */
+    uint8_t      icmp_type, icmp_code; /* graph: error for icmp-error */
+    uint8_t      lat_path; /* latency histogram sr_send_packet records
+                              ts_ns in, 0 for none (see sr_stats.h) */
+    int16_t      route;    /* sr_rt index of the route it is forwarded
+                              by, which sr_send_packet counts, -1 if none */
+};
+
+#define SR_PKT_DATA(p)     ((p)->head + (p)->off)
+#define SR_PKT_TAILROOM(p) ((p)->end - (p)->off - (p)->len)
+
+/* Describe a borrowed frame; headroom is how many bytes in front of buf
+   may be overwritten. */
+void sr_pkt_wrap(struct sr_pkt* pkt, uint8_t* buf, unsigned int len,
+                 unsigned int headroom, int ifindex);
+
+/* A new empty packet from sr->pkt_pool with 'headroom' bytes reserved,
+   or 0 if the pool is exhausted. */
+struct sr_pkt* sr_pkt_alloc(struct sr_instance* sr, unsigned int headroom);
+
+/* Prepend n bytes, returning the new start of data (0 if the headroom is
+   too small).  sr_pkt_pull() strips n bytes from the front, sr_pkt_put()
+   appends n bytes and returns where they start. */
+uint8_t* sr_pkt_push(struct sr_pkt* pkt, unsigned int n);
+uint8_t* sr_pkt_pull(struct sr_pkt* pkt, unsigned int n);
+uint8_t* sr_pkt_put(struct sr_pkt* pkt, unsigned int n);
+
+struct sr_pkt* sr_pkt_ref(struct sr_pkt* pkt);
+void sr_pkt_unref(struct sr_pkt* pkt);
+
+uint64_t sr_pkt_clock(void);
+
+#endif /* -- SR_PKT_H -- */
@@ -0,0 +1,394 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pool.c
+ *
+ * Description:
+ *
+ * Fixed size object pools with per-thread caches, see sr_pool.h.
+ *
+ *   slab:  | hdr | object ... | hdr | object ... | ...
+ *
+ * Each object is preceded by a small header naming its pool and linking
+ * it on the shared free list.  Objects start 16 byte aligned and each
+ * slot is padded to a whole number of cache lines.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "sr_pool.h"
+
+#define SR_POOL_LINE 64
+
+struct sr_pool_obj
+{
+    struct sr_pool*     pool;
+    struct sr_pool_obj* next;   /* shared free list link */
+};
+
+struct sr_pool
+{
+    char          name[16];
+    unsigned int  obj_size;
+    unsigned int  stride;       /* header + object, cache line multiple */
+    unsigned int  chunk;        /* objects per slab */
+    unsigned long max;          /* limit on total, 0 for none */
+    unsigned int  tag;          /* sr_mem tag of the slabs */
+    int           id;           /* slot in the thread caches, -1 if none */
+
+    pthread_mutex_t     lock;   /* protects everything below */
+    struct sr_pool_obj* free;
+    unsigned long total;
+    unsigned long out;
+    unsigned long high_water;
+    unsigned long grows;
+    unsigned long failures;
+};
+
+struct sr_pool_cache
+{
+    int n;
+    struct sr_pool_obj* obj[SR_POOL_CACHE];
+};
+
+static __thread struct sr_pool_cache sr_pool_tcache[SR_POOL_MAX];
+
+static struct sr_pool* sr_pools[SR_POOL_MAX];
+static int sr_npools;
+static pthread_mutex_t sr_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* -- its destructor empties an exiting thread's caches -- */
+static pthread_key_t sr_pool_exit_key;
+static pthread_once_t sr_pool_exit_once = PTHREAD_ONCE_INIT;
+static __thread int sr_pool_exit_set;
+
+static void sr_pool_give(struct sr_pool* pool, struct sr_pool_obj** src, int n);
+
+/*---------------------------------------------------------------------
+ * Method: sr_pool_grow_locked(..)
+ * Scope: Local
+ *
+ * Carve one more slab into free objects, the last one cut short at the
+ * limit.  Returns 0, or -1 at the limit or out of memory.  Slabs are
+ * never returned to the system.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pool_grow_locked(struct sr_pool* pool)
+{
+    unsigned char* slab;
+    struct sr_pool_obj* o;
+    unsigned int i, n = pool->chunk;
+
+    if (pool->max && pool->total + n > pool->max)
+    { n = pool->max - pool->total; }
+    if (n == 0 || (slab = (unsigned char*)sr_mem_malloc(pool->tag,
+                          (size_t)n * pool->stride)) == 0)
+    { return -1; }
+
+    for (i = n; i-- > 0; )
+    {
+        o = (struct sr_pool_obj*)(slab + (size_t)i * pool->stride);
+        o->pool = pool;
+        o->next = pool->free;
+        pool->free = o;
+    }
+    if (pool->total)
+    { pool->grows++; }
+    pool->total += n;
+
+    return 0;
+} /* -- sr_pool_grow_locked -- */
+
+struct sr_pool* sr_pool_create(const char* name, unsigned int obj_size,
+                               unsigned int chunk, unsigned long max,
+                               unsigned int tag)
+{
+    struct sr_pool* pool;
+
+    assert(name);
+    assert(obj_size > 0 && chunk > 0);
+
+    if ((pool = (struct sr_pool*)sr_mem_calloc(tag, 1, sizeof(struct sr_pool))) == 0)
+    { return 0; }
+
+    strncpy(pool->name, name, sizeof(pool->name) - 1);
+    pool->obj_size = obj_size;
+    pool->stride = (sizeof(struct sr_pool_obj) + obj_size + SR_POOL_LINE - 1) &
+                   ~(SR_POOL_LINE - 1);
+    pool->chunk = chunk;
+    pool->max = max;
+    pool->tag = tag;
+    pthread_mutex_init(&pool->lock, 0);
+
+    if (sr_pool_grow_locked(pool) != 0)
+    {
+        pthread_mutex_destroy(&pool->lock);
+        sr_mem_free(pool);
+        return 0;
+    }
+
+    pthread_mutex_lock(&sr_pools_lock);
+    pool->id = sr_npools < SR_POOL_MAX ? sr_npools : -1;
+    if (pool->id >= 0)
+    { sr_pools[sr_npools++] = pool; }
+    pthread_mutex_unlock(&sr_pools_lock);
+
+    if (pool->id < 0)
+    { fprintf(stderr, "pool %s: no thread cache (max %d pools)\n", name, SR_POOL_MAX); }
+
+    return pool;
+} /* -- sr_pool_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pool_thread_exit(..)
+ * Scope: Local
+ *
+ * Key destructor: give the objects an exiting thread still caches back
+ * to their pools, or they would be out for good.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_pool_thread_exit(void* unused)
+{
+    int i, n;
+
+    pthread_mutex_lock(&sr_pools_lock);
+    n = sr_npools;
+    pthread_mutex_unlock(&sr_pools_lock);
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_pool_cache* c = &sr_pool_tcache[i];
+
+        if (c->n)
+        {
+            sr_pool_give(sr_pools[i], c->obj, c->n);
+            c->n = 0;
+        }
+    }
+} /* -- sr_pool_thread_exit -- */
+
+static void sr_pool_exit_key_create(void)
+{
+    pthread_key_create(&sr_pool_exit_key, sr_pool_thread_exit);
+} /* -- sr_pool_exit_key_create -- */
+
+/* -- on a thread's first cached object: arrange for the flush at exit -- */
+static void sr_pool_exit_arm(void)
+{
+    if (sr_pool_exit_set)
+    { return; }
+
+    pthread_once(&sr_pool_exit_once, sr_pool_exit_key_create);
+    pthread_setspecific(sr_pool_exit_key, &sr_pool_exit_set);
+    sr_pool_exit_set = 1;
+} /* -- sr_pool_exit_arm -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pool_take(..)
+ * Scope: Local
+ *
+ * Move up to n objects from the shared list into dst, growing the pool
+ * if it is empty.  Returns how many were moved.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pool_take(struct sr_pool* pool, struct sr_pool_obj** dst, int n)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->free && sr_pool_grow_locked(pool) != 0)
+    { pool->failures++; }
+
+    for (i = 0; i < n && pool->free; i++)
+    {
+        dst[i] = pool->free;
+        pool->free = pool->free->next;
+    }
+    pool->out += i;
+    if (pool->out > pool->high_water)
+    { pool->high_water = pool->out; }
+    pthread_mutex_unlock(&pool->lock);
+
+    return i;
+} /* -- sr_pool_take -- */
+
+static void sr_pool_give(struct sr_pool* pool, struct sr_pool_obj** src, int n)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < n; i++)
+    {
+        src[i]->next = pool->free;
+        pool->free = src[i];
+    }
+    pool->out -= n;
+    pthread_mutex_unlock(&pool->lock);
+} /* -- sr_pool_give -- */
+
+void* sr_pool_get(struct sr_pool* pool)
+{
+    struct sr_pool_cache* c;
+    struct sr_pool_obj* o;
+
+    if (pool->id < 0)
+    { return sr_pool_take(pool, &o, 1) ? (void*)(o + 1) : 0; }
+
+    c = &sr_pool_tcache[pool->id];
+    if (c->n == 0)
+    {
+        sr_pool_exit_arm();
+        if ((c->n = sr_pool_take(pool, c->obj, SR_POOL_CACHE / 2)) == 0)
+        { return 0; }
+    }
+
+    return c->obj[--c->n] + 1;
+} /* -- sr_pool_get -- */
+
+void sr_pool_put(void* obj)
+{
+    struct sr_pool_obj* o;
+    struct sr_pool_cache* c;
+
+    if (!obj)
+    { return; }
+
+    o = (struct sr_pool_obj*)obj - 1;
+    if (o->pool->id < 0)
+    {
+        sr_pool_give(o->pool, &o, 1);
+        return;
+    }
+
+    c = &sr_pool_tcache[o->pool->id];
+    if (c->n == 0)
+    { sr_pool_exit_arm(); }
+    else if (c->n == SR_POOL_CACHE)
+    {
+        /* -- hand back the older (colder) half, keep the recent ones -- */
+        sr_pool_give(o->pool, c->obj, SR_POOL_CACHE / 2);
+        memmove(c->obj, c->obj + SR_POOL_CACHE / 2,
+                SR_POOL_CACHE / 2 * sizeof(c->obj[0]));
+        c->n = SR_POOL_CACHE / 2;
+    }
+    c->obj[c->n++] = o;
+} /* -- sr_pool_put -- */
+
+void sr_pool_get_stats(struct sr_pool* pool, struct sr_pool_stats* st)
+{
+    pthread_mutex_lock(&pool->lock);
+    st->name = pool->name;
+    st->obj_size = pool->obj_size;
+    st->total = pool->total;
+    st->max = pool->max;
+    st->out = pool->out;
+    st->high_water = pool->high_water;
+    st->grows = pool->grows;
+    st->failures = pool->failures;
+    pthread_mutex_unlock(&pool->lock);
+} /* -- sr_pool_get_stats -- */
+
+void sr_pool_print_stats(FILE* fp)
+{
+    struct sr_pool_stats st;
+    int i, n;
+
+    pthread_mutex_lock(&sr_pools_lock);
+    n = sr_npools;
+    pthread_mutex_unlock(&sr_pools_lock);
+
+    for (i = 0; i < n; i++)
+    {
+        sr_pool_get_stats(sr_pools[i], &st);
+        fprintf(fp, "pool %s: %u B x %lu (limit %lu), %lu out, high water %lu, "
+                "%lu grows, %lu failures\n", st.name, st.obj_size, st.total,
+                st.max, st.out, st.high_water, st.grows, st.failures);
+    }
+} /* -- sr_pool_print_stats -- */
+
+#ifdef SR_ALLOC_CHECK
+
+/*---------------------------------------------------------------------
+ * Allocation check, see sr_pool.h.  The linker sends the router's own
+ * malloc family calls here (-Wl,--wrap=malloc,...); allocations made
+ * inside libc are not seen.
+ *
+ *---------------------------------------------------------------------*/
+
+#define SR_ALLOC_CHECK_SHOW 16   /* offending calls printed in full */
+
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t n);
+void  __real_free(void* p);
+
+static __thread int sr_alloc_guard;
+static unsigned long sr_alloc_hits;
+
+static void sr_alloc_note(const char* fn, size_t n, void* caller)
+{
+    unsigned long hit;
+
+    if (!sr_alloc_guard)
+    { return; }
+
+    hit = __atomic_add_fetch(&sr_alloc_hits, 1, __ATOMIC_RELAXED);
+    if (hit <= SR_ALLOC_CHECK_SHOW)
+    {
+        sr_alloc_guard = 0;
+        fprintf(stderr, "alloc check: %s(%lu) on the packet path from %p\n",
+                fn, (unsigned long)n, caller);
+        sr_alloc_guard = 1;
+    }
+} /* -- sr_alloc_note -- */
+
+void* __wrap_malloc(size_t n)
+{
+    sr_alloc_note("malloc", n, __builtin_return_address(0));
+    return __real_malloc(n);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+    sr_alloc_note("calloc", n * size, __builtin_return_address(0));
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t n)
+{
+    sr_alloc_note("realloc", n, __builtin_return_address(0));
+    return __real_realloc(p, n);
+}
+
+void __wrap_free(void* p)
+{
+    if (p)
+    { sr_alloc_note("free", 0, __builtin_return_address(0)); }
+    __real_free(p);
+}
+
+void sr_alloc_check_begin(void)
+{
+    sr_alloc_guard = 1;
+}
+
+void sr_alloc_check_end(void)
+{
+    sr_alloc_guard = 0;
+}
+
+unsigned long sr_alloc_check_report(FILE* fp)
+{
+    unsigned long hits = __atomic_load_n(&sr_alloc_hits, __ATOMIC_RELAXED);
+
+    fprintf(fp, "alloc check: %lu heap calls on the packet path\n", hits);
+    return hits;
+} /* -- sr_alloc_check_report -- */
+
+#endif /* SR_ALLOC_CHECK */
@@ -0,0 +1,101 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pool.h
+ *
+ * Description:
+ *
+ * Fixed size object pools for packet buffers and the small records that
+ * travel with them (ARP queue entries, ...).  Objects are carved from
+ * large slabs, kept on a shared free list and cached per thread, so a get
+ * or put normally touches only the calling thread's cache.  The shared
+ * list is locked only to move half a cache worth of objects at a time.
+ *
+ * Every object remembers its pool, so sr_pool_put() needs no pool
+ * argument.  Pools (and their slabs) live for the life of the process;
+ * the slabs are counted under the pool's sr_mem tag.  A pool grows up
+ * to its limit and then fails gets, so callers drop instead of memory
+ * growing without bound under load.  Objects a thread still caches are
+ * handed back to their pools when it exits.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_POOL_H
+#define SR_POOL_H
+
+#include <stdio.h>
+
+#include "sr_mem.h"
+
+#define SR_PKT_BUF_SIZE 10240  /* VNS frames are at most 10000 bytes */
+#define SR_POOL_MAX     8      /* pools that get a per-thread cache */
+#define SR_POOL_CACHE   64     /* objects cached per thread and pool */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pool_stats
+ *
+ * Occupancy is counted when objects leave or return to the shared free
+ * list, so 'out' includes objects parked in thread caches (at most
+ * SR_POOL_CACHE per thread) and keeps the fast path free of atomics.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pool_stats
+{
+    const char*   name;
+    unsigned int  obj_size;
+    unsigned long total;       /* objects carved from slabs */
+    unsigned long max;         /* limit on total, 0 for none */
+    unsigned long out;         /* in use or cached by a thread */
+    unsigned long high_water;  /* highest 'out' seen */
+    unsigned long grows;       /* slabs added after the first */
+    unsigned long failures;    /* gets that found the pool empty */
+};
+
+struct sr_pool;
+
+/* Create a pool of obj_size byte objects, growing chunk objects at a time
+   (the first chunk is allocated up front) up to max objects (0 for no
+   limit), its memory counted under tag (an SR_MEM_*). Returns 0 if out
+   of memory. */
+struct sr_pool* sr_pool_create(const char* name, unsigned int obj_size,
+                               unsigned int chunk, unsigned long max,
+                               unsigned int tag);
+
+/* Returns an object or 0 if the pool is empty and at its limit (or out
+   of memory); counted in the pool's failures. */
+void* sr_pool_get(struct sr_pool* pool);
+
+/* Give an object back to its pool. obj may be 0. */
+void  sr_pool_put(void* obj);
+
+void  sr_pool_get_stats(struct sr_pool* pool, struct sr_pool_stats* st);
+
+/* One line per pool created so far. */
+void  sr_pool_print_stats(FILE* fp);
+
+/* ----------------------------------------------------------------------------
+ * Allocation check
+ *
+ * Built with 'make ALLOC_CHECK=1' the router links with malloc, calloc,
+ * realloc and free wrapped, and any call made by router code between
+ * sr_alloc_check_begin() and sr_alloc_check_end() on the same thread is
+ * reported.  The backend brackets sr_handlepacket(..) with them, so once
+ * the pools are warm the packet path must not touch the heap at all.
+ * sr_alloc_check_report() prints the total and returns it; main() turns
+ * a nonzero total into a failing exit status.  Without ALLOC_CHECK all
+ * three compile to nothing.  'make check' builds sr_check.c this way,
+ * which replays a fixed packet mix through a stub backend under the
+ * check, so no server is needed.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifdef SR_ALLOC_CHECK
+void  sr_alloc_check_begin(void);
+void  sr_alloc_check_end(void);
+unsigned long sr_alloc_check_report(FILE* fp);
+#else
+#define sr_alloc_check_begin()    ((void)0)
+#define sr_alloc_check_end()      ((void)0)
+#define sr_alloc_check_report(fp) 0UL
+#endif
+
+#endif /* -- SR_POOL_H -- */
@@ -0,0 +1,52 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_probe.h
+ *
+ * Description:
+ *
+ * USDT (user level statically defined tracing) probes for perf, bpftrace
+ * and systemtap.  Built with systemtap's <sys/sdt.h> (the Makefile looks
+ * for it, make USDT=0 leaves the probes out) each probe is a single nop
+ * plus a note in the ELF file telling the tracer where its arguments
+ * are; nothing is called and nothing is read unless a tracer attaches.
+ * Without the header they compile to nothing.
+ *
+ *   bpftrace -e 'usdt:./sr:sr:packet__drop { @[arg0] = count(); }'
+ *   perf buildid-cache --add ./sr; perf record -e sdt_sr:route__lookup
+ *
+ * Probes, all in provider "sr" (addresses in network order):
+ *
+ *   packet__receive   (ifindex, len, frame)
+ *   packet__transmit  (ifindex, len, frame)
+ *   packet__drop      (reason, len)           reason: SR_DROP_* (sr_stats.h)
+ *   route__lookup     (dst, route, mask, ifindex)   ifindex -1 for no route
+ *   arp__hit          (ip)
+ *   arp__miss         (ip)
+ *   arp__insert       (ip, mac, released)     released: a request was waiting
+ *   arp__expire       (ip)
+ *   arp__request      (ip, ifindex, tries)
+ *   icmp__send        (type, code, dst, ifindex)
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PROBE_H
+#define SR_PROBE_H
+
+#ifdef SR_HAVE_SDT
+
+#include <sys/sdt.h>
+
+#define SR_PROBE1(name, a)          DTRACE_PROBE1(sr, name, a)
+#define SR_PROBE2(name, a, b)       DTRACE_PROBE2(sr, name, a, b)
+#define SR_PROBE3(name, a, b, c)    DTRACE_PROBE3(sr, name, a, b, c)
+#define SR_PROBE4(name, a, b, c, d) DTRACE_PROBE4(sr, name, a, b, c, d)
+
+#else
+
+#define SR_PROBE1(name, a)          do { } while (0)
+#define SR_PROBE2(name, a, b)       do { } while (0)
+#define SR_PROBE3(name, a, b, c)    do { } while (0)
+#define SR_PROBE4(name, a, b, c, d) do { } while (0)
+
+#endif /* SR_HAVE_SDT */
+
+#endif /* -- SR_PROBE_H -- */
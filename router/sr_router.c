@@ -21,6 +21,12 @@
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
 #include "sr_utils.h"
+#include "sr_pool.h"
+#include "sr_pkt.h"
+#include "sr_graph.h"
+#include "sr_trace.h"
+#include "sr_stats.h"
+#include "sr_probe.h"
 
 
 
@@ -45,6 +51,7 @@ void sr_init(struct sr_instance* sr)
 
     /* Initialize cache and cache cleanup thread */
     sr_arpcache_init(&(sr->cache));
+    sr->cache.sr = sr;
 
     pthread_attr_init(&(sr->attr));
     pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
@@ -59,54 +66,101 @@ void sr_init(struct sr_instance* sr)
 } /* -- sr_init -- */
 
 /*---------------------------------------------------------------------
- * Method: sr_handlepacket(uint8_t* p,char* interface)
+ * Method: sr_queue_for_arp(..)
+ * Scope:  Local
+ *
+ * Queue pkt until next_hop resolves and send the first ARP request; a
+ * datagram being forwarded goes in untouched with 'forward' set.  The
+ * ARP thread and other workers walk the request queue too, so the cache
+ * lock is held until the request has been serviced.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_queue_for_arp(struct sr_instance* sr, uint32_t next_hop,
+        struct sr_pkt* pkt, int ifindex, int forward)
+{
+    struct sr_arpreq * req;
+
+    pthread_mutex_lock(&(sr->cache.lock));
+    req = sr_arpcache_queuereq(&(sr->cache), next_hop, pkt, ifindex, forward);
+    if (req)
+        handle_arpreq(sr, req);
+    pthread_mutex_unlock(&(sr->cache.lock));
+} /* -- sr_queue_for_arp -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_handlepacket(struct sr_pkt* pkt)
  * Scope:  Global
  *
  * This method is called each time the router receives a packet on the
- * interface.  The packet buffer, the packet length and the receiving
- * interface are passed in as parameters. The packet is complete with
- * ethernet headers.
+ * interface.  pkt describes the frame (complete with ethernet headers)
+ * and pkt->ifindex is the receiving interface (sr->if_table).
  *
- * Note: Both the packet buffer and the character's memory are handled
- * by sr_vns_comm.c that means do NOT delete either.  Make a copy of the
- * packet instead if you intend to keep it around beyond the scope of
- * the method call.
+ * A vector of one through the forwarding graph (sr_graph.h): transit
+ * packets with a resolved next hop are forwarded there, the rest end up
+ * in sr_handle_exception(..), on the slow path thread if there is one.
+ * Bursts go to sr_graph_run(..) directly.
+ *
+ * Note: The packet is lent by the backend, do NOT free it.
  *
  *---------------------------------------------------------------------*/
 
 void sr_handlepacket(struct sr_instance* sr,
-        uint8_t * packet/* lent */,
-        unsigned int len,
-        char* interface/* lent */)
+        struct sr_pkt* pkt /* lent */)
 {
     /* REQUIRES */
     assert(sr);
-    assert(packet);
-    assert(interface);
-
-    printf("*** -> Received packet of length %d \n",len);
+    assert(pkt);
 
-    /* Sanity check still needed!!!!!!!!!!!!!!*/
-    /* ****************************************/
+    sr_graph_run(sr, &pkt, 1);
+} /* -- sr_handlepacket -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_handle_exception(struct sr_pkt* pkt)
+ * Scope:  Global
+ *
+ * Everything the forwarding graph punts to its slow-path node: ARP,
+ * packets for the router itself, ICMP errors and next hops still being
+ * resolved.
+ *
+ * Note: The packet is lent, do NOT free it.  Replies that fit are built
+ * in place in its buffer; anything kept beyond the scope of the method
+ * call is held through sr_arpcache_queuereq(..).
+ *
+ *---------------------------------------------------------------------*/
 
+void sr_handle_exception(struct sr_instance* sr,
+        struct sr_pkt* pkt /* lent */)
+{
+    uint8_t * packet = SR_PKT_DATA(pkt);
+    unsigned int len = pkt->len;
+    struct sr_if* in_if = sr_get_interface_idx(sr, pkt->ifindex);
 
+    /* REQUIRES */
+    assert(sr);
+    assert(pkt);
+    assert(in_if);
 
-    /*print_hdrs(packet, len);*/
+    if (len < sizeof(sr_ethernet_hdr_t))
+    {
+        SR_STATS_DROP(SHORT_FRAME, len);
+        return;
+    }
 
-    /*printf("interface: %s", interface);*/
     uint16_t ether_type = ethertype(packet);
     /* Initialize ethernet header */
     sr_ethernet_hdr_t *ether_hdr = (sr_ethernet_hdr_t *) packet;
 
-    sr_print_routing_table(sr);
-
+    SR_TRACE(EXC_RX, len, pkt->ifindex, ether_type, 0);
 
     /* Determine the type of frame */
     if (ether_type == ethertype_arp){
         /* ARP packet */
-        printf("ARP Packet \n");
-        print_hdrs(packet, len);
+        if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+        {
+            SR_STATS_DROP(SHORT_ARP, len);
+            return;
+        }
         sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
         unsigned short ar_op = ntohs(arp_hdr->ar_op);
 
@@ -117,70 +171,27 @@ void sr_handlepacket(struct sr_instance* sr,
 
             /* Find the interface matching with the ARP tip */
             struct sr_if* target_if = find_tip_in_router(sr, arp_hdr->ar_tip);
-            /* Initialize a new ethernet header */
-            struct sr_ethernet_hdr *ether_hdr_reply = (struct sr_ethernet_hdr *) malloc(sizeof(sr_ethernet_hdr_t));
-            /* Initialize a new arp header/packet */
-            struct sr_arp_hdr *arp_hdr_reply = (sr_arp_hdr_t *) malloc(sizeof(sr_arp_hdr_t));
-            /* Initialize a new PACKET, to hold ether_hdr + arp_packet */
-            uint8_t * reply_packet = malloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));		
-
-
-
-            if(target_if){
-                printf("ARP to my IPs\n");
-                /* The requested tip is one of the router's interfaces, REPLY */
-                /* Create a new ethernet header */
-                sr_fill_ether_reply_arp(ether_hdr, ether_hdr_reply, target_if);
-
-                /* Create a new arp packet */
-                sr_fill_arp_reply(arp_hdr, arp_hdr_reply, target_if);
-
-                /* Put the new ethernet hdr + arp packet together */
-                memcpy(reply_packet, ether_hdr_reply, sizeof(sr_ethernet_hdr_t));
-                memcpy(reply_packet + sizeof(sr_ethernet_hdr_t), arp_hdr_reply, sizeof(sr_arp_hdr_t));
-                printf("ARP Reply sent: \n");
-                print_hdrs(reply_packet, len);
-                /* Send the packet back */
-                sr_send_packet(sr, reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t), target_if->name);
-            } else {
-                printf("ARP not to my IPs\n");
-                /* The requested tip is not one of the router's interfaces, BROADCAST */
-                struct sr_if* if_walker = 0;
-                if_walker = sr->if_list;
-                while(if_walker)
-                {
-                    if(!strncmp(if_walker->name, interface, sr_IFACE_NAMELEN))
-                    {
-                        sr_fill_ether_reply_arp(ether_hdr, ether_hdr_reply, if_walker);
-                        sr_fill_arp_reply(arp_hdr, arp_hdr_reply, if_walker);
-                        memcpy(reply_packet, ether_hdr_reply, sizeof(sr_ethernet_hdr_t));
-                        memcpy(reply_packet + sizeof(sr_ethernet_hdr_t), arp_hdr_reply, sizeof(sr_arp_hdr_t));												                        				printf("ARP Reply sent: \n");
-                        print_hdrs(reply_packet, len);
-
-
-                        sr_send_packet(sr, reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t), if_walker->name);
-                    }
-                }
 
+            SR_TRACE(ARP_REQUEST, arp_hdr->ar_tip, target_if != 0, pkt->ifindex, 0);
+            if(!target_if){
+                /* The requested tip is not one of the router's interfaces,
+                   answer for the receiving interface */
+                target_if = in_if;
             }
 
+            /* Turn the request around in place */
+            sr_fill_ether_reply_arp(ether_hdr, ether_hdr, target_if);
+            sr_fill_arp_reply(arp_hdr, target_if);
+            pkt->len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
+            pkt->lat_path = SR_PATH_ARP;
 
-
-
-            free(ether_hdr_reply);
-            free(arp_hdr_reply);
-            free(reply_packet);
-
-
-
+            /* Send the packet back */
+            sr_send_packet(sr, pkt, target_if->index);
 
         } else if (ar_op == arp_op_reply){
-            printf("ARP Reply \n");
+            unsigned int released = 0;
+
             /* Insert the IP->Mac provided by the arp packet to cache */
-            /*unsigned char * mac = (unsigned char *) malloc(ETHER_ADDR_LEN * sizeof(unsigned char));
-            memcpy(mac, arp_hdr->ar_sha, ETHER_ADDR_LEN);
-            uint32_t ip = arp_hdr->ar_sip;
-            */
             struct sr_arpreq * req = sr_arpcache_insert(&(sr->cache), arp_hdr->ar_sha, arp_hdr->ar_sip); 
             
             /* If a req with this IP/Mac already exist, send outstanding packets */
@@ -190,46 +201,55 @@ void sr_handlepacket(struct sr_instance* sr,
 
                 while (pkts)
                 {
-                    struct sr_ethernet_hdr * ether_reply = (sr_ethernet_hdr_t *) pkts->buf;
-                    print_addr_ip_int(req->ip); 
-                   /* struct sr_rt * outgoing_rt = find_rt_by_ip(sr, req->ip);
-                    assert(outgoing_rt);
-                   */
-                    struct sr_if * outgoing_if = sr_get_interface(sr, pkts->iface);
+                    struct sr_ethernet_hdr * ether_reply = (sr_ethernet_hdr_t *) SR_PKT_DATA(pkts->pkt);
+                    struct sr_if * outgoing_if = sr_get_interface_idx(sr, pkts->ifindex);
                     assert(outgoing_if);
-                    
-                    printf("outgoing_if name: %s \n", outgoing_if->name);
-                    printf("pkts->iface %s \n", pkts->iface);
 
+                    if (pkts->forward)
+                    {
+                        /* Queued as it arrived, TTL checked on the way in */
+                        sr_ip_hdr_t * fwd_ip = (sr_ip_hdr_t *)(SR_PKT_DATA(pkts->pkt) + sizeof(sr_ethernet_hdr_t));
+
+                        fwd_ip->ip_ttl--;
+                        fwd_ip->ip_sum = 0;
+                        fwd_ip->ip_sum = cksum(fwd_ip, sizeof(sr_ip_hdr_t));
+                    }
                     memcpy(ether_reply->ether_dhost, arp_hdr->ar_sha, ETHER_ADDR_LEN);
                     memcpy(ether_reply->ether_shost, outgoing_if->addr, ETHER_ADDR_LEN);
 
+                    SR_TRACE(ARP_RELEASE, req->ip, outgoing_if->index, pkts->pkt->len, 0);
+                    pkts->pkt->lat_path = SR_PATH_ARP_QUEUED;
+                    sr_send_packet(sr, pkts->pkt, outgoing_if->index);
+                    released++;
 
-
-
-                    sr_send_packet(sr, pkts->buf, pkts->len, outgoing_if->name);
-
-                    printf("Sent out below:\n");
-                    print_hdrs(pkts->buf, pkts->len);
-
-                    
-                
                     pkts = pkts->next;
                 }
                 sr_arpreq_destroy(&(sr->cache), req); 
             }
-            /*free(mac);*/
+            SR_TRACE(ARP_REPLY, arp_hdr->ar_sip, released, 0, 0);
             
         }
 
     } else if (ether_type == ethertype_ip){
         /*IP packet */
-        printf("IP Packet \n");
+        if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+        {
+            SR_STATS_DROP(BAD_IP_HEADER, len);
+            return;
+        }
         /* Construct an IP hdr */
         struct sr_ip_hdr *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
-        /*print_hdrs(packet, len);*/
-        printf("Received below:\n");
-        print_hdrs(packet, len);
+
+        /* Checksum */
+        uint16_t old_ip_sum = ip_hdr->ip_sum;
+        ip_hdr->ip_sum = 0;
+        uint16_t new_ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+        ip_hdr->ip_sum = old_ip_sum;
+        if (old_ip_sum != new_ip_sum)
+        {
+            SR_STATS_DROP(BAD_CKSUM, len);
+            return;
+        }
 
 
         /* Check if the target ip is for me (In one of my interfaces) */
@@ -238,303 +258,172 @@ void sr_handlepacket(struct sr_instance* sr,
 
         /* If the IP packet is for me */
         if (target_if){
-            printf("IP Packet for me\n");
             uint8_t ip_proto = ip_hdr->ip_p;
-            /* Initialize a new reply_packet for ICMP */
-            uint8_t * reply_packet = (uint8_t *) malloc(len * sizeof(uint8_t));
+
+            SR_TRACE(IP_LOCAL, ip_hdr->ip_src, ip_hdr->ip_dst, ip_proto, 0);
             /* ICMP packet */
-            printf("ip_proto: %u \n", ip_proto);
-            printf("ip_protocol: %u \n", ip_protocol_icmp);
-            if(ip_proto == ip_protocol_icmp)
+            if(ip_proto == ip_protocol_icmp &&
+               len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t))
             {
-                printf("ICMP Packet\n");
                 struct sr_icmp_hdr * icmp_hdr = (struct sr_icmp_hdr *)(packet + sizeof(sr_ethernet_hdr_t)  + sizeof(sr_ip_hdr_t));
-                printf("ICMP Type: %u \n", icmp_hdr->icmp_type);
-                printf("ICMP Code: %u \n", icmp_hdr->icmp_code);
                 if((icmp_hdr->icmp_type == 8) && (icmp_hdr->icmp_code == 0))
                     /* If it's an ICMP Req message, construct a reply */
                 {
-                    
-
-                    print_addr_ip_int(ip_hdr->ip_src);
-
-                    sr_print_routing_table(sr);
                     struct sr_rt * lpm_match = longest_prefix_match(sr, ip_hdr->ip_src);
                     if (lpm_match)
                     {
                     /* LPM Matched, can proceed */
-                        printf("LPM Matched \n");
-                        printf("ICMP Req\n");
-
-                        struct sr_arpentry * entry = sr_arpcache_lookup(&(sr->cache), ip_hdr->ip_src);
-
-                        if (entry)
-                        /* Entry exists, send */
-                        {
-
-
-                        /* Create a new ethernet header */
-                            struct sr_ethernet_hdr * ether_reply = (sr_ethernet_hdr_t *)malloc(sizeof(sr_ethernet_hdr_t));
-                            /* Create a new ip header */
-                            struct sr_ip_hdr * ip_reply = (sr_ip_hdr_t *) malloc(sizeof(sr_ip_hdr_t));
-                            /* Create a new icmp header */
-                            struct sr_icmp_hdr * icmp_reply = (struct sr_icmp_hdr *) malloc(len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
-                            sr_fill_ether_hdr_reply(ether_hdr, ether_reply);
 
-                            memcpy(ether_reply->ether_dhost, entry->mac, ETHER_ADDR_LEN);
+                        /* Turn the request into the reply in place */
+                        uint32_t original_src_ip = ip_hdr->ip_src;
+                        uint32_t next_hop = lpm_match->gw.s_addr ? lpm_match->gw.s_addr : original_src_ip;
+                        struct sr_if * outgoing_if = sr_get_interface_idx(sr, lpm_match->ifindex);
 
+                        ip_hdr->ip_src = ip_hdr->ip_dst;
+                        ip_hdr->ip_dst = original_src_ip;
+                        ip_hdr->ip_id = 0;
+                        ip_hdr->ip_ttl = 64;
+                        ip_hdr->ip_sum = 0;
+                        ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+                        sr_fill_icmp_echo_reply(icmp_hdr, len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
 
-                            sr_fill_ip_hdr_reply(ip_hdr, ip_reply, ip_hdr->ip_p, len - sizeof(sr_ethernet_hdr_t));
-                            sr_fill_icmp_echo_reply(icmp_hdr, icmp_reply, len);
-                            /* Combine ethernet + ip + icmp headers */
-                            memcpy(reply_packet, packet, len);
-                            memcpy(reply_packet, ether_reply, sizeof(sr_ethernet_hdr_t));
-                            memcpy(reply_packet + sizeof(sr_ethernet_hdr_t), ip_reply, sizeof(sr_ip_hdr_t));
-                            memcpy(reply_packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t), icmp_reply, sizeof(sr_icmp_hdr_t));
+                        memcpy(ether_hdr->ether_shost, outgoing_if->addr, ETHER_ADDR_LEN);
+                        pkt->lat_path = SR_PATH_ICMP;
 
+                        struct sr_arpentry entry;
 
-                            printf("target_if->name: %s \n", target_if->name);
-                            printf("outgoing if (interface): %s \n", interface);
-                            printf("lpm_match->iface: %s \n", lpm_match->interface);
+                        int resolved = sr_arpcache_lookup(&(sr->cache), next_hop, &entry);
 
-                            sr_send_packet(sr, reply_packet, len, lpm_match->interface);
-                            printf("Sent out below: \n");
-                            print_hdrs(reply_packet, len);
-                            free(ether_reply);
-                            free(ip_reply);
-                            free(icmp_reply);
-                            free(reply_packet);
-                            free(entry);
+                        SR_TRACE(ECHO_REPLY, original_src_ip, next_hop, lpm_match->ifindex, resolved);
+                        SR_PROBE4(icmp__send, 0, 0, original_src_ip, lpm_match->ifindex);
+                        if (resolved)
+                        /* Entry exists, send */
+                        {
+                            memcpy(ether_hdr->ether_dhost, entry.mac, ETHER_ADDR_LEN);
+                            sr_send_packet(sr, pkt, lpm_match->ifindex);
                         } else {
                             /* Entry does not exist, queue for ARP req */
-                            printf("Entry does not exist, queue for ARP req \n");
-                            /* Update IP hdr */
-                            uint32_t original_src_ip = ip_hdr->ip_src;
-                            ip_hdr->ip_src = ip_hdr->ip_dst;
-                            ip_hdr->ip_dst = original_src_ip;
-                            ip_hdr->ip_id = 0;
-                            ip_hdr->ip_len = htons(len - sizeof(sr_ethernet_hdr_t));
-                            ip_hdr->ip_p = ip_protocol_icmp;
-                            ip_hdr->ip_ttl = 64;
-                            ip_hdr->ip_sum = 0;
-                            ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
-
-                            /* Update ICMP */
-
-                            icmp_hdr->icmp_type = 0;
-                            icmp_hdr->icmp_code = 0;
-                            icmp_hdr->icmp_sum = 0;
-                            icmp_hdr->icmp_sum = cksum(icmp_hdr, len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
-                            print_addr_ip_int(original_src_ip);
-
-                            free(reply_packet);
-
-                            sr_print_routing_table(sr);
-                            struct sr_arpreq * req = sr_arpcache_queuereq(&(sr->cache), original_src_ip, packet, len, lpm_match->interface);
-                            handle_arpreq(sr, req);
+                            sr_queue_for_arp(sr, next_hop, pkt, lpm_match->ifindex, 0);
 
                         }
                     } else {
                     /* LPM not matched */
-                        printf("LPM not matched! Dropping\n");
+                        SR_STATS_DROP(NO_ROUTE, len);
                         return;    
                     }
 
                 }
-            } else if (ip_proto == 6 || ip_proto == 17){
-                printf("TCP or UDP Packet\n");
-                /* TCP or UDP Packet */
-
-                /* Create new ethernet header */
-                struct sr_ethernet_hdr * ether_reply = (sr_ethernet_hdr_t *)malloc(sizeof(sr_ethernet_hdr_t));
-                sr_fill_ether_hdr_reply(ether_hdr, ether_reply);
-
-                /* Create new ip header */
-                struct sr_ip_hdr * ip_reply = (sr_ip_hdr_t *)malloc(sizeof(sr_ip_hdr_t));
-                sr_fill_ip_hdr_reply(ip_hdr, ip_reply, ip_protocol_icmp, len - sizeof(sr_ethernet_hdr_t));
-
-                /* Create new ICMP port unreachable packet */
-                struct sr_icmp_t3_hdr * icmp_t3_reply = (sr_icmp_t3_hdr_t *)malloc(sizeof(sr_icmp_t3_hdr_t));
-                sr_fill_icmp_t3_reply(icmp_t3_reply,3, 3, packet, len);
-                free(reply_packet);
-                /* Define a new reply_packet (since size might be diff) */
-                uint8_t * reply_packet = (uint8_t *) malloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
-                memcpy(reply_packet, ether_reply, sizeof(sr_ethernet_hdr_t));
-                memcpy(reply_packet + sizeof(sr_ethernet_hdr_t), ip_reply, sizeof(sr_ip_hdr_t));
-                memcpy(reply_packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t), icmp_t3_reply, sizeof(sr_icmp_t3_hdr_t));
-
-                printf("outgoing if (interface): %s \n", interface);
-                sr_send_packet(sr, reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t), interface);
-                printf("Sent out below: \n");
-                print_hdrs(reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +sizeof(sr_icmp_t3_hdr_t));
-                free(ether_reply);
-                free(ip_reply);
-                free(icmp_t3_reply);
-                free(reply_packet);
-
-
-
+            } else if (ip_proto == ip_protocol_tcp || ip_proto == ip_protocol_udp){
+                /* TCP or UDP Packet, port unreachable */
+                sr_send_icmp_error(sr, pkt, 3, 3, ip_hdr->ip_dst);
             }
 
 
         } else {
             /* If the IP packet is not for me, forward */
 
-            printf("IP Packet not for me \n");
-
-            /*Check minimum length? */
-
-            /* Checksum */
-            uint16_t old_ip_sum = ip_hdr->ip_sum;
-            ip_hdr->ip_sum = 0;
-            uint16_t new_ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
-            if (old_ip_sum != new_ip_sum)
-            {
-                printf("Checksum doesnt match!!!\n");
-                    return;
-            }
-
-            /* Decrement TTL */
-            ip_hdr->ip_ttl--;
-            
-            /* Check if TTL is 0 after reduction */
-            if (ip_hdr->ip_ttl == 0)
+            /* Check TTL before touching the header, so an ICMP error
+               quotes the datagram as it arrived */
+            if (ip_hdr->ip_ttl <= 1)
             {
                 /* Send ICMP type 11 (time exceeded) */
-
-                struct sr_ethernet_hdr * ether_reply = (sr_ethernet_hdr_t *)malloc(sizeof(sr_ethernet_hdr_t));
-                struct sr_ip_hdr * ip_reply = (sr_ip_hdr_t *)malloc(sizeof(sr_ip_hdr_t));
-                struct sr_icmp_t3_hdr * icmp_t3_reply = (sr_icmp_t3_hdr_t *)malloc(sizeof(sr_icmp_t3_hdr_t));
-                
-                struct sr_if* outgoing_if = sr_get_interface(sr, interface);
-
-
-                sr_fill_ether_hdr_reply(ether_hdr, ether_reply);
-                sr_fill_ip_hdr_icmpt11(ip_hdr, ip_reply, ip_protocol_icmp, outgoing_if->ip, len - sizeof(sr_ethernet_hdr_t));
-                sr_fill_icmp_t3_reply(icmp_t3_reply, 11, 0, packet, len);
-
-                /* Create ICMP type 11 */ 
-                uint8_t * reply_packet = (uint8_t *) malloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
-
-                memcpy(reply_packet, ether_reply, sizeof(sr_ethernet_hdr_t));
-                memcpy(reply_packet + sizeof(sr_ethernet_hdr_t), ip_reply, sizeof(sr_ip_hdr_t));
-                memcpy(reply_packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t), icmp_t3_reply, sizeof(sr_icmp_t3_hdr_t));
-                
-                printf("outgoing if (interface): %s \n", interface);
-                sr_send_packet(sr, reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t), interface);
-                printf("Sent out below: \n");
-                print_hdrs(reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
-                free(ether_reply);
-                free(ip_reply);
-                free(icmp_t3_reply);
-                free(reply_packet);
-                
-
+                sr_send_icmp_error(sr, pkt, 11, 0, in_if->ip);
                 return;
             }
 
-
-
-            /* Update checksum after ttl */
-            ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
-
-
-
             /* Perform LPM */
             struct sr_rt * lpm_match = longest_prefix_match(sr, ip_hdr->ip_dst);
             if (lpm_match)
             {
-                printf("LPM Matched \n");
-                struct sr_arpentry * entry = sr_arpcache_lookup(&(sr->cache), lpm_match->gw.s_addr);
+                uint32_t next_hop = lpm_match->gw.s_addr ? lpm_match->gw.s_addr : ip_hdr->ip_dst;
+                struct sr_if * target_if = sr_get_interface_idx(sr, lpm_match->ifindex);
 
-                if(entry)
-                /* If the ip->mac mapping exists, use it to send the packet */
-                {
-                    printf("Entry exists\n");
-                    struct sr_ethernet_hdr * ether_reply = (sr_ethernet_hdr_t *)packet;
-                    struct sr_if * target_if = sr_get_interface(sr, lpm_match->interface);
-                    memcpy(ether_reply->ether_dhost, entry->mac, ETHER_ADDR_LEN);
-                    memcpy(ether_reply->ether_shost, target_if->addr, ETHER_ADDR_LEN);
+                pkt->lat_path = SR_PATH_FORWARD;
+                pkt->route = SR_STATS_ROUTE_ID(lpm_match);
 
-                    sr_send_packet(sr, packet, len, target_if->name);
-                    printf("Sent out below\n");
-                    print_hdrs(packet, len);
-                    
+                struct sr_arpentry entry;
 
+                int resolved = sr_arpcache_lookup(&(sr->cache), next_hop, &entry);
 
-
-
-
-                    free(entry);
+                SR_TRACE(FORWARD, ip_hdr->ip_dst, next_hop, target_if->index, resolved);
+                if(resolved)
+                /* If the ip->mac mapping exists, use it to send the packet */
+                {
+                    /* Decrement TTL and update checksum */
+                    ip_hdr->ip_ttl--;
+                    ip_hdr->ip_sum = 0;
+                    ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+                    memcpy(ether_hdr->ether_shost, target_if->addr, ETHER_ADDR_LEN);
+                    memcpy(ether_hdr->ether_dhost, entry.mac, ETHER_ADDR_LEN);
+
+                    sr_send_packet(sr, pkt, target_if->index);
                 } else {
-                    printf("Entry does not exist\n");
-                /* If ip->mac mapping d.n.e. then add to request */
-                    struct sr_arpreq * req = sr_arpcache_queuereq(&(sr->cache), lpm_match->gw.s_addr, packet, len, lpm_match->interface);
-                    handle_arpreq(sr, req);
-
-
+                /* If ip->mac mapping d.n.e. then add to request, as it
+                   arrived: the rewrite happens when it is released */
+                    sr_queue_for_arp(sr, next_hop, pkt, lpm_match->ifindex, 1);
                 }
 
-
-
-
-
-
-
             } else {
-                printf("LPM not matched \n");
-                
-                struct sr_if * outgoing_if = sr_get_interface(sr, interface);
-                
-                /* initialize icmp type 3 packet */
-                struct sr_icmp_t3_hdr * icmp_t3_reply = (sr_icmp_t3_hdr_t *)malloc(sizeof(sr_icmp_t3_hdr_t));
-                sr_fill_icmp_t3_reply(icmp_t3_reply,3, 0, packet, len);
-                
-                /* Initialize ip reply header */
-                struct sr_ip_hdr * ip_reply = (sr_ip_hdr_t *)malloc(sizeof(sr_ip_hdr_t));
-                sr_fill_ip_hdr_icmpt11(ip_hdr, ip_reply, ip_protocol_icmp, outgoing_if->ip, len - sizeof(sr_ethernet_hdr_t));
-
-                /* Initialize ethernet reply header */
-                struct sr_ethernet_hdr * ether_reply = (sr_ethernet_hdr_t*) malloc(sizeof(sr_ethernet_hdr_t));
-                sr_fill_ether_hdr_reply(ether_hdr, ether_reply);
-                
-
-                
-
-                /* Define a new reply_packet (since size might be diff) */
-                uint8_t * reply_packet = (uint8_t *) malloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
-
-
-                /*uint8_t * reply_packet = (uint8_t *) malloc(len * sizeof(uint8_t));*/
-                memcpy(reply_packet, ether_reply, sizeof(sr_ethernet_hdr_t));
-                memcpy(reply_packet + sizeof(sr_ethernet_hdr_t), ip_reply, sizeof(sr_ip_hdr_t));
-                memcpy(reply_packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t), icmp_t3_reply, sizeof(sr_icmp_t3_hdr_t));
-                sr_send_packet(sr, reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t), interface);
-
+                sr_send_icmp_error(sr, pkt, 3, 0, in_if->ip);
+            }
 
-                /*sr_send_packet(sr, reply_packet, len, interface);*/
-                printf("Sent out below: \n");
-                print_hdrs(reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +sizeof(sr_icmp_t3_hdr_t));
-                free(ether_reply);
-                free(ip_reply);
-                free(icmp_t3_reply);
-                free(reply_packet);
+        }
 
+    }
 
-            }
+}/* end sr_ForwardPacket */
 
+/*---------------------------------------------------------------------
+ * Method: sr_send_icmp_error(..)
+ * Scope:  Global
+ *
+ * Send an ICMP error (type 3 or 11) about orig back out the interface
+ * it arrived on, quoting its IP header and the first 8 bytes of payload.
+ * The reply is built front to back in a fresh packet from the pool.
+ *
+ *---------------------------------------------------------------------*/
 
+int sr_send_icmp_error(struct sr_instance* sr, struct sr_pkt* orig,
+                       int type, int code, uint32_t src_ip)
+{
+    sr_ethernet_hdr_t * ether_hdr = (sr_ethernet_hdr_t *)SR_PKT_DATA(orig);
+    sr_ip_hdr_t * ip_hdr = (sr_ip_hdr_t *)(SR_PKT_DATA(orig) + sizeof(sr_ethernet_hdr_t));
+    struct sr_if * in_if = sr_get_interface_idx(sr, orig->ifindex);
+    struct sr_pkt * reply;
+    int rc;
 
+    if (!in_if || orig->len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+    { return -1; }
 
+    if ((reply = sr_pkt_alloc(sr, SR_PKT_HEADROOM)) == 0)
+    {
+        SR_STATS_DROP(NO_BUFFER, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +
+                      sizeof(sr_icmp_t3_hdr_t));
+        return -1;
+    }
 
-        }
+    sr_icmp_t3_hdr_t * icmp_t3_reply = (sr_icmp_t3_hdr_t *)sr_pkt_put(reply, sizeof(sr_icmp_t3_hdr_t));
+    sr_fill_icmp_t3_reply(icmp_t3_reply, type, code, (uint8_t *)ip_hdr,
+                          orig->len - sizeof(sr_ethernet_hdr_t));
 
-    }
+    sr_ip_hdr_t * ip_reply = (sr_ip_hdr_t *)sr_pkt_push(reply, sizeof(sr_ip_hdr_t));
+    sr_fill_ip_hdr_icmpt11(ip_hdr, ip_reply, ip_protocol_icmp, src_ip,
+                           sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
 
+    sr_ethernet_hdr_t * ether_reply = (sr_ethernet_hdr_t *)sr_pkt_push(reply, sizeof(sr_ethernet_hdr_t));
+    memcpy(ether_reply->ether_dhost, ether_hdr->ether_shost, ETHER_ADDR_LEN);
+    memcpy(ether_reply->ether_shost, in_if->addr, ETHER_ADDR_LEN);
+    ether_reply->ether_type = htons(ethertype_ip);
+    reply->ts_ns = orig->ts_ns;
+    reply->lat_path = SR_PATH_ICMP;
 
-    /* fill in code here */
+    SR_TRACE(ICMP_ERROR, type, code, ip_hdr->ip_src, in_if->index);
+    SR_PROBE4(icmp__send, type, code, ip_hdr->ip_src, in_if->index);
+    rc = sr_send_packet(sr, reply, in_if->index);
+    sr_pkt_unref(reply);
 
-}/* end sr_ForwardPacket */
+    return rc;
+} /* -- sr_send_icmp_error -- */
 
 struct sr_rt * find_rt_by_ip(struct sr_instance *sr, uint32_t ip)
 {
@@ -564,15 +453,15 @@ struct sr_rt * longest_prefix_match(struct sr_instance *sr, uint32_t ip_dst)
     uint32_t match_ip = 0;
     uint32_t mask = 0;
 
+    /* Called on the fast path for every packet, so no printing here */
     if(sr->routing_table == 0)
     {
-        printf("Routing table empty \n");
+        SR_TRACE(LPM, ip_dst, 0, 0, -1);
+        SR_PROBE4(route__lookup, ip_dst, 0, 0, -1);
         return 0;
     }
     rt_walker = sr->routing_table;
     
-    printf("Performing LPM\n");
-    
     while(rt_walker)
     {
         
@@ -590,8 +479,13 @@ struct sr_rt * longest_prefix_match(struct sr_instance *sr, uint32_t ip_dst)
         rt_walker = rt_walker->next;
 
     }
-    sr_print_routing_table(sr);
 
+    SR_TRACE(LPM, ip_dst, matched_rt ? matched_rt->dest.s_addr : 0,
+             matched_rt ? matched_rt->mask.s_addr : 0,
+             matched_rt ? matched_rt->ifindex : -1);
+    SR_PROBE4(route__lookup, ip_dst, matched_rt ? matched_rt->dest.s_addr : 0,
+              matched_rt ? matched_rt->mask.s_addr : 0,
+              matched_rt ? matched_rt->ifindex : -1);
     return matched_rt;
 
 
@@ -601,49 +495,36 @@ struct sr_rt * longest_prefix_match(struct sr_instance *sr, uint32_t ip_dst)
 
 struct sr_if* find_tip_in_router(struct sr_instance *sr, uint32_t tip)
 {
-    struct sr_if* if_walker = 0;
     assert(sr);
-    assert(tip);
 
-    if_walker = sr->if_list;
-    while(if_walker)
-    {
-        if(if_walker->ip == tip){
-            return if_walker;
-        }
-        if_walker = if_walker->next;
-    }
-    return 0;
+    /* -- 0.0.0.0 comes off the wire too, and is never ours -- */
+    return tip ? sr_find_local_addr(sr, tip) : 0;
 }
 
 
-void sr_fill_icmp_t3_reply(sr_icmp_t3_hdr_t *icmp_t3_reply,int type,  int code, uint8_t *packet, unsigned int len)
+void sr_fill_icmp_t3_reply(sr_icmp_t3_hdr_t *icmp_t3_reply,int type,  int code, uint8_t *ip_packet, unsigned int ip_len)
 {
+    unsigned int quoted = ip_len < ICMP_DATA_SIZE ? ip_len : ICMP_DATA_SIZE;
+
     icmp_t3_reply->icmp_type = type;
     icmp_t3_reply->icmp_code = code;
     icmp_t3_reply->icmp_sum = 0;
     icmp_t3_reply->unused = 0;
     icmp_t3_reply->next_mtu = 0;
-    memcpy(icmp_t3_reply->data, (packet + sizeof(sr_ethernet_hdr_t)), ICMP_DATA_SIZE);
+    /* Quote the IP header + 8 bytes, zero padded if the datagram is shorter */
+    memcpy(icmp_t3_reply->data, ip_packet, quoted);
+    memset(icmp_t3_reply->data + quoted, 0, ICMP_DATA_SIZE - quoted);
     icmp_t3_reply->icmp_sum = cksum(icmp_t3_reply, sizeof(sr_icmp_t3_hdr_t));
-
-    /*icmp_t3_reply->icmp_sum = cksum(icmp_t3_reply, len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));*/
-}
-
-void sr_fill_ether_hdr_reply(sr_ethernet_hdr_t *ether_hdr, sr_ethernet_hdr_t *ether_reply)
-{
-    /* Copy existing ethernet header */
-    memcpy(ether_reply, ether_hdr, sizeof(sr_ethernet_hdr_t));
-    /* Switch source/dest mac addresses */
-    memcpy(ether_reply->ether_dhost, ether_hdr->ether_shost, ETHER_ADDR_LEN);
-    memcpy(ether_reply->ether_shost, ether_hdr->ether_dhost, ETHER_ADDR_LEN);
-
 }
 
 void sr_fill_ip_hdr_icmpt11(sr_ip_hdr_t *ip_hdr, sr_ip_hdr_t *ip_reply, int protocol, uint32_t ip, int ip_length)
 {
     /* copy existing ip header */
     memcpy(ip_reply, ip_hdr, sizeof(sr_ip_hdr_t));
+    /* No options, not a fragment */
+    ip_reply->ip_hl = 5;
+    ip_reply->ip_tos = 0;
+    ip_reply->ip_off = 0;
     /* Switch source/dest IP address */
     ip_reply->ip_src = ip;
     ip_reply->ip_dst = ip_hdr->ip_src;
@@ -658,35 +539,13 @@ void sr_fill_ip_hdr_icmpt11(sr_ip_hdr_t *ip_hdr, sr_ip_hdr_t *ip_reply, int prot
 }
 
 
-void sr_fill_ip_hdr_reply(sr_ip_hdr_t *ip_hdr, sr_ip_hdr_t *ip_reply, int protocol, int ip_length)
-{
-    /* copy existing ip header */
-    memcpy(ip_reply, ip_hdr, sizeof(sr_ip_hdr_t));
-    /* Switch source/dest IP address */
-    ip_reply->ip_src = ip_hdr->ip_dst;
-    ip_reply->ip_dst = ip_hdr->ip_src;
-    ip_reply->ip_id = 0;
-    ip_reply->ip_len = htons(ip_length);
-    ip_reply->ip_p = protocol;
-    ip_reply->ip_ttl = 64;
-    ip_reply->ip_sum = 0;
-    ip_reply->ip_sum = cksum(ip_reply, sizeof(sr_ip_hdr_t));
-
-
-
-}
-
-void sr_fill_icmp_echo_reply(sr_icmp_hdr_t *icmp_hdr, sr_icmp_hdr_t * icmp_reply, unsigned int len)
+void sr_fill_icmp_echo_reply(sr_icmp_hdr_t *icmp_hdr, unsigned int icmp_len)
 {
-
-    /* Copy existing icmp hdr */
-    memcpy(icmp_reply, icmp_hdr, len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
-    icmp_reply->icmp_type = 0;
-    icmp_reply->icmp_code = 0;
-    icmp_reply->icmp_sum = 0;
-    icmp_reply->icmp_sum = cksum(icmp_reply, len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
-
-
+    /* Turn the request into a reply in place */
+    icmp_hdr->icmp_type = 0;
+    icmp_hdr->icmp_code = 0;
+    icmp_hdr->icmp_sum = 0;
+    icmp_hdr->icmp_sum = cksum(icmp_hdr, icmp_len);
 }
 
 
@@ -723,21 +582,15 @@ void sr_fill_arp_req(sr_arp_hdr_t *arp_req, struct sr_if * sr_if_con, sr_etherne
 }
 
 
-void sr_fill_arp_reply(sr_arp_hdr_t *arp_hdr,sr_arp_hdr_t *arp_hdr_reply, struct sr_if *sr_if_con)
+void sr_fill_arp_reply(sr_arp_hdr_t *arp_hdr, struct sr_if *sr_if_con)
 {
-    /* Need to construct a new arp hdr */
-    arp_hdr_reply->ar_hrd = arp_hdr->ar_hrd;
-    arp_hdr_reply->ar_pro = arp_hdr->ar_pro;
-    arp_hdr_reply->ar_hln = arp_hdr->ar_hln;
-    arp_hdr_reply->ar_pln = arp_hdr->ar_pln;
+    /* Rewrites the request in place; hrd, pro, hln and pln stay */
     /* Change op_code to reply */
-    arp_hdr_reply->ar_op = htons(arp_op_reply);
-    /* Copy the router's interface address as sender's address */
-    memcpy(arp_hdr_reply->ar_sha, sr_if_con->addr, ETHER_ADDR_LEN);
-    /* Copy the router's interface ip as sender's ip */ 
-    arp_hdr_reply->ar_sip = sr_if_con->ip;
-    /* Copy the old sender hw address as target hw addr */
-    memcpy(arp_hdr_reply->ar_tha, arp_hdr->ar_sha, ETHER_ADDR_LEN);
-    /* copy the old sender ip as target ip */
-    arp_hdr_reply->ar_tip = arp_hdr->ar_sip;
+    arp_hdr->ar_op = htons(arp_op_reply);
+    /* The old sender becomes the target */
+    memcpy(arp_hdr->ar_tha, arp_hdr->ar_sha, ETHER_ADDR_LEN);
+    arp_hdr->ar_tip = arp_hdr->ar_sip;
+    /* Copy the router's interface address and ip as sender's */
+    memcpy(arp_hdr->ar_sha, sr_if_con->addr, ETHER_ADDR_LEN);
+    arp_hdr->ar_sip = sr_if_con->ip;
 }
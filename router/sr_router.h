@@ -12,6 +12,7 @@
 #include <netinet/in.h>
 #include <sys/time.h>
 #include <stdio.h>
+#include <signal.h>
 
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
@@ -33,6 +34,75 @@
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_uring;
+struct sr_backend;
+struct sr_vns_v2;
+struct sr_pool;
+struct sr_capture;
+struct sr_workers;
+struct sr_slowpath;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_vns_stats
+ *
+ * Syscall and packet counts for the connection to the VNS server, used to
+ * compare the classic socket path with the io_uring one.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_vns_stats
+{
+    unsigned long syscalls;    /* recv/read/write or io_uring_enter calls */
+    unsigned long rx_pkts;
+    unsigned long tx_pkts;
+    struct timeval first_pkt;
+    struct timeval last_pkt;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_io_stats
+ *
+ * Backend independent frame counts and receive-to-handled latency, so the
+ * backends can be compared on the same numbers.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_io_stats
+{
+    unsigned long rx_frames;
+    unsigned long tx_frames;
+    unsigned long bursts;      /* rx_burst calls that returned frames */
+    double lat_sum_us;         /* burst received -> frame handled */
+    double lat_max_us;
+    struct timeval first_rx;
+    struct timeval last_rx;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_busy_poll
+ *
+ * Opt-in busy polling of the receive loop (-B usecs, see sr_backend.c).
+ * spin_us adapts between 0 and budget_us: a spin that finds frames or a
+ * blocking wait shorter than the budget sets it back to the budget, a
+ * spin that comes up empty halves it.  Mode 0 counts bursts found while
+ * spinning, mode 1 bursts received after blocking in rx_burst.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_busy_poll
+{
+    unsigned int budget_us;    /* 0: always block (the default) */
+    unsigned int spin_us;      /* current spin before blocking */
+    unsigned long spins;
+    unsigned long spin_hits;
+    double spin_time_us;       /* wall time spent spinning */
+    double block_time_us;      /* wall time spent in a blocking rx_burst */
+    unsigned long mode_bursts[2];
+    unsigned long mode_frames[2];
+    double mode_lat_sum_us[2]; /* burst received -> handled */
+    double mode_lat_max_us[2];
+    double started_us;         /* first poll, for the CPU share */
+};
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -50,39 +120,56 @@ struct sr_instance
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
     struct sr_if* if_list; /* list of interfaces */
+    struct sr_if* if_table[SR_MAX_IF]; /* the same, by index */
+    int  nif;
+    struct sr_local_addr local_addrs[SR_LOCAL_HASH_SZ]; /* "is it for me" */
     struct sr_rt* routing_table; /* routing table */
     struct sr_arpcache cache;   /* ARP cache */
     pthread_attr_t attr;
-    FILE* logfile;
+    struct sr_capture* capture; /* -l logfile, 0 if not capturing */
+    const struct sr_backend* backend; /* packet I/O backend */
+    void* backend_data;     /* backend private state */
+    int use_uring;          /* vns: switch to io_uring once connected */
+    struct sr_uring* uring; /* io_uring transport, 0 for classic path */
+    struct sr_vns_v2* vns_v2; /* vns: protocol v2 state, 0 for a v1 session */
+    struct sr_pool* pkt_pool;  /* SR_PKT_BUF_SIZE packet buffers */
+    struct sr_pool* arpq_pool; /* sr_packet records for the ARP queue */
+    struct sr_pool* arpreq_pool; /* sr_arpreq records */
+    struct sr_workers* workers; /* forwarding workers, 0 to forward inline */
+    struct sr_slowpath* slowpath; /* exception thread, 0 to handle inline */
+    struct sr_vns_stats vns_stats;
+    struct sr_io_stats io_stats;
+    struct sr_busy_poll busy_poll;
 };
 
 /* -- sr_main.c -- */
+extern volatile sig_atomic_t sr_stop_requested;
 int sr_verify_routing_table(struct sr_instance* sr);
 
+/* -- sr_backend.c -- */
+int sr_send_packet(struct sr_instance* , struct sr_pkt* , int);
+
 /* -- sr_vns_comm.c -- */
-int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
-void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
+void sr_handlepacket(struct sr_instance* , struct sr_pkt* );
+void sr_handle_exception(struct sr_instance* , struct sr_pkt* );
+int sr_send_icmp_error(struct sr_instance* , struct sr_pkt* , int , int , uint32_t );
 
 struct sr_if* find_tip_in_router(struct sr_instance *sr, uint32_t tip);
 
-void sr_fill_ether_hdr_reply(sr_ethernet_hdr_t *ether_hdr, sr_ethernet_hdr_t *ether_reply);
-
-void sr_fill_ip_hdr_reply(sr_ip_hdr_t *ip_hdr, sr_ip_hdr_t *ip_reply, int protocol, int ip_length);
-
-void sr_fill_icmp_echo_reply(sr_icmp_hdr_t *icmp_hdr, sr_icmp_hdr_t * icmp_reply, unsigned int len);
+void sr_fill_icmp_echo_reply(sr_icmp_hdr_t *icmp_hdr, unsigned int icmp_len);
 
 void sr_fill_ether_reply_arp(sr_ethernet_hdr_t *ether_hdr, sr_ethernet_hdr_t *ether_hdr_reply, struct sr_if *sr_if_con);
 
-void sr_fill_icmp_t3_reply(sr_icmp_t3_hdr_t *icmp_t3_reply,int type, int code, uint8_t *packet, unsigned int len);
+void sr_fill_icmp_t3_reply(sr_icmp_t3_hdr_t *icmp_t3_reply,int type, int code, uint8_t *ip_packet, unsigned int ip_len);
 
 struct sr_rt * longest_prefix_match(struct sr_instance *sr, uint32_t ip_dst);
 
-void sr_fill_arp_reply(sr_arp_hdr_t *arp_hdr,sr_arp_hdr_t *arp_hdr_reply, struct sr_if *sr_if_con);
+void sr_fill_arp_reply(sr_arp_hdr_t *arp_hdr, struct sr_if *sr_if_con);
 
 void sr_fill_ether_req_arp(sr_ethernet_hdr_t *ether_reply, struct sr_if * sr_if_con);
 
@@ -95,7 +182,7 @@ void sr_fill_ip_hdr_icmpt11(sr_ip_hdr_t *ip_hdr, sr_ip_hdr_t *ip_reply, int prot
 struct sr_rt * find_rt_by_ip(struct sr_instance *sr, uint32_t ip);
 
 /* -- sr_if.c -- */
-void sr_add_interface(struct sr_instance* , const char* );
+int  sr_add_interface(struct sr_instance* , const char* );
 void sr_set_ether_ip(struct sr_instance* , uint32_t );
 void sr_set_ether_addr(struct sr_instance* , const unsigned char* );
 void sr_print_if_list(struct sr_instance* );
@@ -20,7 +20,10 @@
 #include <arpa/inet.h>
 
 #include "sr_rt.h"
+#include "sr_if.h"
 #include "sr_router.h"
+#include "sr_mem.h"
+#include "sr_stats.h"
 
 /*---------------------------------------------------------------------
  * Method:
@@ -94,6 +97,7 @@ void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
 struct in_addr gw, struct in_addr mask,char* if_name)
 {
     struct sr_rt* rt_walker = 0;
+    int index = 1;
 
     /* -- REQUIRES -- */
     assert(if_name);
@@ -102,13 +106,16 @@ struct in_addr gw, struct in_addr mask,char* if_name)
     /* -- empty list special case -- */
     if(sr->routing_table == 0)
     {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
+        sr->routing_table = (struct sr_rt*)sr_mem_malloc(SR_MEM_ROUTE,
+                                                         sizeof(struct sr_rt));
         assert(sr->routing_table);
         sr->routing_table->next = 0;
         sr->routing_table->dest = dest;
         sr->routing_table->gw   = gw;
         sr->routing_table->mask = mask;
         strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+        sr->routing_table->ifindex = -1;
+        sr->routing_table->index = 0;
 
         return;
     }
@@ -117,9 +124,11 @@ struct in_addr gw, struct in_addr mask,char* if_name)
     rt_walker = sr->routing_table;
     while(rt_walker->next){
       rt_walker = rt_walker->next; 
+      index++;
     }
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
+    rt_walker->next = (struct sr_rt*)sr_mem_malloc(SR_MEM_ROUTE,
+                                                   sizeof(struct sr_rt));
     assert(rt_walker->next);
     rt_walker = rt_walker->next;
 
@@ -128,9 +137,57 @@ struct in_addr gw, struct in_addr mask,char* if_name)
     rt_walker->gw   = gw;
     rt_walker->mask = mask;
     strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    rt_walker->ifindex = -1;
+    rt_walker->index = index;
 
 } /* -- sr_add_entry -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_verify_routing_table()
+ * Scope: Global
+ *
+ * make sure the routing table is consistent with the interface list by
+ * verifying that all interfaces used in the routing table actually exist
+ * in the hardware, and resolve each entry's interface name to its index.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  something other than zero on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_verify_routing_table(struct sr_instance* sr)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_if* iface = 0;
+    int ret = 0;
+
+    /* -- REQUIRES --*/
+    assert(sr);
+
+    if( (sr->if_list == 0) || (sr->routing_table == 0))
+    {
+        return 999; /* doh! */
+    }
+
+    rt_walker = sr->routing_table;
+
+    while(rt_walker)
+    {
+        /* -- check to see if interface exists -- */
+        iface = sr_get_interface(sr, rt_walker->interface);
+        if(iface == 0)
+        { ret++; } /* -- interface not found! -- */
+        else
+        { rt_walker->ifindex = iface->index; }
+
+        rt_walker = rt_walker->next;
+    } /* -- while -- */
+
+    return ret;
+} /* -- sr_verify_routing_table -- */
+
 /*---------------------------------------------------------------------
  * Method:
  *
@@ -146,7 +203,7 @@ void sr_print_routing_table(struct sr_instance* sr)
         return;
     }
 
-    printf("Destination\tGateway\t\tMask\tIface\n");
+    printf("Destination\tGateway\t\tMask\tIface\tPackets\tBytes\n");
 
     rt_walker = sr->routing_table;
     
@@ -166,6 +223,8 @@ void sr_print_routing_table(struct sr_instance* sr)
 
 void sr_print_routing_entry(struct sr_rt* entry)
 {
+    uint64_t pkts, bytes;
+
     /* -- REQUIRES --*/
     assert(entry);
     assert(entry->interface);
@@ -173,6 +232,12 @@ void sr_print_routing_entry(struct sr_rt* entry)
     printf("%s\t\t",inet_ntoa(entry->dest));
     printf("%s\t",inet_ntoa(entry->gw));
     printf("%s\t",inet_ntoa(entry->mask));
-    printf("%s\n",entry->interface);
+    printf("%s\t",entry->interface);
+
+    /* -- past SR_STATS_MAX_ROUTES a route is not counted -- */
+    if (sr_stats_route(entry->index, &pkts, &bytes) == 0)
+    { printf("%llu\t%llu\n", (unsigned long long)pkts, (unsigned long long)bytes); }
+    else
+    { printf("-\t-\n"); }
 
 } /* -- sr_print_routing_entry -- */
@@ -33,6 +33,8 @@ struct sr_rt
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    int    ifindex;    /* of 'interface', set by sr_verify_routing_table */
+    int    index;      /* position in the table, its counters in sr_stats */
     struct sr_rt* next;
 };
 
@@ -0,0 +1,362 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.c
+ *
+ * Description:
+ *
+ * Shared memory backend for a controller running on the same machine:
+ *
+ *   ./pox.py cs144.ofhandler cs144.srhandler --shm=sr-shm
+ *   ./sr -b shm -m sr-shm -r rtable
+ *
+ * Interfaces come from the table the controller writes into the segment
+ * (see sr_shm.h).  Received frames are handed to the router straight out
+ * of their ring slot and the slots are given back in rx_release; frames
+ * going out are written once into a slot of the other ring.  No socket
+ * calls and no VNS framing on either path.
+ *
+ * There is no doorbell: the receive side spins for a while when the ring
+ * is empty and then backs off into short sleeps.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_backend.h"
+#include "sr_shm.h"
+#include "sr_mem.h"
+
+#define SR_SHM_SPIN        2000   /* empty polls before sleeping */
+#define SR_SHM_SLEEP_MIN   20     /* us */
+#define SR_SHM_SLEEP_MAX   1000   /* us */
+#define SR_SHM_WAIT_SECS   30     /* for the controller to set ready */
+
+struct sr_shm
+{
+    sr_shm_hdr* hdr;
+    size_t      len;
+    sr_shm_ring_idx* ring[2];
+    uint8_t*    slots[2];
+    uint32_t    nslots;
+    uint32_t    slot_size;
+
+    uint32_t    rx_taken;      /* slots handed out since the last release */
+    unsigned    idle;
+    unsigned    sleep_us;
+
+    pthread_mutex_t tx_lock;   /* the ARP thread sends too */
+
+    unsigned long rx_frames;
+    unsigned long tx_frames;
+    unsigned long tx_drops;
+    unsigned long rx_bad;
+    unsigned long sleeps;
+};
+
+static sr_shm_slot* sr_shm_slot_at(struct sr_shm* shm, int r, uint32_t n)
+{
+    return (sr_shm_slot*)(shm->slots[r] +
+                          (size_t)(n & (shm->nslots - 1)) * shm->slot_size);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_map(..)
+ * Scope: Local
+ *
+ * Map /dev/shm/<name>, waiting for the controller to create it and mark
+ * it ready.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_shm_map(struct sr_shm* shm, const char* name)
+{
+    char path[128];
+    struct stat st;
+    int fd = -1, tries;
+
+    snprintf(path, sizeof(path), "/dev/shm/%s", name);
+
+    for (tries = 0; tries < SR_SHM_WAIT_SECS * 10 && !sr_stop_requested; tries++)
+    {
+        if (fd < 0)
+        { fd = open(path, O_RDWR); }
+        if (fd >= 0 && fstat(fd, &st) == 0 &&
+                (size_t)st.st_size >= sizeof(sr_shm_hdr))
+        {
+            if (!shm->hdr)
+            {
+                shm->len = st.st_size;
+                shm->hdr = (sr_shm_hdr*)mmap(0, shm->len, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED, fd, 0);
+                if (shm->hdr == MAP_FAILED)
+                {
+                    perror("mmap:sr_shm.c::sr_shm_map");
+                    shm->hdr = 0;
+                    close(fd);
+                    return -1;
+                }
+            }
+            if (__atomic_load_n(&shm->hdr->ready, __ATOMIC_ACQUIRE))
+            { break; }
+        }
+        if (tries == 0)
+        { fprintf(stderr, "Waiting for controller to set up %s ...\n", path); }
+        usleep(100000);
+    }
+    if (fd >= 0)
+    { close(fd); }
+
+    if (!shm->hdr || !shm->hdr->ready)
+    {
+        fprintf(stderr, "No shared memory segment %s from the controller\n", path);
+        return -1;
+    }
+
+    if (shm->hdr->magic != SR_SHM_MAGIC || shm->hdr->version != SR_SHM_VERSION)
+    {
+        fprintf(stderr, "%s: bad magic/version (%x/%u)\n", path,
+                shm->hdr->magic, shm->hdr->version);
+        return -1;
+    }
+
+    shm->nslots = shm->hdr->nslots;
+    shm->slot_size = shm->hdr->slot_size;
+    if (shm->nslots == 0 || (shm->nslots & (shm->nslots - 1)) ||
+            shm->slot_size <= sizeof(sr_shm_slot) + sizeof(struct sr_ethernet_hdr) ||
+            shm->hdr->nif > SR_SHM_MAX_IF ||
+            shm->len < SR_SHM_SEG_SIZE(shm->nslots, shm->slot_size))
+    {
+        fprintf(stderr, "%s: inconsistent segment geometry\n", path);
+        return -1;
+    }
+
+    shm->ring[0]  = (sr_shm_ring_idx*)((uint8_t*)shm->hdr + SR_SHM_RING_OFF);
+    shm->slots[0] = (uint8_t*)(shm->ring[0] + 1);
+    shm->ring[1]  = (sr_shm_ring_idx*)((uint8_t*)shm->ring[0] +
+                         SR_SHM_RING_SIZE(shm->nslots, shm->slot_size));
+    shm->slots[1] = (uint8_t*)(shm->ring[1] + 1);
+
+    return 0;
+} /* -- sr_shm_map -- */
+
+static int sr_shm_open(struct sr_instance* sr, const struct sr_backend_config* cfg)
+{
+    struct sr_shm* shm;
+
+    shm = (struct sr_shm*)sr_mem_calloc(SR_MEM_BACKEND, 1, sizeof(struct sr_shm));
+    assert(shm);
+    pthread_mutex_init(&shm->tx_lock, 0);
+    shm->sleep_us = SR_SHM_SLEEP_MIN;
+
+    if (sr_shm_map(shm, cfg->shm_name) < 0)
+    {
+        if (shm->hdr)
+        { munmap(shm->hdr, shm->len); }
+        sr_mem_free(shm);
+        return -1;
+    }
+
+    /* -- anything left over from a previous router is stale -- */
+    shm->ring[SR_SHM_TO_ROUTER]->tail =
+        __atomic_load_n(&shm->ring[SR_SHM_TO_ROUTER]->head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&shm->hdr->attached, (uint32_t)getpid(), __ATOMIC_RELEASE);
+
+    sr->backend_data = shm;
+    return 0;
+}
+
+static int sr_shm_discover(struct sr_instance* sr)
+{
+    struct sr_shm* shm = (struct sr_shm*)sr->backend_data;
+    char name[sr_IFACE_NAMELEN];
+    uint32_t i;
+
+    assert(sr->nif == 0);
+    for (i = 0; i < shm->hdr->nif; i++)
+    {
+        const sr_shm_if* ifs = &shm->hdr->ifs[i];
+
+        memset(name, 0, sizeof(name));
+        strncpy(name, ifs->name, sizeof(name) - 1);
+        /* -- table entry i becomes router interface i -- */
+        sr_add_interface(sr, name);
+        sr_set_ether_addr(sr, ifs->addr);
+        sr_set_ether_ip(sr, ifs->ip);
+    }
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_rx_burst(..)
+ * Scope: Local
+ *
+ * Hand out up to max frames in place.  The consumer index is only moved
+ * in rx_release, so the controller can't reuse the slots under us.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_shm_rx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int max)
+{
+    struct sr_shm* shm = (struct sr_shm*)sr->backend_data;
+    sr_shm_ring_idx* r = shm->ring[SR_SHM_TO_ROUTER];
+    uint32_t tail = r->tail;
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    if (head == tail)
+    {
+        struct timespec ts;
+
+        if (++shm->idle < SR_SHM_SPIN)
+        { return 0; }
+
+        ts.tv_sec = 0;
+        ts.tv_nsec = shm->sleep_us * 1000;
+        nanosleep(&ts, 0);
+        shm->sleeps++;
+        if (shm->sleep_us < SR_SHM_SLEEP_MAX)
+        { shm->sleep_us *= 2; }
+        return 0;
+    }
+    shm->idle = 0;
+    shm->sleep_us = SR_SHM_SLEEP_MIN;
+
+    for (; tail != head && n < max; tail++)
+    {
+        sr_shm_slot* s = sr_shm_slot_at(shm, SR_SHM_TO_ROUTER, tail);
+
+        shm->rx_taken++;
+        if (s->ifindex >= shm->hdr->nif || s->len < sizeof(struct sr_ethernet_hdr) ||
+                s->len > shm->slot_size - sizeof(sr_shm_slot))
+        {
+            shm->rx_bad++;
+            continue;
+        }
+
+        frames[n].buf   = (uint8_t*)(s + 1);
+        frames[n].len   = s->len;
+        frames[n].ifindex = s->ifindex;
+        frames[n].headroom = 0;
+        frames[n].priv  = 0;
+        n++;
+    }
+
+    if (n == 0)
+    {
+        /* -- only malformed slots, nothing references them -- */
+        __atomic_store_n(&r->tail, r->tail + shm->rx_taken, __ATOMIC_RELEASE);
+        shm->rx_taken = 0;
+    }
+
+    shm->rx_frames += n;
+    return n;
+}
+
+static int sr_shm_rx_ready(struct sr_instance* sr)
+{
+    struct sr_shm* shm = (struct sr_shm*)sr->backend_data;
+    sr_shm_ring_idx* r = shm->ring[SR_SHM_TO_ROUTER];
+
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != r->tail;
+}
+
+static void sr_shm_rx_release(struct sr_instance* sr, struct sr_frame* frames,
+                              int n)
+{
+    struct sr_shm* shm = (struct sr_shm*)sr->backend_data;
+    sr_shm_ring_idx* r = shm->ring[SR_SHM_TO_ROUTER];
+
+    __atomic_store_n(&r->tail, r->tail + shm->rx_taken, __ATOMIC_RELEASE);
+    shm->rx_taken = 0;
+}
+
+static int sr_shm_tx_burst(struct sr_instance* sr, const struct sr_frame* frames,
+                           int n)
+{
+    struct sr_shm* shm = (struct sr_shm*)sr->backend_data;
+    sr_shm_ring_idx* r = shm->ring[SR_SHM_TO_CTRL];
+    uint32_t head, tail;
+    int i;
+
+    pthread_mutex_lock(&shm->tx_lock);
+    head = r->head;
+    tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < n; i++)
+    {
+        sr_shm_slot* s;
+
+        if (frames[i].ifindex < 0 ||
+                (uint32_t)frames[i].ifindex >= shm->hdr->nif)
+        { break; }
+
+        if (head - tail == shm->nslots ||
+                frames[i].len > shm->slot_size - sizeof(sr_shm_slot))
+        {
+            /* -- controller not keeping up: drop like a full queue -- */
+            shm->tx_drops++;
+            continue;
+        }
+
+        s = sr_shm_slot_at(shm, SR_SHM_TO_CTRL, head);
+        s->ifindex = frames[i].ifindex;
+        s->flags = 0;
+        s->len = frames[i].len;
+        memcpy(s + 1, frames[i].buf, frames[i].len);
+        head++;
+        shm->tx_frames++;
+    }
+
+    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&shm->tx_lock);
+    return i;
+}
+
+static void sr_shm_close(struct sr_instance* sr)
+{
+    struct sr_shm* shm = (struct sr_shm*)sr->backend_data;
+
+    if (!shm)
+    { return; }
+
+    fprintf(stderr, "shm: %lu frames rx (%lu malformed), %lu frames tx, "
+            "%lu tx drops, %lu idle sleeps\n", shm->rx_frames, shm->rx_bad,
+            shm->tx_frames, shm->tx_drops, shm->sleeps);
+
+    __atomic_store_n(&shm->hdr->attached, 0, __ATOMIC_RELEASE);
+    munmap(shm->hdr, shm->len);
+    pthread_mutex_destroy(&shm->tx_lock);
+    sr_mem_free(shm);
+    sr->backend_data = 0;
+}
+
+const struct sr_backend sr_shm_backend =
+{
+    "shm",
+    sr_shm_open,
+    sr_shm_discover,
+    sr_shm_rx_burst,
+    sr_shm_rx_release,
+    sr_shm_tx_burst,
+    sr_shm_close,
+    0,
+    0,
+    0,
+    sr_shm_rx_ready
+};
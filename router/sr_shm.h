@@ -0,0 +1,108 @@
+/*-----------------------------------------------------------------------------
+   File:   sr_shm.h
+
+   Description:
+
+   Layout of the shared memory segment used instead of the VNS socket when
+   the controller runs on the same machine (pox_module/cs144/SRShm.py is
+   the other end; keep the two in sync).
+
+   The controller creates /dev/shm/<name>, fills in the interface table and
+   sets ready.  The router maps it, writes its pid to attached and moves
+   frames through two single producer / single consumer rings:
+
+     +---------------------+  0
+     | sr_shm_hdr          |  incl. interface table
+     +---------------------+  SR_SHM_RING_OFF
+     | ring 0: to router   |  sr_shm_ring_idx, nslots * slot_size
+     +---------------------+
+     | ring 1: to ctrl     |
+     +---------------------+
+
+   head is only written by the producer and tail only by the consumer; a
+   slot is filled first and then published by advancing head (both are
+   free running counters, slot = counter % nslots).  Frames name their
+   interface by its index in the table instead of a string.
+
+   The segment never leaves the machine, so everything is in host byte
+   order except ip/mask which are kept in network order like sr_if.
+
+  ---------------------------------------------------------------------------*/
+
+#ifndef SR_SHM_H
+#define SR_SHM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_SHM_MAGIC      0x53525348   /* "SRSH" */
+#define SR_SHM_VERSION    1
+#define SR_SHM_MAX_IF     16
+#define SR_SHM_NAMELEN    32
+#define SR_SHM_RING_OFF   4096
+
+#define SR_SHM_TO_ROUTER  0
+#define SR_SHM_TO_CTRL    1
+
+/*-----------------------------------------------------------------------------
+                                 INTERFACE
+  ---------------------------------------------------------------------------*/
+
+typedef struct
+{
+    char     name[SR_SHM_NAMELEN];
+    uint8_t  addr[6];
+    uint16_t pad;
+    uint32_t ip;               /* network byte order */
+    uint32_t mask;             /* network byte order */
+    uint32_t speed;
+}__attribute__ ((__packed__)) sr_shm_if;
+
+/*-----------------------------------------------------------------------------
+                                 HEADER
+  ---------------------------------------------------------------------------*/
+
+typedef struct
+{
+    uint32_t  magic;           /* SR_SHM_MAGIC */
+    uint32_t  version;         /* SR_SHM_VERSION */
+    uint32_t  nslots;          /* slots per ring, power of two */
+    uint32_t  slot_size;       /* bytes per slot incl. sr_shm_slot header */
+    uint32_t  nif;             /* used entries in ifs */
+    uint32_t  ready;           /* set by the controller once ifs is filled */
+    uint32_t  attached;        /* router pid while attached, else 0 */
+    uint32_t  pad;
+    sr_shm_if ifs[SR_SHM_MAX_IF];
+}__attribute__ ((__packed__)) sr_shm_hdr;
+
+/*-----------------------------------------------------------------------------
+                                 RING
+  ---------------------------------------------------------------------------*/
+
+typedef struct
+{
+    uint32_t head;             /* producer */
+    uint8_t  pad0[60];
+    uint32_t tail;             /* consumer */
+    uint8_t  pad1[60];
+}__attribute__ ((__packed__)) sr_shm_ring_idx;
+
+typedef struct
+{
+    uint16_t ifindex;          /* index into sr_shm_hdr.ifs */
+    uint16_t flags;            /* unused, 0 */
+    uint32_t len;              /* frame length, data follows */
+}__attribute__ ((__packed__)) sr_shm_slot;
+
+#define SR_SHM_RING_SIZE(nslots, slot_size) \
+    (sizeof(sr_shm_ring_idx) + (size_t)(nslots) * (slot_size))
+
+#define SR_SHM_SEG_SIZE(nslots, slot_size) \
+    (SR_SHM_RING_OFF + 2 * SR_SHM_RING_SIZE(nslots, slot_size))
+
+#endif /* SR_SHM_H */
@@ -0,0 +1,239 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_slowpath.c
+ *
+ * Description:
+ *
+ * Exception traffic thread, see sr_slowpath.h.
+ *
+ * Any receive or worker thread may punt, so the queue is a plain ring
+ * under a mutex; at slow path rates the lock is not what limits us.
+ * The copy is not made under it, though: a punt reserves a slot, copies
+ * the packet, then fills the slot, and the thread only sees filled
+ * slots up to the first one still being copied.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "sr_router.h"
+#include "sr_backend.h"
+#include "sr_pool.h"
+#include "sr_pkt.h"
+#include "sr_slowpath.h"
+#include "sr_trace.h"
+#include "sr_stats.h"
+#include "sr_mem.h"
+
+struct sr_slowpath
+{
+    struct sr_instance* sr;
+    pthread_t thread;
+    pthread_mutex_t lock;       /* protects everything below */
+    pthread_cond_t wake;
+    int stop;
+
+    struct sr_pkt* q[SR_SLOW_QUEUE];   /* 0 while reserved but unfilled */
+    unsigned int head;          /* filled up to here */
+    unsigned int resv;          /* reserved up to here */
+    unsigned int tail;
+
+    unsigned int rate;          /* packets per second */
+    double tokens;
+    double depth;               /* bucket size */
+    uint64_t refill_ns;
+
+    unsigned long punted;
+    unsigned long handled;
+    unsigned long drop_budget;
+    unsigned long drop_full;
+    unsigned long drop_nobuf;
+    unsigned int high_water;
+};
+
+/* -- fills a reserved slot whose copy failed -- */
+static struct sr_pkt sr_slow_nobuf;
+
+/*---------------------------------------------------------------------
+ * Method: sr_slowpath_main(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_slowpath_main(void* arg)
+{
+    struct sr_slowpath* sp = (struct sr_slowpath*)arg;
+    struct sr_pkt* batch[SR_SLOW_BATCH];
+    int n, i;
+
+    sr_trace_thread("slowpath");
+    sr_stats_thread("slowpath");
+
+    while (1)
+    {
+        pthread_mutex_lock(&sp->lock);
+        while (sp->head == sp->tail && (!sp->stop || sp->resv != sp->tail))
+        { pthread_cond_wait(&sp->wake, &sp->lock); }
+
+        for (n = 0; n < SR_SLOW_BATCH && sp->tail != sp->head; sp->tail++)
+        {
+            struct sr_pkt** slot = &sp->q[sp->tail & (SR_SLOW_QUEUE - 1)];
+
+            if (*slot != &sr_slow_nobuf)
+            { batch[n++] = *slot; }
+            *slot = 0;
+        }
+        if (n == 0 && sp->stop && sp->resv == sp->tail)
+        {
+            pthread_mutex_unlock(&sp->lock);
+            break;
+        }
+        sp->handled += n;
+        pthread_mutex_unlock(&sp->lock);
+
+        sr_backend_burst_begin();
+        for (i = 0; i < n; i++)
+        {
+            sr_alloc_check_begin();
+            sr_handle_exception(sp->sr, batch[i]);
+            sr_alloc_check_end();
+            sr_pkt_unref(batch[i]);
+        }
+        sr_backend_burst_end(sp->sr);
+    }
+
+    return 0;
+} /* -- sr_slowpath_main -- */
+
+int sr_slowpath_start(struct sr_instance* sr, unsigned int rate)
+{
+    struct sr_slowpath* sp;
+
+    assert(sr);
+    assert(!sr->slowpath);
+
+    if (rate == 0)
+    { return 0; }
+
+    sp = (struct sr_slowpath*)sr_mem_calloc(SR_MEM_THREAD, 1,
+                                            sizeof(struct sr_slowpath));
+    assert(sp);
+
+    sp->sr = sr;
+    sp->rate = rate;
+    sp->depth = rate / 10.0 < SR_SLOW_BATCH ? SR_SLOW_BATCH : rate / 10.0;
+    sp->tokens = sp->depth;
+    sp->refill_ns = sr_pkt_clock();
+    pthread_mutex_init(&sp->lock, 0);
+    pthread_cond_init(&sp->wake, 0);
+
+    if ((errno = pthread_create(&sp->thread, 0, sr_slowpath_main, sp)) != 0)
+    {
+        perror("pthread_create:sr_slowpath.c::sr_slowpath_start");
+        pthread_cond_destroy(&sp->wake);
+        pthread_mutex_destroy(&sp->lock);
+        sr_mem_free(sp);
+        return -1;
+    }
+
+    sr->slowpath = sp;
+    return 0;
+} /* -- sr_slowpath_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_slowpath_punt(..)
+ * Scope: Global
+ *
+ * Budget and queue space are checked before the packet is held, so a
+ * storm costs the fast path a lock round trip per packet and no copy.
+ * The copy itself is made between reserving a slot and filling it, so
+ * other punts and the thread's pops don't wait behind it.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_slowpath_punt(struct sr_instance* sr, struct sr_pkt* pkt)
+{
+    struct sr_slowpath* sp = sr->slowpath;
+    struct sr_pkt* held;
+    uint64_t now = sr_pkt_clock();
+    unsigned int idx, depth, was;
+
+    pthread_mutex_lock(&sp->lock);
+    sp->punted++;
+
+    sp->tokens += (now - sp->refill_ns) * 1e-9 * sp->rate;
+    if (sp->tokens > sp->depth)
+    { sp->tokens = sp->depth; }
+    sp->refill_ns = now;
+
+    if (sp->tokens < 1.0)
+    {
+        sp->drop_budget++;
+        SR_STATS_DROP(SLOW_BUDGET, pkt->len);
+        pthread_mutex_unlock(&sp->lock);
+        return -1;
+    }
+    if (sp->resv - sp->tail == SR_SLOW_QUEUE)
+    {
+        sp->drop_full++;
+        SR_STATS_DROP(QUEUE_FULL, pkt->len);
+        pthread_mutex_unlock(&sp->lock);
+        return -1;
+    }
+    sp->tokens -= 1.0;
+    idx = sp->resv++;
+    pthread_mutex_unlock(&sp->lock);
+
+    /* -- no pin: the queue slot is reused as soon as the thread pops it -- */
+    if ((held = sr_backend_hold(sr, pkt, 0)) == 0)
+    { SR_STATS_DROP(NO_BUFFER, pkt->len); }
+
+    pthread_mutex_lock(&sp->lock);
+    if (!held)
+    {
+        sp->drop_nobuf++;
+        sp->tokens += 1.0;
+    }
+    sp->q[idx & (SR_SLOW_QUEUE - 1)] = held ? held : &sr_slow_nobuf;
+
+    /* -- publish ours and any filled behind an earlier, slower punt -- */
+    was = sp->head;
+    while (sp->head != sp->resv && sp->q[sp->head & (SR_SLOW_QUEUE - 1)])
+    { sp->head++; }
+    depth = sp->head - sp->tail;
+    if (depth > sp->high_water)
+    { sp->high_water = depth; }
+    if (was == sp->tail && sp->head != was)
+    { pthread_cond_signal(&sp->wake); }
+    pthread_mutex_unlock(&sp->lock);
+
+    return held ? 0 : -1;
+} /* -- sr_slowpath_punt -- */
+
+void sr_slowpath_stop(struct sr_instance* sr)
+{
+    struct sr_slowpath* sp = sr->slowpath;
+
+    if (!sp)
+    { return; }
+
+    pthread_mutex_lock(&sp->lock);
+    sp->stop = 1;
+    pthread_cond_signal(&sp->wake);
+    pthread_mutex_unlock(&sp->lock);
+    pthread_join(sp->thread, 0);
+
+    fprintf(stderr, "slow path: %lu punted, %lu handled (queue high water %u), "
+            "%lu over budget, %lu queue full, %lu no buffer\n", sp->punted,
+            sp->handled, sp->high_water, sp->drop_budget, sp->drop_full,
+            sp->drop_nobuf);
+
+    pthread_cond_destroy(&sp->wake);
+    pthread_mutex_destroy(&sp->lock);
+    sr_mem_free(sp);
+    sr->slowpath = 0;
+} /* -- sr_slowpath_stop -- */
@@ -0,0 +1,40 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_slowpath.h
+ *
+ * Description:
+ *
+ * Exception traffic thread.  sr_handlepacket(..) forwards transit packets
+ * with a route and a resolved next hop itself (the fast path) and punts
+ * everything else -- ARP, packets for the router's addresses, TTL expiry,
+ * unroutable and unresolved destinations -- onto a bounded queue served
+ * by one slow path thread.  An ARP or traceroute storm then queues (and
+ * drops) there instead of delaying transit traffic.
+ *
+ * The slow path has its own budget: punts beyond 'rate' packets per
+ * second (with a burst of a tenth of a second) are dropped before they
+ * are copied.  Start it with rate 0 to handle exceptions inline instead.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SLOWPATH_H
+#define SR_SLOWPATH_H
+
+#define SR_SLOW_RATE   10000  /* default budget, packets per second */
+#define SR_SLOW_QUEUE  1024   /* packets waiting, power of 2 */
+#define SR_SLOW_BATCH  32     /* packets handled per queue visit */
+
+struct sr_instance;
+struct sr_pkt;
+
+/* Start the slow path thread, or do nothing if rate is 0.  Returns 0 or
+   -1. */
+int  sr_slowpath_start(struct sr_instance* sr, unsigned int rate);
+
+/* Queue pkt (borrowed) for the slow path thread; it is held or copied as
+   needed.  Returns 0 if queued, -1 if dropped. */
+int  sr_slowpath_punt(struct sr_instance* sr, struct sr_pkt* pkt);
+
+/* Drain and join the thread and print its counters. */
+void sr_slowpath_stop(struct sr_instance* sr);
+
+#endif /* -- SR_SLOWPATH_H -- */
@@ -0,0 +1,216 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stat.c
+ *
+ * Description:
+ *
+ * Live view of a running router's counters (see sr_stats.h):
+ *
+ *   sr_stat [-i secs] [-c count] [-r routes] [segment]
+ *
+ * Maps /dev/shm/<segment> (default sr-stats) read-only, sums the
+ * per-thread blocks every -i seconds (default 1) and prints packet and
+ * bit rates per interface, drops by reason and the -r busiest routes
+ * (default 10, 0 for all), totals and per second over the last
+ * interval, heap use by subsystem, and latency percentiles by path over
+ * the last interval.  The first report covers everything since the router
+ * started.  Stops after -c reports or when the router exits.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sr_stats.h"
+
+#define SR_STAT_SIZE \
+    (SR_STATS_BLOCK_OFF + SR_STATS_MAX_BLOCKS * sizeof(struct sr_stats_block))
+
+static const char* sr_stat_drops[] =
+{
+#define SR_STAT_NAME(id, name) name,
+    SR_STATS_DROPS(SR_STAT_NAME)
+#undef SR_STAT_NAME
+};
+
+static uint64_t sr_stat_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+} /* -- sr_stat_ns -- */
+
+static void sr_stat_print(const struct sr_stats_hdr* hdr,
+                          const struct sr_stats_block* now,
+                          const struct sr_stats_block* prev, double secs,
+                          unsigned int routes)
+{
+    unsigned int nif = __atomic_load_n(&hdr->nif, __ATOMIC_ACQUIRE);
+    unsigned int i, c;
+    uint64_t total = 0;
+
+    if (nif > SR_MAX_IF)
+    { nif = SR_MAX_IF; }
+    if (secs <= 0)
+    { secs = 1e-9; }
+
+    printf("%-8s %10s %10s %10s %10s %12s %12s %8s\n", "iface", "rx pps",
+           "rx Mbps", "tx pps", "tx Mbps", "rx packets", "tx packets",
+           "tx errs");
+    for (i = 0; i < nif; i++)
+    {
+        const uint64_t* a = now->ifc[i];
+        const uint64_t* b = prev->ifc[i];
+
+        printf("%-8.8s %10.0f %10.2f %10.0f %10.2f %12llu %12llu %8llu\n",
+               hdr->ifname[i],
+               (a[SR_IFC_RX_PKTS] - b[SR_IFC_RX_PKTS]) / secs,
+               (a[SR_IFC_RX_BYTES] - b[SR_IFC_RX_BYTES]) * 8 / secs / 1e6,
+               (a[SR_IFC_TX_PKTS] - b[SR_IFC_TX_PKTS]) / secs,
+               (a[SR_IFC_TX_BYTES] - b[SR_IFC_TX_BYTES]) * 8 / secs / 1e6,
+               (unsigned long long)a[SR_IFC_RX_PKTS],
+               (unsigned long long)a[SR_IFC_TX_PKTS],
+               (unsigned long long)a[SR_IFC_TX_ERRORS]);
+    }
+
+    for (c = 0; c < SR_DROP_COUNT; c++)
+    {
+        if (now->drop[c] == 0)
+        { continue; }
+        if (total == 0)
+        { printf("%-17s %10s %12s\n", "drops", "per sec", "total"); }
+        printf("%-17s %10.0f %12llu\n", sr_stat_drops[c],
+               (now->drop[c] - prev->drop[c]) / secs,
+               (unsigned long long)now->drop[c]);
+        total += now->drop[c];
+    }
+    if (total == 0)
+    { printf("no drops\n"); }
+    sr_stats_print_routes(stdout, hdr, now, prev, secs, routes);
+    sr_mem_print(stdout, hdr->mem);
+    sr_stats_print_latency(stdout, now, prev);
+    printf("\n");
+    fflush(stdout);
+} /* -- sr_stat_print -- */
+
+static void usage(char* argv0)
+{
+    fprintf(stderr, "usage: %s [-i secs] [-c count] [-r routes] [segment]\n",
+            argv0);
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    const char* name = SR_STATS_NAME;
+    const struct sr_stats_hdr* hdr;
+    struct sr_stats_block* now;
+    struct sr_stats_block* prev;
+    struct timespec ts;
+    char path[128];
+    struct stat st;
+    double interval = 1.0;
+    uint64_t prev_ns;
+    long count = -1;
+    unsigned int routes = 10;
+    int c, fd;
+
+    while ((c = getopt(argc, argv, "hi:c:r:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'i':
+                interval = atof(optarg);
+                break;
+            case 'c':
+                count = atol(optarg);
+                break;
+            case 'r':
+                routes = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc)
+    { name = argv[optind]; }
+    if (interval <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "/dev/shm/%s", name);
+    if ((fd = open(path, O_RDONLY)) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SR_STAT_SIZE ||
+            (hdr = (const struct sr_stats_hdr*)mmap(0, SR_STAT_SIZE, PROT_READ,
+                    MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: can't map the segment\n", path);
+        return 1;
+    }
+    close(fd);
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SR_STATS_MAGIC ||
+            hdr->version != SR_STATS_VERSION ||
+            hdr->block_size != sizeof(struct sr_stats_block) ||
+            hdr->if_counters != SR_IFC_COUNT || hdr->drops != SR_DROP_COUNT ||
+            hdr->paths != SR_PATH_COUNT || hdr->lat_buckets != SR_LAT_BUCKETS ||
+            hdr->max_if != SR_MAX_IF ||
+            hdr->max_routes != SR_STATS_MAX_ROUTES ||
+            hdr->mem_tags != SR_MEM_COUNT)
+    {
+        fprintf(stderr, "%s: not a stats segment of this version\n", path);
+        return 1;
+    }
+
+    now = (struct sr_stats_block*)calloc(1, sizeof(*now));
+    prev = (struct sr_stats_block*)calloc(1, sizeof(*prev));
+    if (!now || !prev)
+    { return 1; }
+    prev_ns = hdr->started_ns;
+
+    while (count != 0)
+    {
+        struct sr_stats_block* t;
+        uint64_t ns = sr_stat_ns();
+        int gone = kill(hdr->pid, 0) != 0 && errno == ESRCH;
+
+        sr_stats_sum(hdr, now);
+        printf("sr pid %u, up %.1f s%s\n", hdr->pid,
+               (ns - hdr->started_ns) / 1e9, gone ? ", exited" : "");
+        sr_stat_print(hdr, now, prev, (ns - prev_ns) / 1e9, routes);
+        if (gone)
+        { break; }
+        if (count > 0)
+        { count--; }
+        if (count == 0)
+        { break; }
+
+        t = prev;
+        prev = now;
+        now = t;
+        prev_ns = ns;
+
+        ts.tv_sec = (time_t)interval;
+        ts.tv_nsec = (long)((interval - ts.tv_sec) * 1e9);
+        nanosleep(&ts, 0);
+    }
+
+    free(now);
+    free(prev);
+    return 0;
+} /* -- main -- */
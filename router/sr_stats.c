@@ -0,0 +1,447 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Per-thread packet counter blocks in a shared memory segment, see
+ * sr_stats.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_stats.h"
+
+#define SR_STATS_SIZE \
+    (SR_STATS_BLOCK_OFF + SR_STATS_MAX_BLOCKS * sizeof(struct sr_stats_block))
+
+/* -- for threads without a block, and everyone before sr_stats_init -- */
+static struct sr_stats_block sr_stats_private;
+
+__thread struct sr_stats_block* sr_stats_mine = &sr_stats_private;
+
+static struct sr_stats_hdr* sr_stats_hdr;
+static struct sr_stats_block* sr_stats_blocks;
+static char sr_stats_path[128];
+
+int sr_stats_init(const char* name)
+{
+    struct timespec ts;
+    void* seg = MAP_FAILED;
+    int fd;
+
+    assert(name);
+    assert(!sr_stats_hdr);
+    assert(sizeof(struct sr_stats_hdr) <= SR_STATS_BLOCK_OFF);
+
+    if (strchr(name, '/') == 0)
+    {
+        snprintf(sr_stats_path, sizeof(sr_stats_path), "/dev/shm/%s", name);
+        if ((fd = open(sr_stats_path, O_RDWR | O_CREAT | O_TRUNC, 0644)) >= 0)
+        {
+            if (ftruncate(fd, SR_STATS_SIZE) == 0)
+            {
+                seg = mmap(0, SR_STATS_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+            }
+            close(fd);
+        }
+    }
+
+    if (seg == MAP_FAILED)
+    {
+        /* -- the counters still work, sr_stat just can't see them -- */
+        fprintf(stderr, "stats: can't create /dev/shm/%s, counting privately\n",
+                name);
+        sr_stats_path[0] = 0;
+        seg = mmap(0, SR_STATS_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (seg == MAP_FAILED)
+        {
+            perror("mmap:sr_stats.c::sr_stats_init");
+            return -1;
+        }
+    }
+
+    sr_stats_hdr = (struct sr_stats_hdr*)seg;
+    sr_stats_blocks = (struct sr_stats_block*)((uint8_t*)seg + SR_STATS_BLOCK_OFF);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    sr_stats_hdr->pid = getpid();
+    sr_stats_hdr->block_size = sizeof(struct sr_stats_block);
+    sr_stats_hdr->if_counters = SR_IFC_COUNT;
+    sr_stats_hdr->drops = SR_DROP_COUNT;
+    sr_stats_hdr->paths = SR_PATH_COUNT;
+    sr_stats_hdr->lat_buckets = SR_LAT_BUCKETS;
+    sr_stats_hdr->max_if = SR_MAX_IF;
+    sr_stats_hdr->max_routes = SR_STATS_MAX_ROUTES;
+    sr_stats_hdr->mem_tags = SR_MEM_COUNT;
+    sr_stats_hdr->started_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    sr_stats_hdr->version = SR_STATS_VERSION;
+    sr_mem_attach(sr_stats_hdr->mem);
+    __atomic_store_n(&sr_stats_hdr->magic, SR_STATS_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+} /* -- sr_stats_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_thread(..)
+ * Scope: Global
+ *
+ * Call at thread start, next to sr_trace_thread(..).  Blocks are never
+ * given back; a thread that finds none left counts privately.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_thread(const char* name)
+{
+    unsigned int i;
+
+    if (!sr_stats_hdr || sr_stats_mine != &sr_stats_private)
+    { return; }
+
+    if ((i = __atomic_fetch_add(&sr_stats_hdr->nblocks, 1, __ATOMIC_ACQ_REL)) >=
+            SR_STATS_MAX_BLOCKS)
+    {
+        fprintf(stderr, "stats: no block left for thread %s\n", name);
+        return;
+    }
+
+    strncpy(sr_stats_hdr->thread[i], name, SR_STATS_NAMELEN - 1);
+    sr_stats_mine = &sr_stats_blocks[i];
+} /* -- sr_stats_thread -- */
+
+void sr_stats_set_ifs(struct sr_instance* sr)
+{
+    int i;
+
+    assert(sr);
+
+    if (!sr_stats_hdr)
+    { return; }
+
+    for (i = 0; i < sr->nif && i < SR_MAX_IF; i++)
+    {
+        if (sr->if_table[i])
+        {
+            strncpy(sr_stats_hdr->ifname[i], sr->if_table[i]->name,
+                    sr_IFACE_NAMELEN - 1);
+        }
+    }
+    __atomic_store_n(&sr_stats_hdr->nif, (uint32_t)i, __ATOMIC_RELEASE);
+} /* -- sr_stats_set_ifs -- */
+
+void sr_stats_set_routes(struct sr_instance* sr)
+{
+    struct sr_rt* rt;
+    int n = 0;
+
+    assert(sr);
+
+    if (!sr_stats_hdr)
+    { return; }
+
+    for (rt = sr->routing_table; rt; rt = rt->next, n++)
+    {
+        struct sr_stats_route* r;
+
+        if (rt->index < 0 || rt->index >= SR_STATS_MAX_ROUTES)
+        { continue; }
+        r = &sr_stats_hdr->route[rt->index];
+        r->dest = rt->dest.s_addr;
+        r->gw = rt->gw.s_addr;
+        r->mask = rt->mask.s_addr;
+        r->ifindex = rt->ifindex;
+    }
+    if (n > SR_STATS_MAX_ROUTES)
+    {
+        fprintf(stderr, "stats: counting the first %d of %d routes\n",
+                SR_STATS_MAX_ROUTES, n);
+        n = SR_STATS_MAX_ROUTES;
+    }
+    __atomic_store_n(&sr_stats_hdr->nroutes, (uint32_t)n, __ATOMIC_RELEASE);
+} /* -- sr_stats_set_routes -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_lat_bucket(..), sr_stats_lat_value(..)
+ * Scope: Local
+ *
+ * Values below 2 * SR_LAT_SUB have a bucket each.  Above that a bucket
+ * covers 2^shift ns, shift growing by one per power of 2 so that every
+ * power of 2 is split into SR_LAT_SUB buckets.  A bucket's value is the
+ * highest it holds.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_stats_lat_bucket(uint64_t ns)
+{
+    unsigned int shift;
+
+    if (ns < 2 * SR_LAT_SUB)
+    { return ns; }
+    if (ns >= (1ull << SR_LAT_MAX_BITS))
+    { ns = (1ull << SR_LAT_MAX_BITS) - 1; }
+
+    shift = 63 - __builtin_clzll(ns) - SR_LAT_SUB_BITS;
+    return (shift + 1) * SR_LAT_SUB + (ns >> shift) - SR_LAT_SUB;
+} /* -- sr_stats_lat_bucket -- */
+
+static uint64_t sr_stats_lat_value(unsigned int b)
+{
+    unsigned int shift;
+
+    if (b < 2 * SR_LAT_SUB)
+    { return b; }
+
+    shift = b / SR_LAT_SUB - 1;
+    return (((uint64_t)(b % SR_LAT_SUB + SR_LAT_SUB) + 1) << shift) - 1;
+} /* -- sr_stats_lat_value -- */
+
+void sr_stats_latency(unsigned int path, uint64_t ns)
+{
+    struct sr_stats_block* b = sr_stats_mine;
+
+    if (path == SR_PATH_NONE || path >= SR_PATH_END)
+    { return; }
+    b->lat[path - 1][sr_stats_lat_bucket(ns)]++;
+    b->lat_sum_ns[path - 1] += ns;
+} /* -- sr_stats_latency -- */
+
+void sr_stats_sum(const struct sr_stats_hdr* hdr, struct sr_stats_block* sum)
+{
+    const struct sr_stats_block* blocks =
+        (const struct sr_stats_block*)((const uint8_t*)hdr + SR_STATS_BLOCK_OFF);
+    unsigned int n = __atomic_load_n(&hdr->nblocks, __ATOMIC_ACQUIRE);
+    unsigned int b, i, c;
+
+    if (n > SR_STATS_MAX_BLOCKS)
+    { n = SR_STATS_MAX_BLOCKS; }
+
+    memset(sum, 0, sizeof(*sum));
+    for (b = 0; b < n; b++)
+    {
+        for (i = 0; i < SR_MAX_IF; i++)
+        {
+            for (c = 0; c < SR_IFC_COUNT; c++)
+            { sum->ifc[i][c] += blocks[b].ifc[i][c]; }
+        }
+        for (c = 0; c < SR_DROP_COUNT; c++)
+        { sum->drop[c] += blocks[b].drop[c]; }
+        for (i = 0; i < SR_STATS_MAX_ROUTES; i++)
+        {
+            sum->route_pkts[i] += blocks[b].route_pkts[i];
+            sum->route_bytes[i] += blocks[b].route_bytes[i];
+        }
+        for (c = 0; c < SR_PATH_COUNT; c++)
+        {
+            sum->lat_sum_ns[c] += blocks[b].lat_sum_ns[c];
+            for (i = 0; i < SR_LAT_BUCKETS; i++)
+            { sum->lat[c][i] += blocks[b].lat[c][i]; }
+        }
+    }
+} /* -- sr_stats_sum -- */
+
+int sr_stats_route(unsigned int i, uint64_t* pkts, uint64_t* bytes)
+{
+    unsigned int b, n;
+
+    *pkts = *bytes = 0;
+    if (i >= SR_STATS_MAX_ROUTES)
+    { return -1; }
+    if (!sr_stats_hdr)
+    { return 0; }
+
+    n = __atomic_load_n(&sr_stats_hdr->nblocks, __ATOMIC_ACQUIRE);
+    if (n > SR_STATS_MAX_BLOCKS)
+    { n = SR_STATS_MAX_BLOCKS; }
+    for (b = 0; b < n; b++)
+    {
+        *pkts += sr_stats_blocks[b].route_pkts[i];
+        *bytes += sr_stats_blocks[b].route_bytes[i];
+    }
+    return 0;
+} /* -- sr_stats_route -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_print_latency(..)
+ * Scope: Global
+ *
+ * One walk over each histogram picks up all the percentiles, in us.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_print_latency(FILE* fp, const struct sr_stats_block* now,
+                            const struct sr_stats_block* prev)
+{
+    static const char* names[] =
+    {
+#define SR_STATS_NAME_OF(id, name) name,
+        SR_STATS_PATHS(SR_STATS_NAME_OF)
+#undef SR_STATS_NAME_OF
+    };
+    static const double q[] = { 0.5, 0.9, 0.99, 0.999 };
+    int header = 0;
+    unsigned int p, i;
+
+    for (p = 0; p < SR_PATH_COUNT; p++)
+    {
+        uint64_t count = 0, seen = 0, max = 0;
+        double v[4];
+        unsigned int k = 0;
+
+        for (i = 0; i < SR_LAT_BUCKETS; i++)
+        { count += now->lat[p][i] - (prev ? prev->lat[p][i] : 0); }
+        if (count == 0)
+        { continue; }
+
+        for (i = 0; i < SR_LAT_BUCKETS; i++)
+        {
+            uint64_t n = now->lat[p][i] - (prev ? prev->lat[p][i] : 0);
+
+            if (n == 0)
+            { continue; }
+            seen += n;
+            max = sr_stats_lat_value(i);
+            while (k < 4 && seen >= q[k] * count)
+            { v[k++] = max / 1e3; }
+        }
+
+        if (!header)
+        {
+            fprintf(fp, "%-12s %10s %10s %10s %10s %10s %10s %10s\n",
+                    "latency us", "packets", "mean", "p50", "p90", "p99",
+                    "p99.9", "max");
+            header = 1;
+        }
+        fprintf(fp, "%-12s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                names[p], (unsigned long long)count,
+                (now->lat_sum_ns[p] - (prev ? prev->lat_sum_ns[p] : 0)) /
+                1e3 / count, v[0], v[1], v[2], v[3], max / 1e3);
+    }
+} /* -- sr_stats_print_latency -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_print_routes(..)
+ * Scope: Global
+ *
+ * Busiest first by packets over the interval, picked by selection: the
+ * tables are small and top is smaller.  With a top the list stops at
+ * the first route that carried nothing; without one every route is
+ * listed, idle ones last, so they show up as candidates to remove.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_print_routes(FILE* fp, const struct sr_stats_hdr* hdr,
+                           const struct sr_stats_block* now,
+                           const struct sr_stats_block* prev, double secs,
+                           unsigned int top)
+{
+    unsigned int n = __atomic_load_n(&hdr->nroutes, __ATOMIC_ACQUIRE);
+    unsigned int nif = __atomic_load_n(&hdr->nif, __ATOMIC_ACQUIRE);
+    uint8_t shown[SR_STATS_MAX_ROUTES];
+    uint64_t total = 0;
+    unsigned int i, k, shows, idle = 0;
+
+    if (n > SR_STATS_MAX_ROUTES)
+    { n = SR_STATS_MAX_ROUTES; }
+    if (n == 0)
+    { return; }
+    if (secs <= 0)
+    { secs = 1e-9; }
+    if (nif > SR_MAX_IF)
+    { nif = SR_MAX_IF; }
+    shows = top == 0 || top > n ? n : top;
+
+    for (i = 0; i < n; i++)
+    {
+        total += now->route_pkts[i] - (prev ? prev->route_pkts[i] : 0);
+        if (now->route_pkts[i] == 0)
+        { idle++; }
+    }
+    memset(shown, 0, sizeof(shown));
+
+    fprintf(fp, "%-18s %-15s %-8s %10s %10s %12s %14s %6s\n", "route",
+            "gateway", "iface", "pps", "Mbps", "packets", "bytes", "share");
+    for (k = 0; k < shows; k++)
+    {
+        const struct sr_stats_route* r;
+        char dest[INET_ADDRSTRLEN], gw[INET_ADDRSTRLEN], prefix[24];
+        uint64_t best = 0;
+        unsigned int b = n;
+
+        for (i = 0; i < n; i++)
+        {
+            uint64_t d = now->route_pkts[i] - (prev ? prev->route_pkts[i] : 0);
+
+            if (!shown[i] && (b == n || d > best))
+            {
+                best = d;
+                b = i;
+            }
+        }
+        if (top && best == 0)
+        { break; }
+        shown[b] = 1;
+
+        r = &hdr->route[b];
+        inet_ntop(AF_INET, &r->dest, dest, sizeof(dest));
+        inet_ntop(AF_INET, &r->gw, gw, sizeof(gw));
+        snprintf(prefix, sizeof(prefix), "%s/%d", dest,
+                 __builtin_popcount(r->mask));
+        fprintf(fp, "%-18s %-15s %-8.8s %10.0f %10.2f %12llu %14llu %5.1f%%\n",
+                prefix, gw,
+                (unsigned int)r->ifindex < nif ? hdr->ifname[r->ifindex] : "?",
+                best / secs,
+                (now->route_bytes[b] - (prev ? prev->route_bytes[b] : 0)) *
+                8 / secs / 1e6,
+                (unsigned long long)now->route_pkts[b],
+                (unsigned long long)now->route_bytes[b],
+                total ? 100.0 * best / total : 0.0);
+    }
+    fprintf(fp, "%u of %u routes idle\n", idle, n);
+} /* -- sr_stats_print_routes -- */
+
+void sr_stats_report(FILE* fp)
+{
+    static struct sr_stats_block sum;
+    struct timespec ts;
+    uint64_t ns;
+
+    if (!sr_stats_hdr)
+    { return; }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    sr_stats_sum(sr_stats_hdr, &sum);
+    sr_stats_print_routes(fp, sr_stats_hdr, &sum, 0,
+                          (ns - sr_stats_hdr->started_ns) / 1e9, 0);
+    sr_stats_print_latency(fp, &sum, 0);
+} /* -- sr_stats_report -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_close(..)
+ * Scope: Global
+ *
+ * Only the name goes: the ARP thread is never joined and may still
+ * count into its block, so the mapping stays.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_close(void)
+{
+    if (sr_stats_path[0])
+    {
+        unlink(sr_stats_path);
+        sr_stats_path[0] = 0;
+    }
+} /* -- sr_stats_close -- */
@@ -0,0 +1,236 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ *
+ * Description:
+ *
+ * Packet counters: rx / tx packets and bytes per interface, drops by
+ * reason, packets and bytes per route and receive-to-send latency
+ * histograms by the path a packet took.  Every packet thread counts
+ * into a block of its own, so the packet path does plain increments on
+ * cache lines no other thread writes.  The blocks live in a shared
+ * memory segment (/dev/shm/<name>, -M, "sr-stats" by default) that
+ * sr_stat maps read-only and sums up; the packet path never
+ * aggregates, reads or locks them.
+ *
+ *   +----------------------+  0
+ *   | sr_stats_hdr         |  interface, route and thread names,
+ *   |                      |  heap use (sr_mem.h)
+ *   +----------------------+  SR_STATS_BLOCK_OFF
+ *   | block 0 .. nblocks-1 |  struct sr_stats_block each
+ *   +----------------------+
+ *
+ * Counters are 64 bit and only ever grow; a reader on a 32 bit machine
+ * may see one torn now and then.
+ *
+ * A route's counters are indexed by its position in the routing table
+ * (sr_rt index); the header describes the first SR_STATS_MAX_ROUTES,
+ * later routes go uncounted.  Only forwarded packets count, against
+ * the route they leave by, and only once sr_send_packet(..) has handed
+ * them to the backend (pkt->route), so a packet that is dropped or
+ * goes round the slow path on its way counts once or not at all.
+ *
+ * Latency is recorded when sr_send_packet(..) hands a packet with a
+ * lat_path to the backend, as the time since it was received (ts_ns).
+ * Packets that waited for ARP keep their receive time, so arp-queued
+ * includes the wait; replies built in a new packet inherit the time of
+ * the packet they answer.  The histograms are log-linear like HDR
+ * histograms: exact below 2^SR_LAT_SUB_BITS ns, then SR_LAT_SUB buckets
+ * per power of 2, so any value is within ~3% of its bucket's.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_STATS_H
+#define SR_STATS_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_if.h"
+#include "sr_trace.h"
+#include "sr_probe.h"
+#include "sr_mem.h"
+
+#define SR_STATS_MAGIC       0x53545253   /* "SRST" */
+#define SR_STATS_VERSION     4
+#define SR_STATS_NAME        "sr-stats"
+#define SR_STATS_MAX_BLOCKS  32           /* counting threads */
+#define SR_STATS_MAX_ROUTES  256          /* routes with counters */
+#define SR_STATS_NAMELEN     16
+#define SR_STATS_BLOCK_OFF   8192         /* the header must fit */
+
+#define SR_STATS_IF_COUNTERS(X) \
+    X(RX_PKTS,   "rx-packets") \
+    X(RX_BYTES,  "rx-bytes") \
+    X(TX_PKTS,   "tx-packets") \
+    X(TX_BYTES,  "tx-bytes") \
+    X(TX_ERRORS, "tx-errors")
+
+/* Drop reasons, also the trace's "r" argument. */
+#define SR_STATS_DROPS(X) \
+    X(SHORT_FRAME,    "short-frame") \
+    X(BAD_ETHERTYPE,  "bad-ethertype") \
+    X(SHORT_ARP,      "short-arp") \
+    X(ARP_NOT_FOR_US, "arp-not-for-us") \
+    X(BAD_IP_HEADER,  "bad-ip-header") \
+    X(BAD_CKSUM,      "bad-checksum") \
+    X(TTL_EXPIRED,    "ttl-expired") \
+    X(NO_ROUTE,       "no-route") \
+    X(ARP_TIMEOUT,    "arp-timeout") \
+    X(QUEUE_FULL,     "queue-full") \
+    X(SLOW_BUDGET,    "slowpath-budget") \
+    X(NO_BUFFER,      "no-buffer") \
+    X(OVERSIZE,       "oversize") \
+    X(TX_ERROR,       "tx-error")
+
+/* Latency paths, see lat_path in sr_pkt.h. */
+#define SR_STATS_PATHS(X) \
+    X(FORWARD,    "forward") \
+    X(ARP_QUEUED, "arp-queued") \
+    X(ICMP,       "icmp") \
+    X(ARP,        "arp")
+
+#define SR_LAT_SUB_BITS  5
+#define SR_LAT_SUB       (1 << SR_LAT_SUB_BITS)
+#define SR_LAT_MAX_BITS  36    /* longer clamps, 2^36 ns is ~69 s */
+#define SR_LAT_BUCKETS   ((SR_LAT_MAX_BITS - SR_LAT_SUB_BITS + 1) * SR_LAT_SUB)
+
+#define SR_STATS_ENUM(id, name) SR_IFC_##id,
+enum sr_stats_if_counter { SR_STATS_IF_COUNTERS(SR_STATS_ENUM) SR_IFC_COUNT };
+#undef SR_STATS_ENUM
+
+#define SR_STATS_ENUM(id, name) SR_DROP_##id,
+enum sr_stats_drop { SR_STATS_DROPS(SR_STATS_ENUM) SR_DROP_COUNT };
+#undef SR_STATS_ENUM
+
+#define SR_STATS_ENUM(id, name) SR_PATH_##id,
+enum sr_stats_path { SR_PATH_NONE, SR_STATS_PATHS(SR_STATS_ENUM) SR_PATH_END };
+#undef SR_STATS_ENUM
+
+#define SR_PATH_COUNT (SR_PATH_END - 1)    /* paths with a histogram */
+
+struct sr_stats_block
+{
+    uint64_t ifc[SR_MAX_IF][SR_IFC_COUNT];
+    uint64_t drop[SR_DROP_COUNT];
+    uint64_t route_pkts[SR_STATS_MAX_ROUTES];
+    uint64_t route_bytes[SR_STATS_MAX_ROUTES];
+    uint64_t lat_sum_ns[SR_PATH_COUNT];
+    uint64_t lat[SR_PATH_COUNT][SR_LAT_BUCKETS];
+} __attribute__ ((aligned(64)));
+
+struct sr_stats_route
+{
+    uint32_t dest;                    /* network order, as in sr_rt */
+    uint32_t gw;
+    uint32_t mask;
+    int32_t  ifindex;
+};
+
+struct sr_stats_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;
+    uint32_t nif;
+    uint32_t nroutes;
+    uint32_t nblocks;                 /* blocks handed out so far */
+    uint32_t block_size;
+    uint16_t if_counters;             /* SR_IFC_COUNT, SR_DROP_COUNT, */
+    uint16_t drops;                   /* SR_PATH_COUNT and SR_LAT_BUCKETS, */
+    uint16_t paths;                   /* the reader must agree */
+    uint16_t lat_buckets;
+    uint32_t max_if;
+    uint32_t max_routes;
+    uint32_t mem_tags;                /* SR_MEM_COUNT */
+    uint32_t reserved;
+    uint64_t started_ns;              /* CLOCK_REALTIME */
+    char ifname[SR_MAX_IF][sr_IFACE_NAMELEN];
+    char thread[SR_STATS_MAX_BLOCKS][SR_STATS_NAMELEN];
+    struct sr_stats_route route[SR_STATS_MAX_ROUTES];
+    struct sr_mem_counter mem[SR_MEM_SLOTS];  /* written by sr_mem.c */
+};
+
+/* The calling thread's block; threads that never called
+   sr_stats_thread(..) share one that is not exported. */
+extern __thread struct sr_stats_block* sr_stats_mine;
+
+#define SR_STATS_IF(ifindex, dir, len) \
+    do { unsigned int ifi_ = (ifindex); \
+         if (ifi_ < SR_MAX_IF) { \
+             sr_stats_mine->ifc[ifi_][SR_IFC_##dir##_PKTS]++; \
+             sr_stats_mine->ifc[ifi_][SR_IFC_##dir##_BYTES] += (len); } \
+    } while (0)
+
+#define SR_STATS_TX_ERROR(ifindex) \
+    do { unsigned int ifi_ = (ifindex); \
+         if (ifi_ < SR_MAX_IF) \
+             sr_stats_mine->ifc[ifi_][SR_IFC_TX_ERRORS]++; \
+         sr_stats_mine->drop[SR_DROP_TX_ERROR]++; } while (0)
+
+/* The pkt->route to give packets forwarded by rt (a struct sr_rt*):
+   its index, or -1 if it is past the counted routes. */
+#define SR_STATS_ROUTE_ID(rt) \
+    ((rt)->index < SR_STATS_MAX_ROUTES ? (rt)->index : -1)
+
+/* Count one packet of len bytes sent by the route with sr_rt index i. */
+#define SR_STATS_ROUTE(i, len) \
+    do { unsigned int rti_ = (i); \
+         if (rti_ < SR_STATS_MAX_ROUTES) { \
+             sr_stats_mine->route_pkts[rti_]++; \
+             sr_stats_mine->route_bytes[rti_] += (len); } \
+    } while (0)
+
+/* Count one dropped packet of len bytes, trace it and fire its probe. */
+#define SR_STATS_DROP(reason, len) \
+    do { sr_stats_mine->drop[SR_DROP_##reason]++; \
+         SR_TRACE(DROP, SR_DROP_##reason, (len), 0, 0); \
+         SR_PROBE2(packet__drop, SR_DROP_##reason, (len)); } while (0)
+
+/* Record the latency of a packet sent on path (an SR_PATH_*). */
+void sr_stats_latency(unsigned int path, uint64_t ns);
+
+/* Create the segment /dev/shm/name, falling back to private memory if
+   that fails, and move the heap counters into it.  Returns 0 or -1. */
+int  sr_stats_init(const char* name);
+
+/* Give the calling thread a block of its own. */
+void sr_stats_thread(const char* name);
+
+/* Publish the interface names, once they are known. */
+void sr_stats_set_ifs(struct sr_instance* sr);
+
+/* Publish the routing table, once its interfaces are resolved. */
+void sr_stats_set_routes(struct sr_instance* sr);
+
+/* Add up the first nblocks blocks of a segment into sum. */
+void sr_stats_sum(const struct sr_stats_hdr* hdr, struct sr_stats_block* sum);
+
+/* One route's packets and bytes so far, summed over this router's
+   blocks.  Returns -1 if route i (an sr_rt index) is not counted. */
+int  sr_stats_route(unsigned int i, uint64_t* pkts, uint64_t* bytes);
+
+/* Latency percentiles per path of now - prev (prev may be 0). */
+void sr_stats_print_latency(FILE* fp, const struct sr_stats_block* now,
+                            const struct sr_stats_block* prev);
+
+/* The top busiest routes of now - prev (prev may be 0, top 0 for all),
+   rates over secs, and how many routes carried nothing at all. */
+void sr_stats_print_routes(FILE* fp, const struct sr_stats_hdr* hdr,
+                           const struct sr_stats_block* now,
+                           const struct sr_stats_block* prev, double secs,
+                           unsigned int top);
+
+/* Print this router's routes and latencies so far. */
+void sr_stats_report(FILE* fp);
+
+/* Remove the segment. */
+void sr_stats_close(void);
+
+#endif /* -- SR_STATS_H -- */
@@ -0,0 +1,320 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_tap.c
+ *
+ * Description:
+ *
+ * Linux TAP backend.  Each device named with -i becomes one router
+ * interface, e.g.
+ *
+ *   ./sr -b tap -i tap0=10.0.1.1,tap1=192.168.2.1 -r rtable
+ *
+ * The address after '=' is the router's own address on that link (the
+ * kernel side of the tap keeps its own address) and the router's MAC is
+ * derived from it.  Frames are read/written straight from the tap file
+ * descriptors, so no controller sits in the data path.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#ifdef _LINUX_
+#include <net/if.h>
+#include <linux/if_tun.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_backend.h"
+#include "sr_mem.h"
+
+#define SR_TAP_FRAME_MAX 9216   /* jumbo sized, taps default to 1500 */
+#define SR_TAP_BURST     32     /* one read(2) per frame, no point going bigger */
+
+struct sr_tap_dev
+{
+    struct sr_ifspec spec;
+    int fd;
+};
+
+struct sr_tap
+{
+    struct sr_tap_dev dev[SR_MAX_IFSPEC];
+    int ndev;
+    int next_rx;                 /* round robin start for fairness */
+    uint8_t rx_buf[SR_TAP_BURST][SR_TAP_FRAME_MAX];
+};
+
+#ifdef _LINUX_
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_attach(..)
+ * Scope: Local
+ *
+ * Open /dev/net/tun, attach to (or create) the named tap device and
+ * bring it up.  Returns the fd or -1.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_tap_attach(const char* name)
+{
+    struct ifreq ifr;
+    int fd, sock;
+
+    if ((fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK)) < 0)
+    {
+        perror("open(/dev/net/tun):sr_tap.c::sr_tap_attach");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+    {
+        perror("ioctl(TUNSETIFF):sr_tap.c::sr_tap_attach");
+        close(fd);
+        return -1;
+    }
+
+    /* -- bring the link up, the kernel side address is left alone -- */
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) >= 0)
+    {
+        if (ioctl(sock, SIOCGIFFLAGS, &ifr) == 0)
+        {
+            ifr.ifr_flags |= IFF_UP;
+            ioctl(sock, SIOCSIFFLAGS, &ifr);
+        }
+        close(sock);
+    }
+
+    return fd;
+} /* -- sr_tap_attach -- */
+
+static int sr_tap_open(struct sr_instance* sr, const struct sr_backend_config* cfg)
+{
+    struct sr_ifspec specs[SR_MAX_IFSPEC];
+    struct sr_tap* tap;
+    int i;
+
+    tap = (struct sr_tap*)sr_mem_calloc(SR_MEM_BACKEND, 1, sizeof(struct sr_tap));
+    assert(tap);
+
+    tap->ndev = sr_parse_ifspec(cfg->ifspec, specs, SR_MAX_IFSPEC);
+    if (tap->ndev <= 0)
+    {
+        fprintf(stderr, "tap backend needs -i dev=ip[,dev=ip...]\n");
+        sr_mem_free(tap);
+        return -1;
+    }
+    for (i = 0; i < tap->ndev; i++)
+    {
+        tap->dev[i].spec = specs[i];
+        tap->dev[i].fd = -1;
+    }
+
+    for (i = 0; i < tap->ndev; i++)
+    {
+        if (tap->dev[i].spec.ip == 0)
+        {
+            fprintf(stderr, "tap device %s needs an address (%s=a.b.c.d)\n",
+                    tap->dev[i].spec.dev, tap->dev[i].spec.dev);
+            goto fail;
+        }
+        if ((tap->dev[i].fd = sr_tap_attach(tap->dev[i].spec.dev)) < 0)
+        { goto fail; }
+    }
+
+    sr->backend_data = tap;
+    return 0;
+
+fail:
+    for (i = 0; i < tap->ndev; i++)
+    {
+        if (tap->dev[i].fd >= 0)
+        { close(tap->dev[i].fd); }
+    }
+    sr_mem_free(tap);
+    return -1;
+}
+
+static int sr_tap_discover(struct sr_instance* sr)
+{
+    struct sr_tap* tap = (struct sr_tap*)sr->backend_data;
+    unsigned char mac[ETHER_ADDR_LEN];
+    int i;
+
+    assert(sr->nif == 0);
+    for (i = 0; i < tap->ndev; i++)
+    {
+        /* -- device i becomes router interface i -- */
+        sr_add_interface(sr, tap->dev[i].spec.dev);
+        sr_local_mac(tap->dev[i].spec.ip, mac);
+        sr_set_ether_addr(sr, mac);
+        sr_set_ether_ip(sr, tap->dev[i].spec.ip);
+    }
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_rx_burst(..)
+ * Scope: Local
+ *
+ * Wait for any tap to become readable, then read round robin across the
+ * devices until the burst is full or every device is drained.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_tap_rx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int max)
+{
+    struct sr_tap* tap = (struct sr_tap*)sr->backend_data;
+    struct pollfd pfd[SR_MAX_IFSPEC];
+    int i, n = 0, progress = 1;
+
+    for (i = 0; i < tap->ndev; i++)
+    {
+        pfd[i].fd = tap->dev[i].fd;
+        pfd[i].events = POLLIN;
+    }
+
+    if (poll(pfd, tap->ndev, -1) < 0)
+    {
+        if (errno == EINTR)
+        { return sr_stop_requested ? -1 : 0; }
+        perror("poll(..):sr_tap.c::sr_tap_rx_burst");
+        return -1;
+    }
+
+    if (max > SR_TAP_BURST)
+    { max = SR_TAP_BURST; }
+
+    while (n < max && progress)
+    {
+        progress = 0;
+        for (i = 0; i < tap->ndev && n < max; i++)
+        {
+            struct sr_tap_dev* dev = &tap->dev[(tap->next_rx + i) % tap->ndev];
+            ssize_t len = read(dev->fd, tap->rx_buf[n], SR_TAP_FRAME_MAX);
+
+            if (len < 0)
+            {
+                if (errno != EAGAIN && errno != EINTR)
+                {
+                    perror("read(..):sr_tap.c::sr_tap_rx_burst");
+                    return -1;
+                }
+                continue;
+            }
+            if (len < (ssize_t)sizeof(struct sr_ethernet_hdr))
+            { continue; }
+
+            frames[n].buf   = tap->rx_buf[n];
+            frames[n].len   = len;
+            frames[n].ifindex = dev - tap->dev;
+            frames[n].headroom = 0;
+            frames[n].priv  = 0;
+            n++;
+            progress = 1;
+        }
+    }
+    tap->next_rx = (tap->next_rx + 1) % tap->ndev;
+
+    return n;
+}
+
+static int sr_tap_tx_burst(struct sr_instance* sr, const struct sr_frame* frames,
+                           int n)
+{
+    struct sr_tap* tap = (struct sr_tap*)sr->backend_data;
+    int i, j;
+
+    for (i = 0; i < n; i++)
+    {
+        j = frames[i].ifindex;
+        if (j < 0 || j >= tap->ndev)
+        { return i; }
+
+        if (write(tap->dev[j].fd, frames[i].buf, frames[i].len) < 0 &&
+                errno != EAGAIN)
+        {
+            perror("write(..):sr_tap.c::sr_tap_tx_burst");
+            return i;
+        }
+        /* -- EAGAIN: tap queue full, drop like a real link would -- */
+    }
+
+    return n;
+}
+
+static int sr_tap_rx_ready(struct sr_instance* sr)
+{
+    struct sr_tap* tap = (struct sr_tap*)sr->backend_data;
+    struct pollfd pfd[SR_MAX_IFSPEC];
+    int i;
+
+    for (i = 0; i < tap->ndev; i++)
+    {
+        pfd[i].fd = tap->dev[i].fd;
+        pfd[i].events = POLLIN;
+    }
+    return poll(pfd, tap->ndev, 0) > 0;
+}
+
+static void sr_tap_close(struct sr_instance* sr)
+{
+    struct sr_tap* tap = (struct sr_tap*)sr->backend_data;
+    int i;
+
+    if (!tap)
+    { return; }
+
+    for (i = 0; i < tap->ndev; i++)
+    { close(tap->dev[i].fd); }
+    sr_mem_free(tap);
+    sr->backend_data = 0;
+}
+
+#else /* -- !_LINUX_ -- */
+
+static int sr_tap_open(struct sr_instance* sr, const struct sr_backend_config* cfg)
+{
+    fprintf(stderr, "tap backend is only available on Linux\n");
+    return -1;
+}
+static int sr_tap_discover(struct sr_instance* sr) { return -1; }
+static int sr_tap_rx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int max) { return -1; }
+static int sr_tap_tx_burst(struct sr_instance* sr, const struct sr_frame* frames,
+                           int n) { return -1; }
+static void sr_tap_close(struct sr_instance* sr) { }
+static int sr_tap_rx_ready(struct sr_instance* sr) { return 0; }
+
+#endif /* _LINUX_ */
+
+const struct sr_backend sr_tap_backend =
+{
+    "tap",
+    sr_tap_open,
+    sr_tap_discover,
+    sr_tap_rx_burst,
+    0,
+    sr_tap_tx_burst,
+    sr_tap_close,
+    0,
+    0,
+    0,
+    sr_tap_rx_ready
+};
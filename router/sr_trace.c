@@ -0,0 +1,252 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_trace.c
+ *
+ * Description:
+ *
+ * Per-thread event trace rings, see sr_trace.h.
+ *
+ * A ring's head is only written by its thread; the record is filled in
+ * before head moves on (release), so a dump that reads head (acquire)
+ * first sees complete records behind it, bar the ones the thread is
+ * overwriting at that moment.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef _LINUX_
+#include <sys/syscall.h>
+#endif /* _LINUX_ */
+
+#include "sr_trace.h"
+#include "sr_mem.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SR_TRACE_CLOCK()  __builtin_ia32_rdtsc()
+#else
+#define SR_TRACE_CLOCK()  sr_trace_ns()
+#endif
+
+struct sr_trace_ring
+{
+    uint64_t head;
+    struct sr_trace_rec* rec;
+    struct sr_trace_file_ring info;
+};
+
+int sr_trace_on;
+
+static struct sr_trace_ring sr_trace_rings[SR_TRACE_MAX_THREADS];
+static unsigned int sr_trace_nrings;
+static unsigned int sr_trace_entries;
+static char sr_trace_path[256];
+static uint64_t sr_trace_tsc0, sr_trace_ns0;
+
+static __thread struct sr_trace_ring* sr_trace_mine;
+
+static const int sr_trace_fatal[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+static uint64_t sr_trace_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+} /* -- sr_trace_ns -- */
+
+static void sr_trace_usr2(int sig)
+{
+    int saved = errno;
+
+    sr_trace_dump();
+    errno = saved;
+} /* -- sr_trace_usr2 -- */
+
+/* -- handlers are reset on entry, so raising again kills us as before -- */
+static void sr_trace_crash(int sig)
+{
+    sr_trace_dump();
+    raise(sig);
+} /* -- sr_trace_crash -- */
+
+int sr_trace_init(unsigned int entries, const char* path)
+{
+    struct sigaction sa;
+    unsigned int i;
+
+    assert(!sr_trace_on);
+
+    for (sr_trace_entries = 1; sr_trace_entries < entries; )
+    { sr_trace_entries <<= 1; }
+    snprintf(sr_trace_path, sizeof(sr_trace_path), "%s", path);
+    sr_trace_tsc0 = SR_TRACE_CLOCK();
+    sr_trace_ns0 = sr_trace_ns();
+
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = sr_trace_usr2;
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR2, &sa, 0) != 0)
+    {
+        perror("sigaction:sr_trace.c::sr_trace_init");
+        return -1;
+    }
+    sa.sa_handler = sr_trace_crash;
+    sa.sa_flags = SA_RESETHAND;
+    for (i = 0; i < sizeof(sr_trace_fatal) / sizeof(sr_trace_fatal[0]); i++)
+    { sigaction(sr_trace_fatal[i], &sa, 0); }
+
+    sr_trace_on = 1;
+    return 0;
+} /* -- sr_trace_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_trace_thread(..)
+ * Scope: Global
+ *
+ * Call at thread start, before the thread handles packets: this is
+ * where the ring is allocated.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_trace_thread(const char* name)
+{
+    struct sr_trace_ring* ring;
+    struct sr_trace_rec* rec;
+    unsigned int i;
+
+    if (!sr_trace_on || sr_trace_mine)
+    { return; }
+
+    rec = (struct sr_trace_rec*)sr_mem_calloc(SR_MEM_TRACE, sr_trace_entries,
+                                              sizeof(struct sr_trace_rec));
+    assert(rec);
+
+    /* -- the dump sees the slot at once and writes it empty until rec is set -- */
+    if ((i = __atomic_fetch_add(&sr_trace_nrings, 1, __ATOMIC_ACQ_REL)) >=
+            SR_TRACE_MAX_THREADS)
+    {
+        fprintf(stderr, "trace: no ring left for thread %s\n", name);
+        sr_mem_free(rec);
+        return;
+    }
+    ring = &sr_trace_rings[i];
+
+    strncpy(ring->info.name, name, sizeof(ring->info.name) - 1);
+#ifdef _LINUX_
+    ring->info.tid = syscall(SYS_gettid);
+#endif /* _LINUX_ */
+    __atomic_store_n(&ring->rec, rec, __ATOMIC_RELEASE);
+    sr_trace_mine = ring;
+} /* -- sr_trace_thread -- */
+
+void sr_trace_event(uint32_t id, uint32_t a0, uint32_t a1, uint32_t a2,
+                    uint32_t a3)
+{
+    struct sr_trace_ring* ring = sr_trace_mine;
+    struct sr_trace_rec* r;
+
+    if (!ring)
+    { return; }
+
+    r = &ring->rec[ring->head & (sr_trace_entries - 1)];
+    r->ts = SR_TRACE_CLOCK();
+    r->id = id;
+    r->arg[0] = a0;
+    r->arg[1] = a1;
+    r->arg[2] = a2;
+    r->arg[3] = a3;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+} /* -- sr_trace_event -- */
+
+static int sr_trace_write(int fd, const void* buf, size_t n)
+{
+    const char* p = (const char*)buf;
+
+    while (n > 0)
+    {
+        ssize_t w = write(fd, p, n);
+
+        if (w < 0 && errno == EINTR)
+        { continue; }
+        if (w <= 0)
+        { return -1; }
+        p += w;
+        n -= w;
+    }
+    return 0;
+} /* -- sr_trace_write -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_trace_dump(..)
+ * Scope: Global
+ *
+ * Runs in signal handlers: no stdio, no locks, no heap.  A ring claimed
+ * but not yet set up is written out empty.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_trace_dump(void)
+{
+    struct sr_trace_file_hdr hdr;
+    unsigned int i, n;
+    int fd, rc = 0;
+
+    if (!sr_trace_on)
+    { return 0; }
+
+    if ((fd = open(sr_trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    { return -1; }
+
+    n = __atomic_load_n(&sr_trace_nrings, __ATOMIC_ACQUIRE);
+    if (n > SR_TRACE_MAX_THREADS)
+    { n = SR_TRACE_MAX_THREADS; }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SR_TRACE_MAGIC;
+    hdr.version = SR_TRACE_VERSION;
+    hdr.nrings = n;
+    hdr.entries = sr_trace_entries;
+    hdr.tsc0 = sr_trace_tsc0;
+    hdr.ns0 = sr_trace_ns0;
+    hdr.tsc1 = SR_TRACE_CLOCK();
+    hdr.ns1 = sr_trace_ns();
+    rc |= sr_trace_write(fd, &hdr, sizeof(hdr));
+
+    for (i = 0; i < n && rc == 0; i++)
+    {
+        struct sr_trace_ring* ring = &sr_trace_rings[i];
+        struct sr_trace_rec* rec = __atomic_load_n(&ring->rec, __ATOMIC_ACQUIRE);
+        struct sr_trace_file_ring info = ring->info;
+
+        info.head = rec ? __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) : 0;
+        rc |= sr_trace_write(fd, &info, sizeof(info));
+        if (rec)
+        { rc |= sr_trace_write(fd, rec, sr_trace_entries * sizeof(*rec)); }
+        else
+        {
+            /* -- keep the layout fixed size -- */
+            struct sr_trace_rec zero[16];
+            unsigned int left;
+
+            memset(zero, 0, sizeof(zero));
+            for (left = sr_trace_entries; left > 0 && rc == 0; )
+            {
+                unsigned int k = left < 16 ? left : 16;
+
+                rc |= sr_trace_write(fd, zero, k * sizeof(zero[0]));
+                left -= k;
+            }
+        }
+    }
+
+    close(fd);
+    return rc;
+} /* -- sr_trace_dump -- */
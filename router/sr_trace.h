@@ -0,0 +1,105 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_trace.h
+ *
+ * Description:
+ *
+ * Binary event trace, in place of printf(..)s on the packet path.  Each
+ * thread that calls sr_trace_thread(..) gets a ring of fixed-size records
+ * (timestamp, event id, 4 arguments) that only it writes, so recording an
+ * event is a TSC read and a 32 byte store; with tracing off SR_TRACE(..)
+ * is a single predictable branch.  Older records are overwritten, the
+ * rings keep the last -e entries of every thread.
+ *
+ * sr_trace_dump(..) writes all rings to the trace file with nothing but
+ * open(2) / write(2), so it is called from the SIGUSR2 handler, from the
+ * fatal signal handlers before the process dies, and at exit.  Records
+ * being written during a dump may come out torn.  sr_tracedump decodes
+ * the file, merging the threads by time:
+ *
+ *   header, nrings x { ring header, entries x record }
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TRACE_H
+#define SR_TRACE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_TRACE_MAX_THREADS  64
+#define SR_TRACE_FILE         "sr.trace"
+#define SR_TRACE_MAGIC        0x52545253   /* "SRTR" */
+#define SR_TRACE_VERSION      1
+
+/* Events: id, name, and the arguments as "name:fmt", fmt being d
+   (decimal), x (hex), i (IPv4 address, network order) or r (drop
+   reason, see sr_stats.h). */
+#define SR_TRACE_EVENTS(X) \
+    X(EXC_RX,      "exception",   "len:d if:d type:x") \
+    X(DROP,        "drop",        "reason:r len:d") \
+    X(ARP_REQUEST, "arp-request", "tip:i for_us:d if:d") \
+    X(ARP_REPLY,   "arp-reply",   "sip:i released:d") \
+    X(ARP_RELEASE, "arp-release", "ip:i if:d len:d") \
+    X(IP_LOCAL,    "ip-local",    "src:i dst:i proto:d") \
+    X(ECHO_REPLY,  "echo-reply",  "dst:i nh:i if:d resolved:d") \
+    X(FORWARD,     "forward",     "dst:i nh:i if:d resolved:d") \
+    X(ICMP_ERROR,  "icmp-error",  "type:d code:d to:i if:d") \
+    X(ARP_SEND,    "arp-send",    "ip:i if:d tries:d") \
+    X(ARP_GIVE_UP, "arp-give-up", "ip:i queued:d") \
+    X(LPM,         "lpm",         "dst:i route:i mask:i if:d")
+
+#define SR_TRACE_ENUM(id, name, args) SR_TR_##id,
+enum sr_trace_event { SR_TRACE_EVENTS(SR_TRACE_ENUM) SR_TR_NEVENTS };
+#undef SR_TRACE_ENUM
+
+struct sr_trace_rec
+{
+    uint64_t ts;               /* TSC on x86, else CLOCK_REALTIME ns */
+    uint32_t id;
+    uint32_t arg[4];
+};                             /* 32 bytes */
+
+struct sr_trace_file_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nrings;
+    uint32_t entries;          /* per ring, a power of 2 */
+    uint64_t tsc0, ns0;        /* clock pairs at start and at the dump, */
+    uint64_t tsc1, ns1;        /* ns CLOCK_REALTIME */
+};
+
+struct sr_trace_file_ring
+{
+    char name[16];
+    uint32_t tid;
+    uint32_t reserved;
+    uint64_t head;             /* records ever written */
+};
+
+extern int sr_trace_on;
+
+#define SR_TRACE(id, a0, a1, a2, a3) \
+    do { if (__builtin_expect(sr_trace_on, 0)) \
+         sr_trace_event(SR_TR_##id, (a0), (a1), (a2), (a3)); } while (0)
+
+/* Turn tracing on with rings of (rounded up to a power of 2) entries,
+   dumped to path; also installs the signal handlers. */
+int sr_trace_init(unsigned int entries, const char* path);
+
+/* Give the calling thread a ring; a no-op with tracing off.  Events from
+   threads without one are not recorded. */
+void sr_trace_thread(const char* name);
+
+void sr_trace_event(uint32_t id, uint32_t a0, uint32_t a1, uint32_t a2,
+                    uint32_t a3);
+
+/* Async-signal-safe; returns 0 or -1. */
+int sr_trace_dump(void);
+
+#endif /* -- SR_TRACE_H -- */
@@ -0,0 +1,221 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_tracedump.c
+ *
+ * Description:
+ *
+ * Decode a trace file written by sr -e (see sr_trace.h):
+ *
+ *   sr_tracedump [-e event] [file]
+ *
+ * Prints the records of all threads merged in time order, one per line,
+ * timestamps converted to wall clock time with the clock pairs in the
+ * header; -e keeps only the named event.  file defaults to sr.trace.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sr_trace.h"
+#include "sr_stats.h"
+
+struct sr_tracedump_rec
+{
+    uint64_t ns;
+    unsigned int ring;
+    struct sr_trace_rec r;
+};
+
+#define SR_TRACE_NAME(id, name, args) name,
+#define SR_TRACE_ARGS(id, name, args) args,
+static const char* sr_tracedump_events[] = { SR_TRACE_EVENTS(SR_TRACE_NAME) };
+static const char* sr_tracedump_args[] = { SR_TRACE_EVENTS(SR_TRACE_ARGS) };
+#undef SR_TRACE_NAME
+#undef SR_TRACE_ARGS
+
+#define SR_TRACE_NAME(id, name) name,
+static const char* sr_tracedump_drops[] = { SR_STATS_DROPS(SR_TRACE_NAME) };
+#undef SR_TRACE_NAME
+
+static int sr_tracedump_cmp(const void* a, const void* b)
+{
+    const struct sr_tracedump_rec* x = (const struct sr_tracedump_rec*)a;
+    const struct sr_tracedump_rec* y = (const struct sr_tracedump_rec*)b;
+
+    if (x->ns != y->ns)
+    { return x->ns < y->ns ? -1 : 1; }
+    return x->ring < y->ring ? -1 : x->ring > y->ring;
+} /* -- sr_tracedump_cmp -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_tracedump_print(..)
+ * Scope: Local
+ *
+ * Arguments as described by the event's "name:fmt ..." string.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_tracedump_print(const struct sr_trace_rec* r)
+{
+    const char* p;
+    int i;
+
+    if (r->id >= SR_TR_NEVENTS)
+    {
+        printf("event-%u %u %u %u %u\n", r->id, r->arg[0], r->arg[1],
+               r->arg[2], r->arg[3]);
+        return;
+    }
+
+    printf("%-12s", sr_tracedump_events[r->id]);
+    for (i = 0, p = sr_tracedump_args[r->id]; i < 4 && *p; i++)
+    {
+        const char* colon = strchr(p, ':');
+        uint32_t v = r->arg[i];
+
+        if (!colon)
+        { break; }
+        printf(" %.*s=", (int)(colon - p), p);
+        switch (colon[1])
+        {
+            case 'x':
+                printf("0x%04x", v);
+                break;
+            case 'i':
+                /* -- network order, as it sat in the header -- */
+                {
+                    const uint8_t* b = (const uint8_t*)&v;
+
+                    printf("%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+                }
+                break;
+            case 'r':
+                if (v < SR_DROP_COUNT)
+                { printf("%s", sr_tracedump_drops[v]); }
+                else
+                { printf("%u", v); }
+                break;
+            default:
+                printf("%d", (int)v);
+                break;
+        }
+        p = colon + 2;
+        while (*p == ' ')
+        { p++; }
+    }
+    printf("\n");
+} /* -- sr_tracedump_print -- */
+
+static void usage(char* argv0)
+{
+    fprintf(stderr, "usage: %s [-e event] [file]\n", argv0);
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    const char* path = SR_TRACE_FILE;
+    const char* only = 0;
+    struct sr_trace_file_hdr hdr;
+    struct sr_trace_file_ring* rings;
+    struct sr_trace_rec* buf;
+    struct sr_tracedump_rec* all;
+    unsigned long n = 0, i;
+    unsigned int ring;
+    double scale;
+    FILE* fp;
+    int c;
+
+    while ((c = getopt(argc, argv, "he:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'e':
+                only = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc)
+    { path = argv[optind]; }
+
+    if ((fp = fopen(path, "rb")) == 0)
+    {
+        perror(path);
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != SR_TRACE_MAGIC ||
+            hdr.version != SR_TRACE_VERSION || hdr.nrings > SR_TRACE_MAX_THREADS ||
+            hdr.entries == 0 || (hdr.entries & (hdr.entries - 1)) != 0)
+    {
+        fprintf(stderr, "%s: not a trace file\n", path);
+        return 1;
+    }
+
+    rings = (struct sr_trace_file_ring*)calloc(hdr.nrings + 1, sizeof(*rings));
+    buf = (struct sr_trace_rec*)malloc(hdr.entries * sizeof(*buf));
+    all = (struct sr_tracedump_rec*)malloc((unsigned long)hdr.nrings *
+                                           hdr.entries * sizeof(*all) + 1);
+    if (!rings || !buf || !all)
+    {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return 1;
+    }
+
+    scale = hdr.tsc1 != hdr.tsc0 ?
+            (double)(hdr.ns1 - hdr.ns0) / (double)(hdr.tsc1 - hdr.tsc0) : 1.0;
+
+    for (ring = 0; ring < hdr.nrings; ring++)
+    {
+        uint64_t first, k;
+
+        if (fread(&rings[ring], sizeof(rings[ring]), 1, fp) != 1 ||
+                fread(buf, sizeof(*buf), hdr.entries, fp) != hdr.entries)
+        {
+            fprintf(stderr, "%s: truncated\n", path);
+            return 1;
+        }
+        rings[ring].name[sizeof(rings[ring].name) - 1] = 0;
+
+        /* -- the ring holds the last 'entries' of 'head' records -- */
+        first = rings[ring].head > hdr.entries ? rings[ring].head - hdr.entries : 0;
+        for (k = first; k < rings[ring].head; k++)
+        {
+            struct sr_trace_rec* r = &buf[k & (hdr.entries - 1)];
+
+            if (only && (r->id >= SR_TR_NEVENTS ||
+                         strcmp(sr_tracedump_events[r->id], only) != 0))
+            { continue; }
+            all[n].ns = hdr.ns0 + (int64_t)((double)(int64_t)(r->ts - hdr.tsc0) * scale);
+            all[n].ring = ring;
+            all[n].r = *r;
+            n++;
+        }
+    }
+    fclose(fp);
+
+    qsort(all, n, sizeof(*all), sr_tracedump_cmp);
+
+    for (i = 0; i < n; i++)
+    {
+        printf("%llu.%09llu %-10s ", (unsigned long long)(all[i].ns / 1000000000ull),
+               (unsigned long long)(all[i].ns % 1000000000ull),
+               rings[all[i].ring].name);
+        sr_tracedump_print(&all[i].r);
+    }
+
+    for (ring = 0; ring < hdr.nrings; ring++)
+    {
+        fprintf(stderr, "%-10s tid %-7u %llu events%s\n", rings[ring].name,
+                rings[ring].tid, (unsigned long long)rings[ring].head,
+                rings[ring].head > hdr.entries ? " (oldest overwritten)" : "");
+    }
+
+    free(rings);
+    free(buf);
+    free(all);
+    return 0;
+} /* -- main -- */
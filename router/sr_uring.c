@@ -0,0 +1,688 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_uring.c
+ *
+ * Description:
+ *
+ * io_uring transport for the VNS socket.  Talks to the kernel through the
+ * raw io_uring_setup/enter/register syscalls so no liburing is needed.
+ *
+ * Receive side: a ring of SR_URING_NBUFS provided buffers is registered
+ * with the kernel and a (multishot, if supported) RECV with buffer select
+ * is kept armed on the socket.  Completions are consumed strictly in CQ
+ * order, so the TCP byte stream is reassembled in order by
+ * sr_uring_read_full().
+ *
+ * Send side: messages are copied into one of two staging buffers.  At most
+ * one SEND is in flight at a time (keeps the stream ordered); while it is
+ * in flight new messages accumulate in the other buffer.  The SEND SQE is
+ * submitted by the same io_uring_enter() that waits for receive data, so
+ * a request/response exchange costs one syscall instead of three.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sr_router.h"
+#include "sr_uring.h"
+#include "sr_mem.h"
+
+#ifdef _LINUX_
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#define SR_URING_BGID      1
+#define SR_URING_TAG_RECV  1
+#define SR_URING_TAG_SEND  2
+
+struct sr_uring
+{
+    int ring_fd;
+    int sockfd;
+    pthread_t owner;             /* thread allowed to reap completions */
+    pthread_mutex_t lock;
+    pthread_cond_t  tx_done;
+
+    /* -- submission queue -- */
+    void*     sq_ptr;
+    size_t    sq_sz;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    size_t    sqes_sz;
+    unsigned  sq_entries;
+    unsigned  sq_pending;        /* prepared but not yet submitted */
+
+    /* -- completion queue -- */
+    void*     cq_ptr;
+    size_t    cq_sz;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    /* -- provided receive buffers -- */
+    struct io_uring_buf_ring* br;
+    size_t    br_sz;
+    uint8_t*  rx_bufs;
+    uint16_t  br_tail;
+    int       recv_armed;
+    int       multishot;
+    uint16_t  rxq_bid[SR_URING_NBUFS];  /* completed, not yet drained */
+    unsigned  rxq_len[SR_URING_NBUFS];
+    unsigned  rxq_head;
+    unsigned  rxq_tail;
+    int       cur_bid;           /* buffer being drained, -1 if none */
+    unsigned  cur_len;
+    unsigned  cur_off;
+    int       eof;
+
+    /* -- send staging -- */
+    uint8_t*  tx_buf[2];
+    unsigned  tx_len[2];
+    int       tx_fill;           /* buffer accepting new messages */
+    int       tx_inflight;       /* a SEND is owned by the kernel */
+    unsigned  tx_off;            /* bytes of the in-flight buffer sent */
+
+    int       error;
+    struct sr_uring_stats stats;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p)
+{ return (int)syscall(__NR_io_uring_setup, entries, p); }
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags)
+{ return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                      flags, NULL, 0); }
+
+static int sys_io_uring_register(int fd, unsigned op, void* arg, unsigned n)
+{ return (int)syscall(__NR_io_uring_register, fd, op, arg, n); }
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_get_sqe(..)
+ * Scope: Local
+ *
+ * Grab a zeroed SQE, submitting what is queued if the ring is full.
+ * Caller holds u->lock.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct io_uring_sqe* sr_uring_get_sqe(struct sr_uring* u)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned idx;
+    struct io_uring_sqe* sqe;
+
+    while (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+    {
+        u->stats.enters++;
+        if (sys_io_uring_enter(u->ring_fd, u->sq_pending, 0, 0) < 0 &&
+                errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            perror("io_uring_enter(..):sr_uring.c::sr_uring_get_sqe");
+            return 0;
+        }
+        u->sq_pending = 0;
+    }
+
+    idx = tail & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->sq_pending++;
+    return sqe;
+} /* -- sr_uring_get_sqe -- */
+
+static void sr_uring_recycle_buf(struct sr_uring* u, int bid)
+{
+    struct io_uring_buf* b =
+        &u->br->bufs[u->br_tail & (SR_URING_NBUFS - 1)];
+
+    b->addr = (uint64_t)(uintptr_t)(u->rx_bufs + (size_t)bid * SR_URING_BUF_SIZE);
+    b->len  = SR_URING_BUF_SIZE;
+    b->bid  = (uint16_t)bid;
+    u->br_tail++;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static int sr_uring_arm_recv(struct sr_uring* u)
+{
+    struct io_uring_sqe* sqe = sr_uring_get_sqe(u);
+
+    if (!sqe)
+    { return -1; }
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = u->sockfd;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = SR_URING_BGID;
+    sqe->user_data = SR_URING_TAG_RECV;
+    if (u->multishot)
+    { sqe->ioprio = IORING_RECV_MULTISHOT; }
+    else
+    { sqe->len = SR_URING_BUF_SIZE; }
+
+    u->recv_armed = 1;
+    return 0;
+}
+
+static int sr_uring_start_send(struct sr_uring* u)
+{
+    struct io_uring_sqe* sqe;
+    int idx;
+
+    if (u->tx_inflight || u->tx_len[u->tx_fill] == 0)
+    { return 0; }
+
+    if ((sqe = sr_uring_get_sqe(u)) == 0)
+    { return -1; }
+
+    idx = u->tx_fill;
+    u->tx_fill ^= 1;
+    u->tx_len[u->tx_fill] = 0;
+    u->tx_inflight = 1;
+    u->tx_off = 0;
+
+    sqe->opcode    = IORING_OP_SEND;
+    sqe->fd        = u->sockfd;
+    sqe->addr      = (uint64_t)(uintptr_t)u->tx_buf[idx];
+    sqe->len       = u->tx_len[idx];
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = SR_URING_TAG_SEND;
+    u->stats.send_sqes++;
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_handle_cqe(..)
+ * Scope: Local
+ *
+ * Consume the CQE at the head of the completion queue.
+ * Caller holds u->lock and is the owner thread.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_uring_handle_cqe(struct sr_uring* u, struct io_uring_cqe* cqe)
+{
+    if (cqe->user_data == SR_URING_TAG_SEND)
+    {
+        int idx = u->tx_fill ^ 1;
+        unsigned remaining = u->tx_len[idx] - u->tx_off;
+
+        if (cqe->res < 0)
+        {
+            fprintf(stderr, "io_uring send failed: %s\n", strerror(-cqe->res));
+            u->error = 1;
+            u->tx_inflight = 0;
+        }
+        else if ((unsigned)cqe->res < remaining)
+        {
+            /* -- short send, push out the rest of the same buffer -- */
+            struct io_uring_sqe* sqe = sr_uring_get_sqe(u);
+            u->stats.bytes_tx += cqe->res;
+            u->tx_off += cqe->res;
+            if (!sqe)
+            { u->error = 1; u->tx_inflight = 0; }
+            else
+            {
+                sqe->opcode    = IORING_OP_SEND;
+                sqe->fd        = u->sockfd;
+                sqe->addr      = (uint64_t)(uintptr_t)(u->tx_buf[idx] + u->tx_off);
+                sqe->len       = u->tx_len[idx] - u->tx_off;
+                sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+                sqe->user_data = SR_URING_TAG_SEND;
+                u->stats.send_sqes++;
+            }
+        }
+        else
+        {
+            u->stats.bytes_tx += cqe->res;
+            u->tx_inflight = 0;
+            sr_uring_start_send(u);
+        }
+        pthread_cond_broadcast(&u->tx_done);
+        return;
+    }
+
+    /* -- receive completion -- */
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    { u->recv_armed = 0; }
+
+    if (cqe->res > 0)
+    {
+        unsigned slot = u->rxq_tail++ & (SR_URING_NBUFS - 1);
+        assert(cqe->flags & IORING_CQE_F_BUFFER);
+        u->rxq_bid[slot] = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        u->rxq_len[slot] = cqe->res;
+        u->stats.recv_cqes++;
+        u->stats.bytes_rx += cqe->res;
+    }
+    else if (cqe->res == 0)
+    { u->eof = 1; }
+    else if (cqe->res == -EINVAL && u->multishot)
+    { u->multishot = 0; } /* -- kernel predates multishot recv -- */
+    else if (cqe->res != -ENOBUFS && cqe->res != -EINTR)
+    {
+        fprintf(stderr, "io_uring recv failed: %s\n", strerror(-cqe->res));
+        u->error = 1;
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_wait_cqe(..)
+ * Scope: Local
+ *
+ * Reap one completion, entering the kernel (and submitting whatever is
+ * queued) if none is ready.  Caller holds u->lock; it is dropped while
+ * blocked in the kernel.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_uring_wait_cqe(struct sr_uring* u)
+{
+    unsigned head = *u->cq_head;
+
+    while (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        unsigned to_submit = u->sq_pending;
+        int ret;
+
+        u->sq_pending = 0;
+        u->stats.enters++;
+        pthread_mutex_unlock(&u->lock);
+        ret = sys_io_uring_enter(u->ring_fd, to_submit, 1,
+                                 IORING_ENTER_GETEVENTS);
+        pthread_mutex_lock(&u->lock);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            perror("io_uring_enter(..):sr_uring.c::sr_uring_wait_cqe");
+            u->error = 1;
+            return -1;
+        }
+        if (ret < 0 && errno == EINTR)
+        { return -1; } /* -- let the caller look at shutdown flags -- */
+    }
+
+    sr_uring_handle_cqe(u, &u->cqes[head & *u->cq_mask]);
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_create(..)
+ * Scope: Global
+ *
+ * Set up the ring and provided buffers for sockfd.  Returns 0 (and leaves
+ * nothing behind) if the kernel cannot do it.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_uring* sr_uring_create(int sockfd)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    struct sr_uring* u;
+    int i;
+
+    u = (struct sr_uring*)sr_mem_calloc(SR_MEM_BACKEND, 1,
+                                        sizeof(struct sr_uring));
+    if (!u)
+    { return 0; }
+
+    u->sockfd = sockfd;
+    u->cur_bid = -1;
+    u->multishot = 1;
+    u->owner = pthread_self();
+    u->ring_fd = -1;
+
+    memset(&p, 0, sizeof(p));
+    if ((u->ring_fd = sys_io_uring_setup(SR_URING_ENTRIES, &p)) < 0)
+    {
+        perror("io_uring_setup");
+        sr_mem_free(u);
+        return 0;
+    }
+
+    u->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cq_sz > u->sq_sz)
+        { u->sq_sz = u->cq_sz; }
+        u->cq_sz = u->sq_sz;
+    }
+
+    u->sq_ptr = mmap(0, u->sq_sz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED)
+    { u->sq_ptr = 0; goto fail; }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    { u->cq_ptr = u->sq_ptr; }
+    else
+    {
+        u->cq_ptr = mmap(0, u->cq_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED)
+        { u->cq_ptr = 0; goto fail; }
+    }
+
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe*)mmap(0, u->sqes_sz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    { u->sqes = 0; goto fail; }
+
+    u->sq_head  = (unsigned*)((char*)u->sq_ptr + p.sq_off.head);
+    u->sq_tail  = (unsigned*)((char*)u->sq_ptr + p.sq_off.tail);
+    u->sq_mask  = (unsigned*)((char*)u->sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)((char*)u->sq_ptr + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->cq_head  = (unsigned*)((char*)u->cq_ptr + p.cq_off.head);
+    u->cq_tail  = (unsigned*)((char*)u->cq_ptr + p.cq_off.tail);
+    u->cq_mask  = (unsigned*)((char*)u->cq_ptr + p.cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe*)((char*)u->cq_ptr + p.cq_off.cqes);
+
+    /* -- provided buffer ring (needs 5.19+) -- */
+    u->br_sz = SR_URING_NBUFS * sizeof(struct io_uring_buf);
+    u->br = (struct io_uring_buf_ring*)mmap(0, u->br_sz, PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (u->br == MAP_FAILED)
+    { u->br = 0; goto fail; }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = SR_URING_NBUFS;
+    reg.bgid         = SR_URING_BGID;
+    if (sys_io_uring_register(u->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        perror("io_uring_register(PBUF_RING)");
+        goto fail;
+    }
+
+    u->rx_bufs = (uint8_t*)sr_mem_malloc(SR_MEM_BACKEND,
+                 (size_t)SR_URING_NBUFS * SR_URING_BUF_SIZE);
+    u->tx_buf[0] = (uint8_t*)sr_mem_malloc(SR_MEM_BACKEND, SR_URING_TXBUF_SIZE);
+    u->tx_buf[1] = (uint8_t*)sr_mem_malloc(SR_MEM_BACKEND, SR_URING_TXBUF_SIZE);
+    if (!u->rx_bufs || !u->tx_buf[0] || !u->tx_buf[1])
+    { goto fail; }
+
+    for (i = 0; i < SR_URING_NBUFS; i++)
+    { sr_uring_recycle_buf(u, i); }
+
+    pthread_mutex_init(&u->lock, 0);
+    pthread_cond_init(&u->tx_done, 0);
+
+    return u;
+
+fail:
+    fprintf(stderr, "io_uring unavailable, using classic socket path\n");
+    sr_mem_free(u->rx_bufs);
+    sr_mem_free(u->tx_buf[0]);
+    sr_mem_free(u->tx_buf[1]);
+    if (u->br)
+    { munmap(u->br, u->br_sz); }
+    if (u->sqes)
+    { munmap(u->sqes, u->sqes_sz); }
+    if (u->cq_ptr && u->cq_ptr != u->sq_ptr)
+    { munmap(u->cq_ptr, u->cq_sz); }
+    if (u->sq_ptr)
+    { munmap(u->sq_ptr, u->sq_sz); }
+    close(u->ring_fd);
+    sr_mem_free(u);
+    return 0;
+} /* -- sr_uring_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_destroy(..)
+ * Scope: Global
+ *
+ * Push out anything still staged, then tear the ring down.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_uring_destroy(struct sr_uring* u)
+{
+    if (!u)
+    { return; }
+
+    pthread_mutex_lock(&u->lock);
+    sr_uring_start_send(u);
+    while (!u->error && u->tx_inflight)
+    {
+        if (sr_uring_wait_cqe(u) < 0)
+        { break; }
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    close(u->ring_fd);
+    munmap(u->br, u->br_sz);
+    munmap(u->sqes, u->sqes_sz);
+    if (u->cq_ptr != u->sq_ptr)
+    { munmap(u->cq_ptr, u->cq_sz); }
+    munmap(u->sq_ptr, u->sq_sz);
+    sr_mem_free(u->rx_bufs);
+    sr_mem_free(u->tx_buf[0]);
+    sr_mem_free(u->tx_buf[1]);
+    pthread_mutex_destroy(&u->lock);
+    pthread_cond_destroy(&u->tx_done);
+    sr_mem_free(u);
+} /* -- sr_uring_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_read_full(..)
+ * Scope: Global
+ *
+ * Copy the next len bytes of the stream into dst.  Signals don't
+ * restart io_uring waits, so an interrupted wait is simply retried,
+ * keeping what was copied so far; only a stop request (SIGINT/SIGTERM)
+ * makes it give up, with EINTR.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_uring_read_full(struct sr_uring* u, uint8_t* dst, unsigned int len)
+{
+    unsigned int done = 0;
+
+    assert(pthread_equal(pthread_self(), u->owner));
+
+    pthread_mutex_lock(&u->lock);
+    while (done < len)
+    {
+        if (u->error)
+        { pthread_mutex_unlock(&u->lock); return -1; }
+
+        if (u->cur_bid >= 0)
+        {
+            unsigned n = u->cur_len - u->cur_off;
+            if (n > len - done)
+            { n = len - done; }
+            memcpy(dst + done, u->rx_bufs + (size_t)u->cur_bid * SR_URING_BUF_SIZE
+                   + u->cur_off, n);
+            done += n;
+            u->cur_off += n;
+            if (u->cur_off == u->cur_len)
+            {
+                sr_uring_recycle_buf(u, u->cur_bid);
+                u->cur_bid = -1;
+            }
+            continue;
+        }
+
+        if (u->rxq_head != u->rxq_tail)
+        {
+            unsigned slot = u->rxq_head++ & (SR_URING_NBUFS - 1);
+            u->cur_bid = u->rxq_bid[slot];
+            u->cur_len = u->rxq_len[slot];
+            u->cur_off = 0;
+            continue;
+        }
+
+        if (u->eof)
+        { pthread_mutex_unlock(&u->lock); return 0; }
+
+        /* -- receive side ran dry: good moment to push staged sends -- */
+        sr_uring_start_send(u);
+        if (!u->recv_armed && sr_uring_arm_recv(u) < 0)
+        { u->error = 1; continue; }
+
+        if (sr_uring_wait_cqe(u) < 0 && !u->error && sr_stop_requested)
+        { pthread_mutex_unlock(&u->lock); errno = EINTR; return -1; }
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    return (int)len;
+} /* -- sr_uring_read_full -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_write2(..)
+ * Scope: Global
+ *
+ * Stage one message (header + payload) for sending.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_uring_write2(struct sr_uring* u,
+                    const uint8_t* hdr, unsigned int hdr_len,
+                    const uint8_t* data, unsigned int data_len)
+{
+    unsigned int total = hdr_len + data_len;
+    int owner = pthread_equal(pthread_self(), u->owner);
+    uint8_t* dst;
+
+    if (total > SR_URING_TXBUF_SIZE)
+    { return -1; }
+
+    pthread_mutex_lock(&u->lock);
+    while (!u->error && u->tx_len[u->tx_fill] + total > SR_URING_TXBUF_SIZE)
+    {
+        if (!u->tx_inflight)
+        { sr_uring_start_send(u); }
+        else if (owner)
+        { sr_uring_wait_cqe(u); }
+        else
+        {
+            if (u->sq_pending)
+            {
+                u->stats.enters++;
+                sys_io_uring_enter(u->ring_fd, u->sq_pending, 0, 0);
+                u->sq_pending = 0;
+            }
+            pthread_cond_wait(&u->tx_done, &u->lock);
+        }
+    }
+    if (u->error)
+    { pthread_mutex_unlock(&u->lock); return -1; }
+
+    dst = u->tx_buf[u->tx_fill] + u->tx_len[u->tx_fill];
+    memcpy(dst, hdr, hdr_len);
+    memcpy(dst + hdr_len, data, data_len);
+    u->tx_len[u->tx_fill] += total;
+    u->stats.tx_msgs++;
+
+    if (!owner)
+    {
+        /* -- the owner may be asleep in the kernel; submit ourselves -- */
+        sr_uring_start_send(u);
+        if (u->sq_pending)
+        {
+            u->stats.enters++;
+            sys_io_uring_enter(u->ring_fd, u->sq_pending, 0, 0);
+            u->sq_pending = 0;
+        }
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    return 0;
+} /* -- sr_uring_write2 -- */
+
+int sr_uring_flush(struct sr_uring* u)
+{
+    int ret;
+
+    pthread_mutex_lock(&u->lock);
+    ret = sr_uring_start_send(u);
+    if (ret == 0 && u->sq_pending)
+    {
+        u->stats.enters++;
+        ret = sys_io_uring_enter(u->ring_fd, u->sq_pending, 0, 0) < 0 ? -1 : 0;
+        u->sq_pending = 0;
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    return ret;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_uring_rx_ready(..)
+ * Scope: Global
+ *
+ * Busy poll check.  Data already reaped or a completion waiting in the
+ * CQ counts as ready; the receive is (re)armed without waiting so the
+ * CQ can fill while we spin.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_uring_rx_ready(struct sr_uring* u)
+{
+    int ready;
+
+    assert(pthread_equal(pthread_self(), u->owner));
+
+    pthread_mutex_lock(&u->lock);
+    if (!u->recv_armed && !u->eof && !u->error)
+    {
+        if (sr_uring_arm_recv(u) < 0)
+        { u->error = 1; }
+        else
+        {
+            u->stats.enters++;
+            sys_io_uring_enter(u->ring_fd, u->sq_pending, 0, 0);
+            u->sq_pending = 0;
+        }
+    }
+    ready = u->cur_bid >= 0 || u->rxq_head != u->rxq_tail || u->eof ||
+            u->error ||
+            *u->cq_head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    pthread_mutex_unlock(&u->lock);
+
+    return ready;
+} /* -- sr_uring_rx_ready -- */
+
+const struct sr_uring_stats* sr_uring_get_stats(struct sr_uring* u)
+{
+    return &u->stats;
+}
+
+#else /* -- !_LINUX_ -- */
+
+struct sr_uring { int unused; };
+
+struct sr_uring* sr_uring_create(int sockfd)
+{
+    fprintf(stderr, "io_uring unavailable, using classic socket path\n");
+    return 0;
+}
+void sr_uring_destroy(struct sr_uring* u) { }
+int  sr_uring_read_full(struct sr_uring* u, uint8_t* dst, unsigned int len)
+{ return -1; }
+int  sr_uring_write2(struct sr_uring* u, const uint8_t* hdr, unsigned int hdr_len,
+                     const uint8_t* data, unsigned int data_len)
+{ return -1; }
+int  sr_uring_flush(struct sr_uring* u) { return -1; }
+int  sr_uring_rx_ready(struct sr_uring* u) { return 0; }
+const struct sr_uring_stats* sr_uring_get_stats(struct sr_uring* u) { return 0; }
+
+#endif /* _LINUX_ */
@@ -0,0 +1,69 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_uring.h
+ *
+ * Description:
+ *
+ * Optional io_uring transport for the VNS socket.  Receives use a
+ * provided-buffer ring (with multishot recv where the kernel has it) and
+ * sends are coalesced into a staging buffer that is handed to the kernel
+ * as a single SEND, piggy-backed on the next io_uring_enter() that waits
+ * for receive data.
+ *
+ * sr_uring_create() returns 0 if the running kernel lacks io_uring or
+ * provided-buffer rings; callers then stay on the classic recv/write path.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_URING_H
+#define SR_URING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#define SR_URING_ENTRIES     64     /* SQ/CQ depth */
+#define SR_URING_NBUFS       64     /* provided receive buffers (power of 2) */
+#define SR_URING_BUF_SIZE    16384  /* size of each receive buffer */
+#define SR_URING_TXBUF_SIZE  65536  /* send staging buffer (x2) */
+
+struct sr_uring_stats
+{
+    unsigned long enters;     /* io_uring_enter() syscalls */
+    unsigned long recv_cqes;  /* receive completions reaped */
+    unsigned long send_sqes;  /* SEND operations submitted */
+    unsigned long tx_msgs;    /* messages staged for sending */
+    unsigned long bytes_rx;
+    unsigned long bytes_tx;
+};
+
+struct sr_uring;
+
+struct sr_uring* sr_uring_create(int sockfd);
+void sr_uring_destroy(struct sr_uring* u);
+
+/* Read exactly len bytes from the socket. Returns len, 0 on EOF or -1 on
+   error. Must only be called from the thread that created the ring. */
+int  sr_uring_read_full(struct sr_uring* u, uint8_t* dst, unsigned int len);
+
+/* Nonzero if sr_uring_read_full(..) has data (or EOF/error) to return
+   without entering the kernel.  Owner thread only. */
+int  sr_uring_rx_ready(struct sr_uring* u);
+
+/* Stage hdr+data as one message for sending. Returns 0 or -1 on error. */
+int  sr_uring_write2(struct sr_uring* u,
+                     const uint8_t* hdr, unsigned int hdr_len,
+                     const uint8_t* data, unsigned int data_len);
+
+/* Queue a SEND for everything staged so far. The SQE reaches the kernel on
+   the next enter (immediately if called from a non-owner thread). */
+int  sr_uring_flush(struct sr_uring* u);
+
+const struct sr_uring_stats* sr_uring_get_stats(struct sr_uring* u);
+
+#endif /* -- SR_URING_H -- */
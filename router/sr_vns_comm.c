@@ -30,26 +30,63 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <errno.h>
+#include <pthread.h>
+#include <poll.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 
-#include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_backend.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
+#include "sr_uring.h"
+#include "sr_pool.h"
+#include "sr_stats.h"
+#include "sr_mem.h"
+
+#define VNS_V2_MAXIF 64   /* interface ids we accept from the server */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_vns_v2
+ *
+ * State of a v2 session: the interface ids the server handed out in
+ * VNSHWINFO and the VNSPACKETV2 batch being filled for the server.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_vns_v2
+{
+    int             ifindex[VNS_V2_MAXIF]; /* server id -> sr_if index, -1 */
+    int             ifid[SR_MAX_IF];       /* sr_if index -> server id, -1 */
+
+    pthread_mutex_t tx_lock;   /* the ARP thread sends too */
+    unsigned int    tx_len;    /* bytes in tx_buf, header included */
+    unsigned int    tx_count;  /* frames in tx_buf */
+    uint8_t         tx_buf[VNS_V2_MAXMSG];
+
+    struct sr_pool* msg_pool;  /* receive buffers too big for sr->pkt_pool */
+
+    unsigned long   rx_msgs;
+    unsigned long   tx_msgs;
+    unsigned long   rx_bad;    /* malformed records or unknown ids */
+};
+
+/* -- classic path sends, one whole burst of messages at a time -- */
+static pthread_mutex_t sr_vns_tx_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static void sr_log_packet(struct sr_instance* , uint8_t* , int );
-static int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                                  uint8_t * packet /* lent */,
-                                  unsigned int len,
-                                  char* interface  /* lent */);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
+static int  sr_read_msg(struct sr_instance* sr, int expected_cmd,
+                        struct sr_frame* frames, int max, int* nframes);
+static int  sr_read_full(struct sr_instance* sr, uint8_t* buf, int len);
+static int  sr_write_full(struct sr_instance* sr, const uint8_t* buf,
+                          unsigned int len);
 
 /*-----------------------------------------------------------------------------
  * Method: sr_session_closed_help(..)
@@ -142,6 +179,7 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
         command.mLen   = htonl(sizeof(c_open));
         command.mType  = htonl(VNSOPEN);
         command.topoID = htons(sr->topo_id);
+        command.mVersion = htons(VNS_VERSION_2);
         strncpy( command.mVirtualHostID, sr->host,  IDSIZE);
         strncpy( command.mUID, sr->user, IDSIZE);
 
@@ -164,6 +202,45 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
 
 
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_v2_set_ifid(..)
+ * Scope: Local
+ *
+ * Record the v2 id the server gave interface 'name'.  The first id switches
+ * the session over to v2.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_vns_v2_set_ifid(struct sr_instance* sr, const char* name,
+                               uint32_t id)
+{
+    struct sr_vns_v2* v2 = sr->vns_v2;
+    struct sr_if* iface = name ? sr_get_interface(sr, name) : 0;
+
+    if (!iface || id >= VNS_V2_MAXIF)
+    {
+        fprintf(stderr, "Ignoring interface id %u from the server\n", id);
+        return;
+    }
+
+    if (!v2)
+    {
+        v2 = (struct sr_vns_v2*)sr_mem_calloc(SR_MEM_VNS, 1,
+                                              sizeof(struct sr_vns_v2));
+        assert(v2);
+        memset(v2->ifindex, 0xff, sizeof(v2->ifindex));
+        memset(v2->ifid, 0xff, sizeof(v2->ifid));
+        pthread_mutex_init(&v2->tx_lock, 0);
+        v2->tx_len = sizeof(c_packet_v2_header);
+        v2->msg_pool = sr_pool_create("vns-msg", VNS_V2_MAXMSG, 4, 64, SR_MEM_VNS);
+        assert(v2->msg_pool);
+        sr->vns_v2 = v2;
+    }
+
+    v2->ifindex[id] = iface->index;
+    v2->ifid[iface->index] = id;
+} /* -- sr_vns_v2_set_ifid -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_handle_hwinfo(..)
  * scope: global
@@ -177,6 +254,7 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
 {
     int num_entries;
     int i = 0;
+    const char* cur = 0;
 
     /* REQUIRES */
     assert(sr);
@@ -197,6 +275,11 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
             case HWINTERFACE:
                 /*Debug("INTERFACE: %s\n",hwinfo->mHWInfo[i].value);*/
                 sr_add_interface(sr,hwinfo->mHWInfo[i].value);
+                cur = hwinfo->mHWInfo[i].value;
+                break;
+            case HWIFID:
+                sr_vns_v2_set_ifid(sr, cur,
+                        ntohl(*((uint32_t*)hwinfo->mHWInfo[i].value)));
                 break;
             case HWSPEED:
                 /* Debug("Speed: %d\n",
@@ -228,6 +311,8 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
 
     printf("Router interfaces:\n");
     sr_print_if_list(sr);
+    if (sr->vns_v2)
+    { printf("Using VNS protocol v2 (batched packets, interface ids)\n"); }
 
     return num_entries;
 } /* -- sr_handle_hwinfo -- */
@@ -281,7 +366,7 @@ int sr_handle_auth_request(struct sr_instance* sr, c_auth_request* req) {
         /* build the auth reply packet and then send it */
         len_username = strlen(sr->user);
         len = sizeof(c_auth_reply) + len_username + SHA1_LEN;
-        buf = (char*)malloc(len);
+        buf = (char*)sr_mem_malloc(SR_MEM_VNS, len);
         if(!buf) {
             perror("malloc failed");
             return 0;
@@ -301,7 +386,7 @@ int sr_handle_auth_request(struct sr_instance* sr, c_auth_request* req) {
         }
         else
             ret = 1;
-        free(buf);
+        sr_mem_free(buf);
         return ret;
     }
     else {
@@ -328,15 +413,131 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
 
 int sr_read_from_server(struct sr_instance* sr /* borrowed */)
 {
-    return sr_read_from_server_expect(sr, 0);
+    return sr_read_msg(sr, 0, 0, 0, 0);
 }
 
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
 {
-    int command, len;
+    return sr_read_msg(sr, expected_cmd, 0, 0, 0);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_ifindex(..)
+ * Scope: Local
+ *
+ * Index of the interface a v1 VNSPACKET names, -1 if there is no such
+ * interface.  The name field need not be NUL terminated.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_ifindex(struct sr_instance* sr, const char* name)
+{
+    char buf[sizeof(((c_packet_header*)0)->mInterfaceName) + 1];
+    struct sr_if* iface;
+
+    memcpy(buf, name, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+
+    iface = sr_get_interface(sr, buf);
+    return iface ? iface->index : -1;
+} /* -- sr_vns_ifindex -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_v2_unpack(..)
+ * Scope: Local
+ *
+ * Split a VNSPACKETV2 message into frames.  They are handed back through
+ * 'frames' if given and there is room for all of them, otherwise they are
+ * delivered to the router right away.
+ *
+ * RETURN VALUES:
+ *
+ *  number of frames handed back
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_v2_unpack(struct sr_instance* sr, uint8_t* buf,
+                            unsigned int len, struct sr_frame* frames, int max)
+{
+    struct sr_vns_v2* v2 = sr->vns_v2;
+    c_packet_v2_header* hdr = (c_packet_v2_header*)buf;
+    unsigned int off = sizeof(c_packet_v2_header);
+    uint32_t count, i;
+    int deliver, n = 0;
+
+    if (!v2 || len < sizeof(c_packet_v2_header))
+    {
+        fprintf(stderr, "Error: unexpected VNSPACKETV2 message\n");
+        return 0;
+    }
+
+    count = ntohl(hdr->mCount);
+    deliver = (frames == 0 || count > (uint32_t)max);
+    v2->rx_msgs++;
+
+    for (i = 0; i < count; i++)
+    {
+        c_packet_v2_rec* rec = (c_packet_v2_rec*)(buf + off);
+        unsigned int flen;
+        uint16_t id;
+        struct sr_frame f;
+
+        if (off + sizeof(c_packet_v2_rec) > len)
+        { break; }
+        flen = ntohs(rec->mLen);
+        id   = ntohs(rec->mIfId);
+        off += sizeof(c_packet_v2_rec);
+        if (off + flen > len)
+        { break; }
+
+        if (id >= VNS_V2_MAXIF || v2->ifindex[id] < 0 ||
+                flen < sizeof(struct sr_ethernet_hdr))
+        {
+            v2->rx_bad++;
+            off += flen;
+            continue;
+        }
+
+        if (sr->vns_stats.rx_pkts++ == 0)
+        { gettimeofday(&sr->vns_stats.first_pkt, 0); }
+
+        f.buf   = buf + off;
+        f.len   = flen;
+        f.ifindex = v2->ifindex[id];
+        f.headroom = 0;
+        f.priv  = 0;
+        off += flen;
+
+        if (deliver)
+        { sr_backend_input(sr, &f); }
+        else
+        { frames[n++] = f; }
+    }
+
+    if (i < count)
+    { v2->rx_bad += count - i; }
+
+    return n;
+} /* -- sr_vns_v2_unpack -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_msg(..)
+ * Scope: Local
+ *
+ * Read and act on one message from the server.  If packets arrive and
+ * 'frames' is given, up to 'max' of them are handed back through it and
+ * their number stored in *nframes (the caller must free frames[i].priv);
+ * otherwise they are delivered to the router right away.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_read_msg(struct sr_instance* sr /* borrowed */, int expected_cmd,
+                       struct sr_frame* frames, int max, int* nframes)
+{
+    int command, len, n;
     unsigned char *buf = 0;
     c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    int ret = 0;
 
     /* REQUIRES */
     assert(sr);
@@ -345,65 +546,56 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
       Read a command from the server
       -------------------------------------------------------------------------*/
 
-    bytes_read = 0;
-
     /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
-    {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
-
-    }
+    if ((ret = sr_read_full(sr, (uint8_t*)&len, 4)) != 1)
+    { return ret; }
 
     len = ntohl(len);
 
-    if ( len > 10000 || len < 0 )
+    if ( len > (sr->vns_v2 ? VNS_V2_MAXMSG : 10000) || len < 0 )
     {
         fprintf(stderr,"Error: command length to large %d\n",len);
         close(sr->sockfd);
         return -1;
     }
 
-    if((buf = malloc(len)) == 0)
+    /* -- v1 messages (and most v2 ones) fit a packet buffer -- */
+    if((buf = sr_pool_get(len <= SR_PKT_BUF_SIZE ? sr->pkt_pool :
+                    sr->vns_v2->msg_pool)) == 0)
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
-        return -1;
+        /* -- pool at its limit: skip the message to stay in step -- */
+        unsigned char scratch[1024];
+
+        for (n = len - 4; n > 0; n -= sizeof(scratch))
+        {
+            if ((ret = sr_read_full(sr, scratch,
+                            n < (int)sizeof(scratch) ? n : (int)sizeof(scratch))) != 1)
+            {
+                if (ret < 0)
+                {
+                    fprintf(stderr,"Error: failed reading command body %d\n",ret);
+                    close(sr->sockfd);
+                }
+                return ret;
+            }
+        }
+        SR_STATS_DROP(NO_BUFFER, len);
+        return 1;
     }
 
     /* set first field of command since we've already read it */
     *((int *)buf) = htonl(len);
 
-    bytes_read = 0;
-
     /* read the rest of the command */
-    while ( bytes_read < len - 4)
+    if ((ret = sr_read_full(sr, buf + 4, len - 4)) != 1)
     {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
+        if (ret < 0)
+        {
+            fprintf(stderr,"Error: failed reading command body %d\n",ret);
+            close(sr->sockfd);
+        }
+        sr_pool_put(buf);
+        return ret;
     }
 
     /* My entry for most unreadable line of code - guido */
@@ -414,6 +606,7 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
     if(expected_cmd && command!=expected_cmd) {
         if(command != VNSCLOSE) { /* VNSCLOSE is always ok */
             fprintf(stderr, "Error: expected command %d but got %d\n", expected_cmd, command);
+            sr_pool_put(buf);
             return -1;
         }
     }
@@ -426,25 +619,55 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         case VNSPACKET:
             sr_pkt = (c_packet_ethernet_header *)buf;
 
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
-            { break; }
+            if (sr->vns_stats.rx_pkts++ == 0)
+            { gettimeofday(&sr->vns_stats.first_pkt, 0); }
 
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
+            /* -- the one place a received packet is named, not indexed -- */
+            if ((n = sr_vns_ifindex(sr, sr_pkt->mInterfaceName)) < 0)
+            {
+                fprintf(stderr, "Packet on unknown interface %.16s\n",
+                        sr_pkt->mInterfaceName);
+            }
+            else if (frames)
+            {
+                /* -- hand the message buffer over to the caller; the
+                      parsed VNS header is free for re-encapsulation -- */
+                frames[0].buf     = buf + sizeof(c_packet_header);
+                frames[0].len     = ntohl(sr_pkt->mLen) - sizeof(c_packet_header);
+                frames[0].ifindex = n;
+                frames[0].headroom = sizeof(c_packet_header);
+                frames[0].priv    = buf;
+                *nframes = 1;
+                return 1;
+            }
+            else
+            {
+                struct sr_frame f;
+
+                f.buf     = buf + sizeof(c_packet_header);
+                f.len     = ntohl(sr_pkt->mLen) - sizeof(c_packet_header);
+                f.ifindex = n;
+                f.headroom = sizeof(c_packet_header);
+                f.priv    = 0;
+                sr_backend_input(sr, &f);
+            }
 
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base)));
+            gettimeofday(&sr->vns_stats.last_pkt, 0);
+            break;
 
+            /* -------------       VNSPACKETV2    -------------------- */
+
+        case VNSPACKETV2:
+            n = sr_vns_v2_unpack(sr, buf, len, frames, max);
+            if (n > 0)
+            {
+                /* -- frames point into buf, freed with the first one -- */
+                frames[0].priv = buf;
+                *nframes = n;
+                return 1;
+            }
+
+            gettimeofday(&sr->vns_stats.last_pkt, 0);
             break;
 
             /* -------------        VNSCLOSE      -------------------- */
@@ -454,8 +677,7 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
 
-            if(buf)
-            { free(buf); }
+            sr_pool_put(buf);
             return 0;
             break;
 
@@ -469,12 +691,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
         case VNSHWINFO:
             sr_handle_hwinfo(sr,(c_hwinfo*)buf);
-            if(sr_verify_routing_table(sr) != 0)
-            {
-                fprintf(stderr,"Routing table not consistent with hardware\n");
-                return -1;
-            }
-            printf(" <-- Ready to process packets --> \n");
             break;
 
             /* ---------------- VNS_RTABLE ---------------- */
@@ -501,167 +717,489 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
+    sr_pool_put(buf);
     return ret;
-}/* -- sr_read_from_server -- */
+}/* -- sr_read_msg -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_ether_addrs_match_interface(..)
+ * Method: sr_read_full(..)
  * Scope: Local
  *
- * Make sure ethernet addresses are sane so we don't muck uo the system.
+ * Read exactly len bytes from the server, through io_uring if it is
+ * enabled, otherwise with plain recv(..).
  *
- *----------------------------------------------------------------------------*/
+ * RETURN VALUES:
+ *
+ *  1 on success
+ *  0 if the server closed the connection or we were asked to stop
+ * -1 on error
+ *
+ *---------------------------------------------------------------------------*/
 
-static int
-sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
-                                uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+static int sr_read_full(struct sr_instance* sr, uint8_t* buf, int len)
 {
-    struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
+    int ret = 0, bytes_read = 0;
 
-    /* -- REQUIRES -- */
-    assert(sr);
-    assert(buf);
-    assert(name);
+    if (sr->uring)
+    {
+        ret = sr_uring_read_full(sr->uring, buf, len);
+        if (ret < 0 && errno == EINTR && sr_stop_requested)
+        { return 0; }
+        return (ret == len) ? 1 : ret;
+    }
 
-    ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
+    while( bytes_read < len)
+    {
+        do
+        { /* -- just in case SIGALRM breaks recv -- */
+            errno = 0; /* -- hacky glibc workaround -- */
+            __atomic_add_fetch(&sr->vns_stats.syscalls, 1, __ATOMIC_RELAXED);
+            if((ret = recv(sr->sockfd, buf + bytes_read,
+                            len - bytes_read, 0)) == -1)
+            {
+                if ( errno == EINTR )
+                {
+                    if (sr_stop_requested)
+                    { return 0; }
+                    continue;
+                }
 
-    if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
-        return 0;
+                perror("recv(..):sr_client.c::sr_read_from_server");
+                return -1;
+            }
+            if (ret == 0)
+            { return 0; } /* -- server went away -- */
+            bytes_read += ret;
+        } while ( errno == EINTR); /* be mindful of signals */
     }
 
-    if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
-        fprintf( stderr, "** Error, source address does not match interface\n");
-        return 0;
+    return 1;
+} /* -- sr_read_full -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_write_full(..)
+ * Scope: Local
+ *
+ * Write all of buf to the server on the classic path.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_write_full(struct sr_instance* sr, const uint8_t* buf,
+                         unsigned int len)
+{
+    unsigned int done = 0;
+    ssize_t ret;
+
+    while (done < len)
+    {
+        __atomic_add_fetch(&sr->vns_stats.syscalls, 1, __ATOMIC_RELAXED);
+        if ((ret = send(sr->sockfd, buf + done, len - done, 0)) < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            perror("send(..):sr_vns_comm.c::sr_write_full");
+            return -1;
+        }
+        done += ret;
     }
 
-    /* TODO */
-    /* Check destination, hardware address.  If it is private (i.e. destined
-     * to a virtual interface) ensure it is going to the correct topology
-     * Note: This check should really be done server side ...
-     */
+    return 0;
+} /* -- sr_write_full -- */
 
-    return 1;
+/*-----------------------------------------------------------------------------
+ * Method: sr_writev_full(..)
+ * Scope: Local
+ *
+ * Write all of iov to the server on the classic path, advancing it past
+ * whatever a short writev(..) took; a message cut in half would leave
+ * the stream out of frame.  iov is consumed.  Returns 0 or -1.
+ *
+ *---------------------------------------------------------------------------*/
 
-} /* -- sr_ether_addrs_match_interface -- */
+static int sr_writev_full(struct sr_instance* sr, struct iovec* iov, int niov)
+{
+    ssize_t ret;
+
+    while (niov > 0)
+    {
+        __atomic_add_fetch(&sr->vns_stats.syscalls, 1, __ATOMIC_RELAXED);
+        if ((ret = writev(sr->sockfd, iov, niov)) < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                struct pollfd pfd;
+
+                pfd.fd = sr->sockfd;
+                pfd.events = POLLOUT;
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            perror("writev(..):sr_vns_comm.c::sr_writev_full");
+            return -1;
+        }
+
+        while (niov > 0 && (size_t)ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if (niov > 0)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+} /* -- sr_writev_full -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_send_packet(..)
+ * Method: sr_enable_uring(..)
  * Scope: Global
  *
- * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * Switch the server connection over to io_uring.  Must be called from the
+ * thread that runs sr_read_from_server(..).  Falls back to the classic path
+ * if the kernel does not support it.
+ *
+ * RETURN VALUES:
+ *
+ *  0 if io_uring is in use, -1 if the classic path stays in use
  *
  *---------------------------------------------------------------------------*/
 
-int sr_send_packet(struct sr_instance* sr /* borrowed */,
-                         uint8_t* buf /* borrowed */ ,
-                         unsigned int len,
-                         const char* iface /* borrowed */)
+static int sr_enable_uring(struct sr_instance* sr)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
-
-    /* REQUIRES */
     assert(sr);
-    assert(buf);
-    assert(iface);
 
-    /* don't waste my time ... */
-    if ( len < sizeof(struct sr_ethernet_hdr) ){
-        fprintf(stderr , "** Error: packet is wayy to short \n");
-        return -1;
+    sr->uring = sr_uring_create(sr->sockfd);
+    if (!sr->uring)
+    { return -1; }
+
+    printf("Using io_uring for the VNS connection\n");
+    return 0;
+} /* -- sr_enable_uring -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_print_vns_stats(..)
+ * Scope: Global
+ *
+ * Print syscall counts and packet rates for the server connection.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_print_vns_stats(struct sr_instance* sr)
+{
+    struct sr_vns_stats* st = &sr->vns_stats;
+    unsigned long syscalls = st->syscalls;
+    double secs = 0;
+
+    if (sr->uring)
+    {
+        const struct sr_uring_stats* us = sr_uring_get_stats(sr->uring);
+        syscalls = us->enters;
+        fprintf(stderr, "io_uring: %lu recv cqes, %lu send sqes, %lu tx msgs, "
+                "%lu bytes rx, %lu bytes tx\n", us->recv_cqes, us->send_sqes,
+                us->tx_msgs, us->bytes_rx, us->bytes_tx);
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    if (st->rx_pkts > 1)
+    {
+        secs = (st->last_pkt.tv_sec - st->first_pkt.tv_sec) +
+               (st->last_pkt.tv_usec - st->first_pkt.tv_usec) / 1e6;
+    }
 
-    /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+    fprintf(stderr, "VNS %s path: %lu pkts rx, %lu pkts tx, %lu syscalls "
+            "(%.2f per pkt)", sr->uring ? "io_uring" : "classic",
+            st->rx_pkts, st->tx_pkts, syscalls,
+            (st->rx_pkts + st->tx_pkts) ?
+            (double)syscalls / (st->rx_pkts + st->tx_pkts) : 0.0);
+    if (secs > 0)
+    { fprintf(stderr, ", %.0f pps rx", st->rx_pkts / secs); }
+    fprintf(stderr, "\n");
 
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
-        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
-        return -1;
+    if (sr->vns_v2)
+    {
+        struct sr_vns_v2* v2 = sr->vns_v2;
+
+        fprintf(stderr, "VNS v2: %lu msgs rx (%.1f pkts/msg, %lu bad), "
+                "%lu msgs tx (%.1f pkts/msg)\n", v2->rx_msgs,
+                v2->rx_msgs ? (double)st->rx_pkts / v2->rx_msgs : 0.0,
+                v2->rx_bad, v2->tx_msgs,
+                v2->tx_msgs ? (double)st->tx_pkts / v2->tx_msgs : 0.0);
     }
+} /* -- sr_print_vns_stats -- */
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        return -1;
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_v2_flush_locked(..)
+ * Scope: Local
+ *
+ * Send the pending VNSPACKETV2 batch, if any.  Called with tx_lock held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_v2_flush_locked(struct sr_instance* sr)
+{
+    struct sr_vns_v2* v2 = sr->vns_v2;
+    c_packet_v2_header* hdr = (c_packet_v2_header*)v2->tx_buf;
+    int ret;
+
+    if (v2->tx_count == 0)
+    { return 0; }
+
+    hdr->mLen   = htonl(v2->tx_len);
+    hdr->mType  = htonl(VNSPACKETV2);
+    hdr->mCount = htonl(v2->tx_count);
+
+    if (sr->uring)
+    {
+        ret = sr_uring_write2(sr->uring, v2->tx_buf, sizeof(c_packet_v2_header),
+                              v2->tx_buf + sizeof(c_packet_v2_header),
+                              v2->tx_len - sizeof(c_packet_v2_header));
     }
+    else
+    { ret = sr_write_full(sr, v2->tx_buf, v2->tx_len); }
 
-    free(sr_pkt);
+    v2->tx_msgs++;
+    v2->tx_len = sizeof(c_packet_v2_header);
+    v2->tx_count = 0;
 
-    return 0;
-} /* -- sr_send_packet -- */
+    return ret;
+} /* -- sr_vns_v2_flush_locked -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_log_packet()
+ * Method: sr_vns_v2_write(..)
  * Scope: Local
  *
+ * Append frames to the pending VNSPACKETV2 batch.  The batch goes out when
+ * it is full or on the next tx_flush.
+ *
  *---------------------------------------------------------------------------*/
 
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
+static int sr_vns_v2_write(struct sr_instance* sr, const struct sr_frame* frames,
+                           int n)
 {
-    struct pcap_pkthdr h;
-    int size;
+    struct sr_vns_v2* v2 = sr->vns_v2;
+    int i, id;
 
-    /* REQUIRES */
-    assert(sr);
+    pthread_mutex_lock(&v2->tx_lock);
+    for (i = 0; i < n; i++)
+    {
+        unsigned int need = sizeof(c_packet_v2_rec) + frames[i].len;
+        c_packet_v2_rec* rec;
 
-    if(!sr->logfile)
-    {return; }
+        if (frames[i].ifindex < 0 || frames[i].ifindex >= SR_MAX_IF ||
+                (id = v2->ifid[frames[i].ifindex]) < 0 ||
+                need > VNS_V2_MAXMSG - sizeof(c_packet_v2_header))
+        { break; }
 
-    size = min(PACKET_DUMP_SIZE, len);
+        if (v2->tx_len + need > VNS_V2_MAXMSG || v2->tx_count == VNS_V2_MAXBATCH)
+        {
+            if (sr_vns_v2_flush_locked(sr) < 0)
+            { break; }
+        }
 
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
+        rec = (c_packet_v2_rec*)(v2->tx_buf + v2->tx_len);
+        rec->mIfId = htons(id);
+        rec->mLen  = htons(frames[i].len);
+        memcpy(rec + 1, frames[i].buf, frames[i].len);
+        v2->tx_len += need;
+        v2->tx_count++;
+    }
+    __atomic_add_fetch(&sr->vns_stats.tx_pkts, i, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&v2->tx_lock);
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
-} /* -- sr_log_packet -- */
+    return i;
+} /* -- sr_vns_v2_write -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_arp_req_not_for_us()
+ * Method: sr_vns_write(..)
  * Scope: Local
  *
+ * Frame 'n' packets as VNSPACKET messages and send them to the server,
+ * with a single writev(..) on the classic path when the socket takes it
+ * all.  Workers and the ARP thread all send, so the classic path holds
+ * sr_vns_tx_lock until the last byte is out.
+ *
  *---------------------------------------------------------------------------*/
 
-int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                           uint8_t * packet /* lent */,
-                           unsigned int len,
-                           char* interface  /* lent */)
+static int sr_vns_write(struct sr_instance* sr, const struct sr_frame* frames,
+                        int n)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
-    struct sr_ethernet_hdr* e_hdr = 0;
-    struct sr_arp_hdr*       a_hdr = 0;
+    c_packet_header hdrs[SR_RX_BURST];
+    struct iovec iov[2 * SR_RX_BURST];
+    int i, niov = 0, ret;
 
-    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
-    { return 0; }
+    if (sr->vns_v2)
+    { return sr_vns_v2_write(sr, frames, n); }
 
-    assert(iface);
+    if (n > SR_RX_BURST)
+    { n = SR_RX_BURST; }
 
-    e_hdr = (struct sr_ethernet_hdr*)packet;
-    a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+    for (i = 0; i < n; i++)
+    {
+        unsigned int msg_len = frames[i].len + sizeof(c_packet_header);
+        struct sr_if* iface = sr_get_interface_idx(sr, frames[i].ifindex);
+        c_packet_header* hdr = &hdrs[i];
+
+        if (!iface)
+        { break; }
+
+        /* -- prepend the framing in place when the frame has room -- */
+        if (frames[i].headroom >= sizeof(c_packet_header))
+        { hdr = (c_packet_header*)(frames[i].buf - sizeof(c_packet_header)); }
 
-    if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
-            (a_hdr->ar_op      == htons(arp_op_request))   &&
-            (a_hdr->ar_tip     != iface->ip ) )
-    { return 1; }
+        hdr->mLen  = htonl(msg_len);
+        hdr->mType = htonl(VNSPACKET);
+        strncpy(hdr->mInterfaceName, iface->name, 16);
+
+        if (sr->uring)
+        {
+            /* -- staged by copy either way -- */
+            if (sr_uring_write2(sr->uring, (uint8_t*)hdr, sizeof(*hdr),
+                                frames[i].buf, frames[i].len) < 0)
+            { return i; }
+            continue;
+        }
+
+        if (hdr != &hdrs[i])
+        {
+            iov[niov].iov_base = hdr;
+            iov[niov].iov_len  = msg_len;
+            niov++;
+        }
+        else
+        {
+            iov[niov].iov_base   = hdr;
+            iov[niov].iov_len    = sizeof(c_packet_header);
+            iov[niov+1].iov_base = frames[i].buf;
+            iov[niov+1].iov_len  = frames[i].len;
+            niov += 2;
+        }
+    }
+    n = i;
+
+    __atomic_add_fetch(&sr->vns_stats.tx_pkts, n, __ATOMIC_RELAXED);
+
+    if (sr->uring)
+    { return n; }
+
+    pthread_mutex_lock(&sr_vns_tx_lock);
+    ret = sr_writev_full(sr, iov, niov);
+    pthread_mutex_unlock(&sr_vns_tx_lock);
+
+    return ret == 0 ? n : 0;
+} /* -- sr_vns_write -- */
+
+/*-----------------------------------------------------------------------------
+ * VNS backend ops
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_open(struct sr_instance* sr, const struct sr_backend_config* cfg)
+{
+    return sr_connect_to_server(sr, cfg->port, (char*)cfg->server);
+}
+
+static int sr_vns_discover(struct sr_instance* sr)
+{
+    /* -- the server sends VNSHWINFO in response to our open -- */
+    while (sr->if_list == 0)
+    {
+        if (sr_read_from_server(sr) != 1)
+        { return -1; }
+    }
+
+    if (sr->use_uring)
+    { sr_enable_uring(sr); }
 
     return 0;
-} /* -- sr_arp_req_not_for_us -- */
+}
+
+static int sr_vns_rx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int max)
+{
+    int n = 0;
+
+    if (sr_read_msg(sr, 0, frames, max, &n) != 1)
+    { return -1; }
+    return n;
+}
+
+/* -- with io_uring the completion ring is checked, otherwise poll(2) -- */
+static int sr_vns_rx_ready(struct sr_instance* sr)
+{
+    struct pollfd pfd;
+
+    if (sr->uring)
+    { return sr_uring_rx_ready(sr->uring); }
+
+    pfd.fd = sr->sockfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    __atomic_add_fetch(&sr->vns_stats.syscalls, 1, __ATOMIC_RELAXED);
+    return poll(&pfd, 1, 0) > 0;
+}
+
+static void sr_vns_rx_release(struct sr_instance* sr, struct sr_frame* frames,
+                              int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    { sr_pool_put(frames[i].priv); }
+    gettimeofday(&sr->vns_stats.last_pkt, 0);
+}
+
+static int sr_vns_tx_flush(struct sr_instance* sr)
+{
+    struct sr_vns_v2* v2 = sr->vns_v2;
+    int ret;
+
+    if (!v2)
+    { return 0; }
+
+    pthread_mutex_lock(&v2->tx_lock);
+    ret = sr_vns_v2_flush_locked(sr);
+    pthread_mutex_unlock(&v2->tx_lock);
+
+    return ret;
+}
+
+static void sr_vns_close(struct sr_instance* sr)
+{
+    sr_print_vns_stats(sr);
+
+    if (sr->uring)
+    {
+        sr_uring_destroy(sr->uring);
+        sr->uring = 0;
+    }
+    if (sr->sockfd >= 0)
+    {
+        close(sr->sockfd);
+        sr->sockfd = -1;
+    }
+    if (sr->vns_v2)
+    {
+        pthread_mutex_destroy(&sr->vns_v2->tx_lock);
+        sr_mem_free(sr->vns_v2);
+        sr->vns_v2 = 0;
+    }
+}
+
+const struct sr_backend sr_vns_backend =
+{
+    "vns",
+    sr_vns_open,
+    sr_vns_discover,
+    sr_vns_rx_burst,
+    sr_vns_rx_release,
+    sr_vns_write,
+    sr_vns_close,
+    0,
+    0,
+    sr_vns_tx_flush,
+    sr_vns_rx_ready
+};
@@ -0,0 +1,397 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_worker.c
+ *
+ * Description:
+ *
+ * Flow-affine forwarding workers, see sr_worker.h.
+ *
+ * Each worker has a single producer / single consumer ring: the dispatch
+ * thread moves head, the worker moves tail.  An idle worker spins on its
+ * ring for a while and then sleeps on a condition variable; the
+ * dispatcher only signals workers that said they are sleeping.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_backend.h"
+#include "sr_pkt.h"
+#include "sr_worker.h"
+#include "sr_trace.h"
+#include "sr_stats.h"
+#include "sr_probe.h"
+#include "sr_mem.h"
+
+#define SR_WORKER_SPIN     2000   /* empty polls before sleeping */
+#define SR_WORKER_SLEEP_MS 100    /* longest sleep, in case a wakeup is lost */
+#define SR_WORKER_MAX_CPU  1024
+
+struct sr_worker
+{
+    /* -- written by the dispatcher -- */
+    unsigned int head __attribute__((aligned(64)));
+    unsigned long stalls;         /* bursts that found the ring full */
+    unsigned long wakeups;
+
+    /* -- written by the worker -- */
+    unsigned int tail __attribute__((aligned(64)));
+    int sleeping;
+    unsigned long pkts;
+    unsigned long bursts;
+
+    struct sr_instance* sr;
+    int id;
+    int cpu;                      /* -1 if not pinned */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct sr_pkt* ring[SR_WORKER_RING];
+};
+
+struct sr_workers
+{
+    int n;
+    int stop;
+    unsigned long dropped;        /* too long or no packet buffer */
+    struct sr_worker* w[SR_MAX_WORKERS];
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_hash(..)
+ * Scope: Global
+ *
+ * Hash the IPv4 addresses, protocol and (for unfragmented TCP/UDP) the
+ * ports.  ARP hashes on the sender address; anything else hashes to 0.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint32_t sr_hash_mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+uint32_t sr_flow_hash(const uint8_t* frame, unsigned int len)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)frame;
+    const sr_ip_hdr_t* ip;
+    unsigned int hl;
+    uint32_t h, ports = 0;
+
+    if (len < sizeof(sr_ethernet_hdr_t))
+    { return 0; }
+
+    if (eth->ether_type == htons(ethertype_arp) &&
+            len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+    {
+        const sr_arp_hdr_t* arp = (const sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        return sr_hash_mix(arp->ar_sip);
+    }
+
+    if (eth->ether_type != htons(ethertype_ip) ||
+            len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+    { return 0; }
+
+    ip = (const sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    hl = ip->ip_hl * 4;
+    if ((ip->ip_p == ip_protocol_tcp || ip->ip_p == ip_protocol_udp) &&
+            (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)) == 0 &&
+            len >= sizeof(sr_ethernet_hdr_t) + hl + 4)
+    { memcpy(&ports, frame + sizeof(sr_ethernet_hdr_t) + hl, 4); }
+
+    h = sr_hash_mix(ip->ip_src);
+    h = sr_hash_mix(h ^ ip->ip_dst);
+    h = sr_hash_mix(h ^ ports ^ ip->ip_p);
+    return h;
+} /* -- sr_flow_hash -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_main(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_worker_pop(struct sr_worker* w, struct sr_pkt** out, int max)
+{
+    unsigned int tail = w->tail;
+    unsigned int head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    while (tail != head && n < max)
+    { out[n++] = w->ring[tail++ & (SR_WORKER_RING - 1)]; }
+
+    __atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+static void sr_worker_sleep(struct sr_worker* w, struct sr_workers* ws)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += SR_WORKER_SLEEP_MS * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    __atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+    /* -- recheck after announcing, the dispatcher may have just pushed -- */
+    if (__atomic_load_n(&w->head, __ATOMIC_SEQ_CST) == w->tail &&
+            !__atomic_load_n(&ws->stop, __ATOMIC_ACQUIRE))
+    { pthread_cond_timedwait(&w->wake, &w->lock, &ts); }
+    __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void* sr_worker_main(void* arg)
+{
+    struct sr_worker* w = (struct sr_worker*)arg;
+    struct sr_workers* ws = w->sr->workers;
+    struct sr_pkt* burst[SR_WORKER_BURST];
+    unsigned int idle = 0;
+    char name[16];
+    int n;
+
+    snprintf(name, sizeof(name), "worker%d", w->id);
+    sr_trace_thread(name);
+    sr_stats_thread(name);
+
+#ifdef _LINUX_
+    if (w->cpu >= 0)
+    {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+        { perror("pthread_setaffinity_np:sr_worker.c::sr_worker_main"); }
+    }
+#endif /* _LINUX_ */
+
+    while (1)
+    {
+        if ((n = sr_worker_pop(w, burst, SR_WORKER_BURST)) > 0)
+        {
+            sr_backend_deliver(w->sr, burst, n);
+            w->pkts += n;
+            w->bursts++;
+            idle = 0;
+            continue;
+        }
+
+        /* -- stop only once the ring is empty -- */
+        if (__atomic_load_n(&ws->stop, __ATOMIC_ACQUIRE))
+        { break; }
+
+        if (++idle < SR_WORKER_SPIN)
+        { continue; }
+
+        sr_worker_sleep(w, ws);
+        idle = 0;
+    }
+
+    return 0;
+} /* -- sr_worker_main -- */
+
+int sr_workers_start(struct sr_instance* sr, int n, const int* cpus, int ncpus)
+{
+    struct sr_workers* ws;
+    int i;
+
+    assert(sr);
+    assert(!sr->workers);
+
+    if (n <= 0)
+    { return 0; }
+    if (n > SR_MAX_WORKERS)
+    {
+        fprintf(stderr, "At most %d workers\n", SR_MAX_WORKERS);
+        return -1;
+    }
+
+    ws = (struct sr_workers*)sr_mem_calloc(SR_MEM_THREAD, 1,
+                                           sizeof(struct sr_workers));
+    assert(ws);
+    sr->workers = ws;
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_worker* w;
+
+        w = (struct sr_worker*)sr_mem_memalign(SR_MEM_THREAD, 64,
+                                               sizeof(struct sr_worker));
+        assert(w);
+        memset(w, 0, sizeof(struct sr_worker));
+
+        w->sr = sr;
+        w->id = i;
+        w->cpu = ncpus > 0 ? cpus[i % ncpus] : -1;
+        pthread_mutex_init(&w->lock, 0);
+        pthread_cond_init(&w->wake, 0);
+
+        if ((errno = pthread_create(&w->thread, 0, sr_worker_main, w)) != 0)
+        {
+            perror("pthread_create:sr_worker.c::sr_workers_start");
+            pthread_cond_destroy(&w->wake);
+            pthread_mutex_destroy(&w->lock);
+            sr_mem_free(w);
+            break;
+        }
+        ws->w[ws->n++] = w;
+    }
+
+    if (ws->n < n)
+    {
+        sr_workers_stop(sr);
+        return -1;
+    }
+
+    printf("%d forwarding workers\n", n);
+    return 0;
+} /* -- sr_workers_start -- */
+
+static void sr_worker_kick(struct sr_worker* w)
+{
+    if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+        w->wakeups++;
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_workers_dispatch(..)
+ * Scope: Global
+ *
+ * Runs on the receive thread.  When a worker's ring is full the
+ * dispatcher waits for it, which pushes back on the backend: frames then
+ * queue (and eventually drop) in the socket or NIC ring, as they would
+ * in front of a single threaded router.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_workers_dispatch(struct sr_instance* sr, struct sr_frame* frames, int n)
+{
+    struct sr_workers* ws = sr->workers;
+    unsigned int pushed[SR_MAX_WORKERS];
+    uint64_t now = sr_pkt_clock();
+    int i;
+
+    memset(pushed, 0, sizeof(pushed));
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_frame* f = &frames[i];
+        struct sr_worker* w;
+        struct sr_pkt* pkt;
+
+        SR_STATS_IF(f->ifindex, RX, f->len);
+        SR_PROBE3(packet__receive, f->ifindex, f->len, f->buf);
+        if (f->len > SR_PKT_DATA_MAX)
+        {
+            SR_STATS_DROP(OVERSIZE, f->len);
+            ws->dropped++;
+            continue;
+        }
+        if ((pkt = sr_pkt_alloc(sr, SR_PKT_HEADROOM)) == 0)
+        {
+            SR_STATS_DROP(NO_BUFFER, f->len);
+            ws->dropped++;
+            continue;
+        }
+        memcpy(sr_pkt_put(pkt, f->len), f->buf, f->len);
+        pkt->ifindex = f->ifindex;
+        pkt->ts_ns = now;
+
+        w = ws->w[((uint64_t)sr_flow_hash(f->buf, f->len) * ws->n) >> 32];
+        if (w->head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == SR_WORKER_RING)
+        {
+            w->stalls++;
+            do
+            {
+                sr_worker_kick(w);
+                sched_yield();
+            } while (w->head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) ==
+                     SR_WORKER_RING);
+        }
+        w->ring[w->head & (SR_WORKER_RING - 1)] = pkt;
+        __atomic_store_n(&w->head, w->head + 1, __ATOMIC_SEQ_CST);
+        pushed[w->id]++;
+    }
+
+    for (i = 0; i < ws->n; i++)
+    {
+        if (pushed[i])
+        { sr_worker_kick(ws->w[i]); }
+    }
+} /* -- sr_workers_dispatch -- */
+
+void sr_workers_stop(struct sr_instance* sr)
+{
+    struct sr_workers* ws = sr->workers;
+    int i;
+
+    if (!ws)
+    { return; }
+
+    __atomic_store_n(&ws->stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < ws->n; i++)
+    {
+        struct sr_worker* w = ws->w[i];
+
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, 0);
+
+        fprintf(stderr, "worker %d (cpu %d): %lu packets in %lu bursts, "
+                "%lu ring full stalls, %lu wakeups\n", w->id, w->cpu, w->pkts,
+                w->bursts, w->stalls, w->wakeups);
+
+        pthread_cond_destroy(&w->wake);
+        pthread_mutex_destroy(&w->lock);
+        sr_mem_free(w);
+    }
+    if (ws->dropped)
+    { fprintf(stderr, "workers: %lu frames dropped at dispatch\n", ws->dropped); }
+
+    sr_mem_free(ws);
+    sr->workers = 0;
+} /* -- sr_workers_stop -- */
+
+int sr_parse_cpulist(const char* spec, int* cpus, int max)
+{
+    const char* p = spec;
+    char* end;
+    int n = 0;
+
+    while (p && *p)
+    {
+        long cpu = strtol(p, &end, 10);
+
+        if (end == p || cpu < 0 || cpu >= SR_WORKER_MAX_CPU || n == max ||
+                (*end != ',' && *end != 0))
+        { return -1; }
+        cpus[n++] = (int)cpu;
+        p = *end ? end + 1 : end;
+    }
+    return n;
+} /* -- sr_parse_cpulist -- */
@@ -0,0 +1,57 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_worker.h
+ *
+ * Description:
+ *
+ * Flow-affine forwarding workers.  With -w N the thread running the
+ * backend's receive loop only dispatches: each frame is copied into a pool
+ * packet, hashed on its flow (IP addresses, protocol and ports) and pushed
+ * onto the ring of one of N worker threads, which run the forwarding graph
+ * and transmit.  Frames of one flow always land on the same worker, so
+ * their order is preserved.
+ *
+ * State the workers share:
+ *
+ *   - the routing table and interface table are filled in before the
+ *     workers start and are read-only afterwards
+ *   - the ARP cache and request queue are protected by cache->lock
+ *   - backends serialize tx_burst/tx_flush themselves
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_WORKER_H
+#define SR_WORKER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_MAX_WORKERS   16
+#define SR_WORKER_RING   1024   /* packets queued per worker, power of 2 */
+#define SR_WORKER_BURST  256    /* packets a worker takes at a time */
+
+struct sr_instance;
+struct sr_frame;
+
+/* Start n workers, pinning worker i to cpus[i % ncpus] if ncpus > 0.
+   Returns 0 or -1. */
+int  sr_workers_start(struct sr_instance* sr, int n, const int* cpus, int ncpus);
+
+/* Hand a received burst to the workers.  The frames are copied, so the
+   caller may release them as soon as this returns. */
+void sr_workers_dispatch(struct sr_instance* sr, struct sr_frame* frames, int n);
+
+/* Let the workers drain their rings, join them and print their counters.
+   Does nothing if no workers were started. */
+void sr_workers_stop(struct sr_instance* sr);
+
+uint32_t sr_flow_hash(const uint8_t* frame, unsigned int len);
+
+/* Parse "cpu,cpu,..." into cpus, returns the count or -1. */
+int  sr_parse_cpulist(const char* spec, int* cpus, int max);
+
+#endif /* -- SR_WORKER_H -- */
@@ -0,0 +1,815 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_xdp.c
+ *
+ * Description:
+ *
+ * AF_XDP backend.  Each device named with -i gets an XDP socket bound to
+ * its queue 0 and a tiny XDP program (generic/SKB mode, so any device,
+ * veth included, will do) that redirects everything arriving there to the
+ * socket:
+ *
+ *   ./sr -b xdp -i veth0,veth1=192.168.2.1 -r rtable
+ *
+ * Addresses come from the kernel as with the packet backend.  On
+ * multiqueue NICs reduce the device to one queue (ethtool -L) first.
+ *
+ * All sockets share a single UMEM, so a frame received on one interface
+ * can be queued on another interface's TX ring by address.  Every UMEM
+ * frame carries a reference count:
+ *
+ *   rx burst   +1 while the router handles the frame (dropped in rx_release)
+ *   ARP queue  +1 while the frame waits for a reply (hold/unhold)
+ *   TX ring    +1 until the kernel hands the address back on completion
+ *
+ * and goes back to the free list when it drops to 0.  Frames the router
+ * forwards in place therefore never get copied by the router; only frames
+ * it builds in its own memory (ARP, ICMP) are copied into a free UMEM
+ * frame on send.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#ifdef _LINUX_
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_backend.h"
+#include "sr_mem.h"
+
+#define SR_XDP_NFRAMES     4096
+#define SR_XDP_FRAME_SIZE  2048   /* UMEM chunk, smallest the kernel allows */
+#define SR_XDP_RING_SIZE   1024   /* rx, tx, fill and completion rings */
+#define SR_XDP_FILL_MAX    512    /* frames posted per fill ring */
+#define SR_XDP_KICK_TRIES  16
+
+#if defined(_LINUX_) && defined(AF_XDP)
+
+struct sr_xsk_ring
+{
+    uint32_t* producer;
+    uint32_t* consumer;
+    void*     desc;
+    uint32_t  mask;
+    void*     map;
+    size_t    map_len;
+};
+
+struct sr_xdp_dev
+{
+    struct sr_ifspec spec;
+    int fd;
+    int ifindex;
+    unsigned char mac[ETHER_ADDR_LEN];
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+    struct sr_xsk_ring rx, tx, fill, comp;
+    unsigned in_fill;      /* frames posted to the fill ring, not yet received */
+    int tx_pending;        /* descriptors queued since the last successful kick */
+};
+
+struct sr_xdp
+{
+    struct sr_xdp_dev dev[SR_MAX_IFSPEC];
+    int ndev;
+    int next_rx;
+    unsigned fill_max;
+
+    uint8_t* umem;
+    size_t   umem_len;
+
+    /* -- protects ref, the free list and the tx/completion rings; the
+     *    ARP thread sends and unholds concurrently with the main loop -- */
+    pthread_mutex_t lock;
+    unsigned short ref[SR_XDP_NFRAMES];
+    uint32_t free_list[SR_XDP_NFRAMES];
+    unsigned nfree;
+
+    unsigned long rx_frames;
+    unsigned long tx_zero_copy;
+    unsigned long tx_copied;
+    unsigned long tx_drops;
+    unsigned long held;
+    unsigned long wakeups;
+};
+
+static int sr_bpf(int cmd, union bpf_attr* attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_frame(..)
+ * Scope: Local
+ *
+ * UMEM frame index of buf, -1 if buf is not inside the UMEM or a frame
+ * of len bytes starting there would cross a chunk boundary.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_xdp_frame(struct sr_xdp* xdp, const uint8_t* buf, unsigned len)
+{
+    size_t off;
+
+    if (buf < xdp->umem || buf >= xdp->umem + xdp->umem_len)
+    { return -1; }
+
+    off = buf - xdp->umem;
+    if ((off % SR_XDP_FRAME_SIZE) + len > SR_XDP_FRAME_SIZE)
+    { return -1; }
+
+    return off / SR_XDP_FRAME_SIZE;
+}
+
+/* -- call with xdp->lock held -- */
+static void sr_xdp_unref(struct sr_xdp* xdp, unsigned idx)
+{
+    assert(xdp->ref[idx] > 0);
+    if (--xdp->ref[idx] == 0)
+    { xdp->free_list[xdp->nfree++] = idx; }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_reap(..)
+ * Scope: Local
+ *
+ * Drop the TX reference of every frame on the completion ring.  Call
+ * with xdp->lock held.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_xdp_reap(struct sr_xdp* xdp, struct sr_xdp_dev* d)
+{
+    uint32_t cons = *d->comp.consumer;
+    uint32_t prod = __atomic_load_n(d->comp.producer, __ATOMIC_ACQUIRE);
+    uint64_t* addrs = (uint64_t*)d->comp.desc;
+
+    if (cons == prod)
+    { return; }
+
+    for (; cons != prod; cons++)
+    { sr_xdp_unref(xdp, addrs[cons & d->comp.mask] / SR_XDP_FRAME_SIZE); }
+
+    __atomic_store_n(d->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_refill(..)
+ * Scope: Local
+ *
+ * Top the fill ring back up to fill_max frames from the free list.  Call
+ * with xdp->lock held.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_xdp_refill(struct sr_xdp* xdp, struct sr_xdp_dev* d)
+{
+    uint32_t prod = *d->fill.producer;
+    uint32_t cons = __atomic_load_n(d->fill.consumer, __ATOMIC_ACQUIRE);
+    uint32_t space = SR_XDP_RING_SIZE - (prod - cons);
+    uint64_t* addrs = (uint64_t*)d->fill.desc;
+    unsigned want = xdp->fill_max - d->in_fill;
+
+    if (want > space)
+    { want = space; }
+    if (want > xdp->nfree)
+    { want = xdp->nfree; }
+    if (want == 0)
+    { return; }
+
+    d->in_fill += want;
+    while (want--)
+    { addrs[prod++ & d->fill.mask] = (uint64_t)xdp->free_list[--xdp->nfree] * SR_XDP_FRAME_SIZE; }
+
+    __atomic_store_n(d->fill.producer, prod, __ATOMIC_RELEASE);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_kick(..)
+ * Scope: Local
+ *
+ * Tell the kernel about new TX descriptors.  In copy mode the kernel
+ * transmits a limited batch per call and refuses to go on while the
+ * completion ring is full, so reap and retry on EAGAIN.  Call with
+ * xdp->lock held.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_xdp_kick(struct sr_xdp* xdp, struct sr_xdp_dev* d)
+{
+    int tries;
+
+    for (tries = 0; tries < SR_XDP_KICK_TRIES; tries++)
+    {
+        int rc = sendto(d->fd, 0, 0, MSG_DONTWAIT, 0, 0);
+        sr_xdp_reap(xdp, d);
+
+        if (rc >= 0)
+        { d->tx_pending = 0; return; }
+        if (errno != EAGAIN && errno != EBUSY && errno != EINTR)
+        {
+            if (errno != ENOBUFS && errno != ENETDOWN)
+            { perror("sendto(..):sr_xdp.c::sr_xdp_kick"); }
+            return;
+        }
+    }
+    /* -- still busy, left on tx_pending for the next burst -- */
+}
+
+static int sr_xsk_map_ring(int fd, const struct xdp_ring_offset* off,
+                           size_t desc_size, off_t pgoff, struct sr_xsk_ring* r)
+{
+    r->map_len = off->desc + SR_XDP_RING_SIZE * desc_size;
+    r->map = mmap(0, r->map_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (r->map == MAP_FAILED)
+    {
+        r->map = 0;
+        perror("mmap(ring):sr_xdp.c::sr_xsk_map_ring");
+        return -1;
+    }
+    r->producer = (uint32_t*)((uint8_t*)r->map + off->producer);
+    r->consumer = (uint32_t*)((uint8_t*)r->map + off->consumer);
+    r->desc     = (uint8_t*)r->map + off->desc;
+    r->mask     = SR_XDP_RING_SIZE - 1;
+    return 0;
+}
+
+static void sr_xsk_unmap_ring(struct sr_xsk_ring* r)
+{
+    if (r->map)
+    { munmap(r->map, r->map_len); }
+    r->map = 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_socket(..)
+ * Scope: Local
+ *
+ * Create the XDP socket for one device and bind it to queue 0.  The
+ * first device registers the UMEM, the others share it (each with its
+ * own fill and completion ring, as required for a different device).
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_xdp_socket(struct sr_xdp* xdp, struct sr_xdp_dev* d,
+                         int umem_fd)
+{
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen = sizeof(off);
+    int size = SR_XDP_RING_SIZE;
+
+    if ((d->fd = socket(AF_XDP, SOCK_RAW, 0)) < 0)
+    {
+        perror("socket(AF_XDP):sr_xdp.c::sr_xdp_socket");
+        return -1;
+    }
+
+    if (umem_fd < 0)
+    {
+        struct xdp_umem_reg mr;
+
+        memset(&mr, 0, sizeof(mr));
+        mr.addr = (uintptr_t)xdp->umem;
+        mr.len = xdp->umem_len;
+        mr.chunk_size = SR_XDP_FRAME_SIZE;
+        mr.headroom = 0;
+        if (setsockopt(d->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) < 0)
+        {
+            perror("setsockopt(XDP_UMEM_REG):sr_xdp.c::sr_xdp_socket");
+            return -1;
+        }
+    }
+
+    if (setsockopt(d->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(d->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(d->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(d->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0)
+    {
+        perror("setsockopt(ring):sr_xdp.c::sr_xdp_socket");
+        return -1;
+    }
+
+    if (getsockopt(d->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+    {
+        perror("getsockopt(XDP_MMAP_OFFSETS):sr_xdp.c::sr_xdp_socket");
+        return -1;
+    }
+
+    if (sr_xsk_map_ring(d->fd, &off.rx, sizeof(struct xdp_desc),
+                        XDP_PGOFF_RX_RING, &d->rx) < 0 ||
+        sr_xsk_map_ring(d->fd, &off.tx, sizeof(struct xdp_desc),
+                        XDP_PGOFF_TX_RING, &d->tx) < 0 ||
+        sr_xsk_map_ring(d->fd, &off.fr, sizeof(uint64_t),
+                        XDP_UMEM_PGOFF_FILL_RING, &d->fill) < 0 ||
+        sr_xsk_map_ring(d->fd, &off.cr, sizeof(uint64_t),
+                        XDP_UMEM_PGOFF_COMPLETION_RING, &d->comp) < 0)
+    { return -1; }
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = d->ifindex;
+    sxdp.sxdp_queue_id = 0;
+    if (umem_fd < 0)
+    { sxdp.sxdp_flags = XDP_COPY; }
+    else
+    {
+        sxdp.sxdp_flags = XDP_SHARED_UMEM;
+        sxdp.sxdp_shared_umem_fd = umem_fd;
+    }
+    if (bind(d->fd, (struct sockaddr*)&sxdp, sizeof(sxdp)) < 0)
+    {
+        fprintf(stderr, "bind(AF_XDP) to %s queue 0: %s\n", d->spec.dev,
+                strerror(errno));
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_xdp_socket -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_attach_prog(..)
+ * Scope: Local
+ *
+ * Create the XSKMAP holding the device's socket and attach, in SKB mode,
+ *
+ *   return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+ *
+ * Frames on queues without a socket fall through to the kernel stack.
+ * The program is attached through a BPF link so it goes away with us.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_xdp_attach_prog(struct sr_xdp_dev* d)
+{
+    struct bpf_insn prog[] =
+    {
+        { BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1,
+          offsetof(struct xdp_md, rx_queue_index), 0 },
+        { BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, 0 },
+        { 0, 0, 0, 0, 0 },
+        { BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS },
+        { BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },
+        { BPF_JMP | BPF_EXIT, 0, 0, 0, 0 }
+    };
+    static char log[4096];
+    union bpf_attr attr;
+    uint32_t key = 0;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = 1;
+    if ((d->map_fd = sr_bpf(BPF_MAP_CREATE, &attr)) < 0)
+    {
+        perror("bpf(BPF_MAP_CREATE):sr_xdp.c::sr_xdp_attach_prog");
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = d->map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&d->fd;
+    if (sr_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+    {
+        perror("bpf(BPF_MAP_UPDATE_ELEM):sr_xdp.c::sr_xdp_attach_prog");
+        return -1;
+    }
+
+    prog[1].imm = d->map_fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.license = (uintptr_t)"Dual BSD/GPL";
+    attr.log_buf = (uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    if ((d->prog_fd = sr_bpf(BPF_PROG_LOAD, &attr)) < 0)
+    {
+        perror("bpf(BPF_PROG_LOAD):sr_xdp.c::sr_xdp_attach_prog");
+        fprintf(stderr, "%s\n", log);
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = d->prog_fd;
+    attr.link_create.target_ifindex = d->ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    if ((d->link_fd = sr_bpf(BPF_LINK_CREATE, &attr)) < 0)
+    {
+        fprintf(stderr, "Attaching XDP program to %s: %s%s\n", d->spec.dev,
+                strerror(errno),
+                errno == EBUSY ? " (another XDP program is attached)" : "");
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_xdp_attach_prog -- */
+
+static void sr_xdp_detach(struct sr_xdp_dev* d)
+{
+    if (d->link_fd >= 0)
+    { close(d->link_fd); }
+    if (d->prog_fd >= 0)
+    { close(d->prog_fd); }
+    if (d->map_fd >= 0)
+    { close(d->map_fd); }
+    sr_xsk_unmap_ring(&d->rx);
+    sr_xsk_unmap_ring(&d->tx);
+    sr_xsk_unmap_ring(&d->fill);
+    sr_xsk_unmap_ring(&d->comp);
+    if (d->fd >= 0)
+    { close(d->fd); }
+    d->fd = d->map_fd = d->prog_fd = d->link_fd = -1;
+}
+
+static void sr_xdp_free(struct sr_xdp* xdp)
+{
+    int i;
+
+    /* -- the UMEM owner goes last -- */
+    for (i = xdp->ndev - 1; i >= 0; i--)
+    { sr_xdp_detach(&xdp->dev[i]); }
+    if (xdp->umem)
+    { munmap(xdp->umem, xdp->umem_len); }
+    pthread_mutex_destroy(&xdp->lock);
+    sr_mem_free(xdp);
+}
+
+static int sr_xdp_open(struct sr_instance* sr, const struct sr_backend_config* cfg)
+{
+    struct sr_ifspec specs[SR_MAX_IFSPEC];
+    struct rlimit rl = { RLIM_INFINITY, RLIM_INFINITY };
+    struct sr_xdp* xdp;
+    int i;
+
+    xdp = (struct sr_xdp*)sr_mem_calloc(SR_MEM_BACKEND, 1, sizeof(struct sr_xdp));
+    assert(xdp);
+    pthread_mutex_init(&xdp->lock, 0);
+
+    xdp->ndev = sr_parse_ifspec(cfg->ifspec, specs, SR_MAX_IFSPEC);
+    if (xdp->ndev <= 0)
+    {
+        fprintf(stderr, "xdp backend needs -i dev[=ip][,dev[=ip]...]\n");
+        xdp->ndev = 0;
+        sr_xdp_free(xdp);
+        return -1;
+    }
+    for (i = 0; i < xdp->ndev; i++)
+    {
+        xdp->dev[i].spec = specs[i];
+        xdp->dev[i].fd = xdp->dev[i].map_fd = -1;
+        xdp->dev[i].prog_fd = xdp->dev[i].link_fd = -1;
+    }
+
+    /* -- older kernels charge UMEM and maps against RLIMIT_MEMLOCK -- */
+    setrlimit(RLIMIT_MEMLOCK, &rl);
+
+    xdp->umem_len = (size_t)SR_XDP_NFRAMES * SR_XDP_FRAME_SIZE;
+    xdp->umem = (uint8_t*)mmap(0, xdp->umem_len, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (xdp->umem == MAP_FAILED)
+    {
+        perror("mmap(umem):sr_xdp.c::sr_xdp_open");
+        xdp->umem = 0;
+        sr_xdp_free(xdp);
+        return -1;
+    }
+    for (i = SR_XDP_NFRAMES - 1; i >= 0; i--)
+    { xdp->free_list[xdp->nfree++] = i; }
+
+    /* -- leave at least half of the frames for held and in flight TX -- */
+    xdp->fill_max = SR_XDP_NFRAMES / (2 * xdp->ndev);
+    if (xdp->fill_max > SR_XDP_FILL_MAX)
+    { xdp->fill_max = SR_XDP_FILL_MAX; }
+
+    for (i = 0; i < xdp->ndev; i++)
+    {
+        struct sr_xdp_dev* d = &xdp->dev[i];
+
+        if (sr_ifspec_resolve(&d->spec, &d->ifindex, d->mac) < 0 ||
+            sr_xdp_socket(xdp, d, i == 0 ? -1 : xdp->dev[0].fd) < 0 ||
+            sr_xdp_attach_prog(d) < 0)
+        {
+            sr_xdp_free(xdp);
+            return -1;
+        }
+        sr_xdp_refill(xdp, d);
+    }
+
+    sr->backend_data = xdp;
+    return 0;
+}
+
+static int sr_xdp_discover(struct sr_instance* sr)
+{
+    struct sr_xdp* xdp = (struct sr_xdp*)sr->backend_data;
+    int i;
+
+    assert(sr->nif == 0);
+    for (i = 0; i < xdp->ndev; i++)
+    {
+        /* -- device i becomes router interface i -- */
+        sr_add_interface(sr, xdp->dev[i].spec.dev);
+        sr_set_ether_addr(sr, xdp->dev[i].mac);
+        sr_set_ether_ip(sr, xdp->dev[i].spec.ip);
+    }
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_rx_burst(..)
+ * Scope: Local
+ *
+ * Recycle completed and released frames into the fill rings, then hand
+ * out received frames in place, round robin across the devices.  Sleeps
+ * in poll(..) when nothing is pending.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_xdp_rx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int max)
+{
+    struct sr_xdp* xdp = (struct sr_xdp*)sr->backend_data;
+    struct pollfd pfd[SR_MAX_IFSPEC];
+    int i, n = 0, starving = 0;
+
+    pthread_mutex_lock(&xdp->lock);
+    for (i = 0; i < xdp->ndev; i++)
+    {
+        struct sr_xdp_dev* d = &xdp->dev[i];
+
+        if (d->tx_pending)
+        { sr_xdp_kick(xdp, d); }
+        sr_xdp_reap(xdp, d);
+        sr_xdp_refill(xdp, d);
+        if (d->in_fill < xdp->fill_max)
+        { starving = 1; }
+    }
+    pthread_mutex_unlock(&xdp->lock);
+
+    for (i = 0; i < xdp->ndev && n < max; i++)
+    {
+        struct sr_xdp_dev* d = &xdp->dev[(xdp->next_rx + i) % xdp->ndev];
+        struct xdp_desc* descs = (struct xdp_desc*)d->rx.desc;
+        uint32_t cons = *d->rx.consumer;
+        uint32_t prod = __atomic_load_n(d->rx.producer, __ATOMIC_ACQUIRE);
+
+        for (; cons != prod && n < max; cons++)
+        {
+            const struct xdp_desc* desc = &descs[cons & d->rx.mask];
+            unsigned idx = desc->addr / SR_XDP_FRAME_SIZE;
+
+            /* -- ours alone until the refcount says otherwise -- */
+            d->in_fill--;
+            xdp->ref[idx] = 1;
+
+            frames[n].buf   = xdp->umem + desc->addr;
+            frames[n].len   = desc->len;
+            frames[n].ifindex = d - xdp->dev;
+            frames[n].headroom = 0;
+            frames[n].priv  = 0;
+            n++;
+        }
+        __atomic_store_n(d->rx.consumer, cons, __ATOMIC_RELEASE);
+    }
+    xdp->next_rx = (xdp->next_rx + 1) % xdp->ndev;
+
+    if (n > 0)
+    {
+        xdp->rx_frames += n;
+        return n;
+    }
+
+    for (i = 0; i < xdp->ndev; i++)
+    {
+        pfd[i].fd = xdp->dev[i].fd;
+        pfd[i].events = POLLIN;
+        pfd[i].revents = 0;
+    }
+
+    /* -- frames held elsewhere come back without waking us, so don't
+     *    sleep for long while a fill ring is short -- */
+    xdp->wakeups++;
+    if (poll(pfd, xdp->ndev, starving ? 10 : -1) < 0)
+    {
+        if (errno == EINTR)
+        { return sr_stop_requested ? -1 : 0; }
+        perror("poll(..):sr_xdp.c::sr_xdp_rx_burst");
+        return -1;
+    }
+    return 0;
+}
+
+/* -- rx producer vs consumer, no syscall -- */
+static int sr_xdp_rx_ready(struct sr_instance* sr)
+{
+    struct sr_xdp* xdp = (struct sr_xdp*)sr->backend_data;
+    int i;
+
+    for (i = 0; i < xdp->ndev; i++)
+    {
+        struct sr_xdp_dev* d = &xdp->dev[i];
+
+        if (*d->rx.consumer != __atomic_load_n(d->rx.producer, __ATOMIC_ACQUIRE))
+        { return 1; }
+    }
+    return 0;
+}
+
+static void sr_xdp_rx_release(struct sr_instance* sr, struct sr_frame* frames,
+                              int n)
+{
+    struct sr_xdp* xdp = (struct sr_xdp*)sr->backend_data;
+    int i;
+
+    pthread_mutex_lock(&xdp->lock);
+    for (i = 0; i < n; i++)
+    { sr_xdp_unref(xdp, (frames[i].buf - xdp->umem) / SR_XDP_FRAME_SIZE); }
+    pthread_mutex_unlock(&xdp->lock);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_tx_burst(..)
+ * Scope: Local
+ *
+ * Queue frames on the TX rings.  Frames already in the UMEM (forwarded
+ * in place, or released from the ARP queue) go out by address; anything
+ * else is copied into a free frame first.  A full ring or an exhausted
+ * UMEM drops the frame like a full NIC queue would.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_xdp_tx_burst(struct sr_instance* sr, const struct sr_frame* frames,
+                           int n)
+{
+    struct sr_xdp* xdp = (struct sr_xdp*)sr->backend_data;
+    int i, j;
+
+    pthread_mutex_lock(&xdp->lock);
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_xdp_dev* d = 0;
+        struct xdp_desc* desc;
+        uint32_t prod, cons;
+        uint64_t addr;
+        int idx;
+
+        if (frames[i].ifindex < 0 || frames[i].ifindex >= xdp->ndev)
+        { break; }
+        d = &xdp->dev[frames[i].ifindex];
+
+        prod = *d->tx.producer;
+        cons = __atomic_load_n(d->tx.consumer, __ATOMIC_ACQUIRE);
+        if (prod - cons == SR_XDP_RING_SIZE)
+        {
+            xdp->tx_drops++;
+            continue;
+        }
+
+        if ((idx = sr_xdp_frame(xdp, frames[i].buf, frames[i].len)) >= 0)
+        {
+            addr = frames[i].buf - xdp->umem;
+            xdp->ref[idx]++;
+            xdp->tx_zero_copy++;
+        }
+        else
+        {
+            if (xdp->nfree == 0 || frames[i].len > SR_XDP_FRAME_SIZE)
+            {
+                xdp->tx_drops++;
+                continue;
+            }
+            idx = xdp->free_list[--xdp->nfree];
+            xdp->ref[idx] = 1;
+            addr = (uint64_t)idx * SR_XDP_FRAME_SIZE;
+            memcpy(xdp->umem + addr, frames[i].buf, frames[i].len);
+            xdp->tx_copied++;
+        }
+
+        desc = &((struct xdp_desc*)d->tx.desc)[prod & d->tx.mask];
+        desc->addr = addr;
+        desc->len = frames[i].len;
+        desc->options = 0;
+        __atomic_store_n(d->tx.producer, prod + 1, __ATOMIC_RELEASE);
+        d->tx_pending = 1;
+    }
+
+    for (j = 0; j < xdp->ndev; j++)
+    {
+        if (xdp->dev[j].tx_pending)
+        { sr_xdp_kick(xdp, &xdp->dev[j]); }
+    }
+
+    pthread_mutex_unlock(&xdp->lock);
+    return i;
+}
+
+static uint8_t* sr_xdp_hold(struct sr_instance* sr, uint8_t* buf, unsigned int len)
+{
+    struct sr_xdp* xdp = (struct sr_xdp*)sr->backend_data;
+    int idx = sr_xdp_frame(xdp, buf, len);
+
+    if (idx < 0)
+    { return 0; }
+
+    pthread_mutex_lock(&xdp->lock);
+    assert(xdp->ref[idx] > 0);
+    xdp->ref[idx]++;
+    xdp->held++;
+    pthread_mutex_unlock(&xdp->lock);
+    return buf;
+}
+
+static int sr_xdp_unhold(struct sr_instance* sr, uint8_t* buf)
+{
+    struct sr_xdp* xdp = (struct sr_xdp*)sr->backend_data;
+    int idx = sr_xdp_frame(xdp, buf, 1);
+
+    if (idx < 0)
+    { return -1; }
+
+    pthread_mutex_lock(&xdp->lock);
+    sr_xdp_unref(xdp, idx);
+    pthread_mutex_unlock(&xdp->lock);
+    return 0;
+}
+
+static void sr_xdp_close(struct sr_instance* sr)
+{
+    struct sr_xdp* xdp = (struct sr_xdp*)sr->backend_data;
+
+    if (!xdp)
+    { return; }
+
+    fprintf(stderr, "AF_XDP: %lu frames rx (%lu wakeups), %lu tx zero-copy, "
+            "%lu tx copied, %lu held for ARP, %lu tx drops\n", xdp->rx_frames,
+            xdp->wakeups, xdp->tx_zero_copy, xdp->tx_copied, xdp->held,
+            xdp->tx_drops);
+
+    sr_xdp_free(xdp);
+    sr->backend_data = 0;
+}
+
+#else /* -- no AF_XDP -- */
+
+static int sr_xdp_open(struct sr_instance* sr, const struct sr_backend_config* cfg)
+{
+    fprintf(stderr, "xdp backend needs Linux with AF_XDP\n");
+    return -1;
+}
+static int sr_xdp_discover(struct sr_instance* sr) { return -1; }
+static int sr_xdp_rx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int max) { return -1; }
+static void sr_xdp_rx_release(struct sr_instance* sr, struct sr_frame* frames,
+                              int n) { }
+static int sr_xdp_tx_burst(struct sr_instance* sr, const struct sr_frame* frames,
+                           int n) { return -1; }
+static void sr_xdp_close(struct sr_instance* sr) { }
+static uint8_t* sr_xdp_hold(struct sr_instance* sr, uint8_t* buf,
+                            unsigned int len) { return 0; }
+static int sr_xdp_unhold(struct sr_instance* sr, uint8_t* buf) { return -1; }
+static int sr_xdp_rx_ready(struct sr_instance* sr) { return 0; }
+
+#endif /* _LINUX_ && AF_XDP */
+
+const struct sr_backend sr_xdp_backend =
+{
+    "xdp",
+    sr_xdp_open,
+    sr_xdp_discover,
+    sr_xdp_rx_burst,
+    sr_xdp_rx_release,
+    sr_xdp_tx_burst,
+    sr_xdp_close,
+    sr_xdp_hold,
+    sr_xdp_unhold,
+    0,
+    sr_xdp_rx_ready
+};
@@ -40,7 +40,8 @@ typedef struct
     uint32_t mLen;
     uint32_t mType;        /* = VNSOPEN */
     uint16_t topoID;       /* Id of the topology we want to run on */
-    uint16_t pad;          /* unused */
+    uint16_t mVersion;     /* highest protocol version we speak; 0 (v1)
+                              in old clients and ignored by old servers */
     char     mVirtualHostID[IDSIZE]; /* Id of the simulated router (e.g.
                                         'VNS-A'); */
     char     mUID[IDSIZE]; /* User id (e.g. "appenz"), for information only */
@@ -121,6 +122,7 @@ typedef struct
 #define HWETHER       32
 #define HWETHIP       64
 #define HWMASK       128
+#define HWIFID       256   /* v2: uint32 id of the preceding HWINTERFACE */
 
 typedef struct
 {
@@ -196,5 +198,36 @@ typedef struct
 
 }__attribute__ ((__packed__)) c_auth_status;
 
+/* ******* VNS protocol v2 ******** */
+
+/*-----------------------------------------------------------------------------
+   The client asks for v2 by putting VNS_VERSION_2 in c_open.mVersion.  A
+   server that speaks v2 answers with an HWIFID entry after every
+   HWINTERFACE in VNSHWINFO; from then on both sides may send VNSPACKETV2,
+   which carries a batch of frames, each tagged with that id instead of the
+   16 byte interface name.  Old servers leave HWIFID out and the client
+   keeps using VNSPACKET.  (VNS_OPEN_TEMPLATE has no version field, so
+   template sessions are always v1.)
+  ---------------------------------------------------------------------------*/
+
+#define VNS_VERSION_2       2
+#define VNSPACKETV2      1024
+
+#define VNS_V2_MAXMSG   32768   /* max VNSPACKETV2 message, header included */
+#define VNS_V2_MAXBATCH    64   /* max frames in one VNSPACKETV2 */
+
+typedef struct
+{
+    uint32_t mLen;
+    uint32_t mType;        /* = VNSPACKETV2 */
+    uint32_t mCount;       /* frames that follow */
+}__attribute__ ((__packed__)) c_packet_v2_header;
+
+typedef struct
+{
+    uint16_t mIfId;        /* id from HWIFID */
+    uint16_t mLen;         /* frame length, frame follows unpadded */
+}__attribute__ ((__packed__)) c_packet_v2_rec;
+
 
 #endif  /* __VNSCOMMAND_H */